@@ -218,6 +218,24 @@ ldap_pvt_thread_pool_submit2 LDAP_P((
 	void *arg,
 	void **cookie ));
 
+/* Number of task classes, see ldap_pvt_thread_pool_class() */
+#define LDAP_PVT_THREAD_POOL_CLASSES	4
+
+LDAP_F( int )
+ldap_pvt_thread_pool_submit3 LDAP_P((
+	ldap_pvt_thread_pool_t *pool,
+	ldap_pvt_thread_start_t *start,
+	void *arg,
+	void **cookie,
+	int tclass ));
+
+LDAP_F( int )
+ldap_pvt_thread_pool_class LDAP_P((
+	ldap_pvt_thread_pool_t *pool,
+	int tclass,
+	int weight,
+	int max_active ));
+
 LDAP_F( int )
 ldap_pvt_thread_pool_retract LDAP_P((
 	void *cookie ));
@@ -262,6 +280,24 @@ ldap_pvt_thread_pool_query LDAP_P((
 	ldap_pvt_thread_pool_t *pool,
 	ldap_pvt_thread_pool_param_t param, void *value ));
 
+#ifndef LDAP_PVT_THREAD_H_DONE
+typedef struct ldap_pvt_thread_pool_qstats_s {
+	int ltq_pending;			/* pending + paused + idle tasks */
+	int ltq_active;				/* active tasks */
+	int ltq_open;				/* open threads */
+	unsigned long ltq_tasks;	/* tasks started by the queue's threads */
+	unsigned long ltq_stolen;	/* ...of which taken from other queues */
+	unsigned long ltq_wait_avg;	/* mean wait before start, usec */
+	unsigned long ltq_wait_max;	/* longest wait before start, usec */
+} ldap_pvt_thread_pool_qstats_t;
+#endif /* !LDAP_PVT_THREAD_H_DONE */
+
+LDAP_F( int )
+ldap_pvt_thread_pool_queuestats LDAP_P((
+	ldap_pvt_thread_pool_t *pool,
+	int q,
+	ldap_pvt_thread_pool_qstats_t *st ));
+
 LDAP_F( int )
 ldap_pvt_thread_pool_pausing LDAP_P((
 	ldap_pvt_thread_pool_t *pool ));
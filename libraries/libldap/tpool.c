@@ -94,6 +94,9 @@ typedef struct ldap_int_thread_task_s {
 	ldap_pvt_thread_start_t *ltt_start_routine;
 	void *ltt_arg;
 	struct ldap_int_thread_poolq_s *ltt_queue;
+	struct timeval ltt_time;	/* when submitted */
+	int ltt_class;
+	int ltt_limited;	/* holds one of the class's ltp_class_max slots */
 } ldap_int_thread_task_t;
 
 typedef LDAP_STAILQ_HEAD(tcq, ldap_int_thread_task_s) ldap_int_tpool_plist_t;
@@ -113,15 +116,20 @@ struct ldap_int_thread_poolq_s {
 	 */
 	ldap_pvt_thread_cond_t ltp_cond;
 
-	/* ltp_pause == 0 ? &ltp_pending_list : &empty_pending_list,
+	/* ltp_pause == 0 ? ltp_pending_list : empty_pending_list,
 	 * maintained to reduce work for pool_wrapper()
 	 */
 	ldap_int_tpool_plist_t *ltp_work_list;
 
-	/* pending tasks, and unused task objects */
-	ldap_int_tpool_plist_t ltp_pending_list;
+	/* pending tasks of each class, and unused task objects */
+	ldap_int_tpool_plist_t ltp_pending_list[LDAP_PVT_THREAD_POOL_CLASSES];
 	LDAP_SLIST_HEAD(tcl, ldap_int_thread_task_s) ltp_free_list;
 
+	/* Weighted round-robin state of the task classes,
+	 * see ldap_int_thread_pool_next()
+	 */
+	int ltp_class_credit[LDAP_PVT_THREAD_POOL_CLASSES];
+
 	/* Max number of threads in this queue */
 	int ltp_max_count;
 
@@ -132,6 +140,12 @@ struct ldap_int_thread_poolq_s {
 	int ltp_active_count;		/* Active, not paused/idle tasks */
 	int ltp_open_count;			/* Number of threads */
 	int ltp_starting;			/* Currently starting threads */
+
+	/* Statistics, see ldap_pvt_thread_pool_queuestats() */
+	unsigned long ltp_tasks;	/* Tasks started by our threads */
+	unsigned long ltp_stolen;	/* ...of which taken from other queues */
+	unsigned long ltp_wait_max;	/* Longest wait of a task, usec */
+	double ltp_wait_sum;		/* Total wait of all tasks, usec */
 };
 
 struct ldap_int_thread_pool_s {
@@ -176,10 +190,23 @@ struct ldap_int_thread_pool_s {
 
 	/* Max pending + paused + idle tasks, negated when ltp_finishing */
 	int ltp_max_pending;
+
+	/* Scheduling weight and max active tasks (0 for no limit) of
+	 * each task class, see ldap_pvt_thread_pool_class()
+	 */
+	int ltp_class_weight[LDAP_PVT_THREAD_POOL_CLASSES];
+	int ltp_class_max[LDAP_PVT_THREAD_POOL_CLASSES];
+
+	/* Active tasks of each limited class, in all the queues.  The
+	 * limits hold for the whole pool, so that a task of the class
+	 * can run in any queue while the class is below its limit.
+	 */
+	ldap_pvt_thread_mutex_t ltp_class_mutex;
+	int ltp_class_active[LDAP_PVT_THREAD_POOL_CLASSES];
 };
 
-static ldap_int_tpool_plist_t empty_pending_list =
-	LDAP_STAILQ_HEAD_INITIALIZER(empty_pending_list);
+/* Work lists while paused, never inserted into */
+static ldap_int_tpool_plist_t empty_pending_list[LDAP_PVT_THREAD_POOL_CLASSES];
 
 static int ldap_int_has_thread_pool = 0;
 static LDAP_STAILQ_HEAD(tpq, ldap_int_thread_pool_s)
@@ -227,7 +254,7 @@ ldap_pvt_thread_pool_init_q (
 {
 	ldap_pvt_thread_pool_t pool;
 	struct ldap_int_thread_poolq_s *pq;
-	int i, rc, rem_thr, rem_pend;
+	int i, j, rc, rem_thr, rem_pend;
 
 	/* multiple pools are currently not supported (ITS#4943) */
 	assert(!ldap_int_has_thread_pool);
@@ -285,6 +312,10 @@ fail:
 	if (rc != 0)
 		goto fail;
 
+	rc = ldap_pvt_thread_mutex_init(&pool->ltp_class_mutex);
+	if (rc != 0)
+		goto fail;
+
 	rem_thr = max_threads % numqs;
 	rem_pend = max_pending % numqs;
 	for ( i=0; i<numqs; i++ ) {
@@ -296,8 +327,9 @@ fail:
 		rc = ldap_pvt_thread_cond_init(&pq->ltp_cond);
 		if (rc != 0)
 			return(rc);
-		LDAP_STAILQ_INIT(&pq->ltp_pending_list);
-		pq->ltp_work_list = &pq->ltp_pending_list;
+		for (j=0; j<LDAP_PVT_THREAD_POOL_CLASSES; j++)
+			LDAP_STAILQ_INIT(&pq->ltp_pending_list[j]);
+		pq->ltp_work_list = pq->ltp_pending_list;
 		LDAP_SLIST_INIT(&pq->ltp_free_list);
 
 		pq->ltp_max_count = max_threads / numqs;
@@ -316,6 +348,8 @@ fail:
 
 	pool->ltp_max_count = max_threads;
 	pool->ltp_max_pending = max_pending;
+	for (j=0; j<LDAP_PVT_THREAD_POOL_CLASSES; j++)
+		pool->ltp_class_weight[j] = 1;
 
 	ldap_pvt_thread_mutex_lock(&ldap_pvt_thread_pool_mutex);
 	LDAP_STAILQ_INSERT_TAIL(&ldap_int_thread_pool_list, pool, ltp_next);
@@ -341,6 +375,189 @@ ldap_pvt_thread_pool_init (
 	return ldap_pvt_thread_pool_init_q( tpool, max_threads, max_pending, 1 );
 }
 
+/* Is class c below its limit of active tasks?  Unlocked peek, the
+ * slot is only taken by ldap_int_thread_pool_claim().
+ */
+#define	CLASS_OPEN(pool, c)	(!(pool)->ltp_class_max[c] || \
+	(pool)->ltp_class_active[c] < (pool)->ltp_class_max[c])
+
+/* Take a slot of the limit of the class of task, if it has one.
+ * Returns 0 if they are all in use.
+ */
+static int
+ldap_int_thread_pool_claim(
+	struct ldap_int_thread_pool_s *pool,
+	ldap_int_thread_task_t *task )
+{
+	int c = task->ltt_class, rc = 1;
+
+	task->ltt_limited = 0;
+	if (!pool->ltp_class_max[c])
+		return 1;
+	ldap_pvt_thread_mutex_lock(&pool->ltp_class_mutex);
+	if (!pool->ltp_class_max[c]) {
+		/* no longer limited */
+	} else if (pool->ltp_class_active[c] < pool->ltp_class_max[c]) {
+		pool->ltp_class_active[c]++;
+		task->ltt_limited = 1;
+	} else {
+		rc = 0;
+	}
+	ldap_pvt_thread_mutex_unlock(&pool->ltp_class_mutex);
+	return rc;
+}
+
+/* Give back the slot taken by ldap_int_thread_pool_claim() */
+static void
+ldap_int_thread_pool_unclaim(
+	struct ldap_int_thread_pool_s *pool,
+	ldap_int_thread_task_t *task )
+{
+	if (!task->ltt_limited)
+		return;
+	ldap_pvt_thread_mutex_lock(&pool->ltp_class_mutex);
+	pool->ltp_class_active[task->ltt_class]--;
+	ldap_pvt_thread_mutex_unlock(&pool->ltp_class_mutex);
+	task->ltt_limited = 0;
+}
+
+/* Dequeue the next task of pq, or NULL if none can be started now.
+ * The classes below their limit of active tasks share the threads
+ * by smooth weighted round-robin.  Called with pq locked.
+ */
+static ldap_int_thread_task_t *
+ldap_int_thread_pool_next( struct ldap_int_thread_poolq_s *pq )
+{
+	struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
+	ldap_int_tpool_plist_t *work_list = pq->ltp_work_list;
+	int *credit = pq->ltp_class_credit;
+	ldap_int_thread_task_t *task;
+	int c, best, total, ready, full = 0;
+
+	for (;;) {
+		best = -1;
+		total = ready = 0;
+		for (c=0; c<LDAP_PVT_THREAD_POOL_CLASSES; c++) {
+			if (LDAP_STAILQ_EMPTY(&work_list[c]) || (full & (1 << c)) ||
+				!CLASS_OPEN(pool, c))
+				continue;
+			ready |= 1 << c;
+			total += pool->ltp_class_weight[c];
+			if (best < 0 || credit[c] + pool->ltp_class_weight[c] >
+				credit[best] + pool->ltp_class_weight[best])
+				best = c;
+		}
+		if (best < 0)
+			return NULL;
+		task = LDAP_STAILQ_FIRST(&work_list[best]);
+		if (ldap_int_thread_pool_claim(pool, task))
+			break;
+		/* another queue took the last slot meanwhile */
+		full |= 1 << best;
+	}
+
+	for (c=0; c<LDAP_PVT_THREAD_POOL_CLASSES; c++) {
+		if (ready & (1 << c))
+			credit[c] += pool->ltp_class_weight[c];
+	}
+	credit[best] -= total;
+
+	LDAP_STAILQ_REMOVE_HEAD(&work_list[best], ltt_next.q);
+	pq->ltp_pending_count--;
+	return task;
+}
+
+/* Heaviest class with work in vq which pq can start, or -1.
+ * Only class only if that is >= 0.
+ */
+static int
+ldap_int_thread_pool_stealable(
+	struct ldap_int_thread_poolq_s *pq,
+	struct ldap_int_thread_poolq_s *vq,
+	int only )
+{
+	int *weight = pq->ltp_pool->ltp_class_weight;
+	int c, best = -1;
+
+	for (c=0; c<LDAP_PVT_THREAD_POOL_CLASSES; c++) {
+		if (only >= 0 && c != only)
+			continue;
+		if (!LDAP_STAILQ_EMPTY(&vq->ltp_work_list[c]) &&
+			CLASS_OPEN(pq->ltp_pool, c) &&
+			(best < 0 || weight[c] > weight[best]))
+			best = c;
+	}
+	return best;
+}
+
+/* Take the oldest pending task of another queue, for an idle thread
+ * of pq, or of class only if that is >= 0.  Called with pq locked.
+ * The other queue's mutex is only tried, since one of its threads
+ * may be stealing from pq.
+ */
+static ldap_int_thread_task_t *
+ldap_int_thread_pool_steal( struct ldap_int_thread_poolq_s *pq, int only )
+{
+	struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
+	struct ldap_int_thread_poolq_s *vq;
+	ldap_int_thread_task_t *task;
+	int i, c;
+
+	if (pool->ltp_numqs < 2 || pool->ltp_pause)
+		return NULL;
+
+	for (i=0; i<pool->ltp_numqs; i++) {
+		vq = pool->ltp_wqs[i];
+		/* unlocked peek, rechecked below */
+		if (vq == pq || ldap_int_thread_pool_stealable(pq, vq, only) < 0)
+			continue;
+		if (ldap_pvt_thread_mutex_trylock(&vq->ltp_mutex))
+			continue;
+		task = NULL;
+		c = ldap_int_thread_pool_stealable(pq, vq, only);
+		if (c >= 0) {
+			task = LDAP_STAILQ_FIRST(&vq->ltp_work_list[c]);
+			if (ldap_int_thread_pool_claim(pool, task)) {
+				LDAP_STAILQ_REMOVE_HEAD(&vq->ltp_work_list[c], ltt_next.q);
+				vq->ltp_pending_count--;
+			} else {
+				task = NULL;
+			}
+		}
+		ldap_pvt_thread_mutex_unlock(&vq->ltp_mutex);
+		if (task) {
+			pq->ltp_stolen++;
+			return task;
+		}
+	}
+	return NULL;
+}
+
+/* Wake an idle thread of a queue other than pq, so it can steal
+ * the task just submitted to pq.  Called with pq unlocked.
+ */
+static void
+ldap_int_thread_pool_wakeidle(
+	struct ldap_int_thread_pool_s *pool,
+	struct ldap_int_thread_poolq_s *pq )
+{
+	struct ldap_int_thread_poolq_s *wq;
+	int i;
+
+	for (i=0; i<pool->ltp_numqs; i++) {
+		wq = pool->ltp_wqs[i];
+		/* unlocked peek, a wrong guess only costs a wakeup */
+		if (wq == pq || wq->ltp_open_count <= wq->ltp_active_count)
+			continue;
+		ldap_pvt_thread_mutex_lock(&wq->ltp_mutex);
+		if (wq->ltp_open_count > wq->ltp_active_count + wq->ltp_starting) {
+			ldap_pvt_thread_cond_signal(&wq->ltp_cond);
+			i = pool->ltp_numqs;
+		}
+		ldap_pvt_thread_mutex_unlock(&wq->ltp_mutex);
+	}
+}
+
 /* Submit a task to be performed by the thread pool */
 int
 ldap_pvt_thread_pool_submit (
@@ -356,6 +573,17 @@ ldap_pvt_thread_pool_submit2 (
 	ldap_pvt_thread_pool_t *tpool,
 	ldap_pvt_thread_start_t *start_routine, void *arg,
 	void **cookie )
+{
+	return ldap_pvt_thread_pool_submit3( tpool, start_routine, arg,
+		cookie, 0 );
+}
+
+/* Submit a task of class tclass to be performed by the thread pool */
+int
+ldap_pvt_thread_pool_submit3 (
+	ldap_pvt_thread_pool_t *tpool,
+	ldap_pvt_thread_start_t *start_routine, void *arg,
+	void **cookie, int tclass )
 {
 	struct ldap_int_thread_pool_s *pool;
 	struct ldap_int_thread_poolq_s *pq;
@@ -363,7 +591,7 @@ ldap_pvt_thread_pool_submit2 (
 	ldap_pvt_thread_t thr;
 	int i, j;
 
-	if (tpool == NULL)
+	if (tpool == NULL || tclass < 0 || tclass >= LDAP_PVT_THREAD_POOL_CLASSES)
 		return(-1);
 
 	pool = *tpool;
@@ -416,11 +644,13 @@ ldap_pvt_thread_pool_submit2 (
 	task->ltt_start_routine = start_routine;
 	task->ltt_arg = arg;
 	task->ltt_queue = pq;
+	task->ltt_class = tclass;
+	gettimeofday( &task->ltt_time, NULL );
 	if ( cookie )
 		*cookie = task;
 
 	pq->ltp_pending_count++;
-	LDAP_STAILQ_INSERT_TAIL(&pq->ltp_pending_list, task, ltt_next.q);
+	LDAP_STAILQ_INSERT_TAIL(&pq->ltp_pending_list[tclass], task, ltt_next.q);
 
 	if (pool->ltp_pause)
 		goto done;
@@ -449,7 +679,7 @@ ldap_pvt_thread_pool_submit2 (
 				/* let pool_close know there are no more threads */
 				ldap_pvt_thread_cond_signal(&pq->ltp_cond);
 
-				LDAP_STAILQ_FOREACH(ptr, &pq->ltp_pending_list, ltt_next.q)
+				LDAP_STAILQ_FOREACH(ptr, &pq->ltp_pending_list[tclass], ltt_next.q)
 					if (ptr == task) break;
 				if (ptr == task) {
 					/* no open threads, task not handled, so
@@ -457,7 +687,7 @@ ldap_pvt_thread_pool_submit2 (
 					 * report the error.
 					 */
 					pq->ltp_pending_count--;
-					LDAP_STAILQ_REMOVE(&pq->ltp_pending_list, task,
+					LDAP_STAILQ_REMOVE(&pq->ltp_pending_list[tclass], task,
 						ldap_int_thread_task_s, ltt_next.q);
 					LDAP_SLIST_INSERT_HEAD(&pq->ltp_free_list, task,
 						ltt_next.l);
@@ -471,6 +701,19 @@ ldap_pvt_thread_pool_submit2 (
 	}
 	ldap_pvt_thread_cond_signal(&pq->ltp_cond);
 
+	/* No thread of ours can take the task any time soon, let an
+	 * idle thread of another queue steal it.  If its class is at
+	 * its limit, whichever thread frees a slot takes it.
+	 */
+	if (pool->ltp_numqs > 1 && CLASS_OPEN(pool, tclass) &&
+		pq->ltp_open_count >= pq->ltp_max_count &&
+		pq->ltp_open_count < pq->ltp_active_count+pq->ltp_pending_count)
+	{
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+		ldap_int_thread_pool_wakeidle(pool, pq);
+		return(0);
+	}
+
  done:
 	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 	return(0);
@@ -506,7 +749,7 @@ ldap_pvt_thread_pool_retract (
 		return(-1);
 
 	ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
-	LDAP_STAILQ_FOREACH(task, &pq->ltp_pending_list, ltt_next.q)
+	LDAP_STAILQ_FOREACH(task, &pq->ltp_pending_list[ttmp->ltt_class], ltt_next.q)
 		if (task == ttmp) {
 			/* Could LDAP_STAILQ_REMOVE the task, but that
 			 * walks ltp_pending_list again to find it.
@@ -530,7 +773,7 @@ ldap_pvt_thread_pool_walk(
 	struct ldap_int_thread_pool_s *pool;
 	struct ldap_int_thread_poolq_s *pq;
 	ldap_int_thread_task_t *task;
-	int i;
+	int i, c;
 
 	if (tpool == NULL)
 		return(-1);
@@ -546,12 +789,14 @@ ldap_pvt_thread_pool_walk(
 
 	for (i=0; i<pool->ltp_numqs; i++) {
 		pq = pool->ltp_wqs[i];
-		LDAP_STAILQ_FOREACH(task, &pq->ltp_pending_list, ltt_next.q) {
-			if ( task->ltt_start_routine == start ) {
-				if ( cb( task->ltt_start_routine, task->ltt_arg, arg ) ) {
-					/* retract */
-					task->ltt_start_routine = no_task;
-					task->ltt_arg = NULL;
+		for (c=0; c<LDAP_PVT_THREAD_POOL_CLASSES; c++) {
+			LDAP_STAILQ_FOREACH(task, &pq->ltp_pending_list[c], ltt_next.q) {
+				if ( task->ltt_start_routine == start ) {
+					if ( cb( task->ltt_start_routine, task->ltt_arg, arg ) ) {
+						/* retract */
+						task->ltt_start_routine = no_task;
+						task->ltt_arg = NULL;
+					}
 				}
 			}
 		}
@@ -568,7 +813,7 @@ ldap_pvt_thread_pool_queues(
 {
 	struct ldap_int_thread_pool_s *pool;
 	struct ldap_int_thread_poolq_s *pq;
-	int i, rc, rem_thr, rem_pend;
+	int i, j, rc, rem_thr, rem_pend;
 
 	if (numqs < 1 || tpool == NULL)
 		return(-1);
@@ -604,8 +849,9 @@ ldap_pvt_thread_pool_queues(
 			rc = ldap_pvt_thread_cond_init(&pq->ltp_cond);
 			if (rc != 0)
 				return(rc);
-			LDAP_STAILQ_INIT(&pq->ltp_pending_list);
-			pq->ltp_work_list = &pq->ltp_pending_list;
+			for (j=0; j<LDAP_PVT_THREAD_POOL_CLASSES; j++)
+				LDAP_STAILQ_INIT(&pq->ltp_pending_list[j]);
+			pq->ltp_work_list = pq->ltp_pending_list;
 			LDAP_SLIST_INIT(&pq->ltp_free_list);
 		}
 	}
@@ -628,6 +874,34 @@ ldap_pvt_thread_pool_queues(
 	return 0;
 }
 
+/* Set the scheduling weight and the max number of active tasks
+ * (0 for no limit) of task class tclass, in all the queues.
+ */
+int
+ldap_pvt_thread_pool_class(
+	ldap_pvt_thread_pool_t *tpool,
+	int tclass,
+	int weight,
+	int max_active )
+{
+	struct ldap_int_thread_pool_s *pool;
+
+	if (tpool == NULL || tclass < 0 || tclass >= LDAP_PVT_THREAD_POOL_CLASSES ||
+		weight < 1 || max_active < 0)
+		return(-1);
+
+	pool = *tpool;
+
+	if (pool == NULL)
+		return(-1);
+
+	ldap_pvt_thread_mutex_lock(&pool->ltp_class_mutex);
+	pool->ltp_class_weight[tclass] = weight;
+	pool->ltp_class_max[tclass] = max_active;
+	ldap_pvt_thread_mutex_unlock(&pool->ltp_class_mutex);
+	return 0;
+}
+
 /* Set max #threads.  value <= 0 means max supported #threads (LDAP_MAXTHR) */
 int
 ldap_pvt_thread_pool_maxthreads(
@@ -795,6 +1069,46 @@ ldap_pvt_thread_pool_pausing( ldap_pvt_thread_pool_t *tpool )
 	return rc;
 }
 
+/* Get the counters of queue q.  Return -1 if there is no such queue. */
+int
+ldap_pvt_thread_pool_queuestats(
+	ldap_pvt_thread_pool_t *tpool,
+	int q,
+	ldap_pvt_thread_pool_qstats_t *st )
+{
+	struct ldap_int_thread_pool_s	*pool;
+	struct ldap_int_thread_poolq_s	*pq;
+	int rc = -1;
+
+	if ( tpool == NULL || st == NULL ) {
+		return -1;
+	}
+
+	pool = *tpool;
+	if ( pool == NULL ) {
+		return -1;
+	}
+
+	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+	if ( q >= 0 && q < pool->ltp_numqs ) {
+		pq = pool->ltp_wqs[q];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		st->ltq_pending = pq->ltp_pending_count;
+		st->ltq_active = pq->ltp_active_count;
+		st->ltq_open = pq->ltp_open_count;
+		st->ltq_tasks = pq->ltp_tasks;
+		st->ltq_stolen = pq->ltp_stolen;
+		st->ltq_wait_avg = pq->ltp_tasks ?
+			(unsigned long)(pq->ltp_wait_sum / pq->ltp_tasks) : 0;
+		st->ltq_wait_max = pq->ltp_wait_max;
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+		rc = 0;
+	}
+	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+
+	return rc;
+}
+
 /*
  * wrapper for ldap_pvt_thread_pool_query(), left around
  * for backwards compatibility
@@ -838,7 +1152,7 @@ ldap_pvt_thread_pool_close ( ldap_pvt_thread_pool_t *tpool, int run_pending )
 	struct ldap_int_thread_pool_s *pool, *pptr;
 	struct ldap_int_thread_poolq_s *pq;
 	ldap_int_thread_task_t *task;
-	int i;
+	int i, j;
 
 	if (tpool == NULL)
 		return(-1);
@@ -869,9 +1183,11 @@ ldap_pvt_thread_pool_close ( ldap_pvt_thread_pool_t *tpool, int run_pending )
 		if (pq->ltp_max_pending > 0)
 			pq->ltp_max_pending = -pq->ltp_max_pending;
 		if (!run_pending) {
-			while ((task = LDAP_STAILQ_FIRST(&pq->ltp_pending_list)) != NULL) {
-				LDAP_STAILQ_REMOVE_HEAD(&pq->ltp_pending_list, ltt_next.q);
-				LDAP_FREE(task);
+			for (j=0; j<LDAP_PVT_THREAD_POOL_CLASSES; j++) {
+				while ((task = LDAP_STAILQ_FIRST(&pq->ltp_pending_list[j])) != NULL) {
+					LDAP_STAILQ_REMOVE_HEAD(&pq->ltp_pending_list[j], ltt_next.q);
+					LDAP_FREE(task);
+				}
 			}
 			pq->ltp_pending_count = 0;
 		}
@@ -920,6 +1236,7 @@ ldap_pvt_thread_pool_free ( ldap_pvt_thread_pool_t *tpool )
 	ldap_pvt_thread_cond_destroy(&pool->ltp_pcond);
 	ldap_pvt_thread_cond_destroy(&pool->ltp_cond);
 	ldap_pvt_thread_mutex_destroy(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_destroy(&pool->ltp_class_mutex);
 	for (i=0; i<pool->ltp_numqs; i++) {
 		pq = pool->ltp_wqs[i];
 
@@ -946,10 +1263,11 @@ ldap_int_thread_pool_wrapper (
 	struct ldap_int_thread_poolq_s *pq = xpool;
 	struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
 	ldap_int_thread_task_t *task;
-	ldap_int_tpool_plist_t *work_list;
 	ldap_int_thread_userctx_t ctx, *kctx;
 	unsigned i, keyslot, hash;
-	int pool_lock = 0, freeme = 0;
+	int pool_lock = 0, freeme = 0, tclass = -1;
+	struct timeval now;
+	long wait;
 
 	assert(pool != NULL);
 
@@ -987,8 +1305,18 @@ ldap_int_thread_pool_wrapper (
 	pq->ltp_active_count++;
 
 	for (;;) {
-		work_list = pq->ltp_work_list; /* help the compiler a bit */
-		task = LDAP_STAILQ_FIRST(work_list);
+		/* A slot of a limited class just freed up. Tasks of the
+		 * class waiting in other queues rely on us to run them,
+		 * even while we have other work, since the threads of
+		 * their queue may all be busy.
+		 */
+		task = NULL;
+		if (tclass >= 0 && LDAP_STAILQ_EMPTY(&pq->ltp_work_list[tclass]))
+			task = ldap_int_thread_pool_steal(pq, tclass);
+		if (task == NULL)
+			task = ldap_int_thread_pool_next(pq);
+		if (task == NULL)
+			task = ldap_int_thread_pool_steal(pq, -1);
 		if (task == NULL) {	/* paused or no pending tasks */
 			if (--(pq->ltp_active_count) < 1) {
 				if (pool->ltp_pause) {
@@ -1032,25 +1360,33 @@ ldap_int_thread_pool_wrapper (
 				} else
 					ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
 
-				work_list = pq->ltp_work_list;
-				task = LDAP_STAILQ_FIRST(work_list);
+				/* While paused the work list is empty anyway */
+				if (!pool_lock) {
+					task = ldap_int_thread_pool_next(pq);
+					if (task == NULL)
+						task = ldap_int_thread_pool_steal(pq, -1);
+				}
 			} while (task == NULL);
 
-			if (pool_lock) {
-				ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
-				ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
-				pool_lock = 0;
-			}
 			pq->ltp_active_count++;
 		}
 
-		LDAP_STAILQ_REMOVE_HEAD(work_list, ltt_next.q);
-		pq->ltp_pending_count--;
+		gettimeofday(&now, NULL);
+		wait = (now.tv_sec - task->ltt_time.tv_sec) * 1000000L +
+			(now.tv_usec - task->ltt_time.tv_usec);
+		if (wait < 0)	/* clock stepped back */
+			wait = 0;
+		pq->ltp_tasks++;
+		pq->ltp_wait_sum += wait;
+		if ((unsigned long)wait > pq->ltp_wait_max)
+			pq->ltp_wait_max = wait;
 		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 
 		task->ltt_start_routine(&ctx, task->ltt_arg);
 
 		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		tclass = task->ltt_limited ? task->ltt_class : -1;
+		ldap_int_thread_pool_unclaim(pool, task);
 		LDAP_SLIST_INSERT_HEAD(&pq->ltp_free_list, task, ltt_next.l);
 	}
  done:
@@ -1186,7 +1522,7 @@ handle_pause( ldap_pvt_thread_pool_t *tpool, int pause_type )
 				ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
 
 			/* Hide pending tasks from ldap_pvt_thread_pool_wrapper() */
-			pq->ltp_work_list = &empty_pending_list;
+			pq->ltp_work_list = empty_pending_list;
 
 			if (pq->ltp_active_count > 0)
 				pool->ltp_active_queues++;
@@ -1297,7 +1633,7 @@ ldap_pvt_thread_pool_resume (
 	pool->ltp_pause = 0;
 	for (i=0; i<pool->ltp_numqs; i++) {
 		pq = pool->ltp_wqs[i];
-		pq->ltp_work_list = &pq->ltp_pending_list;
+		pq->ltp_work_list = pq->ltp_pending_list;
 		ldap_pvt_thread_cond_broadcast(&pq->ltp_cond);
 	}
 	ldap_pvt_thread_cond_broadcast(&pool->ltp_cond);
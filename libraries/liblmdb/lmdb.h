@@ -303,6 +303,8 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
 #define MDB_NORDAHEAD	0x800000
 	/** don't initialize malloc'd memory before writing to datafile */
 #define MDB_NOMEMINIT	0x1000000
+	/** map the datafile with transparent huge pages if the OS supports it */
+#define MDB_HUGEPAGE	0x2000000
 /** @} */
 
 /**	@defgroup	mdb_dbi_open	Database Flags
@@ -321,6 +323,8 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
 #define MDB_INTEGERDUP	0x20
 	/** with #MDB_DUPSORT, use reverse string dups */
 #define MDB_REVERSEDUP	0x40
+	/** store shortened keys in branch pages */
+#define MDB_PREFIXKEY	0x80
 	/** create DB if not already existing */
 #define MDB_CREATE		0x40000
 /** @} */
@@ -595,6 +599,13 @@ int  mdb_env_create(MDB_env **env);
 	 *		supports it. Turning it off may help random read performance
 	 *		when the DB is larger than RAM and system RAM is full.
 	 *		The option is not implemented on Windows.
+	 *	<li>#MDB_HUGEPAGE
+	 *		Ask the OS to back the memory map with transparent huge pages.
+	 *		Random reads of a large DB then need far fewer TLB entries.
+	 *		Huge pages of a file mapping are only used where the OS and the
+	 *		filesystem support them; elsewhere the flag has no effect.
+	 *		The option is only implemented on systems with
+	 *		madvise(MADV_HUGEPAGE), such as Linux.
 	 *	<li>#MDB_NOMEMINIT
 	 *		Don't initialize malloc'd memory before writing to unused spaces
 	 *		in the data file. By default, memory for pages written to the data
@@ -705,6 +716,96 @@ int  mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags);
 	 */
 int  mdb_env_copyfd2(MDB_env *env, mdb_filehandle_t fd, unsigned int flags);
 
+	/** @brief Copy an LMDB environment to the specified path, with options
+	 *	and read-ahead threads.
+	 *
+	 * This is #mdb_env_copy2() with nthreads additional threads that read
+	 * the pages of the environment ahead of the copy, so that a copy from
+	 * storage with high latency is not bound by one read at a time. The
+	 * copy is written by a single thread, and the result is the same as
+	 * that of #mdb_env_copy2().
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] path The directory in which the copy will reside. This
+	 * directory must already exist and be writable but must otherwise be
+	 * empty.
+	 * @param[in] flags Special options for this operation.
+	 * See #mdb_env_copy2() for options.
+	 * @param[in] nthreads The number of read-ahead threads, 0 for none.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_copy3(MDB_env *env, const char *path, unsigned int flags, int nthreads);
+
+	/** @brief Copy an LMDB environment to the specified file descriptor,
+	 *	with options and read-ahead threads.
+	 *
+	 * See #mdb_env_copy3() and #mdb_env_copyfd2() for details.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] fd The filedescriptor to write the copy to. It must
+	 * have already been opened for Write access.
+	 * @param[in] flags Special options for this operation.
+	 * See #mdb_env_copy2() for options.
+	 * @param[in] nthreads The number of read-ahead threads, 0 for none.
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_copyfd3(MDB_env *env, mdb_filehandle_t fd, unsigned int flags, int nthreads);
+
+	/** @brief Write the changes of an LMDB environment since an earlier copy.
+	 *
+	 * This may be used to keep an uncompacted copy of an environment up
+	 * to date without copying all of it each time. Every page of the
+	 * environment is read and compared to a checksum file that describes
+	 * the copy. Only the pages that changed are written to the delta,
+	 * which #mdb_delta_apply() then writes into the copy. A new checksum
+	 * file is written for the copy as it will be once the delta is
+	 * applied.
+	 *
+	 * Without an old checksum file the delta holds the whole environment,
+	 * and applying it to an empty file makes a new copy.
+	 * @note The copy must not be opened for writing between deltas, or
+	 * #mdb_delta_apply() will refuse the next one.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] fd The filedescriptor to write the delta to. It must
+	 * have already been opened for Write access.
+	 * @param[in] oldsums The checksum file written by the previous delta,
+	 * opened for Read access, or INVALID_HANDLE_VALUE for a full delta.
+	 * (On POSIX systems this is -1.)
+	 * @param[in] newsums The filedescriptor to write the new checksum file
+	 * to. It must have already been opened for Write access.
+	 * @param[in] nthreads The number of read-ahead threads, 0 for none.
+	 * See #mdb_env_copy3().
+	 * @return A non-zero error value on failure and 0 on success.
+	 * Some possible errors are:
+	 * <ul>
+	 *	<li>#MDB_INVALID - oldsums is not a checksum file.
+	 *	<li>#MDB_INCOMPATIBLE - oldsums was made with another page size.
+	 * </ul>
+	 */
+int  mdb_env_copydelta(MDB_env *env, mdb_filehandle_t fd,
+	mdb_filehandle_t oldsums, mdb_filehandle_t newsums, int nthreads);
+
+	/** @brief Apply a delta written by #mdb_env_copydelta() to a copy.
+	 *
+	 * The pages of the delta are written into the data file of the copy,
+	 * then the meta pages, each after a sync of the file. The copy must
+	 * not be in use. If this call fails after it started writing pages
+	 * the copy must be restored from another backup before another
+	 * delta can be applied.
+	 * @param[in] delta The filedescriptor to read the delta from.
+	 * @param[in] fd The data file of the copy, opened for Read and Write
+	 * access. It must be empty for a full delta.
+	 * @return A non-zero error value on failure and 0 on success.
+	 * Some possible errors are:
+	 * <ul>
+	 *	<li>#MDB_INVALID - delta is not a complete delta.
+	 *	<li>#MDB_INCOMPATIBLE - the delta was made against another
+	 *		version of the copy.
+	 * </ul>
+	 */
+int  mdb_delta_apply(mdb_filehandle_t delta, mdb_filehandle_t fd);
+
 	/** @brief Return statistics about the LMDB environment.
 	 *
 	 * @param[in] env An environment handle returned by #mdb_env_create()
@@ -1112,6 +1213,16 @@ int  mdb_txn_renew(MDB_txn *txn);
 	 *	<li>#MDB_REVERSEDUP
 	 *		This option specifies that duplicate data items should be compared as
 	 *		strings in reverse order.
+	 *	<li>#MDB_PREFIXKEY
+	 *		When a leaf page is split, store only the shortest prefix of the
+	 *		first key on the new page that still sorts above the last key on
+	 *		the old page in the parent branch page. Keys with long common
+	 *		prefixes then take less room in branch pages, so the tree is wider
+	 *		and shallower. Leaf pages and the keys returned to the caller are
+	 *		unchanged, and the database remains readable by versions without
+	 *		this option. It has no effect with #MDB_REVERSEKEY, #MDB_INTEGERKEY
+	 *		or a custom key comparison function, and is only recorded when the
+	 *		database is created.
 	 *	<li>#MDB_CREATE
 	 *		Create the named database if it doesn't exist. This option is not
 	 *		allowed in a read-only transaction or a read-only environment.
@@ -1287,6 +1398,28 @@ int  mdb_set_relctx(MDB_txn *txn, MDB_dbi dbi, void *ctx);
 	 */
 int  mdb_get(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_val *data);
 
+	/** @brief Hint that an item will be read soon.
+	 *
+	 * This function finds the leaf page that would hold the specified
+	 * \b key and advises the operating system to start reading it in,
+	 * without waiting for it. Only the branch pages above the leaf are
+	 * read, and these are usually already in memory. A later #mdb_get()
+	 * of the key is then less likely to block on a page fault. Overflow
+	 * pages of large values are not covered.
+	 * Nothing is done in write transactions, or on systems without
+	 * madvise(MADV_WILLNEED).
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[in] key The key that will be searched for
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>#MDB_NOTFOUND - the database is empty.
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_prefetch(MDB_txn *txn, MDB_dbi dbi, MDB_val *key);
+
 	/** @brief Store items into a database.
 	 *
 	 * This function stores key/data pairs in the database. The default behavior
@@ -1014,7 +1014,7 @@ typedef struct MDB_db {
 #define PERSISTENT_FLAGS	(0xffff & ~(MDB_VALID))
 	/** #mdb_dbi_open() flags */
 #define VALID_FLAGS	(MDB_REVERSEKEY|MDB_DUPSORT|MDB_INTEGERKEY|MDB_DUPFIXED|\
-	MDB_INTEGERDUP|MDB_REVERSEDUP|MDB_CREATE)
+	MDB_INTEGERDUP|MDB_REVERSEDUP|MDB_PREFIXKEY|MDB_CREATE)
 
 	/** Handle for the DB used to track free pages. */
 #define	FREE_DBI	0
@@ -1083,6 +1083,7 @@ struct MDB_txn {
 	/** Nested txn under this txn, set together with flag #MDB_TXN_HAS_CHILD */
 	MDB_txn		*mt_child;
 	pgno_t		mt_next_pgno;	/**< next unallocated page */
+	pgno_t		mt_prefetch_pgno;	/**< last page hinted by #mdb_prefetch() */
 	/** The ID of this transaction. IDs are integers incrementing from 1.
 	 *	Only committed write transactions increment the ID. If a transaction
 	 *	aborts, the ID may be re-used by the next writer.
@@ -1252,6 +1253,12 @@ typedef struct MDB_pgstate {
 	txnid_t		mf_pglast;	/**< ID of last used record, or 0 if !mf_pghead */
 } MDB_pgstate;
 
+	/** A run of contiguous pages in me_pghead, see #mdb_pgrun_find() */
+typedef struct MDB_pgrun {
+	pgno_t		pr_len;		/**< number of pages in the run */
+	pgno_t		pr_pgno;	/**< lowest page number of the run */
+} MDB_pgrun;
+
 	/** The database environment. */
 struct MDB_env {
 	HANDLE		me_fd;		/**< The main data file */
@@ -1289,9 +1296,17 @@ struct MDB_env {
 	unsigned int	*me_dbiseqs;	/**< array of dbi sequence numbers */
 	pthread_key_t	me_txkey;	/**< thread-key for readers */
 	txnid_t		me_pgoldest;	/**< ID of oldest reader last time we looked */
+	int			me_pgoldslot;	/**< its reader slot + 1, or 0 if none */
 	MDB_pgstate	me_pgstate;		/**< state of old pages from freeDB */
 #	define		me_pglast	me_pgstate.mf_pglast
 #	define		me_pghead	me_pgstate.mf_pghead
+	/** Runs of two or more pages in me_pghead, by length and page number.
+	 *	Only valid while me_pghead has me_pgrun_len pages.
+	 */
+	MDB_pgrun	*me_pgruns;
+	unsigned int	me_pgrun_cnt;	/**< number of runs in me_pgruns */
+	unsigned int	me_pgrun_size;	/**< allocated size of me_pgruns */
+	pgno_t		me_pgrun_len;	/**< me_pghead[0] when me_pgruns was valid, or 0 */
 	MDB_page	*me_dpages;		/**< list of malloc'd blocks for re-use */
 	/** IDL of pages that became unused in a write txn */
 	MDB_IDL		me_free_pgs;
@@ -2099,13 +2114,24 @@ mdb_find_oldest(MDB_txn *txn)
 {
 	int i;
 	txnid_t mr, oldest = txn->mt_txnid - 1;
-	if (txn->mt_env->me_txns) {
-		MDB_reader *r = txn->mt_env->me_txns->mti_readers;
-		for (i = txn->mt_env->me_txns->mti_numreaders; --i >= 0; ) {
+	MDB_env *env = txn->mt_env;
+	if (env->me_txns) {
+		MDB_reader *r = env->me_txns->mti_readers;
+		/* Readers only start at the latest txnid, so the oldest reader
+		 * we saw last time is still the oldest as long as it stays.
+		 * Only rescan the table once it has moved on.
+		 */
+		i = env->me_pgoldslot - 1;
+		if (i >= 0 && r[i].mr_pid && r[i].mr_txnid == env->me_pgoldest)
+			return env->me_pgoldest;
+		env->me_pgoldslot = 0;
+		for (i = env->me_txns->mti_numreaders; --i >= 0; ) {
 			if (r[i].mr_pid) {
 				mr = r[i].mr_txnid;
-				if (oldest > mr)
+				if (oldest > mr) {
 					oldest = mr;
+					env->me_pgoldslot = i + 1;
+				}
 			}
 		}
 	}
@@ -2131,6 +2157,190 @@ mdb_page_dirty(MDB_txn *txn, MDB_page *mp)
 	txn->mt_dirty_room--;
 }
 
+/** Compare two page runs by length, then by page number */
+static int
+mdb_pgrun_cmp(const void *a, const void *b)
+{
+	const MDB_pgrun *r1 = a, *r2 = b;
+	if (r1->pr_len != r2->pr_len)
+		return r1->pr_len < r2->pr_len ? -1 : 1;
+	return r1->pr_pgno < r2->pr_pgno ? -1 : r1->pr_pgno > r2->pr_pgno;
+}
+
+/** Return the position of the first run not less than (len, pgno) */
+static unsigned
+mdb_pgrun_search(MDB_env *env, pgno_t len, pgno_t pgno)
+{
+	MDB_pgrun *runs = env->me_pgruns;
+	unsigned base = 0, n = env->me_pgrun_cnt, pivot;
+
+	while (n) {
+		pivot = n >> 1;
+		if (runs[base + pivot].pr_len < len ||
+			(runs[base + pivot].pr_len == len &&
+			 runs[base + pivot].pr_pgno < pgno)) {
+			base += pivot + 1;
+			n -= pivot + 1;
+		} else {
+			n = pivot;
+		}
+	}
+	return base;
+}
+
+/** Shorten run x of the index to (len, pgno), keeping it sorted.
+ *	The new length must be less than the old one.
+ */
+static void
+mdb_pgrun_shrink(MDB_env *env, unsigned x, pgno_t len, pgno_t pgno)
+{
+	MDB_pgrun *runs = env->me_pgruns;
+	unsigned y;
+
+	if (len < 2) {
+		env->me_pgrun_cnt--;
+		memmove(runs + x, runs + x + 1,
+			(env->me_pgrun_cnt - x) * sizeof(MDB_pgrun));
+		return;
+	}
+	y = mdb_pgrun_search(env, len, pgno);
+	memmove(runs + y + 1, runs + y, (x - y) * sizeof(MDB_pgrun));
+	runs[y].pr_len = len;
+	runs[y].pr_pgno = pgno;
+}
+
+/** Index the runs of contiguous pages in me_pghead.
+ *	Allocating <num> contiguous pages from a fragmented me_pghead
+ *	otherwise means scanning the whole list every time. The index
+ *	lists every run of at least two pages, sorted by length, so the
+ *	best fit is found by binary search. It is kept up to date by
+ *	#mdb_page_alloc() and rebuilt after anything else changes
+ *	me_pghead, which resets me_pgrun_len.
+ * @param[in] env the environment.
+ * @return 0 on success, ENOMEM if the index could not be allocated.
+ */
+static int
+mdb_pgrun_build(MDB_env *env)
+{
+	pgno_t *mop = env->me_pghead, pgno;
+	unsigned i, j, n = mop[0], cnt = 0;
+
+	if (env->me_pgrun_size < n/2 + 1) {
+		MDB_pgrun *runs = realloc(env->me_pgruns, (n/2 + 1) * sizeof(MDB_pgrun));
+		if (!runs)
+			return ENOMEM;
+		env->me_pgruns = runs;
+		env->me_pgrun_size = n/2 + 1;
+	}
+	/* Walk up from the lowest page number */
+	for (i = n; i; i = j) {
+		pgno = mop[i];
+		for (j = i-1; j && mop[j] == pgno + (i-j); j--) ;
+		if (i - j > 1) {
+			env->me_pgruns[cnt].pr_len = i - j;
+			env->me_pgruns[cnt].pr_pgno = pgno;
+			cnt++;
+		}
+	}
+	qsort(env->me_pgruns, cnt, sizeof(MDB_pgrun), mdb_pgrun_cmp);
+	env->me_pgrun_cnt = cnt;
+	env->me_pgrun_len = n;
+	return 0;
+}
+
+/** Find <n2>+1 contiguous pages in me_pghead using the run index,
+ *	and take them out of the index.
+ * @param[in] env the environment.
+ * @param[in] n2 the number of pages wanted, minus one. At least 1.
+ * @param[out] ip position in me_pghead of the lowest page of the range,
+ *	or 0 if there is no such range.
+ * @return 0 on success, -1 if the index could not be used.
+ */
+static int
+mdb_pgrun_find(MDB_env *env, unsigned n2, unsigned *ip)
+{
+	pgno_t *mop = env->me_pghead, len, pgno;
+	unsigned i, x;
+
+	if (env->me_pgrun_len != mop[0] && mdb_pgrun_build(env))
+		return -1;
+	*ip = 0;
+	x = mdb_pgrun_search(env, n2+1, 0);
+	if (x == env->me_pgrun_cnt)
+		return 0;
+	len = env->me_pgruns[x].pr_len;
+	pgno = env->me_pgruns[x].pr_pgno;
+	i = mdb_midl_search(mop, pgno);
+	if (i <= n2 || i > mop[0] || mop[i] != pgno || mop[i-n2] != pgno+n2) {
+		env->me_pgrun_len = 0;
+		return -1;
+	}
+	mdb_pgrun_shrink(env, x, len - n2 - 1, pgno + n2 + 1);
+	env->me_pgrun_len = mop[0] - n2 - 1;
+	*ip = i;
+	return 0;
+}
+
+/** Take the lowest page in me_pghead out of the run index, if the
+ *	index is valid. The page is at the start of any run it is in.
+ * @param[in] env the environment.
+ */
+static void
+mdb_pgrun_take1(MDB_env *env)
+{
+	pgno_t *mop = env->me_pghead, pgno, n = mop[0];
+	unsigned lo, hi, mid, x;
+
+	if (env->me_pgrun_len != n)
+		return;
+	env->me_pgrun_len = n - 1;
+	pgno = mop[n];
+	if (n < 2 || mop[n-1] != pgno+1)
+		return;
+	/* mop[n-k] == pgno+k exactly while the run lasts */
+	for (lo = 1, hi = n-1; lo < hi; ) {
+		mid = hi - ((hi - lo) >> 1);
+		if (mop[n-mid] == pgno+mid)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	x = mdb_pgrun_search(env, lo+1, pgno);
+	if (x == env->me_pgrun_cnt || env->me_pgruns[x].pr_len != lo+1 ||
+		env->me_pgruns[x].pr_pgno != pgno) {
+		env->me_pgrun_len = 0;
+		return;
+	}
+	mdb_pgrun_shrink(env, x, lo, pgno+1);
+}
+
+/** Look for <num> contiguous pages around the pages just merged into
+ *	me_pghead. Runs that were already there are known to be too short.
+ * @param[in] mop me_pghead.
+ * @param[in] idl the freeDB record that was merged.
+ * @param[in] n2 the number of pages wanted, minus one.
+ * @return the position in mop of the lowest page of the range, or 0.
+ */
+static unsigned
+mdb_pgrun_merged(pgno_t *mop, pgno_t *idl, unsigned n2)
+{
+	pgno_t covered = 0;
+	unsigned i, k, lo, hi, n = mop[0];
+
+	/* Lowest pages first, as in the plain search */
+	for (k = idl[0]; k; k--) {
+		if (idl[k] < covered)
+			continue;
+		i = mdb_midl_search(mop, idl[k]);
+		for (lo = i; lo < n && mop[lo+1] == mop[lo]-1 && lo-i < n2; lo++) ;
+		for (hi = i; hi > 1 && mop[hi-1] == mop[hi]+1 && lo-hi < n2; hi--) ;
+		if (lo - hi >= n2)
+			return lo;
+		covered = mop[hi] + 1;
+	}
+	return 0;
+}
+
 /** Allocate page numbers and memory for writing.  Maintain me_pglast,
  * me_pghead and mt_next_pgno.  Set #MDB_TXN_ERROR on failure.
  *
@@ -2170,6 +2380,7 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 	MDB_cursor_op op;
 	MDB_cursor m2;
 	int found_old = 0;
+	pgno_t *idl = NULL;
 
 	/* If there are any loose pages, just use them */
 	if (num == 1 && txn->mt_loose_pgs) {
@@ -2193,18 +2404,35 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 	for (op = MDB_FIRST;; op = MDB_NEXT) {
 		MDB_val key, data;
 		MDB_node *leaf;
-		pgno_t *idl;
 
 		/* Seek a big enough contiguous page range. Prefer
 		 * pages at the tail, just truncating the list.
 		 */
 		if (mop_len > n2) {
-			i = mop_len;
-			do {
+			if (!n2) {
+				mdb_pgrun_take1(env);
+				i = mop_len;
 				pgno = mop[i];
-				if (mop[i-n2] == pgno+n2)
-					goto search_done;
-			} while (--i > n2);
+				goto search_done;
+			}
+			/* Only the record just merged can have made a long
+			 * enough range, otherwise ask the run index.
+			 */
+			if (idl) {
+				i = mdb_pgrun_merged(mop, idl, n2);
+			} else if (mdb_pgrun_find(env, n2, &i)) {
+				i = mop_len;
+				do {
+					if (mop[i-n2] == mop[i]+n2)
+						break;
+				} while (--i > n2);
+				if (i == n2)
+					i = 0;
+			}
+			if (i) {
+				pgno = mop[i];
+				goto search_done;
+			}
 			if (--retry < 0)
 				break;
 		}
@@ -2279,6 +2507,7 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 		/* Merge in descending sorted order */
 		mdb_midl_xmerge(mop, idl);
 		mop_len = mop[0];
+		env->me_pgrun_len = 0;
 	}
 
 	/* Use new pages from the map when nothing suitable in the freeDB */
@@ -2314,6 +2543,7 @@ search_done:
 	return MDB_SUCCESS;
 
 fail:
+	env->me_pgrun_len = 0;
 	txn->mt_flags |= MDB_TXN_ERROR;
 	return rc;
 }
@@ -2780,6 +3010,7 @@ mdb_txn_renew0(MDB_txn *txn)
 
 	/* Moved to here to avoid a data race in read TXNs */
 	txn->mt_next_pgno = meta->mm_last_pg+1;
+	txn->mt_prefetch_pgno = P_INVALID;
 
 	txn->mt_flags = flags;
 
@@ -2892,6 +3123,7 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 		rc = 0;
 		ntxn = (MDB_ntxn *)txn;
 		ntxn->mnt_pgstate = env->me_pgstate; /* save parent me_pghead & co */
+		env->me_pgrun_len = 0;
 		if (env->me_pghead) {
 			size = MDB_IDL_SIZEOF(env->me_pghead);
 			env->me_pghead = mdb_midl_alloc(env->me_pghead[0]);
@@ -3011,6 +3243,7 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 
 		txn->mt_numdbs = 0;
 		txn->mt_flags = MDB_TXN_FINISHED;
+		env->me_pgrun_len = 0;
 
 		if (!txn->mt_parent) {
 			mdb_midl_shrink(&txn->mt_free_pgs);
@@ -3254,6 +3487,7 @@ mdb_freelist_save(MDB_txn *txn)
 		loose[0] = count;
 		mdb_midl_sort(loose);
 		mdb_midl_xmerge(mop, loose);
+		env->me_pgrun_len = 0;
 		txn->mt_loose_pgs = NULL;
 		txn->mt_loose_count = 0;
 		mop_len = mop[0];
@@ -3648,6 +3882,7 @@ mdb_txn_commit(MDB_txn *txn)
 		goto fail;
 
 	mdb_midl_free(env->me_pghead);
+	env->me_pgrun_len = 0;
 	env->me_pghead = NULL;
 	mdb_midl_shrink(&txn->mt_free_pgs);
 
@@ -4041,6 +4276,15 @@ mdb_env_map(MDB_env *env, void *addr)
 #endif /* POSIX_MADV_RANDOM */
 #endif /* MADV_RANDOM */
 	}
+#ifdef MADV_HUGEPAGE
+	if (flags & MDB_HUGEPAGE) {
+		/* Only a hint; a file mapping gets huge pages only where the
+		 * kernel and filesystem support them. MAP_HUGETLB can't map
+		 * a regular file at all.
+		 */
+		madvise(env->me_map, env->me_mapsize, MADV_HUGEPAGE);
+	}
+#endif
 #endif /* _WIN32 */
 
 	/* Can happen because the address argument to mmap() is just a
@@ -4951,7 +5195,7 @@ fail:
 	 */
 #define	CHANGEABLE	(MDB_NOSYNC|MDB_NOMETASYNC|MDB_MAPASYNC|MDB_NOMEMINIT)
 #define	CHANGELESS	(MDB_FIXEDMAP|MDB_NOSUBDIR|MDB_RDONLY| \
-	MDB_WRITEMAP|MDB_NOTLS|MDB_NOLOCK|MDB_NORDAHEAD)
+	MDB_WRITEMAP|MDB_NOTLS|MDB_NOLOCK|MDB_NORDAHEAD|MDB_HUGEPAGE)
 
 #if VALID_FLAGS & PERSISTENT_FLAGS & (CHANGEABLE|CHANGELESS)
 # error "Persistent DB flags & env flags overlap, but both go in mm_flags"
@@ -5079,6 +5323,10 @@ mdb_env_close0(MDB_env *env, int excl)
 	free(env->me_path);
 	free(env->me_dirty_list);
 	free(env->me_txn0);
+	free(env->me_pgruns);
+	env->me_pgruns = NULL;
+	env->me_pgrun_size = env->me_pgrun_cnt = 0;
+	env->me_pgrun_len = 0;
 	mdb_midl_free(env->me_free_pgs);
 
 	if (env->me_flags & MDB_ENV_TXKEY) {
@@ -5750,6 +5998,7 @@ release:
 		while (j>i)
 			mop[j--] = pg++;
 		mop[0] += ovpages;
+		env->me_pgrun_len = 0;
 	} else {
 		rc = mdb_midl_append_range(&txn->mt_free_pgs, pg, ovpages);
 		if (rc)
@@ -5812,6 +6061,79 @@ mdb_get(MDB_txn *txn, MDB_dbi dbi,
 	return mdb_cursor_set(&mc, key, data, MDB_SET, &exact);
 }
 
+int
+mdb_prefetch(MDB_txn *txn, MDB_dbi dbi, MDB_val *key)
+{
+	MDB_cursor	mc;
+	MDB_xcursor	mx;
+	MDB_page	*mp;
+	MDB_node	*node;
+	MDB_env		*env;
+	pgno_t		pgno, last;
+	unsigned	i, depth;
+	int		exact, rc;
+
+	if (!key || !TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
+		return EINVAL;
+
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	/* Pages of a write txn may be dirty copies, don't bother */
+	if (!(txn->mt_flags & MDB_TXN_RDONLY) || (txn->mt_dbflags[dbi] & DB_STALE))
+		return MDB_SUCCESS;
+
+	pgno = txn->mt_dbs[dbi].md_root;
+	if (pgno == P_INVALID)
+		return MDB_NOTFOUND;
+
+	/* Same descent as #mdb_page_search_root(), but stop
+	 * before touching the leaf page.
+	 */
+	mdb_cursor_init(&mc, txn, dbi, &mx);
+	mc.mc_snum = 1;
+	mc.mc_top = 0;
+	for (depth = txn->mt_dbs[dbi].md_depth; depth > 1; depth--) {
+		if ((rc = mdb_page_get(&mc, pgno, &mp, NULL)) != 0)
+			return rc;
+		if (!IS_BRANCH(mp)) {
+			txn->mt_flags |= MDB_TXN_ERROR;
+			return MDB_CORRUPTED;
+		}
+		mc.mc_pg[0] = mp;
+		node = mdb_node_search(&mc, key, &exact);
+		if (node == NULL)
+			i = NUMKEYS(mp) - 1;
+		else {
+			i = mc.mc_ki[0];
+			if (!exact && i)
+				i--;
+		}
+		pgno = NODEPGNO(NODEPTR(mp, i));
+	}
+	if (pgno >= txn->mt_next_pgno)
+		return MDB_PAGE_NOTFOUND;
+	/* Consecutive keys are mostly on the same page. Unless readahead
+	 * was turned off, the OS already reads ahead of sequential faults
+	 * and single page hints would only break up its larger reads.
+	 */
+	env = txn->mt_env;
+	last = txn->mt_prefetch_pgno;
+	txn->mt_prefetch_pgno = pgno;
+	if (pgno == last || (pgno == last + 1 && !(env->me_flags & MDB_NORDAHEAD)))
+		return MDB_SUCCESS;
+
+#ifdef MADV_WILLNEED
+	madvise(env->me_map + env->me_psize * pgno, env->me_psize, MADV_WILLNEED);
+#elif defined(POSIX_MADV_WILLNEED)
+	posix_madvise(env->me_map + env->me_psize * pgno, env->me_psize,
+		POSIX_MADV_WILLNEED);
+#else
+	(void) env;
+#endif
+	return MDB_SUCCESS;
+}
+
 /** Find a sibling for a page.
  * Replaces the page at the top of the cursor's stack with the
  * specified sibling, if one exists.
@@ -6992,7 +7314,8 @@ put_sub:
 			xdata.mv_size = 0;
 			xdata.mv_data = "";
 			leaf = NODEPTR(mc->mc_pg[mc->mc_top], mc->mc_ki[mc->mc_top]);
-			if (flags == MDB_CURRENT) {
+			/* flags may have picked up F_DUPDATA/F_SUBDATA on the way */
+			if ((flags & (MDB_CURRENT|MDB_APPENDDUP)) == MDB_CURRENT) {
 				xflags = MDB_CURRENT|MDB_NOSPILL;
 			} else {
 				mdb_xcursor_init1(mc, leaf);
@@ -8599,6 +8922,24 @@ mdb_del0(MDB_txn *txn, MDB_dbi dbi,
 	return rc;
 }
 
+/** Shorten a separator key for a branch page.
+ * @param[in] lkey the last key going to the left page.
+ * @param[in,out] sepkey the first key of the right page. Its size is
+ * reduced to the shortest prefix that still sorts above lkey.
+ */
+static void
+mdb_sepkey_shorten(MDB_val *lkey, MDB_val *sepkey)
+{
+	const unsigned char *l = lkey->mv_data, *r = sepkey->mv_data;
+	size_t i, len = lkey->mv_size;
+
+	if (len > sepkey->mv_size)
+		len = sepkey->mv_size;
+	for (i=0; i<len && l[i] == r[i]; i++) ;
+	if (i < sepkey->mv_size)
+		sepkey->mv_size = i+1;
+}
+
 /** Split a page and insert a new node.
  * Set #MDB_TXN_ERROR on failure.
  * @param[in,out] mc Cursor pointing to the page and desired insertion index.
@@ -8816,6 +9157,29 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 		}
 	}
 
+	/* Only the leading bytes that tell the new page from the old
+	 * one are needed to route searches, see #MDB_PREFIXKEY.
+	 */
+	if (IS_LEAF(mp) && !IS_LEAF2(mp) &&
+		(mc->mc_db->md_flags & MDB_PREFIXKEY) &&
+		mc->mc_dbx->md_cmp == mdb_cmp_memn) {
+		MDB_val lkey;
+		if (nflags & MDB_APPEND) {
+			node = NODEPTR(mp, NUMKEYS(mp)-1);
+		} else if (split_indx-1 == newindx) {
+			node = NULL;
+			lkey = *newkey;
+		} else {
+			node = (MDB_node *)((char *)mp + copy->mp_ptrs[split_indx-1] + PAGEBASE);
+		}
+		if (node) {
+			lkey.mv_size = node->mn_ksize;
+			lkey.mv_data = NODEKEY(node);
+		}
+		if (split_indx > 0 || (nflags & MDB_APPEND))
+			mdb_sepkey_shorten(&lkey, &sepkey);
+	}
+
 	DPRINTF(("separator is %d [%s]", split_indx, DKEY(&sepkey)));
 
 	/* Copy separator key to the parent.
@@ -9054,10 +9418,278 @@ mdb_put(MDB_txn *txn, MDB_dbi dbi,
 #endif
 #define MDB_EOF		0x10	/**< #mdb_env_copyfd1() is done reading */
 
+#ifndef MDB_RA_CHUNK
+#define MDB_RA_CHUNK	256	/**< pages per read-ahead job of a linear copy */
+#endif
+#ifdef _WIN32
+#define MDB_RA_WAIT()	Sleep(1)
+#else
+#define MDB_RA_WAIT()	usleep(1000)
+#endif
+
+	/** State of the threads that read pages ahead of a copy.
+	 *
+	 *	The copy itself stays single-threaded, so its output is the
+	 *	same with or without them. The helpers only fault in the pages
+	 *	the copy is about to read, so that many reads are in flight at
+	 *	once. Their work is split into jobs in the order the copy gets
+	 *	to them: runs of #MDB_RA_CHUNK pages of the file, or the
+	 *	subtrees below one level of the tree being copied. They stay
+	 *	at most #ra_window jobs ahead of the copy.
+	 */
+typedef struct mdb_copyra {
+	MDB_txn		*ra_txn;
+	pthread_mutex_t	ra_mutex;
+	pthread_t	*ra_thr;
+	int			ra_nthreads;
+	volatile int	ra_done;
+	volatile unsigned	ra_gen;	/**< bumped whenever the jobs change */
+	pgno_t		*ra_jobs;	/**< subtree roots, or NULL for runs of pages */
+	pgno_t		ra_first;	/**< first page of the runs */
+	pgno_t		ra_last;	/**< last page of the runs + 1 */
+	size_t		ra_njobs;
+	size_t		ra_next;	/**< next job to hand out */
+	size_t		ra_pos;		/**< job the copy is at */
+	size_t		ra_window;
+} mdb_copyra;
+
+	/** Fault in a subtree, including overflow pages and sub-DBs.
+	 *	Pages are taken straight from the map: this runs outside the
+	 *	copy's thread and must not touch the txn.
+	 */
+static void ESECT
+mdb_copyra_touch(mdb_copyra *ra, unsigned gen, pgno_t pg)
+{
+	MDB_txn *txn = ra->ra_txn;
+	MDB_env *env = txn->mt_env;
+	MDB_page *mp, *omp;
+	MDB_node *ni;
+	MDB_db db;
+	size_t off, len;
+	unsigned i, n;
+
+	if (ra->ra_gen != gen || ra->ra_done || pg >= txn->mt_next_pgno)
+		return;
+	mp = (MDB_page *)(env->me_map + env->me_psize * pg);
+	n = NUMKEYS(mp);
+	if (IS_BRANCH(mp)) {
+		for (i=0; i<n; i++)
+			mdb_copyra_touch(ra, gen, NODEPGNO(NODEPTR(mp, i)));
+	} else if (IS_LEAF(mp) && !IS_LEAF2(mp)) {
+		for (i=0; i<n; i++) {
+			ni = NODEPTR(mp, i);
+			if (ni->mn_flags & F_BIGDATA) {
+				memcpy(&pg, NODEDATA(ni), sizeof(pg));
+				if (pg >= txn->mt_next_pgno)
+					continue;
+				omp = (MDB_page *)(env->me_map + env->me_psize * pg);
+				len = (size_t)omp->mp_pages * env->me_psize;
+				for (off = env->me_os_psize; off < len; off += env->me_os_psize)
+					(void)((volatile char *)omp)[off];
+			} else if (ni->mn_flags & F_SUBDATA) {
+				memcpy(&db, NODEDATA(ni), sizeof(db));
+				if (db.md_root != P_INVALID)
+					mdb_copyra_touch(ra, gen, db.md_root);
+			}
+		}
+	}
+}
+
+	/** Read-ahead thread for a copy. */
+static THREAD_RET ESECT CALL_CONV
+mdb_copyra_thr(void *arg)
+{
+	mdb_copyra *ra = arg;
+	MDB_env *env = ra->ra_txn->mt_env;
+	pgno_t pg, last;
+	unsigned gen;
+	size_t j;
+	int tree;
+
+	pthread_mutex_lock(&ra->ra_mutex);
+	while (!ra->ra_done) {
+		if (ra->ra_next >= ra->ra_njobs ||
+			ra->ra_next >= ra->ra_pos + ra->ra_window) {
+			pthread_mutex_unlock(&ra->ra_mutex);
+			MDB_RA_WAIT();
+			pthread_mutex_lock(&ra->ra_mutex);
+			continue;
+		}
+		j = ra->ra_next++;
+		gen = ra->ra_gen;
+		tree = ra->ra_jobs != NULL;
+		if (tree) {
+			pg = ra->ra_jobs[j];
+		} else {
+			pg = ra->ra_first + j * MDB_RA_CHUNK;
+			last = ra->ra_last;
+			if (last > pg + MDB_RA_CHUNK)
+				last = pg + MDB_RA_CHUNK;
+		}
+		pthread_mutex_unlock(&ra->ra_mutex);
+		if (tree) {
+			mdb_copyra_touch(ra, gen, pg);
+		} else {
+			char *ptr = env->me_map + pg * env->me_psize;
+			char *end = env->me_map + last * env->me_psize;
+			for (; ptr < end && ra->ra_gen == gen; ptr += env->me_os_psize)
+				(void)*(volatile char *)ptr;
+		}
+		pthread_mutex_lock(&ra->ra_mutex);
+	}
+	pthread_mutex_unlock(&ra->ra_mutex);
+	return (THREAD_RET)0;
+}
+
+	/** Give the read-ahead threads a new list of jobs.
+	 * @param[in] ra read-ahead state.
+	 * @param[in] jobs subtree roots, or NULL for runs of pages.
+	 * @param[in] njobs number of jobs.
+	 * @param[in] first with no jobs, the first page of the runs.
+	 * @param[in] last with no jobs, the last page of the runs + 1.
+	 * @param[in] pos the job the copy is at.
+	 */
+static void ESECT
+mdb_copyra_set(mdb_copyra *ra, pgno_t *jobs, size_t njobs,
+	pgno_t first, pgno_t last, size_t pos)
+{
+	pthread_mutex_lock(&ra->ra_mutex);
+	ra->ra_gen++;
+	ra->ra_jobs = jobs;
+	ra->ra_njobs = jobs ? njobs : (last - first + MDB_RA_CHUNK - 1) / MDB_RA_CHUNK;
+	ra->ra_first = first;
+	ra->ra_last = last;
+	ra->ra_next = ra->ra_pos = pos;
+	pthread_mutex_unlock(&ra->ra_mutex);
+}
+
+	/** Tell the read-ahead threads which job the copy is at. */
+static void ESECT
+mdb_copyra_pos(mdb_copyra *ra, size_t pos)
+{
+	pthread_mutex_lock(&ra->ra_mutex);
+	ra->ra_pos = pos;
+	if (ra->ra_next < pos)
+		ra->ra_next = pos;
+	pthread_mutex_unlock(&ra->ra_mutex);
+}
+
+	/** Start read-ahead threads for a copy in txn. */
+static int ESECT
+mdb_copyra_start(mdb_copyra *ra, MDB_txn *txn, int nthreads)
+{
+	int i, rc;
+
+	memset(ra, 0, sizeof(*ra));
+	ra->ra_txn = txn;
+	ra->ra_window = 2 * nthreads;
+#ifdef _WIN32
+	if (!(ra->ra_mutex = CreateMutex(NULL, FALSE, NULL)))
+		return ErrCode();
+#else
+	if ((rc = pthread_mutex_init(&ra->ra_mutex, NULL)) != 0)
+		return rc;
+#endif
+	ra->ra_thr = calloc(nthreads, sizeof(pthread_t));
+	if (!ra->ra_thr) {
+		rc = ENOMEM;
+		goto fail;
+	}
+	for (i=0; i<nthreads; i++) {
+		if ((rc = THREAD_CREATE(ra->ra_thr[i], mdb_copyra_thr, ra)) != 0)
+			goto fail;
+		ra->ra_nthreads++;
+	}
+	return MDB_SUCCESS;
+
+fail:
+	ra->ra_done = 1;
+	for (i=0; i<ra->ra_nthreads; i++)
+		THREAD_FINISH(ra->ra_thr[i]);
+	free(ra->ra_thr);
+#ifdef _WIN32
+	CloseHandle(ra->ra_mutex);
+#else
+	pthread_mutex_destroy(&ra->ra_mutex);
+#endif
+	return rc;
+}
+
+	/** Stop the read-ahead threads of a copy. */
+static void ESECT
+mdb_copyra_stop(mdb_copyra *ra)
+{
+	int i;
+
+	ra->ra_done = 1;
+	for (i=0; i<ra->ra_nthreads; i++)
+		THREAD_FINISH(ra->ra_thr[i]);
+	free(ra->ra_thr);
+#ifdef _WIN32
+	CloseHandle(ra->ra_mutex);
+#else
+	pthread_mutex_destroy(&ra->ra_mutex);
+#endif
+}
+
+	/** Set up read-ahead of the tree with root page mp for a compacting
+	 *	copy. The jobs are the pages of the highest level of the tree
+	 *	that has enough of them to keep the threads busy.
+	 * @return the level of the jobs, or 0 if the tree is too small.
+	 */
+static int ESECT
+mdb_copyra_tree(mdb_copyra *ra, MDB_page *mp, pgno_t **jobs)
+{
+	MDB_cursor mc = {0};
+	pgno_t *lvl, *next;
+	size_t n = 1, i, k, want = 8 * ra->ra_nthreads;
+	unsigned j;
+	int depth = 0;
+
+	*jobs = NULL;
+	if (!IS_BRANCH(mp))
+		return 0;
+	mc.mc_txn = ra->ra_txn;
+	if (!(lvl = malloc(sizeof(pgno_t))))
+		return 0;
+	lvl[0] = mp->mp_pgno;
+	while (n < want && IS_BRANCH(mp)) {
+		/* count the next level, all of its parents are branch pages */
+		for (i=0, k=0; i<n; i++) {
+			if (mdb_page_get(&mc, lvl[i], &mp, NULL))
+				goto fail;
+			k += NUMKEYS(mp);
+		}
+		if (!(next = malloc(k * sizeof(pgno_t))))
+			goto fail;
+		for (i=0, k=0; i<n; i++) {
+			mdb_page_get(&mc, lvl[i], &mp, NULL);
+			for (j=0; j<NUMKEYS(mp); j++)
+				next[k++] = NODEPGNO(NODEPTR(mp, j));
+		}
+		free(lvl);
+		lvl = next;
+		n = k;
+		depth++;
+		if (mdb_page_get(&mc, lvl[0], &mp, NULL))
+			goto fail;
+	}
+	if (n < 2)
+		goto fail;
+	*jobs = lvl;
+	mdb_copyra_set(ra, lvl, n, 0, 0, 0);
+	return depth;
+
+fail:
+	free(lvl);
+	return 0;
+}
+
 	/** State needed for a double-buffering compacting copy. */
 typedef struct mdb_copy {
 	MDB_env *mc_env;
 	MDB_txn *mc_txn;
+	mdb_copyra *mc_ra;		/**< Read-ahead threads, if any */
 	pthread_mutex_t mc_mutex;
 	pthread_cond_t mc_cond;	/**< Condition variable for #mc_new */
 	char *mc_wbuf[2];
@@ -9183,8 +9815,11 @@ mdb_env_cwalk(mdb_copy *my, pgno_t *pg, int flags)
 	MDB_cursor mc = {0};
 	MDB_node *ni;
 	MDB_page *mo, *mp, *leaf;
-	char *buf, *ptr;
-	int rc, toggle;
+	mdb_copyra *ra = my->mc_ra;
+	pgno_t *jobs = NULL, *ojobs = NULL, ofirst = 0, olast = 0;
+	size_t pos = 0, onjobs = 0, opos = 0;
+	char *buf = NULL, *ptr;
+	int rc, toggle, radepth = 0;
 	unsigned int i;
 
 	/* Empty DB, nothing to do */
@@ -9197,14 +9832,25 @@ mdb_env_cwalk(mdb_copy *my, pgno_t *pg, int flags)
 	rc = mdb_page_get(&mc, *pg, &mc.mc_pg[0], NULL);
 	if (rc)
 		return rc;
+	if (ra && !flags) {
+		/* Read the subtrees of this DB ahead, in the order we walk them */
+		ojobs = ra->ra_jobs;
+		onjobs = ra->ra_njobs;
+		ofirst = ra->ra_first;
+		olast = ra->ra_last;
+		opos = ra->ra_pos;
+		radepth = mdb_copyra_tree(ra, mc.mc_pg[0], &jobs);
+	}
 	rc = mdb_page_search_root(&mc, NULL, MDB_PS_FIRST);
 	if (rc)
-		return rc;
+		goto done;
 
 	/* Make cursor pages writable */
 	buf = ptr = malloc(my->mc_env->me_psize * mc.mc_snum);
-	if (buf == NULL)
-		return ENOMEM;
+	if (buf == NULL) {
+		rc = ENOMEM;
+		goto done;
+	}
 
 	for (i=0; i<mc.mc_top; i++) {
 		mdb_page_copy((MDB_page *)ptr, mc.mc_pg[i], my->mc_env->me_psize);
@@ -9295,6 +9941,8 @@ again:
 				mc.mc_top++;
 				mc.mc_snum++;
 				mc.mc_ki[mc.mc_top] = 0;
+				if (radepth && mc.mc_top == radepth)
+					mdb_copyra_pos(ra, ++pos);
 				if (IS_BRANCH(mp)) {
 					/* Whenever we advance to a sibling branch page,
 					 * we must proceed all the way down to its first leaf.
@@ -9329,16 +9977,22 @@ again:
 	}
 done:
 	free(buf);
+	if (radepth) {
+		/* Back to the jobs of the enclosing DB, if any */
+		mdb_copyra_set(ra, ojobs, onjobs, ofirst, olast, opos);
+		free(jobs);
+	}
 	return rc;
 }
 
 	/** Copy environment with compaction. */
 static int ESECT
-mdb_env_copyfd1(MDB_env *env, HANDLE fd)
+mdb_env_copyfd1(MDB_env *env, HANDLE fd, int nthreads)
 {
 	MDB_meta *mm;
 	MDB_page *mp;
 	mdb_copy my = {0};
+	mdb_copyra ra;
 	MDB_txn *txn = NULL;
 	pthread_t thr;
 	pgno_t root, new_root;
@@ -9437,10 +10091,18 @@ mdb_env_copyfd1(MDB_env *env, HANDLE fd)
 
 	my.mc_wlen[0] = env->me_psize * NUM_METAS;
 	my.mc_txn = txn;
+	if (nthreads > 0) {
+		rc = mdb_copyra_start(&ra, txn, nthreads);
+		if (rc)
+			goto finish;
+		my.mc_ra = &ra;
+	}
 	rc = mdb_env_cwalk(&my, &root, 0);
 	if (rc == MDB_SUCCESS && root != new_root) {
 		rc = MDB_INCOMPATIBLE;	/* page leak or corrupt DB */
 	}
+	if (my.mc_ra)
+		mdb_copyra_stop(&ra);
 
 finish:
 	if (rc)
@@ -9465,12 +10127,13 @@ done2:
 
 	/** Copy environment as-is. */
 static int ESECT
-mdb_env_copyfd0(MDB_env *env, HANDLE fd)
+mdb_env_copyfd0(MDB_env *env, HANDLE fd, int nthreads)
 {
 	MDB_txn *txn = NULL;
 	mdb_mutexref_t wmutex = NULL;
-	int rc;
-	size_t wsize, w3;
+	mdb_copyra ra;
+	int rc, rastarted = 0;
+	size_t wsize, w3, wmax = MAX_WRITE;
 	char *ptr;
 #ifdef _WIN32
 	DWORD len, w2;
@@ -9537,10 +10200,19 @@ mdb_env_copyfd0(MDB_env *env, HANDLE fd)
 		if (w3 > fsize)
 			w3 = fsize;
 	}
+	if (nthreads > 0 && w3 > wsize) {
+		if ((rc = mdb_copyra_start(&ra, txn, nthreads)))
+			goto leave;
+		rastarted = 1;
+		mdb_copyra_set(&ra, NULL, 0, NUM_METAS, w3 / env->me_psize, 0);
+		wmax = (size_t)MDB_RA_CHUNK * env->me_psize;
+	}
 	wsize = w3 - wsize;
 	while (wsize > 0) {
-		if (wsize > MAX_WRITE)
-			w2 = MAX_WRITE;
+		if (rastarted)
+			mdb_copyra_pos(&ra, ((ptr - env->me_map) / env->me_psize - NUM_METAS) / MDB_RA_CHUNK);
+		if (wsize > wmax)
+			w2 = wmax;
 		else
 			w2 = wsize;
 		DO_WRITE(rc, fd, ptr, w2, len);
@@ -9559,17 +10231,25 @@ mdb_env_copyfd0(MDB_env *env, HANDLE fd)
 	}
 
 leave:
+	if (rastarted)
+		mdb_copyra_stop(&ra);
 	mdb_txn_abort(txn);
 	return rc;
 }
 
 int ESECT
-mdb_env_copyfd2(MDB_env *env, HANDLE fd, unsigned int flags)
+mdb_env_copyfd3(MDB_env *env, HANDLE fd, unsigned int flags, int nthreads)
 {
 	if (flags & MDB_CP_COMPACT)
-		return mdb_env_copyfd1(env, fd);
+		return mdb_env_copyfd1(env, fd, nthreads);
 	else
-		return mdb_env_copyfd0(env, fd);
+		return mdb_env_copyfd0(env, fd, nthreads);
+}
+
+int ESECT
+mdb_env_copyfd2(MDB_env *env, HANDLE fd, unsigned int flags)
+{
+	return mdb_env_copyfd3(env, fd, flags, 0);
 }
 
 int ESECT
@@ -9579,7 +10259,7 @@ mdb_env_copyfd(MDB_env *env, HANDLE fd)
 }
 
 int ESECT
-mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags)
+mdb_env_copy3(MDB_env *env, const char *path, unsigned int flags, int nthreads)
 {
 	int rc;
 	MDB_name fname;
@@ -9591,19 +10271,400 @@ mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags)
 		mdb_fname_destroy(fname);
 	}
 	if (rc == MDB_SUCCESS) {
-		rc = mdb_env_copyfd2(env, newfd, flags);
+		rc = mdb_env_copyfd3(env, newfd, flags, nthreads);
 		if (close(newfd) < 0 && rc == MDB_SUCCESS)
 			rc = ErrCode();
 	}
 	return rc;
 }
 
+int ESECT
+mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags)
+{
+	return mdb_env_copy3(env, path, flags, 0);
+}
+
 int ESECT
 mdb_env_copy(MDB_env *env, const char *path)
 {
 	return mdb_env_copy2(env, path, 0);
 }
 
+#define MDB_SUMS_MAGIC	0xBEEFC0D5	/**< magic of a checksum file */
+#define MDB_DELTA_MAGIC	0xBEEFC0DD	/**< magic of a delta */
+#define MDB_SUMS_BUF	4096		/**< checksums read or written at once */
+
+	/** Header of a delta, or of the checksum file it was made against.
+	 *	A checksum file holds one #mdb_page_sum() per page of the copy,
+	 *	0 for the meta pages. A delta holds a pgno and a page for each
+	 *	page that changed, the meta pages last, then #P_INVALID.
+	 */
+typedef struct MDB_deltahdr {
+	uint32_t	dh_magic;
+	uint32_t	dh_psize;
+	txnid_t		dh_base;	/**< txnid the delta applies to, 0 if none */
+	txnid_t		dh_txnid;	/**< txnid of the copy */
+	pgno_t		dh_npages;	/**< number of pages in the copy */
+} MDB_deltahdr;
+
+	/** Checksum of a page for #mdb_env_copydelta(). Never 0. */
+static unsigned long long ESECT
+mdb_page_sum(const void *page, unsigned int psize)
+{
+	const uint32_t *w = page, *end = w + psize / sizeof(uint32_t);
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	while (w < end) {
+		h ^= *w++;
+		h *= 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	return h ? h : 1;
+}
+
+	/** Write all of buf to fd. */
+static int ESECT
+mdb_fwrite_all(HANDLE fd, const void *buf, size_t size)
+{
+	const char *ptr = buf;
+	size_t w2;
+#ifdef _WIN32
+	DWORD len;
+#else
+	ssize_t len;
+#endif
+
+	while (size > 0) {
+		w2 = size > MAX_WRITE ? MAX_WRITE : size;
+#ifdef _WIN32
+		if (!WriteFile(fd, ptr, w2, &len, NULL))
+			return ErrCode();
+#else
+		len = write(fd, ptr, w2);
+		if (len < 0) {
+			if (ErrCode() == EINTR)
+				continue;
+			return ErrCode();
+		}
+#endif
+		if (len == 0)
+			return EIO;
+		ptr += len;
+		size -= len;
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Read up to size bytes from fd, fewer only at end of file. */
+static int ESECT
+mdb_fread_all(HANDLE fd, void *buf, size_t size, size_t *got)
+{
+	char *ptr = buf;
+	size_t r2;
+#ifdef _WIN32
+	DWORD len;
+#else
+	ssize_t len;
+#endif
+
+	*got = 0;
+	while (size > 0) {
+		r2 = size > MAX_WRITE ? MAX_WRITE : size;
+#ifdef _WIN32
+		if (!ReadFile(fd, ptr, r2, &len, NULL)) {
+			if (ErrCode() == ERROR_HANDLE_EOF)
+				break;
+			return ErrCode();
+		}
+#else
+		len = read(fd, ptr, r2);
+		if (len < 0) {
+			if (ErrCode() == EINTR)
+				continue;
+			return ErrCode();
+		}
+#endif
+		if (len == 0)
+			break;
+		ptr += len;
+		size -= len;
+		*got += len;
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Write a page of a delta at its place in fd. */
+static int ESECT
+mdb_delta_pwrite(HANDLE fd, const void *ptr, unsigned int psize, pgno_t pgno)
+{
+	off_t pos = (off_t)pgno * psize;
+#ifdef _WIN32
+	DWORD len;
+	OVERLAPPED ov;
+	memset(&ov, 0, sizeof(ov));
+	ov.Offset = pos & 0xffffffff;
+	ov.OffsetHigh = pos >> 16 >> 16;
+	if (!WriteFile(fd, ptr, psize, &len, &ov))
+		return ErrCode();
+#else
+	ssize_t len;
+	do {
+		len = pwrite(fd, ptr, psize, pos);
+	} while (len < 0 && ErrCode() == EINTR);
+	if (len < 0)
+		return ErrCode();
+#endif
+	return len == (int)psize ? MDB_SUCCESS : EIO;
+}
+
+int ESECT
+mdb_env_copydelta(MDB_env *env, HANDLE fd, HANDLE oldsums, HANDLE newsums,
+	int nthreads)
+{
+	MDB_txn *txn = NULL;
+	mdb_mutexref_t wmutex = NULL;
+	mdb_copyra ra;
+	MDB_deltahdr hdr, ohdr = {0};
+	unsigned long long *osum = NULL, *nsum = NULL, sum;
+	unsigned int psize = env->me_psize;
+	size_t fsize = 0, got, rlen, wlen = 0, nlen = 0, ocnt = 0, obase = 0;
+	char *metas = NULL, *wbuf = NULL;
+	pgno_t pg, npages;
+	int rc, rastarted = 0;
+
+	if (oldsums != INVALID_HANDLE_VALUE) {
+		rc = mdb_fread_all(oldsums, &ohdr, sizeof(ohdr), &got);
+		if (rc)
+			return rc;
+		if (got != sizeof(ohdr) || ohdr.dh_magic != MDB_SUMS_MAGIC)
+			return MDB_INVALID;
+		if (ohdr.dh_psize != psize)
+			return MDB_INCOMPATIBLE;
+	}
+
+	rlen = sizeof(pgno_t) + psize;
+	metas = malloc(NUM_METAS * psize);
+	wbuf = malloc(MDB_WBUF + rlen);
+	osum = malloc(2 * MDB_SUMS_BUF * sizeof(*osum));
+	if (!metas || !wbuf || !osum) {
+		rc = ENOMEM;
+		goto leave;
+	}
+	nsum = osum + MDB_SUMS_BUF;
+
+	/* Snapshot the meta pages like mdb_env_copyfd0() does */
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		goto leave;
+	if (env->me_txns) {
+		mdb_txn_end(txn, MDB_END_RESET_TMP);
+		wmutex = env->me_wmutex;
+		if (LOCK_MUTEX(rc, env, wmutex))
+			goto leave;
+		rc = mdb_txn_renew0(txn);
+		if (rc) {
+			UNLOCK_MUTEX(wmutex);
+			goto leave;
+		}
+	}
+	memcpy(metas, env->me_map, NUM_METAS * psize);
+	if (wmutex)
+		UNLOCK_MUTEX(wmutex);
+
+	if ((rc = mdb_fsize(env->me_fd, &fsize)))
+		goto leave;
+	npages = txn->mt_next_pgno;
+	if (npages > fsize / psize)
+		npages = fsize / psize;
+
+	hdr.dh_magic = MDB_DELTA_MAGIC;
+	hdr.dh_psize = psize;
+	hdr.dh_base = ohdr.dh_txnid;
+	hdr.dh_txnid = txn->mt_txnid;
+	hdr.dh_npages = npages;
+	if ((rc = mdb_fwrite_all(fd, &hdr, sizeof(hdr))))
+		goto leave;
+	hdr.dh_magic = MDB_SUMS_MAGIC;
+	hdr.dh_base = 0;
+	if ((rc = mdb_fwrite_all(newsums, &hdr, sizeof(hdr))))
+		goto leave;
+
+	if (nthreads > 0 && npages > NUM_METAS) {
+		if ((rc = mdb_copyra_start(&ra, txn, nthreads)))
+			goto leave;
+		rastarted = 1;
+		mdb_copyra_set(&ra, NULL, 0, NUM_METAS, npages, 0);
+	}
+
+	for (pg = 0; pg < npages; pg++) {
+		if (pg - obase >= ocnt) {
+			/* Next batch of old checksums */
+			obase = pg;
+			ocnt = 0;
+			if (pg < ohdr.dh_npages) {
+				rc = mdb_fread_all(oldsums, osum, MDB_SUMS_BUF * sizeof(*osum), &got);
+				if (rc)
+					goto leave;
+				ocnt = got / sizeof(*osum);
+			}
+			if (!ocnt) {
+				memset(osum, 0, MDB_SUMS_BUF * sizeof(*osum));
+				ocnt = MDB_SUMS_BUF;
+			}
+		}
+		if (pg < NUM_METAS) {
+			nsum[nlen++] = 0;
+		} else {
+			if (rastarted && !((pg - NUM_METAS) % MDB_RA_CHUNK))
+				mdb_copyra_pos(&ra, (pg - NUM_METAS) / MDB_RA_CHUNK);
+			/* Free pages may be reused while we read them, so sum
+			 * exactly the bytes that go into the delta.
+			 */
+			memcpy(wbuf + wlen, &pg, sizeof(pg));
+			memcpy(wbuf + wlen + sizeof(pg), env->me_map + (size_t)pg * psize, psize);
+			sum = mdb_page_sum(wbuf + wlen + sizeof(pg), psize);
+			nsum[nlen++] = sum;
+			if (pg >= ohdr.dh_npages || osum[pg - obase] != sum)
+				wlen += rlen;
+			if (wlen >= MDB_WBUF) {
+				if ((rc = mdb_fwrite_all(fd, wbuf, wlen)))
+					goto leave;
+				wlen = 0;
+			}
+		}
+		if (nlen == MDB_SUMS_BUF) {
+			if ((rc = mdb_fwrite_all(newsums, nsum, nlen * sizeof(*nsum))))
+				goto leave;
+			nlen = 0;
+		}
+	}
+	if ((rc = mdb_fwrite_all(newsums, nsum, nlen * sizeof(*nsum))))
+		goto leave;
+
+	/* The meta pages go last, so that an apply that stops early
+	 * never points the target at pages it does not have.
+	 */
+	for (pg = 0; pg < NUM_METAS; pg++) {
+		memcpy(wbuf + wlen, &pg, sizeof(pg));
+		memcpy(wbuf + wlen + sizeof(pg), metas + pg * psize, psize);
+		wlen += rlen;
+	}
+	pg = P_INVALID;
+	memcpy(wbuf + wlen, &pg, sizeof(pg));
+	wlen += sizeof(pg);
+	rc = mdb_fwrite_all(fd, wbuf, wlen);
+
+leave:
+	if (rastarted)
+		mdb_copyra_stop(&ra);
+	mdb_txn_abort(txn);
+	free(osum);
+	free(wbuf);
+	free(metas);
+	return rc;
+}
+
+int ESECT
+mdb_delta_apply(HANDLE delta, HANDLE fd)
+{
+	MDB_deltahdr hdr;
+	MDB_page *mp;
+	MDB_meta *mm;
+	char *page = NULL, *metas = NULL;
+	txnid_t txnid = 0;
+	pgno_t pg;
+	size_t got;
+	int i, rc, nmetas = 0;
+
+	rc = mdb_fread_all(delta, &hdr, sizeof(hdr), &got);
+	if (rc)
+		return rc;
+	if (got != sizeof(hdr) || hdr.dh_magic != MDB_DELTA_MAGIC ||
+		hdr.dh_psize < sizeof(MDB_metabuf) || hdr.dh_psize > MAX_PAGESIZE)
+		return MDB_INVALID;
+
+	page = malloc(hdr.dh_psize);
+	metas = malloc(NUM_METAS * hdr.dh_psize);
+	if (!page || !metas) {
+		rc = ENOMEM;
+		goto leave;
+	}
+
+	/* The target must be the copy the delta was made against */
+	for (i=0; i<NUM_METAS; i++) {
+#ifdef _WIN32
+		DWORD len;
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		ov.Offset = i * hdr.dh_psize;
+		rc = ReadFile(fd, page, hdr.dh_psize, &len, &ov) ? (int)len : -1;
+		if (rc == -1 && ErrCode() == ERROR_HANDLE_EOF)
+			rc = 0;
+#else
+		rc = pread(fd, page, hdr.dh_psize, (off_t)i * hdr.dh_psize);
+#endif
+		if (rc < 0) {
+			rc = ErrCode();
+			goto leave;
+		}
+		if (rc != (int)hdr.dh_psize)
+			break;
+		mp = (MDB_page *)page;
+		mm = METADATA(mp);
+		if (F_ISSET(mp->mp_flags, P_META) && mm->mm_magic == MDB_MAGIC &&
+			mm->mm_txnid > txnid)
+			txnid = mm->mm_txnid;
+	}
+	if (txnid != hdr.dh_base) {
+		rc = MDB_INCOMPATIBLE;
+		goto leave;
+	}
+
+	for (;;) {
+		if ((rc = mdb_fread_all(delta, &pg, sizeof(pg), &got)))
+			goto leave;
+		if (got != sizeof(pg)) {
+			rc = MDB_INVALID;
+			goto leave;
+		}
+		if (pg == P_INVALID)
+			break;
+		if ((rc = mdb_fread_all(delta, page, hdr.dh_psize, &got)))
+			goto leave;
+		if (got != hdr.dh_psize || pg >= hdr.dh_npages) {
+			rc = MDB_INVALID;
+			goto leave;
+		}
+		if (pg < NUM_METAS) {
+			memcpy(metas + pg * hdr.dh_psize, page, hdr.dh_psize);
+			nmetas++;
+		} else if ((rc = mdb_delta_pwrite(fd, page, hdr.dh_psize, pg))) {
+			goto leave;
+		}
+	}
+	if (nmetas != NUM_METAS) {
+		rc = MDB_INVALID;
+		goto leave;
+	}
+
+	/* Make the data durable before the meta pages point at it */
+	if (MDB_FDATASYNC(fd)) {
+		rc = ErrCode();
+		goto leave;
+	}
+	for (i=0; i<NUM_METAS; i++) {
+		if ((rc = mdb_delta_pwrite(fd, metas + i * hdr.dh_psize, hdr.dh_psize, i)))
+			goto leave;
+	}
+	if (MDB_FDATASYNC(fd))
+		rc = ErrCode();
+
+leave:
+	free(metas);
+	free(page);
+	return rc;
+}
+
 int ESECT
 mdb_env_set_flags(MDB_env *env, unsigned int flag, int onoff)
 {
@@ -13,42 +13,165 @@
  */
 #ifdef _WIN32
 #include <windows.h>
+#define	MDB_STDIN	GetStdHandle(STD_INPUT_HANDLE)
 #define	MDB_STDOUT	GetStdHandle(STD_OUTPUT_HANDLE)
+#define	MDB_NOFILE	INVALID_HANDLE_VALUE
+#define	MDB_CLOSE(fd)	(!CloseHandle(fd))
+#define	MDB_RENAME(from, to)	(!MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING))
 #else
+#include <unistd.h>
+#include <fcntl.h>
+#define	MDB_STDIN	0
 #define	MDB_STDOUT	1
+#define	MDB_NOFILE	(-1)
+#define	MDB_CLOSE(fd)	close(fd)
+#define	MDB_RENAME(from, to)	rename(from, to)
 #endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <signal.h>
 #include "lmdb.h"
 
+#define	F_READ	0	/* read an existing file */
+#define	F_NEW	1	/* write a new file, replacing any old one */
+#define	F_RDWR	2	/* update a file, creating it if needed */
+
 static void
 sighandle(int sig)
 {
 }
 
+static mdb_filehandle_t
+openfile(const char *path, int mode)
+{
+#ifdef _WIN32
+	static const DWORD acc[] = { GENERIC_READ, GENERIC_WRITE,
+		GENERIC_READ|GENERIC_WRITE };
+	static const DWORD disp[] = { OPEN_EXISTING, CREATE_ALWAYS, OPEN_ALWAYS };
+	return CreateFileA(path, acc[mode], FILE_SHARE_READ, NULL, disp[mode],
+		FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+	static const int oflags[] = { O_RDONLY, O_WRONLY|O_CREAT|O_TRUNC,
+		O_RDWR|O_CREAT };
+	return open(path, oflags[mode], 0600);
+#endif
+}
+
+static int
+errcode(void)
+{
+#ifdef _WIN32
+	return GetLastError();
+#else
+	return errno;
+#endif
+}
+
+	/* Apply a delta to the environment at path */
+static int
+apply(const char *delta, const char *path, unsigned flags)
+{
+	mdb_filehandle_t dfd = MDB_STDIN, fd;
+	char *name;
+	int rc;
+
+	name = malloc(strlen(path) + sizeof("/data.mdb"));
+	if (!name)
+		return ENOMEM;
+	sprintf(name, (flags & MDB_NOSUBDIR) ? "%s" : "%s/data.mdb", path);
+	fd = openfile(name, F_RDWR);
+	free(name);
+	if (fd == MDB_NOFILE)
+		return errcode();
+	if (strcmp(delta, "-") && (dfd = openfile(delta, F_READ)) == MDB_NOFILE) {
+		rc = errcode();
+		MDB_CLOSE(fd);
+		return rc;
+	}
+	rc = mdb_delta_apply(dfd, fd);
+	if (dfd != MDB_STDIN)
+		MDB_CLOSE(dfd);
+	MDB_CLOSE(fd);
+	return rc;
+}
+
+	/* Write a delta against sumfile, and update sumfile */
+static int
+delta(MDB_env *env, const char *sumfile, const char *path, int nthreads)
+{
+	mdb_filehandle_t ofd, nfd, fd = MDB_STDOUT;
+	char *tmp;
+	int rc;
+
+	tmp = malloc(strlen(sumfile) + sizeof(".tmp"));
+	if (!tmp)
+		return ENOMEM;
+	sprintf(tmp, "%s.tmp", sumfile);
+	ofd = openfile(sumfile, F_READ);
+	nfd = openfile(tmp, F_NEW);
+	if (nfd == MDB_NOFILE) {
+		rc = errcode();
+		goto done;
+	}
+	if (path && (fd = openfile(path, F_NEW)) == MDB_NOFILE) {
+		rc = errcode();
+		goto done;
+	}
+	rc = mdb_env_copydelta(env, fd, ofd, nfd, nthreads);
+	if (path && MDB_CLOSE(fd) && rc == MDB_SUCCESS)
+		rc = errcode();
+	/* Only replace the checksums once the delta is complete */
+	if (MDB_CLOSE(nfd) && rc == MDB_SUCCESS)
+		rc = errcode();
+	nfd = MDB_NOFILE;
+	if (rc == MDB_SUCCESS && MDB_RENAME(tmp, sumfile))
+		rc = errcode();
+done:
+	if (nfd != MDB_NOFILE)
+		MDB_CLOSE(nfd);
+	if (ofd != MDB_NOFILE)
+		MDB_CLOSE(ofd);
+	free(tmp);
+	return rc;
+}
+
 int main(int argc,char * argv[])
 {
 	int rc;
 	MDB_env *env;
 	const char *progname = argv[0], *act;
+	const char *sumfile = NULL;
 	unsigned flags = MDB_RDONLY;
 	unsigned cpflags = 0;
+	int nthreads = 0, doapply = 0;
 
-	for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+	for (; argc > 1 && argv[1][0] == '-' && argv[1][1]; argc--, argv++) {
 		if (argv[1][1] == 'n' && argv[1][2] == '\0')
 			flags |= MDB_NOSUBDIR;
 		else if (argv[1][1] == 'c' && argv[1][2] == '\0')
 			cpflags |= MDB_CP_COMPACT;
-		else if (argv[1][1] == 'V' && argv[1][2] == '\0') {
+		else if (argv[1][1] == 'a' && argv[1][2] == '\0')
+			doapply = 1;
+		else if (argv[1][1] == 'j' && argv[1][2] == '\0' && argc > 2) {
+			nthreads = atoi(argv[2]);
+			argc--, argv++;
+		} else if (argv[1][1] == 'd' && argv[1][2] == '\0' && argc > 2) {
+			sumfile = argv[2];
+			argc--, argv++;
+		} else if (argv[1][1] == 'V' && argv[1][2] == '\0') {
 			printf("%s\n", MDB_VERSION_STRING);
 			exit(0);
 		} else
 			argc = 0;
 	}
 
-	if (argc<2 || argc>3) {
-		fprintf(stderr, "usage: %s [-V] [-c] [-n] srcpath [dstpath]\n", progname);
+	if (argc<2 || argc>3 || (doapply && (argc != 3 || sumfile || cpflags)) ||
+		(sumfile && cpflags)) {
+		fprintf(stderr, "usage: %s [-V] [-c] [-n] [-j threads] srcpath [dstpath]\n"
+			"       %s [-n] [-j threads] -d sumfile srcpath [deltafile]\n"
+			"       %s [-n] -a deltafile dstpath\n", progname, progname, progname);
 		exit(EXIT_FAILURE);
 	}
 
@@ -61,6 +184,14 @@ int main(int argc,char * argv[])
 	signal(SIGINT, sighandle);
 	signal(SIGTERM, sighandle);
 
+	if (doapply) {
+		rc = apply(argv[1], argv[2], flags);
+		if (rc)
+			fprintf(stderr, "%s: applying delta failed, error %d (%s)\n",
+				progname, rc, mdb_strerror(rc));
+		return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
 	act = "opening environment";
 	rc = mdb_env_create(&env);
 	if (rc == MDB_SUCCESS) {
@@ -68,10 +199,12 @@ int main(int argc,char * argv[])
 	}
 	if (rc == MDB_SUCCESS) {
 		act = "copying";
-		if (argc == 2)
-			rc = mdb_env_copyfd2(env, MDB_STDOUT, cpflags);
+		if (sumfile)
+			rc = delta(env, sumfile, argc == 3 ? argv[2] : NULL, nthreads);
+		else if (argc == 2)
+			rc = mdb_env_copyfd3(env, MDB_STDOUT, cpflags, nthreads);
 		else
-			rc = mdb_env_copy2(env, argv[2], cpflags);
+			rc = mdb_env_copy3(env, argv[2], cpflags, nthreads);
 	}
 	if (rc)
 		fprintf(stderr, "%s: %s failed, error %d (%s)\n",
@@ -41,6 +41,7 @@ flagbit dbflags[] = {
 	{ MDB_DUPFIXED, "dupfixed" },
 	{ MDB_INTEGERDUP, "integerdup" },
 	{ MDB_REVERSEDUP, "reversedup" },
+	{ MDB_PREFIXKEY, "prefixkey" },
 	{ 0, NULL }
 };
 
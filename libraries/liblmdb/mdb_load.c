@@ -62,6 +62,7 @@ flagbit dbflags[] = {
 	{ MDB_DUPFIXED, S("dupfixed") },
 	{ MDB_INTEGERDUP, S("integerdup") },
 	{ MDB_REVERSEDUP, S("reversedup") },
+	{ MDB_PREFIXKEY, S("prefixkey") },
 	{ 0, NULL, 0 }
 };
 
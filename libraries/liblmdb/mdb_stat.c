@@ -15,6 +15,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
 #include "lmdb.h"
 
 #ifdef	_WIN32
@@ -35,9 +41,88 @@ static void prstat(MDB_stat *ms)
 	printf("  Entries: %"Z"u\n", ms->ms_entries);
 }
 
+#ifndef _WIN32
+#define	MAXNODES	64
+#define	CHUNK	1024
+
+/* Count the used pages of the datafile that are in memory, and on
+ * Linux the NUMA nodes they are on. Only resident pages are touched,
+ * so nothing is read in.
+ */
+static void prmem(MDB_env *env, MDB_envinfo *mei, unsigned int psize)
+{
+	mdb_filehandle_t fd;
+	char *map;
+	size_t syspsize = sysconf(_SC_PAGESIZE);
+	size_t len = (mei->me_last_pgno+1) * psize;
+	size_t npages = (len + syspsize - 1) / syspsize;
+	size_t resident = 0, off, i, n;
+	size_t nodes[MAXNODES+1] = {0};
+	unsigned char vec[CHUNK];
+	int placed = 0;
+#if defined(__linux__) && defined(SYS_move_pages)
+	void *pages[CHUNK];
+	int status[CHUNK];
+	int j;
+#endif
+
+	if (mdb_env_get_fd(env, &fd))
+		return;
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return;
+	}
+	for (off = 0; off < npages; off += n) {
+		n = npages - off < CHUNK ? npages - off : CHUNK;
+		if (mincore(map + off * syspsize, n * syspsize, (void *)vec)) {
+			perror("mincore");
+			break;
+		}
+#if defined(__linux__) && defined(SYS_move_pages)
+		for (i = 0, j = 0; i < n; i++) {
+			if (vec[i] & 1) {
+				pages[j] = map + (off + i) * syspsize;
+				(void)*(volatile char *)pages[j++];
+			}
+		}
+		resident += j;
+		/* with no target nodes, move_pages only reports where they are */
+		if (j && !syscall(SYS_move_pages, 0, (unsigned long)j, pages,
+			NULL, status, 0)) {
+			placed = 1;
+			for (i = 0; i < (size_t)j; i++) {
+				if (status[i] >= 0)
+					nodes[status[i] < MAXNODES ? status[i] : MAXNODES]++;
+			}
+		}
+#else
+		for (i = 0; i < n; i++) {
+			if (vec[i] & 1)
+				resident++;
+		}
+#endif
+	}
+	munmap(map, len);
+	printf("Memory Status\n");
+	printf("  System page size: %"Z"u\n", syspsize);
+	printf("  Pages used: %"Z"u\n", npages);
+	printf("  Pages resident: %"Z"u (%.1f%%)\n", resident,
+		npages ? resident * 100.0 / npages : 0.0);
+	if (placed) {
+		for (i = 0; i < MAXNODES; i++) {
+			if (nodes[i])
+				printf("  Resident on node %"Z"u: %"Z"u\n", i, nodes[i]);
+		}
+		if (nodes[MAXNODES])
+			printf("  Resident on other nodes: %"Z"u\n", nodes[MAXNODES]);
+	}
+}
+#endif
+
 static void usage(char *prog)
 {
-	fprintf(stderr, "usage: %s [-V] [-n] [-e] [-r[r]] [-f[f[f]]] [-a|-s subdb] dbpath\n", prog);
+	fprintf(stderr, "usage: %s [-V] [-n] [-e] [-m] [-r[r]] [-f[f[f]]] [-a|-s subdb] dbpath\n", prog);
 	exit(EXIT_FAILURE);
 }
 
@@ -53,6 +138,7 @@ int main(int argc, char *argv[])
 	char *envname;
 	char *subname = NULL;
 	int alldbs = 0, envinfo = 0, envflags = 0, freinfo = 0, rdrinfo = 0;
+	int meminfo = 0;
 
 	if (argc < 2) {
 		usage(prog);
@@ -62,12 +148,13 @@ int main(int argc, char *argv[])
 	 * -s: print stat of only the named subDB
 	 * -e: print env info
 	 * -f: print freelist info
+	 * -m: print memory residency info
 	 * -r: print reader info
 	 * -n: use NOSUBDIR flag on env_open
 	 * -V: print version and exit
 	 * (default) print stat of only the main DB
 	 */
-	while ((i = getopt(argc, argv, "Vaefnrs:")) != EOF) {
+	while ((i = getopt(argc, argv, "Vaefmnrs:")) != EOF) {
 		switch(i) {
 		case 'V':
 			printf("%s\n", MDB_VERSION_STRING);
@@ -84,6 +171,9 @@ int main(int argc, char *argv[])
 		case 'f':
 			freinfo++;
 			break;
+		case 'm':
+			meminfo++;
+			break;
 		case 'n':
 			envflags |= MDB_NOSUBDIR;
 			break;
@@ -134,6 +224,16 @@ int main(int argc, char *argv[])
 		printf("  Number of readers used: %u\n", mei.me_numreaders);
 	}
 
+	if (meminfo) {
+#ifndef _WIN32
+		(void)mdb_env_stat(env, &mst);
+		(void)mdb_env_info(env, &mei);
+		prmem(env, &mei, mst.ms_psize);
+#else
+		fprintf(stderr, "memory status is not supported on Windows\n");
+#endif
+	}
+
 	if (rdrinfo) {
 		printf("Reader Table Status\n");
 		rc = mdb_reader_list(env, (MDB_msg_func *)fputs, stdout);
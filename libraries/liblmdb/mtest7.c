@@ -0,0 +1,123 @@
+/* mtest7.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2021 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for multi-page allocation from a fragmented freelist */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define RES(err, expr) ((rc = expr) == (err) || (CHECK(!rc, #expr), 0))
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define SMALL	3000	/* one overflow page */
+#define LARGE	20000	/* five overflow pages */
+
+static char buf[LARGE];
+
+static void fill(int k, size_t len)
+{
+	size_t i;
+	for (i=0; i<len; i++)
+		buf[i] = (char)(k + i);
+}
+
+int main(int argc,char * argv[])
+{
+	int i, j, rc;
+	int count = argc > 1 ? atoi(argv[1]) : 40000;
+	int large = count / 8;
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_val key, data;
+	MDB_txn *txn;
+	MDB_stat mst;
+	clock_t t0;
+	char kbuf[16];
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapsize(env, 1UL << 30));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+
+	/* Fill with small overflow values, then delete every other one
+	 * so the freelist is made of single pages.
+	 */
+	for (i=0; i<count; i+=1000) {
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		E(mdb_dbi_open(txn, NULL, 0, &dbi));
+		for (j=i; j<i+1000 && j<count; j++) {
+			sprintf(kbuf, "s%08d", j);
+			key.mv_size = strlen(kbuf);
+			key.mv_data = kbuf;
+			fill(j, SMALL);
+			data.mv_size = SMALL;
+			data.mv_data = buf;
+			E(mdb_put(txn, dbi, &key, &data, 0));
+		}
+		E(mdb_txn_commit(txn));
+	}
+	for (i=0; i<count; i+=1000) {
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		for (j=i; j<i+1000 && j<count; j+=2) {
+			sprintf(kbuf, "s%08d", j);
+			key.mv_size = strlen(kbuf);
+			key.mv_data = kbuf;
+			E(mdb_del(txn, dbi, &key, NULL));
+		}
+		E(mdb_txn_commit(txn));
+	}
+
+	/* Now every large value has to find a run of five free pages */
+	t0 = clock();
+	for (i=0; i<large; i+=100) {
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		for (j=i; j<i+100 && j<large; j++) {
+			sprintf(kbuf, "l%08d", j);
+			key.mv_size = strlen(kbuf);
+			key.mv_data = kbuf;
+			fill(j, LARGE);
+			data.mv_size = LARGE;
+			data.mv_data = buf;
+			E(mdb_put(txn, dbi, &key, &data, 0));
+			/* and free some more single pages meanwhile */
+			sprintf(kbuf, "s%08d", (j * 7) % count | 1);
+			key.mv_size = strlen(kbuf);
+			RES(MDB_NOTFOUND, mdb_del(txn, dbi, &key, NULL));
+		}
+		E(mdb_txn_commit(txn));
+	}
+	printf("%d large puts: %.2f sec\n", large,
+		(double)(clock() - t0) / CLOCKS_PER_SEC);
+
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	for (j=0; j<large; j++) {
+		sprintf(kbuf, "l%08d", j);
+		key.mv_size = strlen(kbuf);
+		key.mv_data = kbuf;
+		E(mdb_get(txn, dbi, &key, &data));
+		fill(j, LARGE);
+		CHECK(data.mv_size == LARGE && !memcmp(data.mv_data, buf, LARGE),
+			"large value");
+	}
+	E(mdb_stat(txn, dbi, &mst));
+	printf("%lu entries, %lu overflow pages\n",
+		(unsigned long)mst.ms_entries, (unsigned long)mst.ms_overflow_pages);
+	mdb_txn_abort(txn);
+	mdb_env_close(env);
+
+	return 0;
+}
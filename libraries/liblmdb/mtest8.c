@@ -0,0 +1,117 @@
+/* mtest8.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2021 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for MDB_CURRENT on sorted duplicates, both on a sub-page
+ * and on a sub-DB: the current item must be replaced in place.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define RES(err, expr) ((rc = expr) == (err) || (CHECK(!rc, #expr), 0))
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+static void replace(MDB_txn *txn, MDB_dbi dbi, char *k, int ndups, int old)
+{
+	int rc, i, seen_old = 0, seen_new = 0;
+	MDB_cursor *cursor;
+	MDB_val key, data;
+	size_t count;
+	char dbuf[8];
+
+	key.mv_size = strlen(k);
+	key.mv_data = k;
+	data.mv_size = sprintf(dbuf, "%06d", old);
+	data.mv_data = dbuf;
+
+	E(mdb_cursor_open(txn, dbi, &cursor));
+	E(mdb_cursor_get(cursor, &key, &data, MDB_GET_BOTH));
+
+	/* Still sorts between its neighbours */
+	data.mv_size = sprintf(dbuf, "%06d", old + 1);
+	data.mv_data = dbuf;
+	E(mdb_cursor_put(cursor, &key, &data, MDB_CURRENT));
+
+	E(mdb_cursor_count(cursor, &count));
+	if (count != (size_t)ndups) {
+		fprintf(stderr, "%s: %d dups after MDB_CURRENT, expected %d\n",
+			k, (int)count, ndups);
+		abort();
+	}
+	E(mdb_cursor_get(cursor, &key, &data, MDB_SET));
+	for (i = 0; !rc; i++) {
+		if (data.mv_size == 6 && !memcmp(data.mv_data, dbuf, 6))
+			seen_new++;
+		sprintf(dbuf, "%06d", old);
+		if (data.mv_size == 6 && !memcmp(data.mv_data, dbuf, 6))
+			seen_old++;
+		sprintf(dbuf, "%06d", old + 1);
+		rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_DUP);
+	}
+	CHECK(rc == MDB_NOTFOUND, "mdb_cursor_get");
+	if (seen_old || seen_new != 1) {
+		fprintf(stderr, "%s: old value seen %d times, new %d times\n",
+			k, seen_old, seen_new);
+		abort();
+	}
+	mdb_cursor_close(cursor);
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc;
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_val key, data;
+	MDB_txn *txn;
+	char dbuf[8];
+
+	E(mdb_env_create(&env));
+	E(mdb_env_set_maxdbs(env, 4));
+	E(mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664));
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	E(mdb_dbi_open(txn, "current", MDB_CREATE|MDB_DUPSORT, &dbi));
+	E(mdb_drop(txn, dbi, 0));
+
+	/* "a" keeps its dups on a sub-page, "b" needs a sub-DB */
+	key.mv_size = 1;
+	key.mv_data = "a";
+	for (i = 1; i <= 3; i++) {
+		data.mv_size = sprintf(dbuf, "%06d", i * 10);
+		data.mv_data = dbuf;
+		E(mdb_put(txn, dbi, &key, &data, 0));
+	}
+	key.mv_data = "b";
+	for (i = 1; i <= 2000; i++) {
+		data.mv_size = sprintf(dbuf, "%06d", i * 10);
+		data.mv_data = dbuf;
+		E(mdb_put(txn, dbi, &key, &data, 0));
+	}
+	E(mdb_txn_commit(txn));
+
+	E(mdb_txn_begin(env, NULL, 0, &txn));
+	replace(txn, dbi, "a", 3, 20);
+	replace(txn, dbi, "b", 2000, 10000);
+	E(mdb_txn_commit(txn));
+
+	mdb_dbi_close(env, dbi);
+	mdb_env_close(env);
+	printf("MDB_CURRENT on sub-page and sub-DB dups: ok\n");
+
+	return 0;
+}
@@ -87,6 +87,38 @@ mdb_attr_mask(
 	return i < 0 ? NULL : mdb->mi_attrs[i];
 }
 
+/* Are the values of ad kept in the cover DB? The attributes that
+ * searches always look at are kept regardless. Writers also store
+ * the attributes whose cover is still being built.
+ */
+int
+mdb_attr_cover(
+	struct mdb_info *mdb,
+	AttributeDescription *ad,
+	int writing )
+{
+	AttrInfo *ai;
+	slap_mask_t mask;
+
+	if ( ad == slap_schema.si_ad_objectClass ||
+		ad == slap_schema.si_ad_structuralObjectClass ||
+		ad == slap_schema.si_ad_ref ||
+		ad == slap_schema.si_ad_aliasedObjectName )
+		return 1;
+
+	if ( !ad->ad_type->sat_ad )
+		return 0;
+	ai = mdb_attr_mask( mdb, ad->ad_type->sat_ad );
+	if ( !ai )
+		return 0;
+	mask = ai->ai_indexmask;
+	if ( writing )
+		mask |= ai->ai_newmask;
+	else if ( mask & MDB_INDEX_DELETING )
+		return 0;
+	return ( mask & MDB_INDEX_COVER ) != 0;
+}
+
 /* Open all un-opened index DB handles */
 int
 mdb_attr_dbs_open(
@@ -115,14 +147,18 @@ mdb_attr_dbs_open(
 		rc = 0;
 	}
 
-	flags = MDB_DUPSORT|MDB_DUPFIXED|MDB_INTEGERDUP;
+	/* index keys are compared bytewise, shorter branch keys
+	 * keep the index trees shallow
+	 */
+	flags = MDB_DUPSORT|MDB_DUPFIXED|MDB_INTEGERDUP|MDB_PREFIXKEY;
 	if ( !(slapMode & SLAP_TOOL_READONLY) )
 		flags |= MDB_CREATE;
 
 	for ( i=0; i<mdb->mi_nattrs; i++ ) {
 		if ( mdb->mi_attrs[i]->ai_dbi )	/* already open */
 			continue;
-		if ( !( mdb->mi_attrs[i]->ai_indexmask || mdb->mi_attrs[i]->ai_newmask ))	/* not an index record */
+		if ( !(( mdb->mi_attrs[i]->ai_indexmask | mdb->mi_attrs[i]->ai_newmask )
+			& ~MDB_INDEX_NOKEYS ))	/* not an index record, or no keys */
 			continue;
 		rc = mdb_dbi_open( txn, mdb->mi_attrs[i]->ai_desc->ad_type->sat_cname.bv_val,
 			flags, &mdb->mi_attrs[i]->ai_dbi );
@@ -230,6 +266,15 @@ mdb_attr_index_config(
 
 		for ( i = 0; indexes[i] != NULL; i++ ) {
 			slap_mask_t index;
+
+			if ( !strcasecmp( indexes[i], "cover" )) {
+				mask |= MDB_INDEX_COVER;
+				continue;
+			}
+			if ( !strcasecmp( indexes[i], "order" )) {
+				mask |= MDB_INDEX_ORDER;
+				continue;
+			}
 			rc = slap_str2index( indexes[i], &index );
 
 			if( rc != LDAP_SUCCESS ) {
@@ -374,6 +419,17 @@ fail:
 			goto fail;
 		}
 
+		if( ( mask & MDB_INDEX_ORDER ) && !mdb_order_supported( ad ) ) {
+			if (c_reply) {
+				snprintf(c_reply->msg, sizeof(c_reply->msg),
+					"order index of attribute \"%s\" disallowed", attrs[i] );
+				fprintf( stderr, "%s: line %d: %s\n",
+					fname, lineno, c_reply->msg );
+			}
+			rc = LDAP_INAPPROPRIATE_MATCHING;
+			goto fail;
+		}
+
 		Debug( LDAP_DEBUG_CONFIG, "index %s 0x%04lx\n",
 			ad->ad_cname.bv_val, mask );
 
@@ -384,6 +440,10 @@ fail:
 #endif
 		a->ai_cursor = NULL;
 		a->ai_root = NULL;
+#ifdef MDB_TOOL_IDL_CACHING
+		memset( a->ai_st, 0, sizeof( a->ai_st ));
+#endif
+		a->ai_sort = NULL;
 		a->ai_desc = ad;
 		a->ai_dbi = 0;
 		a->ai_multi_hi = UINT_MAX;
@@ -479,14 +539,34 @@ mdb_attr_index_unparser( void *v1, void *v2 )
 	BerVarray *bva = v2;
 	struct berval bv;
 	char *ptr;
+	int cover = ( ai->ai_indexmask & MDB_INDEX_COVER ) != 0;
+	int order = ( ai->ai_indexmask & MDB_INDEX_ORDER ) != 0;
 
 	slap_index2bvlen( ai->ai_indexmask, &bv );
-	if ( bv.bv_len ) {
+	if ( bv.bv_len || cover || order ) {
+		ber_len_t len = bv.bv_len;
+
+		if ( cover )
+			bv.bv_len += STRLENOF( ",cover" ) - !len;
+		if ( order )
+			bv.bv_len += STRLENOF( ",order" ) - !( len || cover );
 		bv.bv_len += ai->ai_desc->ad_cname.bv_len + 1;
 		ptr = ch_malloc( bv.bv_len+1 );
 		bv.bv_val = lutil_strcopy( ptr, ai->ai_desc->ad_cname.bv_val );
 		*bv.bv_val++ = ' ';
-		slap_index2bv( ai->ai_indexmask, &bv );
+		if ( len ) {
+			struct berval idx;
+			idx.bv_val = bv.bv_val;
+			idx.bv_len = len;
+			slap_index2bv( ai->ai_indexmask, &idx );
+			bv.bv_val += len;
+		}
+		if ( cover )
+			bv.bv_val = lutil_strcopy( bv.bv_val, len ? ",cover" : "cover" );
+		if ( order )
+			bv.bv_val = lutil_strcopy( bv.bv_val,
+				( len || cover ) ? ",order" : "order" );
+		*bv.bv_val = '\0';
 		bv.bv_val = ptr;
 		ber_bvarray_add( bva, &bv );
 	}
@@ -33,7 +33,11 @@ LDAP_BEGIN_DECL
 #define MDB_DN2ID		1
 #define MDB_ID2ENTRY	2
 #define MDB_ID2VAL		3
-#define MDB_NDB			4
+#define MDB_IDXSTATS	4
+#define MDB_COVER		5
+#define MDB_ORDER		6
+#define MDB_ID2ORDER	7
+#define MDB_NDB			8
 
 /* The default search IDL stack cache depth */
 #define DEFAULT_SEARCH_STACK_DEPTH	16
@@ -51,6 +55,18 @@ LDAP_BEGIN_DECL
 /* Most users will never see this */
 #define DEFAULT_RTXN_SIZE	10000
 
+/* Stop intersecting the clauses of an AND filter once no more
+ * than this many candidates are left; testing the entries is
+ * cheaper than reading more index keys.
+ */
+#define MDB_AND_SHORTCUT	8
+
+/* Sort a search by walking an ordering index only if at least one
+ * in this many entries is a candidate, otherwise the walk would look
+ * at too many records that aren't.
+ */
+#define MDB_ORDER_SPARSE	64
+
 #ifdef LDAP_DEVEL
 #define MDB_MONITOR_IDX
 #endif
@@ -63,6 +79,73 @@ typedef struct mdb_monitor_t {
 /* From ldap_rq.h */
 struct re_s;
 
+/* Shared cache of decoded entries, see ecache.c */
+struct mdb_ecnode;
+
+typedef struct mdb_ecache {
+	ldap_pvt_thread_mutex_t	ec_mutex;
+	Avlnode		*ec_tree;		/* all nodes, by ID */
+	LDAP_TAILQ_HEAD(ec_lruq, mdb_ecnode) ec_lru;	/* cached entries, MRU first */
+	LDAP_TAILQ_HEAD(ec_ghostq, mdb_ecnode) ec_ghosts;	/* IDs seen once */
+	unsigned	ec_count;
+	unsigned	ec_nghosts;
+	size_t		ec_wtxnid;		/* last writer to touch any entry */
+	unsigned long	ec_hits;
+	unsigned long	ec_misses;
+} mdb_ecache;
+
+/* Shared cache of DN to ID lookups, see dncache.c */
+struct mdb_dcnode;
+
+typedef struct mdb_plan_stats {
+	struct mdb_plan_stats *ps_next;
+	struct mdb_info *ps_mdb;
+	unsigned long	ps_ands;		/* AND filters planned */
+	unsigned long	ps_reordered;	/* ...evaluated out of order */
+	unsigned long	ps_shortcuts;	/* ...cut short */
+	unsigned long	ps_skipped;		/* clauses not looked up */
+} mdb_plan_stats;
+
+/* Each DN lives in the shard its normalized DN hashes to */
+#define MDB_DNCACHE_SHARDS	16
+
+typedef struct mdb_dcshard {
+	ldap_pvt_thread_mutex_t	ds_mutex;
+	Avlnode		*ds_byndn;		/* all nodes, by normalized DN */
+	Avlnode		*ds_byid;		/* all nodes, by ID */
+	LDAP_TAILQ_HEAD(ds_lruq, mdb_dcnode) ds_lru;	/* MRU first */
+	LDAP_TAILQ_HEAD(ds_freeq, mdb_dcnode) ds_free;	/* nodes to reuse */
+	unsigned	ds_count;
+	size_t		ds_wtxnid;		/* last writer to drop any DN */
+	unsigned long	ds_hits;
+	unsigned long	ds_misses;
+} mdb_dcshard;
+
+typedef struct mdb_dncache {
+	mdb_dcshard	dc_shards[MDB_DNCACHE_SHARDS];
+} mdb_dncache;
+
+/* Writers sharing one txn and its commit, see group.c */
+struct mdb_op_info;
+
+typedef struct mdb_wgroup {
+	ldap_pvt_thread_mutex_t	wg_mutex;
+	ldap_pvt_thread_cond_t	wg_cond;
+	MDB_txn		*wg_txn;		/* the shared txn, owned by the leader */
+	int		wg_state;
+#define	MDB_WG_IDLE		0
+#define	MDB_WG_STARTING	1		/* leader is waiting for the writer lock */
+#define	MDB_WG_OPEN		2		/* members may join */
+#define	MDB_WG_CLOSED	3		/* leader is committing */
+	int		wg_busy;		/* a member's nested txn is open */
+	int		wg_waiting;		/* writers waiting to join */
+	unsigned	wg_nops;		/* members of the current group */
+	int		wg_numads;		/* mi_numads when the group started */
+	struct mdb_op_info	*wg_done;	/* members waiting for the commit */
+	unsigned long	wg_groups;
+	unsigned long	wg_ops;
+} mdb_wgroup;
+
 struct mdb_info {
 	MDB_env		*mi_dbenv;
 
@@ -97,6 +180,32 @@ struct mdb_info {
 	Avlnode		*mi_idx;
 #endif /* MDB_MONITOR_IDX */
 
+	/* AND filter planning statistics. Each thread counts its own,
+	 * mi_plan_stats holds the list of them and the counts of the
+	 * threads that are gone.
+	 */
+	ldap_pvt_thread_mutex_t	mi_plan_mutex;
+	mdb_plan_stats	mi_plan_stats;
+
+	unsigned	mi_ecache_max;		/* 0 disables the entry cache */
+	mdb_ecache	mi_ecache;
+
+	unsigned	mi_dncache_max;		/* 0 disables the DN cache */
+	mdb_dncache	mi_dncache;
+
+	unsigned	mi_search_threads;	/* <= 1 filters candidates serially */
+	unsigned	mi_search_prefetch;	/* candidates to read ahead, 0 = none */
+
+	unsigned	mi_group_max;		/* 0 commits each write on its own */
+	mdb_wgroup	mi_wgroup;
+
+	/* online index build progress, see mdb_online_index() */
+	ldap_pvt_thread_mutex_t	mi_index_mutex;
+	ID		mi_index_next;		/* next entry to index */
+	ID		mi_index_first;		/* where this run started */
+	time_t		mi_index_start;		/* when this run started */
+	unsigned	mi_index_threads;	/* threads generating keys */
+
 	int		mi_flags;
 #define	MDB_IS_OPEN		0x01
 #define	MDB_OPEN_INDEX	0x02
@@ -122,19 +231,82 @@ struct mdb_info {
 #define mi_dn2id	mi_dbis[MDB_DN2ID]
 #define mi_ad2id	mi_dbis[MDB_AD2ID]
 #define mi_id2val	mi_dbis[MDB_ID2VAL]
+#define mi_idxstats	mi_dbis[MDB_IDXSTATS]
+#define mi_cover	mi_dbis[MDB_COVER]
+#define mi_order	mi_dbis[MDB_ORDER]
+#define mi_id2order	mi_dbis[MDB_ID2ORDER]
+
+/* The attributes a search needs from each entry it looks at;
+ * mdb_entry_decode() steps over everything else.
+ */
+typedef struct mdb_proj {
+	int		mp_user;		/* all user attributes */
+	int		mp_oper;		/* all operational attributes */
+	AttributeName	*mp_attrs;	/* requested attributes */
+	AttributeDescription	**mp_ads;	/* needed for filters and ACLs */
+	int		mp_nads;
+	int		mp_maxads;
+	signed char	*mp_want;	/* verdicts by attribute index */
+	int		mp_nwant;
+	int		mp_cover;		/* all of them are in the cover DB */
+} mdb_proj;
 
 typedef struct mdb_op_info {
 	OpExtra		moi_oe;
 	MDB_txn*	moi_txn;
 	int			moi_ref;
 	char		moi_flag;
+	char		moi_gdone;	/* the group commit is over */
+	int			moi_grc;	/* ...and its result */
+	struct mdb_op_info	*moi_gnext;
 } mdb_op_info;
 #define MOI_READER	0x01
 #define MOI_FREEIT	0x02
 #define MOI_KEEPER	0x04
+#define MOI_GROUP	0x08	/* moi_txn is nested in mi_wgroup's txn */
+#define MOI_LEADER	0x10	/* ...and this op commits it */
+#define MOI_NESTED	0x20	/* moi_txn is nested in a kept (MOI_KEEPER) txn */
+
+/* A search walking an ordering index, see order.c */
+typedef struct mdb_orderwalk {
+	SortRequest	*ow_srq;
+	MDB_cursor	*ow_mc;
+	int		ow_phase;
+#define	MDB_OW_COUNT	1		/* only finding the target */
+#define	MDB_OW_SEND		2
+#define	MDB_OW_DONE		3
+	int		ow_placed;		/* cursor is on the next record already */
+	int		ow_counted;		/* ow_total is exact */
+	long	ow_pos;			/* matching entries so far */
+	long	ow_lo, ow_hi;	/* the window to send, ow_lo 0 until known */
+	long	ow_target;
+	long	ow_total;
+	struct berval	ow_pfx;		/* first key of the attribute */
+	struct berval	ow_akey;	/* key of the VLV assertion value */
+	struct berval	ow_key;		/* copy of the current key */
+	size_t	ow_ksize;
+	ID		ow_id;
+} mdb_orderwalk;
 
 LDAP_END_DECL
 
+/* Index statistics, one per index type of each indexed attribute,
+ * kept in the idxstats DB. Keys that overflowed into a range are
+ * counted in is_ranges, only the IDs of the other keys, bitmaps
+ * included, in is_ids.
+ */
+#define MDB_IDXSTAT_PRESENT	0
+#define MDB_IDXSTAT_EQUALITY	1
+#define MDB_IDXSTAT_APPROX	2
+#define MDB_IDXSTAT_SUBSTR	3
+#define MDB_IDXSTAT_TYPES	4
+
+typedef struct mdb_idxstat {
+	ID is_keys;		/* distinct keys */
+	ID is_ranges;	/* keys stored as a range */
+	ID is_ids;		/* IDs stored in the other keys */
+} mdb_idxstat;
+
 /* for the cache of attribute information (which are indexed, etc.) */
 typedef struct mdb_attrinfo {
 	AttributeDescription *ai_desc; /* attribute description cn;lang-en */
@@ -144,7 +316,11 @@ typedef struct mdb_attrinfo {
 	ComponentReference* ai_cr; /*component indexing*/
 #endif
 	TAvlnode *ai_root;		/* for tools */
+#ifdef MDB_TOOL_IDL_CACHING
+	mdb_idxstat ai_st[MDB_IDXSTAT_TYPES];	/* for tools, not written yet */
+#endif
 	MDB_cursor *ai_cursor;	/* for tools */
+	struct mdb_tool_sort *ai_sort;	/* for tools */
 	int ai_idx;	/* position in AI array */
 	MDB_dbi ai_dbi;
 	unsigned ai_multi_hi;
@@ -159,8 +335,51 @@ typedef struct mdb_attrixinfo {
 	AttrInfo *ai_ai;
 } AttrIxInfo;
 
+/* tool bulk indexer state, one per index DB that was empty
+ * when a quick mode slapadd/slapindex started, see tools.c
+ */
+typedef struct mdb_tool_sort {
+	mdb_idxstat ts_st[MDB_IDXSTAT_TYPES];	/* also tells the index types apart */
+	AttrInfo *ts_ai;
+	char *ts_buf;		/* (key, ID) records not yet sorted */
+	size_t ts_len;
+	size_t ts_size;
+	size_t ts_nrecs;
+	void **ts_recs;		/* sorted ts_buf */
+	int ts_fd;			/* temp file holding the sorted runs */
+	int ts_nruns;
+	off_t *ts_runs;		/* start of each run */
+	off_t ts_fend;
+	int ts_rc;
+} mdb_tool_sort;
+
+/* online indexer state, one per chunk of entries. Keys generated by
+ * mdb_keybuf_add() from a read snapshot are kept as mdb_keyrecs until
+ * they are written, see mdb_online_index().
+ */
+typedef struct mdb_keybuf {
+	OpExtra kb_oe;
+	mdb_idxstat kb_st[MDB_IDXSTAT_TYPES];	/* only tells the index types apart */
+	AttrInfo *kb_ai;
+	char *kb_buf;
+	size_t kb_len;
+	size_t kb_size;
+} mdb_keybuf;
+
+typedef struct mdb_keyrec {
+	ID kr_id;
+	AttrInfo *kr_ai;	/* NULL if the entry must be indexed in the write txn */
+	int kr_type;
+	int kr_nkeys;
+	size_t kr_len;		/* of the whole record, keys follow */
+} mdb_keyrec;
+
 /* These flags must not clash with SLAP_INDEX flags or ops in slap.h! */
 #define	MDB_INDEX_DELETING	0x8000U	/* index is being modified */
+#define	MDB_INDEX_COVER		0x4000U	/* values kept in the cover DB */
+#define	MDB_INDEX_ORDER		0x10000U	/* entries kept in the order DB */
+#define	MDB_INDEX_NOKEYS	(MDB_INDEX_COVER|MDB_INDEX_ORDER)	/* not in the index DB */
+#define	MDB_INDEX_KEYLESS(mask)	((mask) && !((mask) & ~MDB_INDEX_NOKEYS))
 #define	MDB_INDEX_UPDATE_OP	0x03	/* performing an index update */
 
 /* For slapindex to record which attrs in an entry belong to which
@@ -45,6 +45,7 @@ enum {
 	MDB_SSTACK,
 	MDB_MULTIVAL,
 	MDB_IDLEXP,
+	MDB_ECACHE,
 };
 
 static ConfigTable mdbcfg[] = {
@@ -68,16 +69,39 @@ static ConfigTable mdbcfg[] = {
 			"DESC 'Disable synchronous database writes' "
 			"EQUALITY booleanMatch "
 			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
+	{ "dncache", "entries", 2, 2, 0, ARG_UINT|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_dncache_max),
+		"( OLcfgDbAt:12.9 NAME 'olcDbDNCache' "
+		"DESC 'Number of DN to ID lookups shared between readers' "
+		"EQUALITY integerMatch "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "entrycache", "entries", 2, 2, 0, ARG_UINT|ARG_MAGIC|MDB_ECACHE,
+		mdb_cf_gen, "( OLcfgDbAt:12.7 NAME 'olcDbEntryCache' "
+		"DESC 'Number of decoded entries shared between readers' "
+		"EQUALITY integerMatch "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "envflags", "flags", 2, 0, 0, ARG_MAGIC|MDB_ENVFLAGS,
 		mdb_cf_gen, "( OLcfgDbAt:12.3 NAME 'olcDbEnvFlags' "
 			"DESC 'Database environment flags' "
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "groupcommit", "ops", 2, 2, 0, ARG_UINT|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_group_max),
+		"( OLcfgDbAt:12.12 NAME 'olcDbGroupCommit' "
+		"DESC 'Maximum number of write operations sharing one commit' "
+		"EQUALITY integerMatch "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "index", "attr> <[pres,eq,approx,sub]", 2, 3, 0, ARG_MAGIC|MDB_INDEX,
 		mdb_cf_gen, "( OLcfgDbAt:0.2 NAME 'olcDbIndex' "
 		"DESC 'Attribute index parameters' "
 		"EQUALITY caseIgnoreMatch "
 		"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "indexthreads", "threads", 2, 2, 0, ARG_UINT|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_index_threads),
+		"( OLcfgDbAt:12.11 NAME 'olcDbIndexThreads' "
+		"DESC 'Number of threads generating keys in online indexing' "
+		"EQUALITY integerMatch "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "maxentrysize", "size", 2, 2, 0, ARG_ULONG|ARG_OFFSET,
 		(void *)offsetof(struct mdb_info, mi_maxentrysize),
 		"( OLcfgDbAt:12.4 NAME 'olcDbMaxEntrySize' "
@@ -117,6 +141,18 @@ static ConfigTable mdbcfg[] = {
 		"DESC 'Depth of search stack in IDLs' "
 		"EQUALITY integerMatch "
 		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "searchprefetch", "entries", 2, 2, 0, ARG_UINT|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_search_prefetch),
+		"( OLcfgDbAt:12.10 NAME 'olcDbSearchPrefetch' "
+		"DESC 'Number of search candidates to read ahead' "
+		"EQUALITY integerMatch "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "searchthreads", "threads", 2, 2, 0, ARG_UINT|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_search_threads),
+		"( OLcfgDbAt:12.8 NAME 'olcDbSearchThreads' "
+		"DESC 'Number of threads used to filter the candidates of a large search' "
+		"EQUALITY integerMatch "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ NULL, NULL, 0, 0, 0, ARG_IGNORED,
 		NULL, NULL, NULL, NULL }
 };
@@ -138,7 +174,9 @@ static ConfigOCs mdbocs[] = {
 		"MAY ( olcDbCheckpoint $ olcDbEnvFlags $ "
 		"olcDbNoSync $ olcDbIndex $ olcDbMaxReaders $ olcDbMaxSize $ "
 		"olcDbMode $ olcDbSearchStack $ olcDbMaxEntrySize $ olcDbRtxnSize $ "
-		"olcDbMultival ) )",
+		"olcDbMultival $ olcDbEntryCache $ olcDbSearchThreads $ "
+		"olcDbDNCache $ olcDbSearchPrefetch $ olcDbIndexThreads $ "
+		"olcDbGroupCommit ) )",
 			Cft_Database, mdbcfg+1 },
 	{ NULL, 0, NULL }
 };
@@ -149,6 +187,7 @@ static slap_verbmasks mdb_envflags[] = {
 	{ BER_BVC("writemap"),	MDB_WRITEMAP },
 	{ BER_BVC("mapasync"),	MDB_MAPASYNC },
 	{ BER_BVC("nordahead"),	MDB_NORDAHEAD },
+	{ BER_BVC("hugepage"),	MDB_HUGEPAGE },
 	{ BER_BVNULL, 0 }
 };
 
@@ -192,6 +231,305 @@ mdb_checkpoint( void *ctx, void *arg )
 	return NULL;
 }
 
+/* Online indexing
+ *
+ * Entries are indexed MDB_OI_BATCH at a time. Their data is read in a
+ * read txn, and the keys of the index types being built are generated
+ * from it by the task and up to indexthreads-1 pool threads, one chunk
+ * of entries at a time, without touching the DB. The keys are then
+ * written in one write txn, together with the ID to resume from, so a
+ * build that was interrupted goes on after a restart. Entries that
+ * changed since they were read, or that can't be decoded without a
+ * txn, are indexed by the writer itself. Updates maintain the new
+ * index types all along, but searches only use them once every entry
+ * is done.
+ */
+#define MDB_OI_BATCH	1024
+#define MDB_OI_CHUNK	64
+#define MDB_OI_NCHUNK	(MDB_OI_BATCH / MDB_OI_CHUNK)
+
+typedef struct mdb_oindex {
+	ldap_pvt_thread_mutex_t	oi_mutex;
+	ldap_pvt_thread_cond_t	oi_cond;
+	int		oi_refcnt;		/* task + pending helpers */
+	int		oi_done;		/* build is over */
+	int		oi_nchunk;		/* chunks in the batch */
+	int		oi_next;		/* next chunk to claim */
+	int		oi_busy;		/* chunks being worked on */
+	int		oi_count;		/* entries in the batch */
+	BackendDB	*oi_be;
+	ID		oi_ids[MDB_OI_BATCH];
+	MDB_val	oi_data[MDB_OI_BATCH];
+	mdb_keybuf	oi_kb[MDB_OI_NCHUNK];
+} mdb_oindex;
+
+/* Drop a reference, the last one frees it */
+static void
+mdb_oindex_release( mdb_oindex *oi, int done )
+{
+	int i, last;
+
+	ldap_pvt_thread_mutex_lock( &oi->oi_mutex );
+	if ( done )
+		oi->oi_done = 1;
+	last = !--oi->oi_refcnt;
+	ldap_pvt_thread_mutex_unlock( &oi->oi_mutex );
+	if ( last ) {
+		for ( i = 0; i < MDB_OI_NCHUNK; i++ )
+			mdb_keybuf_free( &oi->oi_kb[i] );
+		ldap_pvt_thread_cond_destroy( &oi->oi_cond );
+		ldap_pvt_thread_mutex_destroy( &oi->oi_mutex );
+		ch_free( oi );
+	}
+}
+
+/* Generate the new keys of a chunk of entries */
+static void
+mdb_oindex_chunk( Operation *op, mdb_oindex *oi, int c )
+{
+	mdb_keybuf *kb = &oi->oi_kb[c];
+	Entry *e;
+	size_t len;
+	int i, end;
+
+	end = ( c + 1 ) * MDB_OI_CHUNK;
+	if ( end > oi->oi_count )
+		end = oi->oi_count;
+
+	kb->kb_len = 0;
+	LDAP_SLIST_INSERT_HEAD( &op->o_extra, &kb->kb_oe, oe_next );
+	for ( i = c * MDB_OI_CHUNK; i < end; i++ ) {
+		len = kb->kb_len;
+		if ( mdb_entry_decode( op, NULL, &oi->oi_data[i], oi->oi_ids[i], &e, NULL )) {
+			mdb_keybuf_redo( kb, oi->oi_ids[i] );
+			continue;
+		}
+		e->e_id = oi->oi_ids[i];
+		BER_BVZERO( &e->e_name );
+		BER_BVZERO( &e->e_nname );
+		if ( mdb_index_entry( op, NULL, MDB_INDEX_UPDATE_OP, e )) {
+			kb->kb_len = len;
+			mdb_keybuf_redo( kb, oi->oi_ids[i] );
+		}
+		mdb_entry_return( op, e );
+	}
+	LDAP_SLIST_REMOVE( &op->o_extra, &kb->kb_oe, OpExtra, oe_next );
+}
+
+/* Claim and index chunks until the batch is used up */
+static void
+mdb_oindex_work( Operation *op, mdb_oindex *oi )
+{
+	int c;
+
+	ldap_pvt_thread_mutex_lock( &oi->oi_mutex );
+	while ( !oi->oi_done && oi->oi_next < oi->oi_nchunk ) {
+		c = oi->oi_next++;
+		oi->oi_busy++;
+		ldap_pvt_thread_mutex_unlock( &oi->oi_mutex );
+		mdb_oindex_chunk( op, oi, c );
+		ldap_pvt_thread_mutex_lock( &oi->oi_mutex );
+		if ( !--oi->oi_busy && oi->oi_next == oi->oi_nchunk )
+			ldap_pvt_thread_cond_signal( &oi->oi_cond );
+	}
+	ldap_pvt_thread_mutex_unlock( &oi->oi_mutex );
+}
+
+static void *
+mdb_oindex_task( void *ctx, void *arg )
+{
+	mdb_oindex *oi = arg;
+	Connection conn = {0};
+	OperationBuffer opbuf;
+	Operation *op;
+
+	connection_fake_init( &conn, &opbuf, ctx );
+	op = &opbuf.ob_op;
+	op->o_bd = oi->oi_be;
+
+	mdb_oindex_work( op, oi );
+	mdb_oindex_release( oi, 0 );
+	return NULL;
+}
+
+/* Read the batch of entries starting at id, and generate their keys */
+static int
+mdb_oindex_fill( Operation *op, mdb_oindex *oi, MDB_txn *txn, ID id, ID *last )
+{
+	struct mdb_info *mdb = op->o_bd->be_private;
+	MDB_cursor *mc;
+	MDB_val key, data;
+	int i, n = 0, nhelp, rc;
+
+	rc = mdb_cursor_open( txn, mdb->mi_id2entry, &mc );
+	if ( rc )
+		return rc;
+	key.mv_data = &id;
+	key.mv_size = sizeof( ID );
+	rc = mdb_cursor_get( mc, &key, &data, MDB_SET_RANGE );
+	while ( rc == 0 ) {
+		memcpy( last, key.mv_data, sizeof( ID ));
+		/* skip stubs from missing parents */
+		if ( data.mv_size ) {
+			oi->oi_ids[n] = *last;
+			oi->oi_data[n] = data;
+			if ( ++n == MDB_OI_BATCH )
+				break;
+		}
+		rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT );
+	}
+	mdb_cursor_close( mc );
+	if ( rc == MDB_NOTFOUND )
+		rc = 0;
+	if ( rc || !n )
+		return rc;
+
+	ldap_pvt_thread_mutex_lock( &oi->oi_mutex );
+	oi->oi_count = n;
+	oi->oi_nchunk = ( n + MDB_OI_CHUNK - 1 ) / MDB_OI_CHUNK;
+	oi->oi_next = 0;
+	nhelp = ( oi->oi_nchunk < mdb->mi_index_threads ? oi->oi_nchunk :
+		(int)mdb->mi_index_threads ) - oi->oi_refcnt;
+	if ( nhelp > 0 )
+		oi->oi_refcnt += nhelp;
+	ldap_pvt_thread_mutex_unlock( &oi->oi_mutex );
+
+	for ( i = 0; i < nhelp; i++ ) {
+		if ( ldap_pvt_thread_pool_submit( &connection_pool,
+			mdb_oindex_task, oi ))
+			mdb_oindex_release( oi, 0 );
+	}
+
+	/* do our share, then wait for the helpers that got some */
+	mdb_oindex_work( op, oi );
+	ldap_pvt_thread_mutex_lock( &oi->oi_mutex );
+	while ( oi->oi_busy )
+		ldap_pvt_thread_cond_wait( &oi->oi_cond, &oi->oi_mutex );
+	ldap_pvt_thread_mutex_unlock( &oi->oi_mutex );
+	return 0;
+}
+
+/* Write the keys of the batch. The entry data read for it must
+ * still be valid.
+ */
+static int
+mdb_oindex_write( Operation *op, mdb_oindex *oi, MDB_txn *txn )
+{
+	struct mdb_info *mdb = op->o_bd->be_private;
+	MDB_cursor *mc, **mcs;
+	mdb_idxstat *sts;
+	mdb_keybuf *kb;
+	mdb_keyrec *kr;
+	AttrInfo *ai = NULL;
+	MDB_val key, data;
+	Entry *e;
+	ID id = NOID;
+	char *ptr;
+	int c, i = -1, slot = 0, ok = 0, cover, order, rc;
+
+	rc = mdb_cursor_open( txn, mdb->mi_id2entry, &mc );
+	if ( rc )
+		return rc;
+	mcs = op->o_tmpcalloc( mdb->mi_nattrs, sizeof( MDB_cursor * ),
+		op->o_tmpmemctx );
+	sts = op->o_tmpcalloc( mdb->mi_nattrs * MDB_IDXSTAT_TYPES,
+		sizeof( mdb_idxstat ), op->o_tmpmemctx );
+
+	for ( c = 0; c < oi->oi_nchunk && !rc; c++ ) {
+		kb = &oi->oi_kb[c];
+		for ( ptr = kb->kb_buf; ptr < kb->kb_buf + kb->kb_len;
+			ptr += kr->kr_len )
+		{
+			kr = (mdb_keyrec *)ptr;
+			if ( kr->kr_id != id ) {
+				id = kr->kr_id;
+				while ( oi->oi_ids[++i] != id )
+					;
+				/* was it changed since it was read? */
+				key.mv_data = &id;
+				key.mv_size = sizeof( ID );
+				rc = mdb_cursor_get( mc, &key, &data, MDB_SET );
+				if ( rc ) {
+					ok = 0;
+					if ( rc != MDB_NOTFOUND )
+						break;
+					rc = 0;
+					continue;
+				}
+				ok = kr->kr_ai && data.mv_size == oi->oi_data[i].mv_size &&
+					!memcmp( data.mv_data, oi->oi_data[i].mv_data, data.mv_size );
+				if ( !ok ) {
+					rc = mdb_id2entry( op, mc, id, &e );
+					if ( rc == 0 ) {
+						rc = mdb_index_entry( op, txn, MDB_INDEX_UPDATE_OP, e );
+						mdb_entry_return( op, e );
+						if ( rc )
+							break;
+					} else if ( rc == MDB_NOTFOUND ) {
+						rc = 0;
+					} else {
+						break;
+					}
+					continue;
+				}
+			}
+			if ( !ok )
+				continue;
+			if ( kr->kr_ai != ai ) {
+				ai = kr->kr_ai;
+				slot = mdb_attr_slot( mdb, ai->ai_desc, NULL );
+			}
+			if ( !mcs[slot] ) {
+				rc = mdb_cursor_open( txn, ai->ai_dbi, &mcs[slot] );
+				if ( rc )
+					break;
+			}
+			rc = mdb_keyrec_write( op, mcs[slot], kr,
+				&sts[slot * MDB_IDXSTAT_TYPES] );
+			if ( rc )
+				break;
+		}
+	}
+
+	/* cover and order records are rewritten from the whole entry */
+	cover = order = 0;
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		slap_mask_t added = mdb->mi_attrs[i]->ai_newmask &
+			~mdb->mi_attrs[i]->ai_indexmask;
+		if ( added & MDB_INDEX_COVER )
+			cover = 1;
+		if ( added & MDB_INDEX_ORDER )
+			order = 1;
+	}
+	if ( cover || order ) {
+		for ( i = 0; i < oi->oi_count && !rc; i++ ) {
+			rc = mdb_id2entry( op, mc, oi->oi_ids[i], &e );
+			if ( rc == 0 ) {
+				if ( cover )
+					rc = mdb_cover_put( op, txn, e );
+				if ( order && !rc )
+					rc = mdb_order_put( op, txn, e );
+				mdb_entry_return( op, e );
+			} else if ( rc == MDB_NOTFOUND ) {
+				rc = 0;
+			}
+		}
+	}
+
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		if ( !mcs[i] )
+			continue;
+		mdb_cursor_close( mcs[i] );
+		if ( !rc )
+			rc = mdb_idxstat_update( mdb, txn, mdb->mi_attrs[i],
+				&sts[i * MDB_IDXSTAT_TYPES] );
+	}
+	op->o_tmpfree( sts, op->o_tmpmemctx );
+	op->o_tmpfree( mcs, op->o_tmpmemctx );
+	mdb_cursor_close( mc );
+	return rc;
+}
+
 /* reindex entries on the fly */
 static void *
 mdb_online_index( void *ctx, void *arg )
@@ -204,86 +542,116 @@ mdb_online_index( void *ctx, void *arg )
 	OperationBuffer opbuf;
 	Operation *op;
 
-	MDB_cursor *curs;
-	MDB_val key, data;
-	MDB_txn *txn;
-	ID id;
-	Entry *e;
-	int rc, getnext = 1;
-	int i;
+	mdb_oindex *oi;
+	MDB_txn *rtxn, *txn;
+	ID id, last;
+	char *err = NULL;
+	int rc, i;
 
 	connection_fake_init( &conn, &opbuf, ctx );
 	op = &opbuf.ob_op;
 
 	op->o_bd = be;
 
-	id = 1;
-	key.mv_size = sizeof(ID);
+	oi = ch_calloc( 1, sizeof( mdb_oindex ));
+	ldap_pvt_thread_mutex_init( &oi->oi_mutex );
+	ldap_pvt_thread_cond_init( &oi->oi_cond );
+	oi->oi_refcnt = 1;
+	oi->oi_be = be;
+	for ( i = 0; i < MDB_OI_NCHUNK; i++ )
+		mdb_keybuf_init( &oi->oi_kb[i] );
 
 	while ( 1 ) {
-		if ( slapd_shutdown )
+		if ( slapd_shutdown ) {
+			rc = -1;
+			err = NULL;
 			break;
+		}
 
-		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+		ldap_pvt_thread_mutex_lock( &mdb->mi_index_mutex );
+		id = mdb->mi_index_next;
+		ldap_pvt_thread_mutex_unlock( &mdb->mi_index_mutex );
+
+		err = "txn_begin";
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &rtxn );
 		if ( rc )
 			break;
-		rc = mdb_cursor_open( txn, mdb->mi_id2entry, &curs );
+		err = "read";
+		last = id;
+		rc = mdb_oindex_fill( op, oi, rtxn, id, &last );
 		if ( rc ) {
-			mdb_txn_abort( txn );
+			mdb_txn_abort( rtxn );
 			break;
 		}
-		if ( getnext ) {
-			getnext = 0;
-			key.mv_data = &id;
-			rc = mdb_cursor_get( curs, &key, &data, MDB_SET_RANGE );
-			if ( rc ) {
-				mdb_txn_abort( txn );
-				if ( rc == MDB_NOTFOUND )
-					rc = 0;
-				break;
-			}
-			memcpy( &id, key.mv_data, sizeof( id ));
-		}
 
-		rc = mdb_id2entry( op, curs, id, &e );
-		mdb_cursor_close( curs );
+		err = "txn_begin";
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
 		if ( rc ) {
-			mdb_txn_abort( txn );
-			if ( rc == MDB_NOTFOUND ) {
-				id++;
-				getnext = 1;
-				continue;
-			}
+			mdb_txn_abort( rtxn );
 			break;
 		}
-		rc = mdb_index_entry( op, txn, MDB_INDEX_UPDATE_OP, e );
-		mdb_entry_return( op, e );
+		if ( !oi->oi_count ) {
+			/* all done */
+			mdb_txn_abort( rtxn );
+			err = "txn_commit";
+			rc = mdb_idxbuild_del( mdb, txn );
+			if ( rc == 0 )
+				rc = mdb_idxbuilt_put( mdb, txn, MDB_INDEX_NOKEYS );
+			if ( rc == 0 )
+				rc = mdb_txn_commit( txn );
+			else
+				mdb_txn_abort( txn );
+			break;
+		}
+		err = "write";
+		rc = mdb_oindex_write( op, oi, txn );
+		if ( rc == 0 )
+			rc = mdb_idxbuild_put( mdb, txn, last + 1 );
 		if ( rc == 0 ) {
+			err = "txn_commit";
 			rc = mdb_txn_commit( txn );
-			txn = NULL;
 		} else {
 			mdb_txn_abort( txn );
-			txn = NULL;
 		}
-		if ( rc ) {
-			Debug( LDAP_DEBUG_ANY,
-				LDAP_XSTRING(mdb_online_index) ": database %s: "
-				"txn_commit failed: %s (%d)\n",
-				be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+		mdb_txn_abort( rtxn );
+		oi->oi_count = 0;
+		if ( rc )
+			break;
+
+		ldap_pvt_thread_mutex_lock( &mdb->mi_index_mutex );
+		if ( mdb->mi_index_next == id )
+			mdb->mi_index_next = last + 1;
+		ldap_pvt_thread_mutex_unlock( &mdb->mi_index_mutex );
+
+		/* let config changes through, they may even restart us */
+		ldap_pvt_thread_pool_pausecheck( &connection_pool );
+		if ( !( mdb->mi_flags & MDB_IS_OPEN )) {
+			rc = -1;
+			err = NULL;
 			break;
 		}
-		id++;
-		getnext = 1;
 	}
+	mdb_oindex_release( oi, 1 );
 
-	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
-		if ( mdb->mi_attrs[ i ]->ai_indexmask & MDB_INDEX_DELETING
-			|| mdb->mi_attrs[ i ]->ai_newmask == 0 )
-		{
-			continue;
+	if ( rc == 0 ) {
+		for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+			if ( mdb->mi_attrs[ i ]->ai_indexmask & MDB_INDEX_DELETING
+				|| mdb->mi_attrs[ i ]->ai_newmask == 0 )
+			{
+				continue;
+			}
+			mdb->mi_attrs[ i ]->ai_indexmask = mdb->mi_attrs[ i ]->ai_newmask;
+			mdb->mi_attrs[ i ]->ai_newmask = 0;
 		}
-		mdb->mi_attrs[ i ]->ai_indexmask = mdb->mi_attrs[ i ]->ai_newmask;
-		mdb->mi_attrs[ i ]->ai_newmask = 0;
+	} else if ( err ) {
+		/* leave the index types unused, they are finished
+		 * on the next start
+		 */
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_online_index) ": database %s: "
+			"%s failed at ID %lu: %s (%d)\n",
+			be->be_suffix[0].bv_val, err, (unsigned long) id,
+			mdb_strerror(rc), rc );
 	}
 
 	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
@@ -295,6 +663,32 @@ mdb_online_index( void *ctx, void *arg )
 	return NULL;
 }
 
+/* Start indexing the new index types from entry next, or
+ * start over if the task is already running.
+ */
+void
+mdb_online_index_start( BackendDB *be, ID next )
+{
+	struct mdb_info *mdb = be->be_private;
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_index_mutex );
+	mdb->mi_index_next = next;
+	mdb->mi_index_first = next;
+	mdb->mi_index_start = slap_get_time();
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_index_mutex );
+
+	if ( !mdb->mi_index_task ) {
+		/* Start the task as soon as we finish here. Set a long
+		 * interval (10 hours) so that it only gets scheduled once.
+		 */
+		ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+		mdb->mi_index_task = ldap_pvt_runqueue_insert( &slapd_rq, 36000,
+			mdb_online_index, be,
+			LDAP_XSTRING(mdb_online_index), be->be_suffix[0].bv_val );
+		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	}
+}
+
 /* Cleanup loose ends after Modify completes */
 static int
 mdb_cf_cleanup( ConfigArgs *c )
@@ -303,8 +697,20 @@ mdb_cf_cleanup( ConfigArgs *c )
 	int rc = 0;
 
 	if ( mdb->mi_flags & MDB_DEL_INDEX ) {
+		MDB_txn *txn;
 		mdb_attr_flush( mdb );
 		mdb->mi_flags ^= MDB_DEL_INDEX;
+		/* writers no longer keep the dropped cover values */
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+		if ( rc == 0 ) {
+			rc = mdb_idxbuilt_put( mdb, txn, 0 );
+			if ( rc == 0 )
+				rc = mdb_txn_commit( txn );
+			else
+				mdb_txn_abort( txn );
+		}
+		if ( rc )
+			rc = LDAP_OTHER;
 	}
 
 	if ( mdb->mi_flags & MDB_RE_OPEN ) {
@@ -326,6 +732,22 @@ mdb_cf_cleanup( ConfigArgs *c )
 	if ( mdb->mi_flags & MDB_OPEN_INDEX ) {
 		mdb->mi_flags ^= MDB_OPEN_INDEX;
 		rc = mdb_attr_dbs_open( c->be, NULL, &c->reply );
+		if ( rc == 0 ) {
+			/* record the new index types right away, so that
+			 * a restart before the first batch still builds them
+			 */
+			MDB_txn *txn;
+			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+			if ( rc == 0 ) {
+				rc = mdb_idxbuild_put( mdb, txn, mdb->mi_index_next );
+				if ( rc == 0 )
+					rc = mdb_idxbuilt_put( mdb, txn, 0 );
+				if ( rc == 0 )
+					rc = mdb_txn_commit( txn );
+				else
+					mdb_txn_abort( txn );
+			}
+		}
 		if ( rc )
 			rc = LDAP_OTHER;
 	}
@@ -407,6 +829,10 @@ mdb_cf_gen( ConfigArgs *c )
 			c->value_ulong = mdb->mi_mapsize;
 			break;
 
+		case MDB_ECACHE:
+			c->value_uint = mdb->mi_ecache_max;
+			break;
+
 		case MDB_MULTIVAL:
 			mdb_attr_multi_unparse( mdb, &c->rvalue_vals );
 			if ( !c->rvalue_vals ) rc = 1;
@@ -430,6 +856,10 @@ mdb_cf_gen( ConfigArgs *c )
 		case MDB_MAXSIZE:
 			break;
 
+		case MDB_ECACHE:
+			mdb_ecache_resize( mdb, 0 );
+			break;
+
 		case MDB_CHKPT:
 			if ( mdb->mi_txn_cp_task ) {
 				struct re_s *re = mdb->mi_txn_cp_task;
@@ -761,22 +1191,14 @@ mdb_cf_gen( ConfigArgs *c )
 		if ( mdb->mi_flags & MDB_IS_OPEN ) {
 			mdb->mi_flags |= MDB_OPEN_INDEX;
 			config_push_cleanup( c, mdb_cf_cleanup );
-			if ( !mdb->mi_index_task ) {
-				/* Start the task as soon as we finish here. Set a long
-				 * interval (10 hours) so that it only gets scheduled once.
-				 */
-				if ( c->be->be_suffix == NULL || BER_BVISNULL( &c->be->be_suffix[0] ) ) {
-					fprintf( stderr, "%s: "
-						"\"index\" must occur after \"suffix\".\n",
-						c->log );
-					return 1;
-				}
-				ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
-				mdb->mi_index_task = ldap_pvt_runqueue_insert( &slapd_rq, 36000,
-					mdb_online_index, c->be,
-					LDAP_XSTRING(mdb_online_index), c->be->be_suffix[0].bv_val );
-				ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+			if ( c->be->be_suffix == NULL || BER_BVISNULL( &c->be->be_suffix[0] ) ) {
+				fprintf( stderr, "%s: "
+					"\"index\" must occur after \"suffix\".\n",
+					c->log );
+				return 1;
 			}
+			/* a running build starts over to cover this one too */
+			mdb_online_index_start( c->be, 1 );
 		}
 		break;
 
@@ -812,6 +1234,10 @@ mdb_cf_gen( ConfigArgs *c )
 
 		if( rc != LDAP_SUCCESS ) return 1;
 		break;
+
+	case MDB_ECACHE:
+		mdb_ecache_resize( mdb, c->value_uint );
+		break;
 	}
 	return 0;
 }
@@ -207,6 +207,7 @@ mdb_dn2id_delete(
 	ID id,
 	ID nsubs )
 {
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	ID nid;
 	char *ptr;
 	int rc;
@@ -232,6 +233,12 @@ mdb_dn2id_delete(
 		rc = mdb_cursor_get( mc, &key, &data, MDB_SET );
 		if ( rc == 0 )
 			rc = mdb_cursor_del( mc, 0 );
+
+		/* Any children left under our ID are renamed along with us */
+		if ( rc == 0 && ( slapMode & SLAP_SERVER_MODE )) {
+			int subtree = mdb_cursor_get( mc, &key, &data, MDB_SET ) == 0;
+			mdb_dncache_del( mdb, mdb_cursor_txn( mc ), id, subtree );
+		}
 	}
 
 	/* Delete our subtree count from all superiors */
@@ -325,6 +332,16 @@ mdb_dn2id(
 		goto done;
 	}
 
+	/* The cache can't position mc or count the subtree */
+	if ( !mc && !nsubs &&
+		mdb_dncache_get( op, txn, in, id, matched ) == 0 ) {
+		if ( nmatched )
+			*nmatched = *in;
+		Debug( LDAP_DEBUG_TRACE, "<= mdb_dn2id: got id=0x%lx from cache\n",
+			*id );
+		return 0;
+	}
+
 	tmp = *in;
 
 	if ( op->o_bd->be_nsuffix[0].bv_len ) {
@@ -430,6 +447,8 @@ done:
 		Debug( LDAP_DEBUG_TRACE, "<= mdb_dn2id: get failed: %s (%d)\n",
 			mdb_strerror( rc ), rc );
 	} else {
+		if ( matched && matched->bv_val )
+			mdb_dncache_put( op, txn, in, matched, nid );
 		Debug( LDAP_DEBUG_TRACE, "<= mdb_dn2id: got id=0x%lx\n",
 			nid );
 	}
@@ -657,8 +676,8 @@ mdb_idscope(
 
 	ida = mdb_idl_first( ids, &cid );
 
-	/* Don't bother moving out of ids if it's a range */
-	if (!MDB_IDL_IS_RANGE(ids)) {
+	/* Don't bother moving out of ids if it's a range or a bitmap */
+	if (!MDB_IDL_IS_RANGE(ids) && !MDB_IDL_IS_BITS(ids)) {
 		idc = ids[0];
 		ci0 = cid;
 	}
@@ -701,7 +720,7 @@ mdb_idscope(
 		}
 		ida = mdb_idl_next( ids, &cid );
 	}
-	if (!MDB_IDL_IS_RANGE( ids ))
+	if (!MDB_IDL_IS_RANGE( ids ) && !MDB_IDL_IS_BITS( ids ))
 		ids[0] = idc;
 
 leave:
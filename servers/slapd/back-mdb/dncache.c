@@ -0,0 +1,330 @@
+/* dncache.c - shared cache of DN to ID lookups */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2021 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+#include "lutil.h"
+#include "lutil_hash.h"
+
+/*
+ * mdb_dn2id() walks the hierarchical dn2id DB one RDN at a time from
+ * the suffix, so a lookup costs one cursor search per level of the DN.
+ * This cache remembers the ID and the non-normalized DN of entries that
+ * were looked up by their normalized DN, for readers only.
+ *
+ * The cache is split in MDB_DNCACHE_SHARDS shards by a hash of the
+ * normalized DN, each with its own mutex, LRU list and share of the
+ * size limit, so that readers looking up different DNs rarely wait for
+ * each other. Nodes are allocated while a shard fills up; after that
+ * the least recently used node, or one dropped by a writer, is reused
+ * and only grown when a longer DN has to fit in it.
+ *
+ * Validation follows the entry cache: each node remembers the txnid of
+ * the snapshot it was found in and is only handed to readers whose
+ * snapshot is at least as new. mdb_dn2id_delete() drops the node of the
+ * entry it removes, and the whole cache if the entry still has children
+ * (a subtree rename), before the writer commits. Readers may only add a
+ * node if no writer has dropped anything from its shard since their
+ * snapshot was taken. Adding an entry needs no invalidation since only
+ * DNs that were found are cached.
+ */
+
+typedef struct mdb_dcnode {
+	struct berval	dn_ndn;
+	struct berval	dn_name;
+	ID		dn_id;
+	size_t	dn_txnid;		/* snapshot the DN was found in */
+	size_t	dn_size;		/* room for both DNs after the node */
+	LDAP_TAILQ_ENTRY(mdb_dcnode) dn_lru;
+} mdb_dcnode;
+
+/* Node memory is rounded up to this, so that most reuses fit */
+#define MDB_DCNODE_ROUND	64
+
+static int
+mdb_dcnode_ndn_cmp( const void *v1, const void *v2 )
+{
+	const mdb_dcnode *d1 = v1, *d2 = v2;
+
+	return ber_bvcmp( &d1->dn_ndn, &d2->dn_ndn );
+}
+
+static int
+mdb_dcnode_id_cmp( const void *v1, const void *v2 )
+{
+	const mdb_dcnode *d1 = v1, *d2 = v2;
+
+	if ( d1->dn_id < d2->dn_id )
+		return -1;
+	return d1->dn_id > d2->dn_id;
+}
+
+static mdb_dcshard *
+mdb_dncache_shard( mdb_dncache *dc, struct berval *ndn )
+{
+	lutil_HASH_CTX ctx;
+
+	lutil_HASHInit( &ctx );
+	lutil_HASHUpdate( &ctx, (unsigned char *)ndn->bv_val, ndn->bv_len );
+	return &dc->dc_shards[ ctx.hash % MDB_DNCACHE_SHARDS ];
+}
+
+/* Take a node out of the cache, it stays on the shard's
+ * free list. Caller must hold ds_mutex.
+ */
+static void
+mdb_dcnode_unlink( mdb_dcshard *ds, mdb_dcnode *dn )
+{
+	avl_delete( &ds->ds_byndn, dn, mdb_dcnode_ndn_cmp );
+	avl_delete( &ds->ds_byid, dn, mdb_dcnode_id_cmp );
+	LDAP_TAILQ_REMOVE( &ds->ds_lru, dn, dn_lru );
+	LDAP_TAILQ_INSERT_HEAD( &ds->ds_free, dn, dn_lru );
+	ds->ds_count--;
+}
+
+static int
+mdb_dncache_txn_ok( Operation *op, struct mdb_info *mdb, MDB_txn *txn )
+{
+	return mdb->mi_dncache_max && ( slapMode & SLAP_SERVER_MODE ) &&
+		mdb_txn_reader( op, mdb, txn );
+}
+
+void
+mdb_dncache_init( mdb_dncache *dc )
+{
+	mdb_dcshard *ds;
+	int i;
+
+	for ( i = 0; i < MDB_DNCACHE_SHARDS; i++ ) {
+		ds = &dc->dc_shards[i];
+		ldap_pvt_thread_mutex_init( &ds->ds_mutex );
+		ds->ds_byndn = NULL;
+		ds->ds_byid = NULL;
+		LDAP_TAILQ_INIT( &ds->ds_lru );
+		LDAP_TAILQ_INIT( &ds->ds_free );
+		ds->ds_count = 0;
+		ds->ds_wtxnid = 0;
+		ds->ds_hits = 0;
+		ds->ds_misses = 0;
+	}
+}
+
+void
+mdb_dncache_destroy( mdb_dncache *dc )
+{
+	mdb_dcshard *ds;
+	mdb_dcnode *dn;
+	int i;
+
+	for ( i = 0; i < MDB_DNCACHE_SHARDS; i++ ) {
+		ds = &dc->dc_shards[i];
+		avl_free( ds->ds_byid, NULL );
+		ds->ds_byid = NULL;
+		avl_free( ds->ds_byndn, NULL );
+		ds->ds_byndn = NULL;
+		while (( dn = LDAP_TAILQ_FIRST( &ds->ds_lru )) != NULL ) {
+			LDAP_TAILQ_REMOVE( &ds->ds_lru, dn, dn_lru );
+			ch_free( dn );
+		}
+		while (( dn = LDAP_TAILQ_FIRST( &ds->ds_free )) != NULL ) {
+			LDAP_TAILQ_REMOVE( &ds->ds_free, dn, dn_lru );
+			ch_free( dn );
+		}
+		ds->ds_count = 0;
+		ldap_pvt_thread_mutex_destroy( &ds->ds_mutex );
+	}
+}
+
+/* Sum the hit and miss counters of all shards */
+void
+mdb_dncache_stats( mdb_dncache *dc, unsigned long *hits,
+	unsigned long *misses )
+{
+	mdb_dcshard *ds;
+	int i;
+
+	*hits = 0;
+	*misses = 0;
+	for ( i = 0; i < MDB_DNCACHE_SHARDS; i++ ) {
+		ds = &dc->dc_shards[i];
+		ldap_pvt_thread_mutex_lock( &ds->ds_mutex );
+		*hits += ds->ds_hits;
+		*misses += ds->ds_misses;
+		ldap_pvt_thread_mutex_unlock( &ds->ds_mutex );
+	}
+}
+
+/* Look up ndn. If name is given, a copy of the entry's
+ * non-normalized DN is returned in op's memory context.
+ */
+int
+mdb_dncache_get( Operation *op, MDB_txn *txn, struct berval *ndn,
+	ID *id, struct berval *name )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_dcshard *ds;
+	mdb_dcnode *dn, key;
+	int rc = MDB_NOTFOUND;
+
+	if ( !mdb_dncache_txn_ok( op, mdb, txn ))
+		return rc;
+
+	ds = mdb_dncache_shard( &mdb->mi_dncache, ndn );
+	key.dn_ndn = *ndn;
+	ldap_pvt_thread_mutex_lock( &ds->ds_mutex );
+	dn = avl_find( ds->ds_byndn, &key, mdb_dcnode_ndn_cmp );
+	if ( dn && dn->dn_txnid <= mdb_txn_id( txn )) {
+		if ( dn != LDAP_TAILQ_FIRST( &ds->ds_lru )) {
+			LDAP_TAILQ_REMOVE( &ds->ds_lru, dn, dn_lru );
+			LDAP_TAILQ_INSERT_HEAD( &ds->ds_lru, dn, dn_lru );
+		}
+		*id = dn->dn_id;
+		if ( name )
+			ber_dupbv_x( name, &dn->dn_name, op->o_tmpmemctx );
+		ds->ds_hits++;
+		rc = 0;
+	} else {
+		ds->ds_misses++;
+	}
+	ldap_pvt_thread_mutex_unlock( &ds->ds_mutex );
+	return rc;
+}
+
+/* Remember a DN that was just found in txn */
+void
+mdb_dncache_put( Operation *op, MDB_txn *txn, struct berval *ndn,
+	struct berval *name, ID id )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_dcshard *ds;
+	mdb_dcnode *dn, key;
+	size_t txnid, size;
+	unsigned max;
+	char *ptr;
+
+	if ( !mdb_dncache_txn_ok( op, mdb, txn ))
+		return;
+
+	txnid = mdb_txn_id( txn );
+	size = ndn->bv_len + name->bv_len + 2;
+	max = ( mdb->mi_dncache_max + MDB_DNCACHE_SHARDS - 1 ) /
+		MDB_DNCACHE_SHARDS;
+	ds = mdb_dncache_shard( &mdb->mi_dncache, ndn );
+	key.dn_ndn = *ndn;
+
+	ldap_pvt_thread_mutex_lock( &ds->ds_mutex );
+	if ( txnid < ds->ds_wtxnid ||
+		avl_find( ds->ds_byndn, &key, mdb_dcnode_ndn_cmp )) {
+		ldap_pvt_thread_mutex_unlock( &ds->ds_mutex );
+		return;
+	}
+
+	/* Reuse a dropped node, or the least recently used one once
+	 * the shard is full
+	 */
+	if ( ds->ds_count >= max )
+		mdb_dcnode_unlink( ds, LDAP_TAILQ_LAST( &ds->ds_lru, ds_lruq ));
+	dn = LDAP_TAILQ_FIRST( &ds->ds_free );
+	if ( dn ) {
+		LDAP_TAILQ_REMOVE( &ds->ds_free, dn, dn_lru );
+		if ( dn->dn_size < size ) {
+			ch_free( dn );
+			dn = NULL;
+		}
+	}
+	if ( !dn ) {
+		size = ( size + MDB_DCNODE_ROUND - 1 ) & ~( MDB_DCNODE_ROUND - 1 );
+		dn = ch_malloc( sizeof(mdb_dcnode) + size );
+		dn->dn_size = size;
+	}
+
+	dn->dn_ndn.bv_val = (char *)(dn+1);
+	dn->dn_ndn.bv_len = ndn->bv_len;
+	ptr = lutil_strncopy( dn->dn_ndn.bv_val, ndn->bv_val, ndn->bv_len );
+	*ptr++ = '\0';
+	dn->dn_name.bv_val = ptr;
+	dn->dn_name.bv_len = name->bv_len;
+	ptr = lutil_strncopy( ptr, name->bv_val, name->bv_len );
+	*ptr = '\0';
+	dn->dn_id = id;
+	dn->dn_txnid = txnid;
+
+	avl_insert( &ds->ds_byndn, dn, mdb_dcnode_ndn_cmp, avl_dup_error );
+	if ( avl_insert( &ds->ds_byid, dn, mdb_dcnode_id_cmp, avl_dup_error )) {
+		avl_delete( &ds->ds_byndn, dn, mdb_dcnode_ndn_cmp );
+		LDAP_TAILQ_INSERT_HEAD( &ds->ds_free, dn, dn_lru );
+		ldap_pvt_thread_mutex_unlock( &ds->ds_mutex );
+		return;
+	}
+	LDAP_TAILQ_INSERT_HEAD( &ds->ds_lru, dn, dn_lru );
+	ds->ds_count++;
+
+	/* dncache was lowered, give back what's over the limit */
+	while ( ds->ds_count > max ) {
+		dn = LDAP_TAILQ_LAST( &ds->ds_lru, ds_lruq );
+		mdb_dcnode_unlink( ds, dn );
+		LDAP_TAILQ_REMOVE( &ds->ds_free, dn, dn_lru );
+		ch_free( dn );
+	}
+	ldap_pvt_thread_mutex_unlock( &ds->ds_mutex );
+}
+
+/* Called by writers before the DN of entry id goes away in txn.
+ * If the entry has children their DNs go away too, and we don't
+ * know them, so everything is dropped. Only the DN is hashed, so
+ * every shard is searched for the ID.
+ */
+void
+mdb_dncache_del( struct mdb_info *mdb, MDB_txn *txn, ID id, int subtree )
+{
+	mdb_dcshard *ds;
+	mdb_dcnode *dn, key;
+	size_t txnid;
+	int i;
+
+	if ( !( slapMode & SLAP_SERVER_MODE ))
+		return;
+
+	txnid = mdb_txn_id( txn );
+	key.dn_id = id;
+
+	for ( i = 0; i < MDB_DNCACHE_SHARDS; i++ ) {
+		ds = &mdb->mi_dncache.dc_shards[i];
+		ldap_pvt_thread_mutex_lock( &ds->ds_mutex );
+		if ( txnid > ds->ds_wtxnid )
+			ds->ds_wtxnid = txnid;
+		if ( subtree ) {
+			avl_free( ds->ds_byid, NULL );
+			ds->ds_byid = NULL;
+			avl_free( ds->ds_byndn, NULL );
+			ds->ds_byndn = NULL;
+			while (( dn = LDAP_TAILQ_FIRST( &ds->ds_lru )) != NULL ) {
+				LDAP_TAILQ_REMOVE( &ds->ds_lru, dn, dn_lru );
+				LDAP_TAILQ_INSERT_HEAD( &ds->ds_free, dn, dn_lru );
+			}
+			ds->ds_count = 0;
+		} else {
+			dn = avl_find( ds->ds_byid, &key, mdb_dcnode_id_cmp );
+			if ( dn )
+				mdb_dcnode_unlink( ds, dn );
+		}
+		ldap_pvt_thread_mutex_unlock( &ds->ds_mutex );
+	}
+}
@@ -0,0 +1,294 @@
+/* ecache.c - shared cache of decoded entries */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2021 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+
+/*
+ * mdb_entry_decode() builds a new Attribute and berval array every
+ * time an entry is read, with the values pointing into the map, so the
+ * result is only good until the read txn goes away. Entries that are
+ * read over and over (static groups, entries referenced by ACLs) are
+ * copied into this cache instead and shared read-only by all readers.
+ *
+ * An ID is only admitted the second time it is decoded while it is
+ * still remembered on the ghost list, so one large search does not
+ * flush everything else out of the cache.
+ *
+ * Each copy remembers the txnid of the snapshot it was decoded from and
+ * is only handed to readers whose snapshot is at least as new. Writers
+ * drop the node before they commit, and readers may only add a copy if
+ * no writer has touched any entry since their snapshot was taken, so a
+ * stale copy never gets in.
+ */
+
+typedef struct mdb_ecnode {
+	ID		en_id;
+	size_t	en_txnid;		/* snapshot the attrs were decoded from */
+	Attribute	*en_attrs;	/* NULL for a ghost */
+	slap_mask_t	en_ocflags;
+	int		en_refcnt;
+	int		en_dead;		/* no longer in the tree */
+	mdb_ecache	*en_cache;
+	LDAP_TAILQ_ENTRY(mdb_ecnode) en_lru;
+} mdb_ecnode;
+
+static int
+mdb_ecnode_cmp( const void *v1, const void *v2 )
+{
+	const mdb_ecnode *e1 = v1, *e2 = v2;
+
+	if ( e1->en_id < e2->en_id )
+		return -1;
+	return e1->en_id > e2->en_id;
+}
+
+static void
+mdb_ecnode_free( void *v )
+{
+	mdb_ecnode *en = v;
+
+	if ( en->en_attrs )
+		attrs_free( en->en_attrs );
+	ch_free( en );
+}
+
+/* Take a node out of the cache. Caller must hold ec_mutex. */
+static void
+mdb_ecnode_unlink( mdb_ecache *ec, mdb_ecnode *en )
+{
+	avl_delete( &ec->ec_tree, en, mdb_ecnode_cmp );
+	if ( en->en_attrs ) {
+		LDAP_TAILQ_REMOVE( &ec->ec_lru, en, en_lru );
+		ec->ec_count--;
+	} else {
+		LDAP_TAILQ_REMOVE( &ec->ec_ghosts, en, en_lru );
+		ec->ec_nghosts--;
+	}
+	if ( en->en_refcnt )
+		en->en_dead = 1;
+	else
+		mdb_ecnode_free( en );
+}
+
+static int
+mdb_ecache_txn_ok( Operation *op, struct mdb_info *mdb, MDB_txn *txn )
+{
+	return mdb->mi_ecache_max && ( slapMode & SLAP_SERVER_MODE ) &&
+		mdb_txn_reader( op, mdb, txn );
+}
+
+void
+mdb_ecache_init( mdb_ecache *ec )
+{
+	ldap_pvt_thread_mutex_init( &ec->ec_mutex );
+	ec->ec_tree = NULL;
+	LDAP_TAILQ_INIT( &ec->ec_lru );
+	LDAP_TAILQ_INIT( &ec->ec_ghosts );
+	ec->ec_count = 0;
+	ec->ec_nghosts = 0;
+	ec->ec_wtxnid = 0;
+	ec->ec_hits = 0;
+	ec->ec_misses = 0;
+}
+
+void
+mdb_ecache_destroy( mdb_ecache *ec )
+{
+	avl_free( ec->ec_tree, mdb_ecnode_free );
+	ec->ec_tree = NULL;
+	ldap_pvt_thread_mutex_destroy( &ec->ec_mutex );
+}
+
+/* Return a shared copy of entry <id> if the cache has one that
+ * is valid for txn. The Entry itself is private to the op, its
+ * attributes must not be modified.
+ */
+int
+mdb_ecache_get( Operation *op, MDB_txn *txn, ID id, Entry **e )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_ecache *ec = &mdb->mi_ecache;
+	mdb_ecnode *en, key;
+	Entry *x;
+
+	if ( !mdb_ecache_txn_ok( op, mdb, txn ))
+		return MDB_NOTFOUND;
+
+	key.en_id = id;
+	ldap_pvt_thread_mutex_lock( &ec->ec_mutex );
+	en = avl_find( ec->ec_tree, &key, mdb_ecnode_cmp );
+	if ( en && en->en_attrs && en->en_txnid <= mdb_txn_id( txn )) {
+		en->en_refcnt++;
+		LDAP_TAILQ_REMOVE( &ec->ec_lru, en, en_lru );
+		LDAP_TAILQ_INSERT_HEAD( &ec->ec_lru, en, en_lru );
+		ec->ec_hits++;
+	} else {
+		en = NULL;
+		ec->ec_misses++;
+	}
+	ldap_pvt_thread_mutex_unlock( &ec->ec_mutex );
+	if ( !en )
+		return MDB_NOTFOUND;
+
+	x = op->o_tmpcalloc( 1, sizeof(Entry), op->o_tmpmemctx );
+	x->e_id = id;
+	x->e_ocflags = en->en_ocflags;
+	x->e_attrs = en->en_attrs;
+	x->e_private = x;
+	/* e_bv is otherwise unused by back-mdb, mdb_entry_return()
+	 * uses it to find the node again.
+	 */
+	x->e_bv.bv_val = (char *)en;
+	*e = x;
+	return 0;
+}
+
+/* Offer a freshly decoded entry to the cache */
+void
+mdb_ecache_put( Operation *op, MDB_txn *txn, Entry *e )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_ecache *ec = &mdb->mi_ecache;
+	mdb_ecnode *en, key;
+	Attribute *attrs;
+	size_t txnid;
+
+	if ( !e->e_attrs || !mdb_ecache_txn_ok( op, mdb, txn ))
+		return;
+
+	txnid = mdb_txn_id( txn );
+	key.en_id = e->e_id;
+
+	ldap_pvt_thread_mutex_lock( &ec->ec_mutex );
+	if ( txnid < ec->ec_wtxnid ) {
+		ldap_pvt_thread_mutex_unlock( &ec->ec_mutex );
+		return;
+	}
+	en = avl_find( ec->ec_tree, &key, mdb_ecnode_cmp );
+	if ( !en ) {
+		/* first sighting, just remember the ID */
+		en = ch_calloc( 1, sizeof(mdb_ecnode) );
+		en->en_id = e->e_id;
+		en->en_cache = ec;
+		avl_insert( &ec->ec_tree, en, mdb_ecnode_cmp, avl_dup_error );
+		LDAP_TAILQ_INSERT_HEAD( &ec->ec_ghosts, en, en_lru );
+		ec->ec_nghosts++;
+		while ( ec->ec_nghosts > mdb->mi_ecache_max )
+			mdb_ecnode_unlink( ec,
+				LDAP_TAILQ_LAST( &ec->ec_ghosts, ec_ghostq ));
+		en = NULL;
+	}
+	ldap_pvt_thread_mutex_unlock( &ec->ec_mutex );
+	if ( !en || en->en_attrs )
+		return;
+
+	/* Seen before. Copy it without holding the lock, then check
+	 * that no writer got in while we were at it.
+	 */
+	attrs = attrs_dup( e->e_attrs );
+
+	ldap_pvt_thread_mutex_lock( &ec->ec_mutex );
+	en = avl_find( ec->ec_tree, &key, mdb_ecnode_cmp );
+	if ( en && !en->en_attrs && txnid >= ec->ec_wtxnid ) {
+		LDAP_TAILQ_REMOVE( &ec->ec_ghosts, en, en_lru );
+		ec->ec_nghosts--;
+		en->en_attrs = attrs;
+		en->en_txnid = txnid;
+		en->en_ocflags = e->e_ocflags;
+		LDAP_TAILQ_INSERT_HEAD( &ec->ec_lru, en, en_lru );
+		ec->ec_count++;
+		while ( ec->ec_count > mdb->mi_ecache_max )
+			mdb_ecnode_unlink( ec,
+				LDAP_TAILQ_LAST( &ec->ec_lru, ec_lruq ));
+		attrs = NULL;
+	}
+	ldap_pvt_thread_mutex_unlock( &ec->ec_mutex );
+	if ( attrs )
+		attrs_free( attrs );
+}
+
+/* Called by writers before the entry is changed in txn */
+void
+mdb_ecache_del( struct mdb_info *mdb, MDB_txn *txn, ID id )
+{
+	mdb_ecache *ec = &mdb->mi_ecache;
+	mdb_ecnode *en, key;
+	size_t txnid;
+
+	/* Enabling the cache through cn=config pauses the server, there
+	 * are no readers left that could put an entry older than our txn,
+	 * and mdb_ecache_resize() drops what we did not invalidate.
+	 */
+	if ( !mdb->mi_ecache_max || !( slapMode & SLAP_SERVER_MODE ))
+		return;
+
+	txnid = mdb_txn_id( txn );
+	key.en_id = id;
+
+	ldap_pvt_thread_mutex_lock( &ec->ec_mutex );
+	if ( txnid > ec->ec_wtxnid )
+		ec->ec_wtxnid = txnid;
+	en = avl_find( ec->ec_tree, &key, mdb_ecnode_cmp );
+	if ( en )
+		mdb_ecnode_unlink( ec, en );
+	ldap_pvt_thread_mutex_unlock( &ec->ec_mutex );
+}
+
+/* Set the size of the cache, with the server paused. Writers don't
+ * drop the entries they change while it is disabled, so anything it
+ * held then is stale: empty it whenever it is turned off or on, and
+ * trim it if it shrinks.
+ */
+void
+mdb_ecache_resize( struct mdb_info *mdb, unsigned max )
+{
+	mdb_ecache *ec = &mdb->mi_ecache;
+
+	ldap_pvt_thread_mutex_lock( &ec->ec_mutex );
+	if ( !max || !mdb->mi_ecache_max ) {
+		while ( !LDAP_TAILQ_EMPTY( &ec->ec_lru ))
+			mdb_ecnode_unlink( ec, LDAP_TAILQ_FIRST( &ec->ec_lru ));
+		while ( !LDAP_TAILQ_EMPTY( &ec->ec_ghosts ))
+			mdb_ecnode_unlink( ec, LDAP_TAILQ_FIRST( &ec->ec_ghosts ));
+	}
+	while ( ec->ec_count > max )
+		mdb_ecnode_unlink( ec, LDAP_TAILQ_LAST( &ec->ec_lru, ec_lruq ));
+	while ( ec->ec_nghosts > max )
+		mdb_ecnode_unlink( ec,
+			LDAP_TAILQ_LAST( &ec->ec_ghosts, ec_ghostq ));
+	mdb->mi_ecache_max = max;
+	ldap_pvt_thread_mutex_unlock( &ec->ec_mutex );
+}
+
+/* Drop the reference taken by mdb_ecache_get() */
+void
+mdb_ecache_release( Entry *e )
+{
+	mdb_ecnode *en = (mdb_ecnode *)e->e_bv.bv_val;
+	mdb_ecache *ec = en->en_cache;
+	int dead;
+
+	ldap_pvt_thread_mutex_lock( &ec->ec_mutex );
+	dead = !--en->en_refcnt && en->en_dead;
+	ldap_pvt_thread_mutex_unlock( &ec->ec_mutex );
+	if ( dead )
+		mdb_ecnode_free( en );
+}
@@ -37,6 +37,14 @@ static int equality_candidates(
 	AttributeAssertion *ava,
 	ID *ids,
 	ID *tmp );
+static int equality_keys_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	AttributeDescription *desc,
+	MDB_dbi dbi,
+	struct berval *keys,
+	ID *ids,
+	ID *tmp );
 static int inequality_candidates(
 	Operation *op,
 	MDB_txn *rtxn,
@@ -558,6 +566,291 @@ base:
 	return 0;
 }
 
+/* Estimates used to plan AND filters */
+#define EST_ALL		NOID		/* lookup cannot narrow the result */
+#define EST_UNKNOWN	(NOID-1)	/* no cheap estimate */
+
+/* Without a key to count, go by the average number of IDs per key
+ * of the index type in the idxstats. Range keys hold at least
+ * MDB_idl_db_size IDs.
+ */
+static ID
+idxstat_estimate(
+	Operation *op,
+	MDB_txn *rtxn,
+	AttributeDescription *desc,
+	int ftype,
+	int type )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_idxstat stats[MDB_IDXSTAT_TYPES];
+	MDB_dbi	dbi;
+	slap_mask_t mask;
+	struct berval prefix = {0, NULL};
+	AttrInfo *ai;
+	ID ids;
+
+	if ( mdb_index_param( op->o_bd, desc, ftype, &dbi, &mask, &prefix )
+		!= LDAP_SUCCESS )
+		return EST_ALL;
+	ai = mdb_index_mask( op->o_bd, desc, &prefix );
+	if ( !ai || mdb_idxstat_get( mdb, rtxn, ai->ai_desc, stats ) ||
+		!stats[type].is_keys )
+		return EST_UNKNOWN;
+
+	ids = stats[type].is_ids +
+		stats[type].is_ranges * (ID)MDB_idl_db_size;
+	ids /= stats[type].is_keys;
+	return ids ? ids : 1;
+}
+
+/* A clause of an AND filter, as planned by and_plan */
+typedef struct and_clause {
+	Filter *ac_filter;
+	ID ac_est;
+	struct berval *ac_keys;	/* equality index keys, if any */
+	MDB_dbi ac_dbi;
+} and_clause;
+
+/* Estimate the number of candidates a filter clause yields, by
+ * counting the IDs under its index keys without reading them.
+ * The equality keys that were counted are left in ac->ac_keys so
+ * that the lookup need not generate them again. Substring and approx
+ * clauses are estimated from the idxstats.
+ */
+static ID
+filter_estimate(
+	Operation *op,
+	MDB_txn *rtxn,
+	Filter *f,
+	and_clause *ac )
+{
+	AttributeDescription *desc;
+	MDB_dbi	dbi;
+	slap_mask_t mask;
+	struct berval prefix = {0, NULL};
+	struct berval *keys = NULL;
+	MatchingRule *mr;
+	ID est, count;
+	int i, rc;
+
+	if ( f->f_choice & SLAPD_FILTER_UNDEFINED )
+		return 0;
+
+	switch ( f->f_choice ) {
+	case SLAPD_FILTER_COMPUTED:
+		return f->f_result == LDAP_COMPARE_TRUE ? EST_ALL : 0;
+
+	case LDAP_FILTER_NOT:
+		/* no indexing to support NOT filters */
+		return EST_ALL;
+
+	case LDAP_FILTER_PRESENT:
+		desc = f->f_desc;
+		if ( desc == slap_schema.si_ad_objectClass )
+			return EST_ALL;
+		rc = mdb_index_param( op->o_bd, desc, LDAP_FILTER_PRESENT,
+			&dbi, &mask, &prefix );
+		if ( rc != LDAP_SUCCESS )
+			return EST_ALL;
+		if ( prefix.bv_val == NULL )
+			return EST_UNKNOWN;
+		rc = mdb_key_count( op->o_bd, rtxn, dbi, &prefix, &count );
+		return rc ? EST_UNKNOWN : count;
+
+	case LDAP_FILTER_EQUALITY:
+		desc = f->f_ava->aa_desc;
+		if ( desc == slap_schema.si_ad_entryDN )
+			return 1;
+#ifdef LDAP_COMP_MATCH
+		if ( is_aliased_attribute && is_aliased_attribute( desc ))
+			return EST_UNKNOWN;
+#endif
+		rc = mdb_index_param( op->o_bd, desc, LDAP_FILTER_EQUALITY,
+			&dbi, &mask, &prefix );
+		if ( rc != LDAP_SUCCESS )
+			return EST_ALL;
+		mr = desc->ad_type->sat_equality;
+		if ( !mr || !mr->smr_filter )
+			return EST_ALL;
+		rc = (mr->smr_filter)( LDAP_FILTER_EQUALITY, mask,
+			desc->ad_type->sat_syntax, mr, &prefix,
+			&f->f_ava->aa_value, &keys, op->o_tmpmemctx );
+		if ( rc != LDAP_SUCCESS || keys == NULL )
+			return EST_ALL;
+		if ( keys[0].bv_val == NULL ) {
+			ber_bvarray_free_x( keys, op->o_tmpmemctx );
+			return EST_ALL;
+		}
+
+		/* the keys are intersected, so the smallest one bounds it */
+		est = EST_UNKNOWN;
+		for ( i = 0; keys[i].bv_val != NULL; i++ ) {
+			rc = mdb_key_count( op->o_bd, rtxn, dbi, &keys[i], &count );
+			if ( rc == 0 && count < est ) {
+				est = count;
+				if ( est == 0 )
+					break;
+			}
+		}
+		ac->ac_keys = keys;
+		ac->ac_dbi = dbi;
+		return est;
+
+	case LDAP_FILTER_SUBSTRINGS:
+		return idxstat_estimate( op, rtxn, f->f_sub_desc,
+			LDAP_FILTER_SUBSTRINGS, MDB_IDXSTAT_SUBSTR );
+
+	case LDAP_FILTER_APPROX:
+		/* without an approx rule, the equality index is used */
+		return idxstat_estimate( op, rtxn, f->f_av_desc,
+			LDAP_FILTER_APPROX, f->f_av_desc->ad_type->sat_approx ?
+			MDB_IDXSTAT_APPROX : MDB_IDXSTAT_EQUALITY );
+
+	default:
+		return EST_UNKNOWN;
+	}
+}
+
+/* Order the clauses of an AND filter by their estimated number of
+ * candidates, smallest first, dropping the ones that cannot narrow
+ * the result. Clauses without an estimate keep their relative order
+ * at the end. Returns the number of clauses in plan.
+ */
+static int
+and_plan(
+	Operation *op,
+	MDB_txn *rtxn,
+	Filter *flist,
+	and_clause **planp,
+	int *skipped,
+	int *reordered )
+{
+	Filter *f;
+	and_clause *plan, ac;
+	int i, n = 0;
+
+	for ( f = flist; f != NULL; f = f->f_next )
+		n++;
+	plan = op->o_tmpalloc( n * sizeof(and_clause), op->o_tmpmemctx );
+
+	*skipped = 0;
+	*reordered = 0;
+	n = 0;
+	for ( f = flist; f != NULL; f = f->f_next ) {
+		/* ignore precomputed scopes */
+		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
+		     f->f_result == LDAP_SUCCESS ) {
+			continue;
+		}
+		ac.ac_filter = f;
+		ac.ac_keys = NULL;
+		ac.ac_est = filter_estimate( op, rtxn, f, &ac );
+		if ( ac.ac_est == EST_ALL ) {
+			(*skipped)++;
+			continue;
+		}
+		for ( i = n; i > 0 && plan[i-1].ac_est > ac.ac_est; i-- )
+			plan[i] = plan[i-1];
+		if ( i < n )
+			*reordered = 1;
+		plan[i] = ac;
+		n++;
+		/* nothing can match, don't bother with the rest */
+		if ( ac.ac_est == 0 )
+			break;
+	}
+
+	if ( LogTest( LDAP_DEBUG_FILTER )) {
+		struct berval bv;
+
+		for ( i = 0; i < n; i++ ) {
+			filter2bv_x( op, plan[i].ac_filter, &bv );
+			if ( plan[i].ac_est == EST_UNKNOWN ) {
+				Debug( LDAP_DEBUG_FILTER, "\tplan %d: %s est=?\n",
+					i, bv.bv_val );
+			} else {
+				Debug( LDAP_DEBUG_FILTER, "\tplan %d: %s est=%ld\n",
+					i, bv.bv_val, (long) plan[i].ac_est );
+			}
+			op->o_tmpfree( bv.bv_val, op->o_tmpmemctx );
+		}
+		if ( *skipped ) {
+			Debug( LDAP_DEBUG_FILTER, "\tplan: %d clause(s) skipped\n",
+				*skipped );
+		}
+	}
+
+	*planp = plan;
+	return n;
+}
+
+/* Thread exit or database destroy: keep the counts of a thread */
+static void
+mdb_plan_stats_free( void *key, void *data )
+{
+	mdb_plan_stats *ps = data, **prev;
+	struct mdb_info *mdb = ps->ps_mdb;
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_plan_mutex );
+	for ( prev = &mdb->mi_plan_stats.ps_next; *prev; prev = &(*prev)->ps_next ) {
+		if ( *prev == ps ) {
+			*prev = ps->ps_next;
+			break;
+		}
+	}
+	mdb->mi_plan_stats.ps_ands += ps->ps_ands;
+	mdb->mi_plan_stats.ps_reordered += ps->ps_reordered;
+	mdb->mi_plan_stats.ps_shortcuts += ps->ps_shortcuts;
+	mdb->mi_plan_stats.ps_skipped += ps->ps_skipped;
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_plan_mutex );
+	ch_free( ps );
+}
+
+/* Count a planned AND filter in the statistics of this thread, so
+ * that searches don't all contend for one lock. Only the first plan
+ * of a thread, or one without a thread context or a free key slot,
+ * takes mi_plan_mutex.
+ */
+static void
+mdb_plan_stats_count( Operation *op, int reordered, int shortcut,
+	int skipped )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_plan_stats *ps = NULL;
+	void *data = NULL;
+
+	if ( op->o_threadctx ) {
+		if ( !ldap_pvt_thread_pool_getkey( op->o_threadctx, mdb,
+			&data, NULL ) && data ) {
+			ps = data;
+		} else {
+			ps = ch_calloc( 1, sizeof( mdb_plan_stats ));
+			ps->ps_mdb = mdb;
+			if ( ldap_pvt_thread_pool_setkey( op->o_threadctx, mdb, ps,
+				mdb_plan_stats_free, NULL, NULL )) {
+				ch_free( ps );
+				ps = NULL;
+			} else {
+				ldap_pvt_thread_mutex_lock( &mdb->mi_plan_mutex );
+				ps->ps_next = mdb->mi_plan_stats.ps_next;
+				mdb->mi_plan_stats.ps_next = ps;
+				ldap_pvt_thread_mutex_unlock( &mdb->mi_plan_mutex );
+			}
+		}
+	}
+	if ( !ps ) {
+		ldap_pvt_thread_mutex_lock( &mdb->mi_plan_mutex );
+		ps = &mdb->mi_plan_stats;
+	}
+	ps->ps_ands++;
+	ps->ps_reordered += reordered;
+	ps->ps_shortcuts += shortcut;
+	ps->ps_skipped += skipped;
+	if ( ps == &mdb->mi_plan_stats )
+		ldap_pvt_thread_mutex_unlock( &mdb->mi_plan_mutex );
+}
+
 static int
 list_candidates(
 	Operation *op,
@@ -570,17 +863,39 @@ list_candidates(
 {
 	int rc = 0;
 	Filter	*f;
+	and_clause *plan = NULL;
+	int i, n = 0, first = 1, skipped = 0, reordered = 0, shortcut = 0;
 
 	Debug( LDAP_DEBUG_FILTER, "=> mdb_list_candidates 0x%x\n", ftype );
-	for ( f = flist; f != NULL; f = f->f_next ) {
+
+	if ( ftype == LDAP_FILTER_AND && flist && flist->f_next ) {
+		n = and_plan( op, rtxn, flist, &plan, &skipped, &reordered );
+		/* only clauses that could not narrow the result */
+		if ( n == 0 && skipped )
+			MDB_IDL_ALL( ids );
+	}
+
+	f = plan ? ( n ? plan[0].ac_filter : NULL ) : flist;
+	for ( i = 0; f != NULL;
+		f = plan ? ( ++i < n ? plan[i].ac_filter : NULL ) : f->f_next ) {
 		/* ignore precomputed scopes */
 		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
 		     f->f_result == LDAP_SUCCESS ) {
 			continue;
 		}
 		MDB_IDL_ZERO( save );
-		rc = mdb_filter_candidates( op, rtxn, f, save, tmp,
-			save+MDB_idl_um_size );
+		if ( plan && plan[i].ac_keys ) {
+			/* a key the estimate found empty, no need to look */
+			if ( plan[i].ac_est == 0 )
+				rc = 0;
+			else
+				rc = equality_keys_candidates( op, rtxn,
+					f->f_ava->aa_desc, plan[i].ac_dbi,
+					plan[i].ac_keys, save, tmp );
+		} else {
+			rc = mdb_filter_candidates( op, rtxn, f, save, tmp,
+				save+MDB_idl_um_size );
+		}
 
 		if ( rc != 0 ) {
 			if ( ftype == LDAP_FILTER_AND ) {
@@ -592,13 +907,22 @@ list_candidates(
 
 		
 		if ( ftype == LDAP_FILTER_AND ) {
-			if ( f == flist ) {
+			if ( first ) {
 				MDB_IDL_CPY( ids, save );
+				first = 0;
 			} else {
 				mdb_idl_intersection( ids, save );
 			}
 			if( MDB_IDL_IS_ZERO( ids ) )
 				break;
+			if ( i + 1 < n && !MDB_IDL_IS_RANGE( ids ) &&
+				ids[0] <= MDB_AND_SHORTCUT ) {
+				Debug( LDAP_DEBUG_FILTER,
+					"\tplan: stopping after %d of %d clauses\n",
+					i + 1, n );
+				shortcut = 1;
+				break;
+			}
 		} else {
 			if ( f == flist ) {
 				MDB_IDL_CPY( ids, save );
@@ -608,6 +932,15 @@ list_candidates(
 		}
 	}
 
+	if ( plan ) {
+		for ( i = 0; i < n; i++ ) {
+			if ( plan[i].ac_keys )
+				ber_bvarray_free_x( plan[i].ac_keys, op->o_tmpmemctx );
+		}
+		op->o_tmpfree( plan, op->o_tmpmemctx );
+		mdb_plan_stats_count( op, reordered, shortcut, skipped );
+	}
+
 	if( rc == LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_FILTER,
 			"<= mdb_list_candidates: id=%ld first=%ld last=%ld\n",
@@ -703,7 +1036,6 @@ equality_candidates(
 	ID *tmp )
 {
 	MDB_dbi	dbi;
-	int i;
 	int rc;
 	slap_mask_t mask;
 	struct berval prefix = {0, NULL};
@@ -781,6 +1113,28 @@ equality_candidates(
 		return 0;
 	}
 
+	rc = equality_keys_candidates( op, rtxn, ava->aa_desc, dbi, keys,
+		ids, tmp );
+
+	ber_bvarray_free_x( keys, op->o_tmpmemctx );
+
+	return( rc );
+}
+
+/* Intersect the IDs under the equality index keys of desc */
+static int
+equality_keys_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	AttributeDescription *desc,
+	MDB_dbi dbi,
+	struct berval *keys,
+	ID *ids,
+	ID *tmp )
+{
+	int i;
+	int rc = 0;
+
 	for ( i= 0; keys[i].bv_val != NULL; i++ ) {
 		rc = mdb_key_read( op->o_bd, rtxn, dbi, &keys[i], tmp, NULL, 0 );
 
@@ -792,14 +1146,14 @@ equality_candidates(
 			Debug( LDAP_DEBUG_TRACE,
 				"<= mdb_equality_candidates: (%s) "
 				"key read failed (%d)\n",
-				ava->aa_desc->ad_cname.bv_val, rc );
+				desc->ad_cname.bv_val, rc );
 			break;
 		}
 
 		if( MDB_IDL_IS_ZERO( tmp ) ) {
 			Debug( LDAP_DEBUG_TRACE,
 				"<= mdb_equality_candidates: (%s) NULL\n", 
-				ava->aa_desc->ad_cname.bv_val );
+				desc->ad_cname.bv_val );
 			MDB_IDL_ZERO( ids );
 			break;
 		}
@@ -814,8 +1168,6 @@ equality_candidates(
 			break;
 	}
 
-	ber_bvarray_free_x( keys, op->o_tmpmemctx );
-
 	Debug( LDAP_DEBUG_TRACE,
 		"<= mdb_equality_candidates: id=%ld, first=%ld, last=%ld\n",
 		(long) ids[0],
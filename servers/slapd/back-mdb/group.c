@@ -0,0 +1,230 @@
+/* group.c - write operations sharing one txn and commit */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2021 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+
+#include "back-mdb.h"
+
+/*
+ * Every write operation normally runs in a txn of its own, and unless
+ * dbnosync is set each commit waits for the disk, so the writers queued
+ * behind the LMDB writer lock are bounded by the sync latency.
+ *
+ * With groupcommit set, the first writer to come along becomes the
+ * leader of a group: it begins a txn, and every member of the group,
+ * the leader included, makes its changes in a txn nested in that one,
+ * one member at a time. A member whose operation fails aborts its own
+ * nested txn and leaves the others' changes alone. Members that
+ * committed their nested txn wait for the leader, which commits the
+ * group's txn once its own operation is done and nobody else is waiting
+ * to join, or the group is full. The outcome of that commit becomes the
+ * result of every such member, so that no operation is reported to its
+ * client before its changes are durable.
+ *
+ * The leader's thread holds the LMDB writer lock from the start of the
+ * group to its commit, so only the leader may commit or abort the
+ * group's txn. LMDB does not nest txns in a writable map, so writemap
+ * disables grouping.
+ *
+ * Each member begins, uses and ends its nested txn on its own thread.
+ * That relies on LMDB internals rather than on its documented API:
+ * only a top-level write txn takes the writer mutex, so a child txn is
+ * not tied to the thread that began it; but the child and its parent
+ * share the env's dirty page state (me_dpages, the parent's dirty and
+ * spill lists) without any locking of their own. So exactly one thread
+ * at a time may touch the group's txn family. wg_busy is what ensures
+ * that, and wg_mutex orders one member's changes before the next
+ * member's nested txn begins. Anything that lets a member run without
+ * holding wg_busy, or that touches wg_txn outside it, breaks this.
+ */
+
+void
+mdb_wgroup_init( mdb_wgroup *wg )
+{
+	ldap_pvt_thread_mutex_init( &wg->wg_mutex );
+	ldap_pvt_thread_cond_init( &wg->wg_cond );
+}
+
+void
+mdb_wgroup_destroy( mdb_wgroup *wg )
+{
+	ldap_pvt_thread_cond_destroy( &wg->wg_cond );
+	ldap_pvt_thread_mutex_destroy( &wg->wg_mutex );
+}
+
+/* Join the current group, or start one, and begin a nested txn in it
+ * for this op.
+ */
+int
+mdb_wgroup_begin( Operation *op, struct mdb_info *mdb, mdb_op_info *moi )
+{
+	mdb_wgroup *wg = &mdb->mi_wgroup;
+	MDB_txn *txn;
+	int rc;
+
+	ldap_pvt_thread_mutex_lock( &wg->wg_mutex );
+	for (;;) {
+		if ( wg->wg_state == MDB_WG_IDLE ) {
+			wg->wg_state = MDB_WG_STARTING;
+			ldap_pvt_thread_mutex_unlock( &wg->wg_mutex );
+			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+			ldap_pvt_thread_mutex_lock( &wg->wg_mutex );
+			if ( rc ) {
+				wg->wg_state = MDB_WG_IDLE;
+				ldap_pvt_thread_cond_broadcast( &wg->wg_cond );
+				ldap_pvt_thread_mutex_unlock( &wg->wg_mutex );
+				Debug( LDAP_DEBUG_ANY, "mdb_wgroup_begin: err %s(%d)\n",
+					mdb_strerror(rc), rc );
+				return rc;
+			}
+			wg->wg_txn = txn;
+			wg->wg_nops = 0;
+			wg->wg_numads = mdb->mi_numads;
+			wg->wg_state = MDB_WG_OPEN;
+			ldap_pvt_thread_cond_broadcast( &wg->wg_cond );
+			moi->moi_flag |= MOI_LEADER;
+			break;
+		}
+		if ( wg->wg_state == MDB_WG_OPEN && !wg->wg_busy &&
+			wg->wg_nops < mdb->mi_group_max )
+			break;
+		wg->wg_waiting++;
+		ldap_pvt_thread_cond_wait( &wg->wg_cond, &wg->wg_mutex );
+		wg->wg_waiting--;
+	}
+	/* Cleared in mdb_wgroup_end once our nested txn is gone; no other
+	 * thread may use the group's txns until then.
+	 */
+	wg->wg_busy = 1;
+	wg->wg_nops++;
+	moi->moi_flag |= MOI_GROUP;
+	ldap_pvt_thread_mutex_unlock( &wg->wg_mutex );
+
+	rc = mdb_txn_begin( mdb->mi_dbenv, wg->wg_txn, 0, &moi->moi_txn );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "mdb_wgroup_begin: nested txn err %s(%d)\n",
+			mdb_strerror(rc), rc );
+		moi->moi_txn = NULL;
+		mdb_wtxn_abort( mdb, moi );
+		moi->moi_flag &= ~(MOI_GROUP|MOI_LEADER);
+	}
+	return rc;
+}
+
+/* Called by the leader with wg_mutex held once its own nested txn is
+ * over: let the writers that are waiting join, then commit the group
+ * and hand the result to its members.
+ */
+static void
+mdb_wgroup_commit( struct mdb_info *mdb )
+{
+	mdb_wgroup *wg = &mdb->mi_wgroup;
+	mdb_op_info *m;
+	MDB_txn *txn;
+	unsigned long n = 0;
+	int rc = 0;
+
+	while ( wg->wg_busy ||
+		( wg->wg_waiting && wg->wg_nops < mdb->mi_group_max ))
+		ldap_pvt_thread_cond_wait( &wg->wg_cond, &wg->wg_mutex );
+
+	wg->wg_state = MDB_WG_CLOSED;
+	txn = wg->wg_txn;
+	ldap_pvt_thread_mutex_unlock( &wg->wg_mutex );
+
+	/* Nothing to write if every member failed */
+	if ( wg->wg_done )
+		rc = mdb_txn_commit( txn );
+	else
+		mdb_txn_abort( txn );
+
+	ldap_pvt_thread_mutex_lock( &wg->wg_mutex );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "mdb_wgroup_commit: err %s(%d)\n",
+			mdb_strerror(rc), rc );
+		mdb_ad_unwind( mdb, wg->wg_numads );
+	}
+	for ( m = wg->wg_done; m; m = m->moi_gnext ) {
+		m->moi_grc = rc;
+		m->moi_gdone = 1;
+		n++;
+	}
+	if ( n && !rc ) {
+		wg->wg_groups++;
+		wg->wg_ops += n;
+	}
+	wg->wg_done = NULL;
+	wg->wg_txn = NULL;
+	wg->wg_state = MDB_WG_IDLE;
+	ldap_pvt_thread_cond_broadcast( &wg->wg_cond );
+}
+
+/* End a member's nested txn. Members that committed theirs wait for
+ * the group's commit, whose result is theirs.
+ */
+static int
+mdb_wgroup_end( struct mdb_info *mdb, mdb_op_info *moi, int commit )
+{
+	mdb_wgroup *wg = &mdb->mi_wgroup;
+	int rc = 0;
+
+	if ( commit ) {
+		rc = mdb_txn_commit( moi->moi_txn );
+	} else if ( moi->moi_txn ) {
+		mdb_txn_abort( moi->moi_txn );
+	}
+	moi->moi_txn = NULL;
+
+	ldap_pvt_thread_mutex_lock( &wg->wg_mutex );
+	wg->wg_busy = 0;
+	if ( commit && !rc ) {
+		moi->moi_gdone = 0;
+		moi->moi_gnext = wg->wg_done;
+		wg->wg_done = moi;
+	}
+	ldap_pvt_thread_cond_broadcast( &wg->wg_cond );
+	if ( moi->moi_flag & MOI_LEADER ) {
+		mdb_wgroup_commit( mdb );
+	} else if ( commit && !rc ) {
+		while ( !moi->moi_gdone )
+			ldap_pvt_thread_cond_wait( &wg->wg_cond, &wg->wg_mutex );
+	}
+	if ( commit && !rc )
+		rc = moi->moi_grc;
+	ldap_pvt_thread_mutex_unlock( &wg->wg_mutex );
+
+	return rc;
+}
+
+/* Commit the write txn of an op that began it */
+int
+mdb_wtxn_commit( struct mdb_info *mdb, mdb_op_info *moi )
+{
+	if ( moi->moi_flag & MOI_GROUP )
+		return mdb_wgroup_end( mdb, moi, 1 );
+	return mdb_txn_commit( moi->moi_txn );
+}
+
+void
+mdb_wtxn_abort( struct mdb_info *mdb, mdb_op_info *moi )
+{
+	if ( moi->moi_flag & MOI_GROUP )
+		mdb_wgroup_end( mdb, moi, 0 );
+	else
+		mdb_txn_abort( moi->moi_txn );
+}
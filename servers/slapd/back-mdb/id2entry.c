@@ -32,7 +32,7 @@ typedef struct Ecount {
 } Ecount;
 
 static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
-	Ecount *eh);
+	Ecount *eh, int flat);
 static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data,
 	Ecount *ec);
 static Entry *mdb_entry_alloc( Operation *op, int nattrs, int nvals );
@@ -274,12 +274,14 @@ static int mdb_id2entry_put(
 	MDB_val key, data;
 	int rc, adding = flag, prev_ads = mdb->mi_numads;
 
+	mdb_ecache_del( mdb, txn, e->e_id );
+
 	/* We only store rdns, and they go in the dn2id database. */
 
 	key.mv_data = &e->e_id;
 	key.mv_size = sizeof(ID);
 
-	rc = mdb_entry_partsize( mdb, txn, e, &ec );
+	rc = mdb_entry_partsize( mdb, txn, e, &ec, 0 );
 	if (rc) {
 		rc = LDAP_OTHER;
 		goto fail;
@@ -331,6 +333,24 @@ again:
 				goto fail;
 			}
 		}
+		rc = mdb_cover_put( op, txn, e );
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				"mdb_id2entry_put: mdb_cover_put failed: %s(%d) \"%s\"\n",
+				mdb_strerror(rc), rc,
+				e->e_nname.bv_val );
+			rc = LDAP_OTHER;
+			goto fail;
+		}
+		rc = mdb_order_put( op, txn, e );
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				"mdb_id2entry_put: mdb_order_put failed: %s(%d) \"%s\"\n",
+				mdb_strerror(rc), rc,
+				e->e_nname.bv_val );
+			rc = LDAP_OTHER;
+			goto fail;
+		}
 	}
 	if (rc) {
 		/* Was there a hole from slapadd? */
@@ -373,6 +393,67 @@ int mdb_id2entry_update(
 	return mdb_id2entry_put(op, txn, mc, e, 0);
 }
 
+/* Keep the covered attributes of an entry in the cover DB, so that
+ * searches that need nothing else don't have to read and decode the
+ * whole entry. The record is an entry with just those attributes,
+ * all of their values stored inline. With nothing covered the
+ * record is dropped rather than left to go stale.
+ */
+int mdb_cover_put(
+	Operation *op,
+	MDB_txn *txn,
+	Entry *e )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	Entry ce;
+	Attribute *a, *ca, **cap;
+	Ecount ec;
+	MDB_val key, data;
+	int i, n, rc;
+
+	if ( !mdb->mi_cover )
+		return 0;
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		if (( mdb->mi_attrs[i]->ai_indexmask |
+			mdb->mi_attrs[i]->ai_newmask ) & MDB_INDEX_COVER )
+			break;
+	}
+	if ( i == mdb->mi_nattrs ) {
+		key.mv_data = &e->e_id;
+		key.mv_size = sizeof(ID);
+		rc = mdb_del( txn, mdb->mi_cover, &key, NULL );
+		return rc == MDB_NOTFOUND ? 0 : rc;
+	}
+
+	for ( n = 0, a = e->e_attrs; a; a = a->a_next )
+		n++;
+	ca = op->o_tmpalloc( n * sizeof(Attribute), op->o_tmpmemctx );
+
+	ce = *e;
+	cap = &ce.e_attrs;
+	for ( n = 0, a = e->e_attrs; a; a = a->a_next ) {
+		if ( !mdb_attr_cover( mdb, a->a_desc, 1 ))
+			continue;
+		ca[n] = *a;
+		ca[n].a_flags &= ~SLAP_ATTR_BIG_MULTI;
+		*cap = &ca[n++];
+		cap = &(*cap)->a_next;
+	}
+	*cap = NULL;
+
+	rc = mdb_entry_partsize( mdb, txn, &ce, &ec, 1 );
+	if ( rc == 0 ) {
+		key.mv_data = &e->e_id;
+		key.mv_size = sizeof(ID);
+		data.mv_size = ec.dlen;
+		rc = mdb_put( txn, mdb->mi_cover, &key, &data, MDB_RESERVE );
+		if ( rc == 0 )
+			rc = mdb_entry_encode( op, &ce, &data, &ec );
+	}
+	op->o_tmpfree( ca, op->o_tmpmemctx );
+	return rc;
+}
+
 int mdb_id2edata(
 	Operation *op,
 	MDB_cursor *mc,
@@ -404,6 +485,9 @@ int mdb_id2entry(
 
 	*e = NULL;
 
+	if ( mdb_ecache_get( op, mdb_cursor_txn( mc ), id, e ) == 0 )
+		return MDB_SUCCESS;
+
 	key.mv_data = &id;
 	key.mv_size = sizeof(ID);
 
@@ -446,13 +530,15 @@ int mdb_id2entry(
 		rc = MDB_NOTFOUND;
 	if ( rc ) return rc;
 
-	rc = mdb_entry_decode( op, mdb_cursor_txn( mc ), &data, id, e );
+	rc = mdb_entry_decode( op, mdb_cursor_txn( mc ), &data, id, e, NULL );
 	if ( rc ) return rc;
 
 	(*e)->e_id = id;
 	(*e)->e_name.bv_val = NULL;
 	(*e)->e_nname.bv_val = NULL;
 
+	mdb_ecache_put( op, mdb_cursor_txn( mc ), *e );
+
 	return rc;
 }
 
@@ -470,8 +556,18 @@ int mdb_id2entry_delete(
 	key.mv_data = &e->e_id;
 	key.mv_size = sizeof(ID);
 
+	mdb_ecache_del( mdb, tid, e->e_id );
+
 	/* delete from database */
 	rc = mdb_del( tid, dbi, &key, NULL );
+	if (rc)
+		return rc;
+	if ( mdb->mi_cover ) {
+		rc = mdb_del( tid, mdb->mi_cover, &key, NULL );
+		if (rc && rc != MDB_NOTFOUND)
+			return rc;
+	}
+	rc = mdb_order_del( mdb, tid, e->e_id );
 	if (rc)
 		return rc;
 	rc = mdb_cursor_open( tid, mdb->mi_dbis[MDB_ID2VAL], &mvc );
@@ -526,6 +622,9 @@ int mdb_entry_return(
 	if ( !e )
 		return 0;
 	if ( e->e_private ) {
+		/* attrs shared with the entry cache */
+		if ( e->e_bv.bv_val )
+			mdb_ecache_release( e );
 		if ( op->o_hdr && op->o_tmpmfuncs ) {
 			op->o_tmpfree( e->e_nname.bv_val, op->o_tmpmemctx );
 			op->o_tmpfree( e->e_name.bv_val, op->o_tmpmemctx );
@@ -734,6 +833,27 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 		if ( moi->moi_flag & MOI_READER ) {
 			moi = *moip;
 			LDAP_SLIST_INSERT_HEAD( &op->o_extra, &moi->moi_oe, oe_next );
+		} else if ( ( moi->moi_flag & (MOI_KEEPER|MOI_NESTED)) && moi->moi_txn &&
+			*moip && *moip != moi ) {
+		/* This op is one of a batch kept in one txn. Give it a nested
+		 * txn of its own, so that if it fails only its own writes are
+		 * undone. The op commits it like one it began itself.
+		 */
+			mdb_op_info *parent = moi;
+
+			moi = *moip;
+			rc = mdb_txn_begin( mdb->mi_dbenv, parent->moi_txn, 0, &moi->moi_txn );
+			if (rc) {
+				Debug( LDAP_DEBUG_ANY, "mdb_opinfo_get: err %s(%d)\n",
+					mdb_strerror(rc), rc );
+				moi->moi_txn = NULL;
+				return rc;
+			}
+			moi->moi_flag |= MOI_NESTED;
+			moi->moi_ref = 1;
+			moi->moi_oe.oe_key = mdb;
+			LDAP_SLIST_INSERT_HEAD( &op->o_extra, &moi->moi_oe, oe_next );
+			return 0;
 		} else {
 		/* This op is continuing an existing write txn */
 			*moip = moi;
@@ -748,6 +868,11 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 				if ( get_lazyCommit( op ))
 					flag |= MDB_NOMETASYNC;
 #endif
+				/* Ops that commit their own txn may share it with others */
+				if ( mdb->mi_group_max && !flag &&
+					!( moi->moi_flag & (MOI_FREEIT|MOI_KEEPER)) &&
+					!( mdb->mi_dbenv_flags & MDB_WRITEMAP ))
+					return mdb_wgroup_begin( op, mdb, moi );
 				rc = mdb_txn_begin( mdb->mi_dbenv, NULL, flag, &moi->moi_txn );
 				if (rc) {
 					Debug( LDAP_DEBUG_ANY, "mdb_opinfo_get: err %s(%d)\n",
@@ -811,6 +936,23 @@ ok:
 	return 0;
 }
 
+/* Only plain readers may use the shared caches; a write txn can
+ * see its own uncommitted changes.
+ */
+int
+mdb_txn_reader( Operation *op, struct mdb_info *mdb, MDB_txn *txn )
+{
+	OpExtra *oex;
+
+	LDAP_SLIST_FOREACH( oex, &op->o_extra, oe_next ) {
+		if ( oex->oe_key == mdb ) {
+			mdb_op_info *moi = (mdb_op_info *)oex;
+			return moi->moi_txn == txn && ( moi->moi_flag & MOI_READER );
+		}
+	}
+	return 0;
+}
+
 int mdb_txn( Operation *op, int txnop, OpExtra **ptr )
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
@@ -819,6 +961,9 @@ int mdb_txn( Operation *op, int txnop, OpExtra **ptr )
 
 	switch( txnop ) {
 	case SLAP_TXN_BEGIN:
+		/* Ops in the txn each need a nested txn, see mdb_opinfo_get */
+		if ( mdb->mi_dbenv_flags & MDB_WRITEMAP )
+			return LDAP_UNWILLING_TO_PERFORM;
 		rc = mdb_opinfo_get( op, mdb, 0, moip );
 		if ( !rc ) {
 			moi = *moip;
@@ -842,7 +987,7 @@ int mdb_txn( Operation *op, int txnop, OpExtra **ptr )
 
 /* Count up the sizes of the components of an entry */
 static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
-	Ecount *eh)
+	Ecount *eh, int flat)
 {
 	ber_len_t len, dlen;
 	int i, nat = 0, nval = 0, nnval = 0, doff = 0;
@@ -867,9 +1012,11 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
 		len += 2*sizeof(int);	/* AD index, numvals */
 		dlen += 2*sizeof(int);
 		nval += a->a_numvals + 1;	/* empty berval at end */
-		mdb_attr_multi_thresh( mdb, a->a_desc, &hi, NULL );
-		if (a->a_numvals > hi)
-			a->a_flags |= SLAP_ATTR_BIG_MULTI;
+		if (!flat) {
+			mdb_attr_multi_thresh( mdb, a->a_desc, &hi, NULL );
+			if (a->a_numvals > hi)
+				a->a_flags |= SLAP_ATTR_BIG_MULTI;
+		}
 		if (a->a_flags & SLAP_ATTR_BIG_MULTI)
 			doff += a->a_numvals;
 		for (i=0; i<a->a_numvals; i++) {
@@ -1002,14 +1149,40 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
 	return 0;
 }
 
+/* Does the search described by mp need attribute <ad>, whose
+ * index is <i>? The verdict is remembered for the next entry.
+ */
+static int mdb_proj_want(mdb_proj *mp, int i, AttributeDescription *ad)
+{
+	int j, want;
+
+	if (i < mp->mp_nwant && mp->mp_want[i])
+		return mp->mp_want[i] > 0;
+
+	want = is_at_operational(ad->ad_type) ? mp->mp_oper : mp->mp_user;
+	if (!want)
+		want = ad_inlist(ad, mp->mp_attrs);
+	for (j=0; !want && j<mp->mp_nads; j++)
+		want = is_ad_subtype(ad, mp->mp_ads[j]);
+
+	if (i < mp->mp_nwant)
+		mp->mp_want[i] = want ? 1 : -1;
+	return want;
+}
+
 /* Retrieve an Entry that was stored using entry_encode above.
+ * If mp is set, only the attributes it asks for are returned;
+ * the rest, including any values stored in id2val, are skipped.
+ * txn may be NULL if the caller only has the mapped data; if the
+ * entry can't be decoded without the DB, MDB_BAD_TXN is returned.
  *
  * Note: everything is stored in a single contiguous block, so
  * you can not free individual attributes or names from this
  * structure. Attempting to do so will likely corrupt memory.
  */
 
-int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e)
+int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e,
+	mdb_proj *mp)
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	int i, j, nattrs, nvals;
@@ -1051,6 +1224,8 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 			multi = 1;
 		}
 		if (i > mdb->mi_numads) {
+			if (!txn)
+				goto notxn;
 			rc = mdb_ad_read(mdb, txn);
 			if (rc)
 				goto leave;
@@ -1068,8 +1243,18 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 			a->a_numvals ^= MDB_AT_NVALS;
 			have_nval = 1;
 		}
+		if (mp && !mdb_proj_want(mp, i, a->a_desc)) {
+			/* not needed, step over its values */
+			if (!multi) {
+				for (j = have_nval ? 2*a->a_numvals : a->a_numvals; j>0; j--)
+					ptr += *lp++ + 1;
+			}
+			continue;
+		}
 		a->a_vals = bptr;
 		if (multi) {
+			if (!txn)
+				goto notxn;
 			if (!mvc) {
 				rc = mdb_cursor_open(txn, mdb->mi_dbis[MDB_ID2VAL], &mvc);
 				if (rc)
@@ -1124,7 +1309,10 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 		a->a_next = a+1;
 		a = a->a_next;
 	}
-	a[-1].a_next = NULL;
+	if (a == x->e_attrs)
+		x->e_attrs = NULL;
+	else
+		a[-1].a_next = NULL;
 done:
 	Debug(LDAP_DEBUG_TRACE, "<= mdb_entry_decode\n" );
 	*e = x;
@@ -1134,4 +1322,8 @@ leave:
 	if (mvc)
 		mdb_cursor_close(mvc);
 	return rc;
+
+notxn:
+	op->o_tmpfree(x, op->o_tmpmemctx);
+	return MDB_BAD_TXN;
 }
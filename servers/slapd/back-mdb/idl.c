@@ -37,6 +37,13 @@ static void idl_check( ID *ids )
 {
 	if( MDB_IDL_IS_RANGE( ids ) ) {
 		assert( MDB_IDL_RANGE_FIRST(ids) <= MDB_IDL_RANGE_LAST(ids) );
+#ifdef MDB_IDL_BITS
+	} else if( MDB_IDL_IS_BITS( ids ) ) {
+		ID i;
+		for( i=3; i < ids[1]+2; i++ ) {
+			assert( MDB_BITS_BLOCKOF( ids[i+1] ) > MDB_BITS_BLOCKOF( ids[i] ) );
+		}
+#endif
 	} else {
 		ID i;
 		for( i=1; i < ids[0]; i++ ) {
@@ -260,6 +267,839 @@ static int mdb_idl_delete( ID *ids, ID id )
 	return 0;
 }
 
+typedef unsigned long idl_word;
+
+#define IDL_WBITS	(sizeof(idl_word) * CHAR_BIT)
+
+#if defined(__GNUC__) && !defined(IDL_BM_NO_BUILTINS)
+#define IDL_CTZ(w)	__builtin_ctzl(w)
+#define IDL_CLZ(w)	__builtin_clzl(w)
+#define IDL_POPCOUNT(w)	__builtin_popcountl(w)
+#else
+static int IDL_CTZ( idl_word w )
+{
+	int n = 0;
+	while ( !( w & 1 )) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+}
+static int IDL_CLZ( idl_word w )
+{
+	int n = 0;
+	while ( !( w & ((idl_word)1 << (IDL_WBITS-1)) )) {
+		w <<= 1;
+		n++;
+	}
+	return n;
+}
+static int IDL_POPCOUNT( idl_word w )
+{
+	int n = 0;
+	for ( ; w; w &= w - 1 )
+		n++;
+	return n;
+}
+#endif
+
+#ifdef MDB_IDL_BITS
+/* Bitmap IDLs, see idl.h for the format.
+ *
+ * Keys that outgrow MDB_idl_db_max are converted to a bitmap, which
+ * is updated in place a word at a time afterwards. When such a key is
+ * fetched it becomes a list again if it is short enough, else an
+ * in-memory bitmap, and only if that doesn't fit in an IDL a range.
+ * Intersections and unions involving a bitmap are done on the words,
+ * with the lists and ranges converted to bitmaps first.
+ *
+ * The cursor ops that return the key are given a scratch MDB_val, the
+ * key they return points into a page that the next write may move.
+ */
+#define BITS_BLOCK(id)	((id) / MDB_BITS_BLOCK)
+#define BITS_BIT(id)	((ID)1 << ((id) % MDB_BITS_BLOCK))
+
+/* Lowest member of word w */
+static ID
+idl_bits_lo( ID w )
+{
+	ID base = MDB_BITS_BLOCKOF( w ) * MDB_BITS_BLOCK;
+
+	if ( MDB_BITS_IS_RUN( w ))
+		return base;
+	return base + IDL_CTZ( MDB_BITS_VAL( w ));
+}
+
+/* Highest member of word w */
+static ID
+idl_bits_hi( ID w )
+{
+	ID base = MDB_BITS_BLOCKOF( w ) * MDB_BITS_BLOCK;
+
+	if ( MDB_BITS_IS_RUN( w ))
+		return base + MDB_BITS_VAL( w ) * MDB_BITS_BLOCK - 1;
+	return base + IDL_WBITS - 1 - IDL_CLZ( MDB_BITS_VAL( w ));
+}
+
+ID
+mdb_idl_bits_first( ID *ids )
+{
+	return idl_bits_lo( ids[3] );
+}
+
+ID
+mdb_idl_bits_last( ID *ids )
+{
+	return idl_bits_hi( ids[ids[1]+2] );
+}
+
+/* The smallest member of bitmap ids that is >= id, or NOID */
+static ID
+idl_bits_find( ID *ids, ID id )
+{
+	ID *w = ids + 3, b = BITS_BLOCK( id ), x;
+	ID lo = 0, hi = ids[1], mid;
+
+	/* lo is the number of words that start at or before b */
+	while ( lo < hi ) {
+		mid = ( lo + hi ) / 2;
+		if ( MDB_BITS_BLOCKOF( w[mid] ) <= b )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if ( lo ) {
+		x = w[lo-1];
+		if ( MDB_BITS_IS_RUN( x )) {
+			if ( b < MDB_BITS_BLOCKOF( x ) + MDB_BITS_VAL( x ))
+				return id;
+		} else if ( MDB_BITS_BLOCKOF( x ) == b ) {
+			x = MDB_BITS_VAL( x ) >> ( id % MDB_BITS_BLOCK );
+			if ( x )
+				return id + IDL_CTZ( x );
+		}
+	}
+	return lo < ids[1] ? idl_bits_lo( w[lo] ) : NOID;
+}
+
+/* Append the members of the n words at w, which may be unaligned and
+ * may include the header, to list ids.
+ */
+static void
+idl_bits_unpack( void *w, size_t n, ID *ids )
+{
+	ID x, base, i, len;
+
+	for ( ; n; n--, w = (char *)w + sizeof(ID) ) {
+		memcpy( &x, w, sizeof(ID) );
+		if ( MDB_BITS_IS_HEADER( x ))
+			continue;
+		base = MDB_BITS_BLOCKOF( x ) * MDB_BITS_BLOCK;
+		if ( MDB_BITS_IS_RUN( x )) {
+			len = MDB_BITS_VAL( x ) * MDB_BITS_BLOCK;
+			for ( i = 0; i < len; i++ )
+				ids[++ids[0]] = base + i;
+		} else {
+			for ( x = MDB_BITS_VAL( x ); x; x &= x - 1 )
+				ids[++ids[0]] = base + IDL_CTZ( x );
+		}
+	}
+}
+
+/* A bitmap being built */
+typedef struct idl_bits_buf {
+	ID *bb_w;		/* the words */
+	ID bb_n;		/* number of words */
+	ID bb_max;		/* room for that many */
+	ID bb_count;	/* number of IDs */
+} idl_bits_buf;
+
+/* Append the run of len blocks starting at block b, or if len is 0
+ * the members mask of block b. Returns -1 if there is no room.
+ */
+static int
+idl_bits_put( idl_bits_buf *bb, ID b, ID len, ID mask )
+{
+	ID *last = bb->bb_n ? bb->bb_w + bb->bb_n - 1 : NULL;
+
+	if ( !len ) {
+		if ( !mask )
+			return 0;
+		if ( mask != MDB_BITS_FULL ) {
+			if ( bb->bb_n == bb->bb_max )
+				return -1;
+			bb->bb_w[bb->bb_n++] = MDB_BITS_WORD( b ) | mask;
+			bb->bb_count += IDL_POPCOUNT( mask );
+			return 0;
+		}
+		len = 1;
+	}
+	bb->bb_count += len * MDB_BITS_BLOCK;
+	/* a run right after another one makes it longer */
+	if ( last && MDB_BITS_IS_RUN( *last ) &&
+		MDB_BITS_BLOCKOF( *last ) + MDB_BITS_VAL( *last ) == b ) {
+		*last += len;
+		return 0;
+	}
+	if ( bb->bb_n == bb->bb_max )
+		return -1;
+	bb->bb_w[bb->bb_n++] = MDB_BITS_WORD( b ) | MDB_BITS_RUN | len;
+	return 0;
+}
+
+/* Append the n sorted IDs, all below MDB_BITS_MAXID */
+static int
+idl_bits_put_ids( idl_bits_buf *bb, ID *ids, size_t n )
+{
+	size_t i = 0;
+	ID b, mask;
+
+	while ( i < n ) {
+		b = BITS_BLOCK( ids[i] );
+		for ( mask = 0; i < n && BITS_BLOCK( ids[i] ) == b; i++ )
+			mask |= BITS_BIT( ids[i] );
+		if ( idl_bits_put( bb, b, 0, mask ))
+			return -1;
+	}
+	return 0;
+}
+
+/* Store the n sorted IDs of ids, all below MDB_BITS_MAXID, as the
+ * values of a bitmap key in words, which has room for n + 1 of them.
+ * Returns the number of words, with the header.
+ */
+size_t
+mdb_idl_bits_pack( ID *ids, size_t n, ID *words )
+{
+	idl_bits_buf bb;
+
+	bb.bb_w = words;
+	bb.bb_n = 0;
+	bb.bb_max = n;
+	bb.bb_count = 0;
+	idl_bits_put_ids( &bb, ids, n );
+	words[bb.bb_n] = MDB_BITS_HEADER | bb.bb_count;
+	return bb.bb_n + 1;
+}
+
+/* Make ids a copy of bitmap bits, or a list if it is short enough, or
+ * a range if it doesn't fit.
+ */
+static void
+idl_bits_store( ID *bits, ID *ids )
+{
+	if ( !bits[2] ) {
+		MDB_IDL_ZERO( ids );
+	} else if ( bits[2] <= MDB_idl_db_max ) {
+		ids[0] = 0;
+		idl_bits_unpack( bits + 3, bits[1], ids );
+	} else if ( bits[1] <= MDB_idl_db_size - 3 ) {
+		AC_MEMCPY( ids, bits, ( bits[1] + 3 ) * sizeof(ID) );
+	} else {
+		MDB_IDL_RANGE( ids, mdb_idl_bits_first( bits ),
+			mdb_idl_bits_last( bits ));
+	}
+}
+
+/* The words of ids as a bitmap: ids itself, a range clipped to
+ * [lo,hi] in rbuf, or a list converted to *tmp. NULL if the IDs are
+ * too large.
+ */
+static ID *
+idl_bits_of( ID *ids, ID *rbuf, ID **tmp, ID lo, ID hi )
+{
+	idl_bits_buf bb;
+	ID *out, f, l, bf, bl;
+
+	if ( MDB_IDL_IS_BITS( ids ))
+		return ids;
+
+	if ( MDB_IDL_IS_RANGE( ids )) {
+		f = IDL_MAX( ids[1], lo );
+		l = IDL_MIN( ids[2], hi );
+		if ( l >= MDB_BITS_MAXID )
+			return NULL;
+		out = rbuf;
+		bb.bb_max = 3;
+	} else {
+		if ( MDB_IDL_LLAST( ids ) >= MDB_BITS_MAXID )
+			return NULL;
+		out = *tmp = ch_malloc(( ids[0] + 3 ) * sizeof(ID));
+		bb.bb_max = ids[0];
+	}
+	bb.bb_w = out + 3;
+	bb.bb_n = 0;
+	bb.bb_count = 0;
+
+	if ( MDB_IDL_IS_RANGE( ids )) {
+		bf = BITS_BLOCK( f );
+		bl = BITS_BLOCK( l );
+		if ( bf == bl ) {
+			idl_bits_put( &bb, bf, 0, ( MDB_BITS_FULL << ( f % MDB_BITS_BLOCK )) &
+				( MDB_BITS_FULL >> ( MDB_BITS_BLOCK - 1 - l % MDB_BITS_BLOCK )));
+		} else {
+			idl_bits_put( &bb, bf, 0,
+				( MDB_BITS_FULL << ( f % MDB_BITS_BLOCK )) & MDB_BITS_FULL );
+			if ( bl > bf + 1 )
+				idl_bits_put( &bb, bf + 1, bl - bf - 1, 0 );
+			idl_bits_put( &bb, bl, 0,
+				MDB_BITS_FULL >> ( MDB_BITS_BLOCK - 1 - l % MDB_BITS_BLOCK ));
+		}
+	} else {
+		idl_bits_put_ids( &bb, ids + 1, ids[0] );
+	}
+	out[0] = MDB_IDL_BITS_TAG;
+	out[1] = bb.bb_n;
+	out[2] = bb.bb_count;
+	return out;
+}
+
+/* A word of a bitmap being walked: blocks [sg_b,sg_e), members
+ * sg_mask in each. sg_b is NOID at the end.
+ */
+typedef struct idl_bits_seg {
+	ID *sg_w;
+	ID *sg_end;
+	ID sg_b;
+	ID sg_e;
+	ID sg_mask;
+} idl_bits_seg;
+
+static void
+idl_bits_next( idl_bits_seg *sg )
+{
+	ID w;
+
+	if ( sg->sg_w == sg->sg_end ) {
+		sg->sg_b = NOID;
+		return;
+	}
+	w = *sg->sg_w++;
+	sg->sg_b = MDB_BITS_BLOCKOF( w );
+	if ( MDB_BITS_IS_RUN( w )) {
+		sg->sg_e = sg->sg_b + MDB_BITS_VAL( w );
+		sg->sg_mask = MDB_BITS_FULL;
+	} else {
+		sg->sg_e = sg->sg_b + 1;
+		sg->sg_mask = MDB_BITS_VAL( w );
+	}
+}
+
+static void
+idl_bits_walk( idl_bits_seg *sg, ID *ids )
+{
+	sg->sg_w = ids + 3;
+	sg->sg_end = sg->sg_w + ids[1];
+	idl_bits_next( sg );
+}
+
+/* Append what is left of the current word of sg, up to block e */
+static int
+idl_bits_put_seg( idl_bits_buf *bb, idl_bits_seg *sg, ID e )
+{
+	if ( e - sg->sg_b > 1 )
+		return idl_bits_put( bb, sg->sg_b, e - sg->sg_b, 0 );
+	return idl_bits_put( bb, sg->sg_b, 0, sg->sg_mask );
+}
+
+/* Consume the current word of sg up to block e */
+static void
+idl_bits_skip( idl_bits_seg *sg, ID e )
+{
+	sg->sg_b = e;
+	if ( sg->sg_b == sg->sg_e )
+		idl_bits_next( sg );
+}
+
+/* a = a & b, or a = a | b if or is set, where a or b is a bitmap.
+ * For an intersection, ranges are first clipped to [idmin,idmax].
+ * Returns -1 if it can't be done with a bitmap.
+ */
+static int
+idl_bits_op( ID *a, ID *b, int or, ID idmin, ID idmax )
+{
+	ID ra[3+3], rb[3+3], *ta = NULL, *tb = NULL, *out = NULL;
+	ID *wa, *wb, e;
+	idl_bits_seg sa, sb;
+	idl_bits_buf bb;
+	int rc = -1;
+
+	/* A list shorter than the bitmap just looks its IDs up */
+	if ( !or ) {
+		ID *l = a, *bm = b, i, n = 0;
+
+		if ( MDB_IDL_IS_BITS( a )) {
+			l = b;
+			bm = a;
+		}
+		if ( !MDB_IDL_IS_RANGE( l ) && !MDB_IDL_IS_BITS( l ) && l[0] < bm[1] ) {
+			for ( i = 1; i <= l[0]; i++ ) {
+				if ( idl_bits_find( bm, l[i] ) == l[i] )
+					l[++n] = l[i];
+			}
+			l[0] = n;
+			if ( l != a )
+				MDB_IDL_CPY( a, l );
+			return 0;
+		}
+	}
+
+	wa = idl_bits_of( a, ra, &ta, idmin, idmax );
+	wb = idl_bits_of( b, rb, &tb, idmin, idmax );
+	if ( !wa || !wb )
+		goto done;
+
+	/* each word of either side ends at most two output words */
+	bb.bb_max = 2 * ( wa[1] + wb[1] ) + 1;
+	out = ch_malloc(( bb.bb_max + 3 ) * sizeof(ID));
+	bb.bb_w = out + 3;
+	bb.bb_n = 0;
+	bb.bb_count = 0;
+	idl_bits_walk( &sa, wa );
+	idl_bits_walk( &sb, wb );
+
+	while ( sa.sg_b != NOID || sb.sg_b != NOID ) {
+		if ( sa.sg_b != NOID && ( sb.sg_b == NOID || sa.sg_e <= sb.sg_b )) {
+			/* a alone */
+			if ( or && idl_bits_put_seg( &bb, &sa, sa.sg_e ))
+				goto done;
+			if ( !or && sb.sg_b == NOID )
+				break;
+			idl_bits_next( &sa );
+		} else if ( sa.sg_b == NOID || sb.sg_e <= sa.sg_b ) {
+			/* b alone */
+			if ( or && idl_bits_put_seg( &bb, &sb, sb.sg_e ))
+				goto done;
+			if ( !or && sa.sg_b == NOID )
+				break;
+			idl_bits_next( &sb );
+		} else if ( sa.sg_b < sb.sg_b ) {
+			/* the start of a run of a */
+			if ( or && idl_bits_put_seg( &bb, &sa, sb.sg_b ))
+				goto done;
+			sa.sg_b = sb.sg_b;
+		} else if ( sb.sg_b < sa.sg_b ) {
+			if ( or && idl_bits_put_seg( &bb, &sb, sa.sg_b ))
+				goto done;
+			sb.sg_b = sa.sg_b;
+		} else {
+			/* both, up to the end of the shorter one. If that is
+			 * more than one block, both are runs.
+			 */
+			e = IDL_MIN( sa.sg_e, sb.sg_e );
+			if ( e - sa.sg_b > 1 )
+				rc = idl_bits_put( &bb, sa.sg_b, e - sa.sg_b, 0 );
+			else
+				rc = idl_bits_put( &bb, sa.sg_b, 0, or ?
+					sa.sg_mask | sb.sg_mask : sa.sg_mask & sb.sg_mask );
+			if ( rc )
+				goto done;
+			idl_bits_skip( &sa, e );
+			idl_bits_skip( &sb, e );
+		}
+	}
+
+	out[0] = MDB_IDL_BITS_TAG;
+	out[1] = bb.bb_n;
+	out[2] = bb.bb_count;
+	idl_bits_store( out, a );
+	rc = 0;
+done:
+	ch_free( ta );
+	ch_free( tb );
+	ch_free( out );
+	return rc;
+}
+
+/* Add delta to the count in the header of the bitmap key at cursor.
+ * The header goes when the count reaches zero.
+ */
+static int
+idl_bits_count_add( MDB_cursor *cursor, MDB_val *key, ID *count, int delta )
+{
+	MDB_val data, kx;
+	ID hdr;
+	int rc;
+
+	rc = mdb_cursor_get( cursor, &kx, &data, MDB_LAST_DUP );
+	if ( rc )
+		return rc;
+	memcpy( &hdr, data.mv_data, sizeof(ID) );
+	if ( !MDB_BITS_IS_HEADER( hdr ))
+		return MDB_CORRUPTED;
+	*count = MDB_BITS_COUNT( hdr ) + delta;
+	if ( !*count )
+		return mdb_cursor_del( cursor, 0 );
+	hdr = MDB_BITS_HEADER | *count;
+	data.mv_data = &hdr;
+	data.mv_size = sizeof(ID);
+	return mdb_cursor_put( cursor, key, &data, MDB_CURRENT );
+}
+
+/* Read all the dups of the key at cursor into a new array of room
+ * entries, returns the number read.
+ */
+static int
+idl_bits_read( MDB_cursor *cursor, MDB_val *key, ID **ids, size_t room,
+	size_t *n )
+{
+	MDB_val data, kx;
+	int rc;
+
+	*ids = ch_malloc( room * sizeof(ID) );
+	*n = 0;
+	rc = mdb_cursor_get( cursor, &kx, &data, MDB_FIRST_DUP );
+	if ( rc == 0 )
+		rc = mdb_cursor_get( cursor, &kx, &data, MDB_GET_MULTIPLE );
+	while ( rc == 0 ) {
+		if ( *n + data.mv_size / sizeof(ID) > room ) {
+			rc = MDB_CORRUPTED;
+			break;
+		}
+		memcpy( *ids + *n, data.mv_data, data.mv_size );
+		*n += data.mv_size / sizeof(ID);
+		rc = mdb_cursor_get( cursor, &kx, &data, MDB_NEXT_MULTIPLE );
+	}
+	if ( rc == MDB_NOTFOUND )
+		rc = 0;
+	return rc;
+}
+
+/* Replace all the dups of the key at cursor with the n values of w */
+static int
+idl_bits_rewrite( MDB_cursor *cursor, MDB_val *key, ID *w, size_t n )
+{
+	MDB_val data[2];
+	int rc;
+
+	rc = mdb_cursor_del( cursor, MDB_NODUPDATA );
+	if ( rc )
+		return rc;
+	data[0].mv_size = sizeof(ID);
+	data[0].mv_data = w;
+	data[1].mv_size = n;
+	data[1].mv_data = NULL;
+	return mdb_cursor_put( cursor, key, data, MDB_MULTIPLE );
+}
+
+/* Convert the plain key at cursor, with count IDs, to a bitmap while
+ * adding id to it.
+ */
+static int
+idl_bits_convert( MDB_cursor *cursor, MDB_val *key, ID id, size_t count,
+	mdb_idxstat *st )
+{
+	ID *ids, *w;
+	size_t n, x;
+	int rc;
+
+	rc = idl_bits_read( cursor, key, &ids, count + 1, &n );
+	if ( rc ) {
+		ch_free( ids );
+		return rc;
+	}
+	for ( x = 0; x < n && ids[x] < id; x++ ) ;
+	if ( x == n || ids[x] != id ) {
+		AC_MEMCPY( ids + x + 1, ids + x, ( n - x ) * sizeof(ID) );
+		ids[x] = id;
+		n++;
+		if ( st )
+			st->is_ids++;
+	}
+	w = ch_malloc(( n + 1 ) * sizeof(ID) );
+	rc = idl_bits_rewrite( cursor, key, w,
+		mdb_idl_bits_pack( ids, n, w ));
+	ch_free( w );
+	ch_free( ids );
+	return rc;
+}
+
+/* Turn the bitmap key at cursor back into a plain key of count IDs */
+static int
+idl_bits_unconvert( MDB_cursor *cursor, MDB_val *key, ID count )
+{
+	ID *w, *ids;
+	size_t n;
+	int rc;
+
+	rc = idl_bits_read( cursor, key, &w, count + 1, &n );
+	if ( rc == 0 ) {
+		ids = ch_malloc(( count + 1 ) * sizeof(ID) );
+		ids[0] = 0;
+		idl_bits_unpack( w, n, ids );
+		rc = idl_bits_rewrite( cursor, key, ids + 1, ids[0] );
+		ch_free( ids );
+	}
+	ch_free( w );
+	return rc;
+}
+
+/* Turn the bitmap key at cursor into a range, for an id too large
+ * for the bitmap.
+ */
+static int
+idl_bits_to_range( MDB_cursor *cursor, MDB_val *key, ID id,
+	mdb_idxstat *st )
+{
+	MDB_val data, kx;
+	ID w, r[3];
+	int rc;
+
+	rc = mdb_cursor_get( cursor, &kx, &data, MDB_LAST_DUP );
+	if ( rc )
+		return rc;
+	memcpy( &w, data.mv_data, sizeof(ID) );
+	if ( st ) {
+		st->is_ranges++;
+		st->is_ids -= MDB_BITS_COUNT( w );
+	}
+	rc = mdb_cursor_get( cursor, &kx, &data, MDB_FIRST_DUP );
+	if ( rc )
+		return rc;
+	memcpy( &w, data.mv_data, sizeof(ID) );
+	r[0] = 0;
+	r[1] = IDL_MIN( idl_bits_lo( w ), id );
+	r[2] = id;
+	return idl_bits_rewrite( cursor, key, r, 3 );
+}
+
+/* The literal word at cursor, of block b, has just become full:
+ * fold it into a run, along with the runs right before and after it.
+ */
+static int
+idl_bits_fill( MDB_cursor *cursor, MDB_val *key, ID b )
+{
+	MDB_val data, kx;
+	ID w, s = b, len = 1;
+	int rc;
+
+	rc = mdb_cursor_del( cursor, 0 );
+	if ( rc )
+		return rc;
+	w = MDB_BITS_WORD( b );
+	data.mv_data = &w;
+	data.mv_size = sizeof(ID);
+	rc = mdb_cursor_get( cursor, key, &data, MDB_GET_BOTH_RANGE );
+	if ( rc )
+		return rc;
+	memcpy( &w, data.mv_data, sizeof(ID) );
+	if ( !MDB_BITS_IS_HEADER( w ) && MDB_BITS_IS_RUN( w ) &&
+		MDB_BITS_BLOCKOF( w ) == b + 1 ) {
+		len += MDB_BITS_VAL( w );
+		rc = mdb_cursor_del( cursor, 0 );
+		if ( rc == 0 ) {
+			w = MDB_BITS_WORD( b );
+			data.mv_data = &w;
+			data.mv_size = sizeof(ID);
+			rc = mdb_cursor_get( cursor, key, &data, MDB_GET_BOTH_RANGE );
+		}
+		if ( rc )
+			return rc;
+	}
+	rc = mdb_cursor_get( cursor, &kx, &data, MDB_PREV_DUP );
+	if ( rc == 0 ) {
+		memcpy( &w, data.mv_data, sizeof(ID) );
+		if ( MDB_BITS_IS_RUN( w ) &&
+			MDB_BITS_BLOCKOF( w ) + MDB_BITS_VAL( w ) == b ) {
+			s = MDB_BITS_BLOCKOF( w );
+			len += MDB_BITS_VAL( w );
+			rc = mdb_cursor_del( cursor, 0 );
+		}
+	} else if ( rc == MDB_NOTFOUND ) {
+		rc = 0;
+	}
+	if ( rc )
+		return rc;
+	w = MDB_BITS_WORD( s ) | MDB_BITS_RUN | len;
+	data.mv_data = &w;
+	data.mv_size = sizeof(ID);
+	return mdb_cursor_put( cursor, key, &data, MDB_NODUPDATA );
+}
+
+/* Add id to the bitmap key at cursor */
+static int
+idl_bits_insert( MDB_cursor *cursor, MDB_val *key, ID id, mdb_idxstat *st )
+{
+	MDB_val data, kx;
+	ID b = BITS_BLOCK( id ), w = MDB_BITS_WORD( b ), count;
+	int rc;
+
+	if ( id >= MDB_BITS_MAXID )
+		return idl_bits_to_range( cursor, key, id, st );
+
+	/* the first word at or after block b; there's always the header */
+	data.mv_data = &w;
+	data.mv_size = sizeof(ID);
+	rc = mdb_cursor_get( cursor, key, &data, MDB_GET_BOTH_RANGE );
+	if ( rc )
+		return rc;
+	memcpy( &w, data.mv_data, sizeof(ID) );
+	if ( !MDB_BITS_IS_HEADER( w ) && MDB_BITS_BLOCKOF( w ) == b ) {
+		if ( MDB_BITS_IS_RUN( w ) || ( w & BITS_BIT( id )))
+			return 0;
+		w |= BITS_BIT( id );
+		if ( MDB_BITS_VAL( w ) == MDB_BITS_FULL ) {
+			rc = idl_bits_fill( cursor, key, b );
+		} else {
+			data.mv_data = &w;
+			data.mv_size = sizeof(ID);
+			rc = mdb_cursor_put( cursor, key, &data, MDB_CURRENT );
+		}
+	} else {
+		/* unless a run before covers it, add a word */
+		rc = mdb_cursor_get( cursor, &kx, &data, MDB_PREV_DUP );
+		if ( rc == 0 ) {
+			memcpy( &w, data.mv_data, sizeof(ID) );
+			if ( MDB_BITS_IS_RUN( w ) &&
+				b < MDB_BITS_BLOCKOF( w ) + MDB_BITS_VAL( w ))
+				return 0;
+		} else if ( rc != MDB_NOTFOUND ) {
+			return rc;
+		}
+		w = MDB_BITS_WORD( b ) | BITS_BIT( id );
+		data.mv_data = &w;
+		data.mv_size = sizeof(ID);
+		rc = mdb_cursor_put( cursor, key, &data, MDB_NODUPDATA );
+	}
+	if ( rc == 0 )
+		rc = idl_bits_count_add( cursor, key, &count, 1 );
+	if ( rc == 0 && st )
+		st->is_ids++;
+	return rc;
+}
+
+/* Delete id from the bitmap key at cursor */
+static int
+idl_bits_delete( MDB_cursor *cursor, MDB_val *key, ID id, mdb_idxstat *st )
+{
+	MDB_val data, kx;
+	ID b = BITS_BLOCK( id ), w = MDB_BITS_WORD( b ), s, e, count;
+	int rc;
+
+	data.mv_data = &w;
+	data.mv_size = sizeof(ID);
+	rc = mdb_cursor_get( cursor, key, &data, MDB_GET_BOTH_RANGE );
+	if ( rc )
+		return rc;
+	memcpy( &w, data.mv_data, sizeof(ID) );
+	if ( MDB_BITS_IS_HEADER( w ) || MDB_BITS_BLOCKOF( w ) != b ) {
+		/* only a run before can have it */
+		rc = mdb_cursor_get( cursor, &kx, &data, MDB_PREV_DUP );
+		if ( rc )
+			return rc;
+		memcpy( &w, data.mv_data, sizeof(ID) );
+		if ( !MDB_BITS_IS_RUN( w ) ||
+			b >= MDB_BITS_BLOCKOF( w ) + MDB_BITS_VAL( w ))
+			return MDB_NOTFOUND;
+	}
+	if ( MDB_BITS_IS_RUN( w )) {
+		/* split the run around block b */
+		s = MDB_BITS_BLOCKOF( w );
+		e = s + MDB_BITS_VAL( w );
+		rc = mdb_cursor_del( cursor, 0 );
+		data.mv_data = &w;
+		data.mv_size = sizeof(ID);
+		if ( rc == 0 && s < b ) {
+			w = MDB_BITS_WORD( s ) | MDB_BITS_RUN | ( b - s );
+			rc = mdb_cursor_put( cursor, key, &data, MDB_NODUPDATA );
+		}
+		if ( rc == 0 ) {
+			w = MDB_BITS_WORD( b ) | ( MDB_BITS_FULL & ~BITS_BIT( id ));
+			rc = mdb_cursor_put( cursor, key, &data, MDB_NODUPDATA );
+		}
+		if ( rc == 0 && b + 1 < e ) {
+			w = MDB_BITS_WORD( b + 1 ) | MDB_BITS_RUN | ( e - b - 1 );
+			rc = mdb_cursor_put( cursor, key, &data, MDB_NODUPDATA );
+		}
+	} else {
+		if ( !( w & BITS_BIT( id )))
+			return MDB_NOTFOUND;
+		w &= ~BITS_BIT( id );
+		if ( MDB_BITS_VAL( w )) {
+			data.mv_data = &w;
+			data.mv_size = sizeof(ID);
+			rc = mdb_cursor_put( cursor, key, &data, MDB_CURRENT );
+		} else {
+			rc = mdb_cursor_del( cursor, 0 );
+		}
+	}
+	if ( rc == 0 )
+		rc = idl_bits_count_add( cursor, key, &count, -1 );
+	if ( rc )
+		return rc;
+	if ( st ) {
+		st->is_ids--;
+		if ( !count )
+			st->is_keys--;
+	}
+	/* back to a plain key once it has shrunk well below the limit */
+	if ( count && count <= MDB_idl_db_max / 2 )
+		rc = idl_bits_unconvert( cursor, key, count );
+	return rc;
+}
+
+/* Read the bitmap key at cursor, nw words with its header, into ids */
+static int
+idl_bits_fetch( MDB_cursor *cursor, MDB_val *key, ID *ids )
+{
+	MDB_val data, kx;
+	size_t nw, n = 0;
+	ID hdr, count, w;
+	int rc;
+
+	rc = mdb_cursor_count( cursor, &nw );
+	if ( rc == 0 )
+		rc = mdb_cursor_get( cursor, &kx, &data, MDB_LAST_DUP );
+	if ( rc )
+		return rc;
+	memcpy( &hdr, data.mv_data, sizeof(ID) );
+	if ( !MDB_BITS_IS_HEADER( hdr ) || nw < 2 )
+		return MDB_CORRUPTED;
+	count = MDB_BITS_COUNT( hdr );
+
+	if ( count > MDB_idl_db_max && nw > MDB_idl_db_size - 3 ) {
+		/* too many words, only keep the bounds */
+		rc = mdb_cursor_get( cursor, &kx, &data, MDB_PREV_DUP );
+		if ( rc )
+			return rc;
+		memcpy( &w, data.mv_data, sizeof(ID) );
+		ids[2] = idl_bits_hi( w );
+		rc = mdb_cursor_get( cursor, &kx, &data, MDB_FIRST_DUP );
+		if ( rc )
+			return rc;
+		memcpy( &w, data.mv_data, sizeof(ID) );
+		MDB_IDL_RANGE( ids, idl_bits_lo( w ), ids[2] );
+		return 0;
+	}
+
+	ids[0] = 0;
+	rc = mdb_cursor_get( cursor, &kx, &data, MDB_FIRST_DUP );
+	if ( rc == 0 )
+		rc = mdb_cursor_get( cursor, &kx, &data, MDB_GET_MULTIPLE );
+	while ( rc == 0 ) {
+		if ( count > MDB_idl_db_max )
+			memcpy( ids + 3 + n, data.mv_data, data.mv_size );
+		else
+			idl_bits_unpack( data.mv_data, data.mv_size / sizeof(ID), ids );
+		n += data.mv_size / sizeof(ID);
+		rc = mdb_cursor_get( cursor, &kx, &data, MDB_NEXT_MULTIPLE );
+	}
+	if ( rc != MDB_NOTFOUND )
+		return rc;
+	if ( n != nw )
+		return MDB_CORRUPTED;
+	if ( count > MDB_idl_db_max ) {
+		/* the header came last */
+		ids[0] = MDB_IDL_BITS_TAG;
+		ids[1] = nw - 1;
+		ids[2] = count;
+	} else if ( ids[0] != count ) {
+		return MDB_CORRUPTED;
+	}
+	return 0;
+}
+#endif /* MDB_IDL_BITS */
+
 static char *
 mdb_show_key(
 	char		*buf,
@@ -288,6 +1128,9 @@ mdb_idl_fetch_key(
 	MDB_val data, key2, *kptr;
 	MDB_cursor *cursor;
 	ID *i;
+#ifdef MDB_IDL_BITS
+	ID first;
+#endif
 	size_t len;
 	int rc;
 	MDB_cursor_op opflag;
@@ -348,6 +1191,20 @@ mdb_idl_fetch_key(
 		key->mv_data, key->mv_size ) > 0 ) {
 		rc = MDB_NOTFOUND;
 	}
+#ifdef MDB_IDL_BITS
+	if (rc == 0)
+		memcpy( &first, data.mv_data, sizeof(ID) );
+	if (rc == 0 && ( first & MDB_BITS_MARK )) {
+		rc = idl_bits_fetch( cursor, key, ids );
+		if ( rc == MDB_CORRUPTED ) {
+			Debug( LDAP_DEBUG_ANY, "=> mdb_idl_fetch_key: "
+				"bad bitmap\n" );
+			mdb_cursor_close( cursor );
+			return -1;
+		}
+		data.mv_size = MDB_IDL_SIZEOF(ids);
+	} else
+#endif
 	if (rc == 0) {
 		i = ids+1;
 		rc = mdb_cursor_get( cursor, key, &data, MDB_GET_MULTIPLE );
@@ -406,18 +1263,87 @@ mdb_idl_fetch_key(
 	return rc;
 }
 
+/* Estimate the number of IDs stored under a key without reading
+ * them: the number of duplicates, or the width of a range.
+ */
+int
+mdb_idl_count_key(
+	BackendDB	*be,
+	MDB_txn		*txn,
+	MDB_dbi		dbi,
+	MDB_val		*key,
+	ID			*count )
+{
+	MDB_cursor *cursor;
+	MDB_val data;
+	ID lo, hi;
+	size_t n;
+	int rc;
+
+	*count = NOID;
+	rc = mdb_cursor_open( txn, dbi, &cursor );
+	if ( rc != 0 ) {
+		Debug( LDAP_DEBUG_ANY, "=> mdb_idl_count_key: "
+			"cursor failed: %s (%d)\n", mdb_strerror(rc), rc );
+		return rc;
+	}
+
+	rc = mdb_cursor_get( cursor, key, &data, MDB_SET );
+	if ( rc == 0 ) {
+		memcpy( &lo, data.mv_data, sizeof(ID) );
+#ifdef MDB_IDL_BITS
+		if ( lo & MDB_BITS_MARK ) {
+			/* A bitmap, the header has the count */
+			rc = mdb_cursor_get( cursor, key, &data, MDB_LAST_DUP );
+			if ( rc == 0 ) {
+				memcpy( &hi, data.mv_data, sizeof(ID) );
+				*count = MDB_BITS_COUNT( hi );
+			}
+		} else
+#endif
+		if ( lo == 0 ) {
+			/* On disk, a range is denoted by 0 in the first element */
+			rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_DUP );
+			if ( rc == 0 ) {
+				memcpy( &lo, data.mv_data, sizeof(ID) );
+				rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_DUP );
+			}
+			if ( rc == 0 ) {
+				memcpy( &hi, data.mv_data, sizeof(ID) );
+				*count = hi - lo + 1;
+			}
+		} else {
+			rc = mdb_cursor_count( cursor, &n );
+			if ( rc == 0 )
+				*count = n;
+		}
+	}
+	mdb_cursor_close( cursor );
+
+	if ( rc == MDB_NOTFOUND ) {
+		*count = 0;
+		rc = 0;
+	} else if ( rc != 0 ) {
+		Debug( LDAP_DEBUG_ANY, "=> mdb_idl_count_key: "
+			"get failed: %s (%d)\n", mdb_strerror(rc), rc );
+	}
+
+	return rc;
+}
+
 int
 mdb_idl_insert_keys(
 	BackendDB	*be,
 	MDB_cursor	*cursor,
 	struct berval *keys,
-	ID			id )
+	ID			id,
+	mdb_idxstat	*st )
 {
 	struct mdb_info *mdb = be->be_private;
 	MDB_val key, data;
 	ID lo, hi, *i;
 	char *err;
-	int	rc = 0, k;
+	int	rc = 0, k, newkey;
 	unsigned int flag = MDB_NODUPDATA;
 #ifndef	MISALIGNED_OK
 	int kbuf[2];
@@ -451,11 +1377,22 @@ mdb_idl_insert_keys(
 		key.mv_size = keys[k].bv_len;
 		key.mv_data = keys[k].bv_val;
 	}
+	newkey = 0;
 	rc = mdb_cursor_get( cursor, &key, &data, MDB_SET );
 	err = "c_get";
 	if ( rc == 0 ) {
 		i = data.mv_data;
 		memcpy(&lo, data.mv_data, sizeof(ID));
+#ifdef MDB_IDL_BITS
+		if ( lo & MDB_BITS_MARK ) {
+			rc = idl_bits_insert( cursor, &key, id, st );
+			if ( rc != 0 ) {
+				err = "bitmap insert";
+				goto fail;
+			}
+			continue;
+		}
+#endif
 		if ( lo != 0 ) {
 			/* not a range, count the number of items */
 			size_t count;
@@ -474,6 +1411,17 @@ mdb_idl_insert_keys(
 				}
 				i = data.mv_data;
 				hi = *i;
+#ifdef MDB_IDL_BITS
+				/* Keep it exact as a bitmap if the IDs allow */
+				if ( hi < MDB_BITS_MAXID && id < MDB_BITS_MAXID ) {
+					rc = idl_bits_convert( cursor, &key, id, count, st );
+					if ( rc != 0 ) {
+						err = "bitmap convert";
+						goto fail;
+					}
+					continue;
+				}
+#endif
 				/* Update hi/lo if needed */
 				if ( id < lo ) {
 					lo = id;
@@ -507,6 +1455,10 @@ mdb_idl_insert_keys(
 					err = "c_put hi";
 					goto fail;
 				}
+				if ( st ) {
+					st->is_ranges++;
+					st->is_ids -= count;
+				}
 			} else {
 			/* There's room, just store it */
 				if (id == mdb->mi_nextid)
@@ -546,9 +1498,14 @@ mdb_idl_insert_keys(
 		}
 	} else if ( rc == MDB_NOTFOUND ) {
 		flag &= ~MDB_APPENDDUP;
+		newkey = 1;
 put1:	data.mv_data = &id;
 		data.mv_size = sizeof(ID);
 		rc = mdb_cursor_put( cursor, &key, &data, flag );
+		if ( rc == 0 && st ) {
+			st->is_ids++;
+			st->is_keys += newkey;
+		}
 		/* Don't worry if it's already there */
 		if ( rc == MDB_KEYEXIST )
 			rc = 0;
@@ -572,7 +1529,8 @@ mdb_idl_delete_keys(
 	BackendDB	*be,
 	MDB_cursor	*cursor,
 	struct berval *keys,
-	ID			id )
+	ID			id,
+	mdb_idxstat	*st )
 {
 	int	rc = 0, k;
 	MDB_val key, data;
@@ -614,19 +1572,36 @@ mdb_idl_delete_keys(
 	if ( rc == 0 ) {
 		memcpy( &tmp, data.mv_data, sizeof(ID) );
 		i = data.mv_data;
+#ifdef MDB_IDL_BITS
+		if ( tmp & MDB_BITS_MARK ) {
+			rc = idl_bits_delete( cursor, &key, id, st );
+			if ( rc != 0 ) {
+				err = "bitmap delete";
+				goto fail;
+			}
+		} else
+#endif
 		if ( tmp != 0 ) {
 			/* Not a range, just delete it */
+			size_t count = 0;
 			data.mv_data = &id;
 			rc = mdb_cursor_get( cursor, &key, &data, MDB_GET_BOTH );
 			if ( rc != 0 ) {
 				err = "c_get id";
 				goto fail;
 			}
+			if ( st )
+				mdb_cursor_count( cursor, &count );
 			rc = mdb_cursor_del( cursor, 0 );
 			if ( rc != 0 ) {
 				err = "c_del id";
 				goto fail;
 			}
+			if ( st ) {
+				st->is_ids--;
+				if ( count == 1 )
+					st->is_keys--;
+			}
 		} else {
 			/* It's a range, see if we need to rewrite
 			 * the boundaries
@@ -668,6 +1643,11 @@ mdb_idl_delete_keys(
 						err = "c_del dup2";
 						goto fail;
 					}
+					/* only the other bound is left */
+					if ( st ) {
+						st->is_ranges--;
+						st->is_ids++;
+					}
 				} else {
 					/* position on lo */
 					rc = mdb_cursor_get( cursor, &key, &data, MDB_NEXT_DUP );
@@ -704,6 +1684,133 @@ fail:
 }
 
 
+/* Word-parallel set operations on dense lists.
+ *
+ * When the members of both lists are packed closely together it is
+ * cheaper to scatter them into bitmaps and combine the bitmaps a word
+ * at a time than to merge the lists element by element, with a
+ * data-dependent branch on every comparison. The ID space is walked in
+ * fixed size windows so the bitmaps can live on the stack.
+ */
+#define IDL_WIN_BITS	(1 << 16)
+#define IDL_WIN_WORDS	(IDL_WIN_BITS / IDL_WBITS)
+
+/* Only worth it for lists of some size with at least one member
+ * in every 16 IDs of the span they cover.
+ */
+#define IDL_BM_MIN	64
+#define IDL_BM_DENSE(n, span)	( (n) >= IDL_BM_MIN && \
+	(span) / (IDL_WBITS / 4) <= (n) )
+
+/* Set the bits for all members of [p,end) in [base,base+IDL_WIN_BITS)
+ * that are <= last, skipping any members below base. Returns the first
+ * unconsumed member.
+ */
+static ID *
+idl_bm_fill( idl_word *bm, ID *p, ID *end, ID base, ID last )
+{
+	ID off;
+
+	for ( ; p < end && *p < base; p++ ) ;
+	for ( ; p < end && *p <= last && ( off = *p - base ) < IDL_WIN_BITS; p++ )
+		bm[off / IDL_WBITS] |= (idl_word)1 << (off % IDL_WBITS);
+	return p;
+}
+
+/* Same as idl_bm_fill, walking downward from p to start. */
+static ID *
+idl_bm_rfill( idl_word *bm, ID *p, ID *start, ID base )
+{
+	ID off;
+
+	for ( ; p >= start && *p >= base; p-- ) {
+		off = *p - base;
+		bm[off / IDL_WBITS] |= (idl_word)1 << (off % IDL_WBITS);
+	}
+	return p;
+}
+
+/* Number of words of a window starting at base that can hold IDs <= last */
+static unsigned
+idl_bm_words( ID base, ID last )
+{
+	ID n = ( last - base ) / IDL_WBITS + 1;
+	return n < IDL_WIN_WORDS ? n : IDL_WIN_WORDS;
+}
+
+/* ids = a & b, both lists sorted. The result is written in ascending
+ * order, which never overtakes the members of a still to be read, so
+ * ids may be a.
+ */
+static void
+idl_bm_and( ID *a, ID *b, ID *ids, ID idmin, ID idmax )
+{
+	idl_word ba[IDL_WIN_WORDS], bb[IDL_WIN_WORDS];
+	ID *pa = a + 1, *ea = a + a[0] + 1;
+	ID *pb = b + 1, *eb = b + b[0] + 1;
+	ID base, n = 0;
+	unsigned w, nw;
+
+	memset( ba, 0, sizeof( ba ));
+	memset( bb, 0, sizeof( bb ));
+
+	for ( ; pa < ea && *pa < idmin; pa++ ) ;
+	while ( pa < ea && *pa <= idmax ) {
+		for ( ; pb < eb && *pb < *pa; pb++ ) ;
+		if ( pb == eb )
+			break;
+		base = IDL_MAX( *pa, *pb );
+		nw = idl_bm_words( base, idmax );
+		pa = idl_bm_fill( ba, pa, ea, base, idmax );
+		pb = idl_bm_fill( bb, pb, eb, base, idmax );
+		for ( w = 0; w < nw; w++ ) {
+			idl_word x = ba[w] & bb[w];
+			ba[w] = bb[w] = 0;
+			while ( x ) {
+				ids[++n] = base + w * IDL_WBITS + IDL_CTZ( x );
+				x &= x - 1;
+			}
+		}
+	}
+	ids[0] = n;
+}
+
+/* a = a | b, both lists sorted, a[0] + b[0] <= MDB_idl_um_max.
+ * The result is built downward from a[a[0]+b[0]], which never
+ * reaches the members of a still to be read, then moved into place.
+ */
+static void
+idl_bm_or( ID *a, ID *b )
+{
+	idl_word ba[IDL_WIN_WORDS], bb[IDL_WIN_WORDS];
+	ID *pa = a + a[0], *pb = b + b[0];
+	ID *top = a + a[0] + b[0] + 1, *out = top;
+	ID lo = IDL_MIN( a[1], b[1] ), hi, base;
+	int w, nw;
+
+	memset( ba, 0, sizeof( ba ));
+	memset( bb, 0, sizeof( bb ));
+
+	while ( pa > a || pb > b ) {
+		hi = IDL_MAX( pa > a ? *pa : 0, pb > b ? *pb : 0 );
+		base = hi - lo >= IDL_WIN_BITS ? hi - ( IDL_WIN_BITS - 1 ) : lo;
+		nw = idl_bm_words( base, hi );
+		pa = idl_bm_rfill( ba, pa, a + 1, base );
+		pb = idl_bm_rfill( bb, pb, b + 1, base );
+		for ( w = nw - 1; w >= 0; w-- ) {
+			idl_word x = ba[w] | bb[w];
+			ba[w] = bb[w] = 0;
+			while ( x ) {
+				int bit = IDL_WBITS - 1 - IDL_CLZ( x );
+				*--out = base + w * IDL_WBITS + bit;
+				x ^= (idl_word)1 << bit;
+			}
+		}
+	}
+	a[0] = top - out;
+	AC_MEMCPY( a + 1, out, a[0] * sizeof(ID) );
+}
+
 /*
  * idl_intersection - return a = a intersection b
  */
@@ -733,6 +1840,14 @@ mdb_idl_intersection(
 		return 0;
 	}
 
+#ifdef MDB_IDL_BITS
+	if ( MDB_IDL_IS_BITS( a ) || MDB_IDL_IS_BITS( b )) {
+		if ( idl_bits_op( a, b, 0, idmin, idmax ))
+			MDB_IDL_RANGE( a, idmin, idmax );
+		return 0;
+	}
+#endif
+
 	if ( MDB_IDL_IS_RANGE( a ) ) {
 		if ( MDB_IDL_IS_RANGE(b) ) {
 		/* If both are ranges, just shrink the boundaries */
@@ -757,6 +1872,21 @@ mdb_idl_intersection(
 		goto done;
 	}
 
+	/* Both are lists; if they're dense enough, use bitmaps,
+	 * otherwise hand them to the sorted list kernels.
+	 */
+	if ( !MDB_IDL_IS_RANGE( b )) {
+		if ( IDL_BM_DENSE( a[0] + b[0], idmax - idmin )) {
+			idl_bm_and( a, b, a, idmin, idmax );
+		} else {
+			cursora = mdb_idl_search( a, idmin );
+			cursorb = mdb_idl_search( b, idmin );
+			a[0] = slap_idl_intersect( a + cursora, a[0] - cursora + 1,
+				b + cursorb, b[0] - cursorb + 1, a + 1, 0 );
+		}
+		goto done;
+	}
+
 	/* Fine, do the intersection one element at a time.
 	 * First advance to idmin in both IDLs.
 	 */
@@ -814,6 +1944,31 @@ over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 		return 0;
 	}
 
+#ifdef MDB_IDL_BITS
+	/* Keep large results exact */
+	if ( MDB_IDL_IS_BITS( a ) || MDB_IDL_IS_BITS( b ) ||
+		a[0] + b[0] > MDB_idl_um_max ) {
+		if ( idl_bits_op( a, b, 1, 0, NOID ))
+			goto over;
+		return 0;
+	}
+#endif
+
+	if ( a[0] + b[0] <= MDB_idl_um_max &&
+		IDL_BM_DENSE( a[0] + b[0], IDL_MAX( MDB_IDL_LLAST(a), MDB_IDL_LLAST(b) )
+			- IDL_MIN( a[1], b[1] ))) {
+		idl_bm_or( a, b );
+		return 0;
+	}
+
+	/* The distinct elements of a are cat'd to b, then merged back */
+	if ( a[0] + b[0] <= MDB_idl_um_max ) {
+		cursorc = slap_idl_intersect( a + 1, a[0], b + 1, b[0],
+			b + b[0] + 1, 1 );
+		a[0] = slap_idl_merge( b + 1, b[0], b + b[0] + 1, cursorc, a + 1 );
+		return 0;
+	}
+
 	ida = mdb_idl_first( a, &cursora );
 	idb = mdb_idl_first( b, &cursorb );
 
@@ -856,61 +2011,6 @@ over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 	return 0;
 }
 
-
-#if 0
-/*
- * mdb_idl_notin - return a intersection ~b (or a minus b)
- */
-int
-mdb_idl_notin(
-	ID	*a,
-	ID	*b,
-	ID *ids )
-{
-	ID ida, idb;
-	ID cursora = 0, cursorb = 0;
-
-	if( MDB_IDL_IS_ZERO( a ) ||
-		MDB_IDL_IS_ZERO( b ) ||
-		MDB_IDL_IS_RANGE( b ) )
-	{
-		MDB_IDL_CPY( ids, a );
-		return 0;
-	}
-
-	if( MDB_IDL_IS_RANGE( a ) ) {
-		MDB_IDL_CPY( ids, a );
-		return 0;
-	}
-
-	ida = mdb_idl_first( a, &cursora ),
-	idb = mdb_idl_first( b, &cursorb );
-
-	ids[0] = 0;
-
-	while( ida != NOID ) {
-		if ( idb == NOID ) {
-			/* we could shortcut this */
-			ids[++ids[0]] = ida;
-			ida = mdb_idl_next( a, &cursora );
-
-		} else if ( ida < idb ) {
-			ids[++ids[0]] = ida;
-			ida = mdb_idl_next( a, &cursora );
-
-		} else if ( ida > idb ) {
-			idb = mdb_idl_next( b, &cursorb );
-
-		} else {
-			ida = mdb_idl_next( a, &cursora );
-			idb = mdb_idl_next( b, &cursorb );
-		}
-	}
-
-	return 0;
-}
-#endif
-
 ID mdb_idl_first( ID *ids, ID *cursor )
 {
 	ID pos;
@@ -927,6 +2027,14 @@ ID mdb_idl_first( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+#ifdef MDB_IDL_BITS
+	/* For a bitmap the cursor is the ID itself */
+	if ( MDB_IDL_IS_BITS( ids ) ) {
+		*cursor = idl_bits_find( ids, *cursor );
+		return *cursor;
+	}
+#endif
+
 	if ( *cursor == 0 )
 		pos = 1;
 	else
@@ -949,6 +2057,14 @@ ID mdb_idl_next( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+#ifdef MDB_IDL_BITS
+	if ( MDB_IDL_IS_BITS( ids ) ) {
+		if ( *cursor != NOID )
+			*cursor = idl_bits_find( ids, *cursor + 1 );
+		return *cursor;
+	}
+#endif
+
 	if ( ++(*cursor) <= ids[0] ) {
 		return ids[*cursor];
 	}
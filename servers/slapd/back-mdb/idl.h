@@ -27,11 +27,51 @@ extern unsigned int MDB_idl_um_size;
 extern unsigned int MDB_idl_db_max;
 extern unsigned int MDB_idl_um_max;
 
+/* Bitmap IDLs
+ *
+ * With 64 bit IDs, keys with more than MDB_idl_db_max IDs are kept
+ * exact as a bitmap instead of being collapsed into a range. Each
+ * word covers the MDB_BITS_BLOCK IDs of one block: either the bits of
+ * its members, or, if MDB_BITS_RUN is set, the number of full blocks
+ * in a run that starts there. The block number is in the high bits,
+ * after MDB_BITS_MARK, so the words sort by position and stay apart
+ * from plain IDs and from the 0 that starts a range.
+ *
+ * In the index DBs the words are the values of the key, followed by a
+ * header word that holds the number of IDs. In memory, ids[0] is
+ * MDB_IDL_BITS_TAG, ids[1] the number of words, ids[2] the number of
+ * IDs, and the words follow, without the header.
+ */
+#if SIZEOF_LONG >= 8
+#define MDB_IDL_BITS	1
+#define MDB_BITS_MARK	((ID)1 << 63)
+#define MDB_BITS_SHIFT	33
+#define MDB_BITS_RUN	((ID)1 << 32)
+#define MDB_BITS_FULL	((ID)0xffffffffUL)
+#define MDB_BITS_BLOCK	32
+#define MDB_BITS_MAXID	((ID)1 << MDB_BITS_SHIFT)	/* larger IDs make a range */
+
+#define MDB_BITS_WORD(block)	(MDB_BITS_MARK | (ID)(block) << MDB_BITS_SHIFT)
+#define MDB_BITS_BLOCKOF(w)		(((w) & ~MDB_BITS_MARK) >> MDB_BITS_SHIFT)
+#define MDB_BITS_IS_RUN(w)		((w) & MDB_BITS_RUN)
+#define MDB_BITS_VAL(w)			((w) & MDB_BITS_FULL)	/* members, or run length */
+
+#define MDB_BITS_HEADER		(~(MDB_BITS_MAXID-1))
+#define MDB_BITS_IS_HEADER(w)	(((w) & MDB_BITS_HEADER) == MDB_BITS_HEADER)
+#define MDB_BITS_COUNT(w)		((w) & (MDB_BITS_MAXID-1))
+
+#define MDB_IDL_BITS_TAG	(NOID-1)
+#define MDB_IDL_IS_BITS(ids)	((ids)[0] == MDB_IDL_BITS_TAG)
+#else
+#define MDB_IDL_IS_BITS(ids)	0
+#endif
+
 #define MDB_IDL_IS_RANGE(ids)	((ids)[0] == NOID)
 #define MDB_IDL_RANGE_SIZE		(3)
 #define MDB_IDL_RANGE_SIZEOF	(MDB_IDL_RANGE_SIZE * sizeof(ID))
 #define MDB_IDL_SIZEOF(ids)		((MDB_IDL_IS_RANGE(ids) \
-	? MDB_IDL_RANGE_SIZE : ((ids)[0]+1)) * sizeof(ID))
+	? MDB_IDL_RANGE_SIZE : MDB_IDL_IS_BITS(ids) \
+	? (ids)[1]+3 : ((ids)[0]+1)) * sizeof(ID))
 
 #define MDB_IDL_RANGE_FIRST(ids)	((ids)[1])
 #define MDB_IDL_RANGE_LAST(ids)		((ids)[2])
@@ -59,13 +99,22 @@ extern unsigned int MDB_idl_um_max;
 #define MDB_IDL_ID( mdb, ids, id ) MDB_IDL_RANGE( ids, id, NOID )
 #define MDB_IDL_ALL( ids ) MDB_IDL_RANGE( ids, 1, NOID )
 
+#ifdef MDB_IDL_BITS
+#define MDB_IDL_FIRST( ids )	( MDB_IDL_IS_BITS(ids) \
+	? mdb_idl_bits_first(ids) : (ids)[1] )
+#define MDB_IDL_LAST( ids )		( MDB_IDL_IS_RANGE(ids) \
+	? (ids)[2] : MDB_IDL_IS_BITS(ids) \
+	? mdb_idl_bits_last(ids) : (ids)[(ids)[0]] )
+#else
 #define MDB_IDL_FIRST( ids )	( (ids)[1] )
-#define MDB_IDL_LLAST( ids )	( (ids)[(ids)[0]] )
 #define MDB_IDL_LAST( ids )		( MDB_IDL_IS_RANGE(ids) \
 	? (ids)[2] : (ids)[(ids)[0]] )
+#endif
+#define MDB_IDL_LLAST( ids )	( (ids)[(ids)[0]] )
 
 #define MDB_IDL_N( ids )		( MDB_IDL_IS_RANGE(ids) \
-	? ((ids)[2]-(ids)[1])+1 : (ids)[0] )
+	? ((ids)[2]-(ids)[1])+1 : MDB_IDL_IS_BITS(ids) \
+	? (ids)[2] : (ids)[0] )
 
 	/** An ID2 is an ID/value pair.
 	 */
@@ -36,7 +36,8 @@ AttrInfo *mdb_index_mask(
 	AttributeType *at;
 	AttrInfo *ai = mdb_attr_mask( be->be_private, desc );
 
-	if( ai ) {
+	/* a cover or order only record doesn't hide the index of a supertype */
+	if( ai && !MDB_INDEX_KEYLESS( ai->ai_indexmask )) {
 		*atname = desc->ad_cname;
 		return ai;
 	}
@@ -61,7 +62,8 @@ AttrInfo *mdb_index_mask(
 
 		ai = mdb_attr_mask( be->be_private, at->sat_ad );
 
-		if ( ai && !( ai->ai_indexmask & SLAP_INDEX_NOSUBTYPES ) ) {
+		if ( ai && !MDB_INDEX_KEYLESS( ai->ai_indexmask ) &&
+			!( ai->ai_indexmask & SLAP_INDEX_NOSUBTYPES ) ) {
 			*atname = at->sat_cname;
 			return ai;
 		}
@@ -161,6 +163,499 @@ done:
 	return LDAP_SUCCESS;
 }
 
+/* Index statistics
+ *
+ * The idxstats DB holds an array of MDB_IDXSTAT_TYPES mdb_idxstat
+ * for each indexed attribute, keyed by the attribute name. They are
+ * updated in the same txn as the index itself, so they stay exact
+ * as long as they were kept since the index was created; slapindex
+ * in truncate mode rebuilds both from scratch.
+ */
+static void
+mdb_idxstat_key( AttributeDescription *ad, MDB_val *key )
+{
+	key->mv_data = ad->ad_cname.bv_val;
+	key->mv_size = ad->ad_cname.bv_len;
+}
+
+int
+mdb_idxstat_get(
+	struct mdb_info *mdb,
+	MDB_txn *txn,
+	AttributeDescription *ad,
+	mdb_idxstat *stats )
+{
+	MDB_val key, data;
+	int rc;
+
+	memset( stats, 0, MDB_IDXSTAT_TYPES * sizeof( mdb_idxstat ));
+	if ( !mdb->mi_idxstats )
+		return MDB_NOTFOUND;
+
+	mdb_idxstat_key( ad, &key );
+	rc = mdb_get( txn, mdb->mi_idxstats, &key, &data );
+	if ( rc == 0 ) {
+		if ( data.mv_size == MDB_IDXSTAT_TYPES * sizeof( mdb_idxstat ))
+			memcpy( stats, data.mv_data, data.mv_size );
+		else
+			rc = MDB_NOTFOUND;
+	}
+	return rc;
+}
+
+/* Add the changes made by one indexer() call */
+int
+mdb_idxstat_update(
+	struct mdb_info *mdb,
+	MDB_txn *txn,
+	AttrInfo *ai,
+	mdb_idxstat *delta )
+{
+	mdb_idxstat stats[MDB_IDXSTAT_TYPES];
+	MDB_val key, data;
+	int i, rc;
+
+	for ( i = 0; i < MDB_IDXSTAT_TYPES; i++ ) {
+		if ( delta[i].is_keys || delta[i].is_ranges || delta[i].is_ids )
+			break;
+	}
+	if ( i == MDB_IDXSTAT_TYPES || !mdb->mi_idxstats )
+		return 0;
+
+	rc = mdb_idxstat_get( mdb, txn, ai->ai_desc, stats );
+	if ( rc && rc != MDB_NOTFOUND )
+		return rc;
+
+	/* the deltas may have wrapped around, that's fine */
+	for ( i = 0; i < MDB_IDXSTAT_TYPES; i++ ) {
+		stats[i].is_keys += delta[i].is_keys;
+		stats[i].is_ranges += delta[i].is_ranges;
+		stats[i].is_ids += delta[i].is_ids;
+	}
+	mdb_idxstat_key( ai->ai_desc, &key );
+	data.mv_data = stats;
+	data.mv_size = sizeof( stats );
+	return mdb_put( txn, mdb->mi_idxstats, &key, &data, 0 );
+}
+
+int
+mdb_idxstat_clear(
+	struct mdb_info *mdb,
+	MDB_txn *txn,
+	AttributeDescription *ad )
+{
+	MDB_val key;
+	int rc;
+
+	if ( !mdb->mi_idxstats )
+		return 0;
+
+	mdb_idxstat_key( ad, &key );
+	rc = mdb_del( txn, mdb->mi_idxstats, &key, NULL );
+	return rc == MDB_NOTFOUND ? 0 : rc;
+}
+
+/* Online index builds
+ *
+ * The progress of an online index build is kept in the idxstats DB
+ * under a key that can't be an attribute name: the next ID to index,
+ * then for each attribute the index types not built yet and its name.
+ */
+static struct berval idxbuild_key = BER_BVC("@build");
+
+typedef struct mdb_idxbuild {
+	slap_mask_t ib_mask;
+	ber_len_t ib_len;	/* of the name that follows */
+} mdb_idxbuild;
+
+static slap_mask_t
+mdb_idxbuild_mask( AttrInfo *ai )
+{
+	return ai->ai_newmask & ~( ai->ai_indexmask | MDB_INDEX_DELETING );
+}
+
+int
+mdb_idxbuild_put(
+	struct mdb_info *mdb,
+	MDB_txn *txn,
+	ID next )
+{
+	MDB_val key, data;
+	mdb_idxbuild ib;
+	AttrInfo *ai;
+	char *ptr;
+	int i, rc;
+
+	if ( !mdb->mi_idxstats )
+		return 0;
+
+	data.mv_size = sizeof( ID );
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		ai = mdb->mi_attrs[i];
+		if ( mdb_idxbuild_mask( ai ))
+			data.mv_size += sizeof( ib ) + ai->ai_desc->ad_cname.bv_len;
+	}
+	key.mv_data = idxbuild_key.bv_val;
+	key.mv_size = idxbuild_key.bv_len;
+	rc = mdb_put( txn, mdb->mi_idxstats, &key, &data, MDB_RESERVE );
+	if ( rc )
+		return rc;
+
+	ptr = data.mv_data;
+	memcpy( ptr, &next, sizeof( ID ));
+	ptr += sizeof( ID );
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		ai = mdb->mi_attrs[i];
+		ib.ib_mask = mdb_idxbuild_mask( ai );
+		if ( !ib.ib_mask )
+			continue;
+		ib.ib_len = ai->ai_desc->ad_cname.bv_len;
+		memcpy( ptr, &ib, sizeof( ib ));
+		ptr += sizeof( ib );
+		memcpy( ptr, ai->ai_desc->ad_cname.bv_val, ib.ib_len );
+		ptr += ib.ib_len;
+	}
+	return 0;
+}
+
+int
+mdb_idxbuild_del(
+	struct mdb_info *mdb,
+	MDB_txn *txn )
+{
+	MDB_val key;
+	int rc;
+
+	if ( !mdb->mi_idxstats )
+		return 0;
+
+	key.mv_data = idxbuild_key.bv_val;
+	key.mv_size = idxbuild_key.bv_len;
+	rc = mdb_del( txn, mdb->mi_idxstats, &key, NULL );
+	return rc == MDB_NOTFOUND ? 0 : rc;
+}
+
+/* Put back the state of a build that was interrupted: the configured
+ * index types become the new ones, and those that weren't built yet
+ * are taken out of the current ones.
+ */
+int
+mdb_idxbuild_restore(
+	struct mdb_info *mdb,
+	MDB_txn *txn,
+	ID *next )
+{
+	MDB_val key, data;
+	mdb_idxbuild ib;
+	AttributeDescription *ad;
+	AttrInfo *ai;
+	struct berval name;
+	const char *text;
+	char *ptr, *end;
+	int rc, n = 0;
+
+	if ( !mdb->mi_idxstats )
+		return MDB_NOTFOUND;
+
+	key.mv_data = idxbuild_key.bv_val;
+	key.mv_size = idxbuild_key.bv_len;
+	rc = mdb_get( txn, mdb->mi_idxstats, &key, &data );
+	if ( rc )
+		return rc;
+	if ( data.mv_size < sizeof( ID ))
+		return MDB_NOTFOUND;
+
+	ptr = data.mv_data;
+	end = ptr + data.mv_size;
+	memcpy( next, ptr, sizeof( ID ));
+	ptr += sizeof( ID );
+	while ( ptr + sizeof( ib ) <= end ) {
+		memcpy( &ib, ptr, sizeof( ib ));
+		ptr += sizeof( ib );
+		if ( ib.ib_len > (ber_len_t)( end - ptr ))
+			break;
+		name.bv_val = ptr;
+		name.bv_len = ib.ib_len;
+		ptr += ib.ib_len;
+
+		ad = NULL;
+		if ( slap_bv2ad( &name, &ad, &text ))
+			continue;
+		ai = mdb_attr_mask( mdb, ad );
+		if ( !ai || !( ai->ai_indexmask & ib.ib_mask ))
+			continue;
+		ai->ai_newmask = ai->ai_indexmask;
+		ai->ai_indexmask &= ~ib.ib_mask;
+		n++;
+	}
+	return n ? 0 : MDB_NOTFOUND;
+}
+
+/* Cover and order records
+ *
+ * The attributes whose values the cover and order DBs hold for every
+ * entry are listed in the idxstats DB too, like a build in progress
+ * but without the ID. Records written while an attribute wasn't
+ * covered or ordered lack its values, so an attribute that isn't
+ * listed isn't served from them until they have been rebuilt.
+ */
+static struct berval idxbuilt_key = BER_BVC("@built");
+
+/* The index types of ai whose records are complete, given that those
+ * in built were just (re)written for every entry.
+ */
+static slap_mask_t
+mdb_idxbuilt_mask( AttrInfo *ai, slap_mask_t built )
+{
+	slap_mask_t mask;
+
+	if ( ai->ai_indexmask & MDB_INDEX_DELETING )
+		return 0;
+	if ( ai->ai_newmask )
+		mask = ai->ai_newmask & ( ai->ai_indexmask | built );
+	else
+		mask = ai->ai_indexmask;
+	return mask & MDB_INDEX_NOKEYS;
+}
+
+int
+mdb_idxbuilt_put(
+	struct mdb_info *mdb,
+	MDB_txn *txn,
+	slap_mask_t built )
+{
+	MDB_val key, data;
+	mdb_idxbuild ib;
+	AttrInfo *ai;
+	char *ptr;
+	int i, rc;
+
+	if ( !mdb->mi_idxstats )
+		return 0;
+
+	data.mv_size = 0;
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		ai = mdb->mi_attrs[i];
+		if ( mdb_idxbuilt_mask( ai, built ))
+			data.mv_size += sizeof( ib ) + ai->ai_desc->ad_cname.bv_len;
+	}
+	key.mv_data = idxbuilt_key.bv_val;
+	key.mv_size = idxbuilt_key.bv_len;
+	if ( !data.mv_size ) {
+		rc = mdb_del( txn, mdb->mi_idxstats, &key, NULL );
+		return rc == MDB_NOTFOUND ? 0 : rc;
+	}
+	rc = mdb_put( txn, mdb->mi_idxstats, &key, &data, MDB_RESERVE );
+	if ( rc )
+		return rc;
+
+	ptr = data.mv_data;
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		ai = mdb->mi_attrs[i];
+		ib.ib_mask = mdb_idxbuilt_mask( ai, built );
+		if ( !ib.ib_mask )
+			continue;
+		ib.ib_len = ai->ai_desc->ad_cname.bv_len;
+		memcpy( ptr, &ib, sizeof( ib ));
+		ptr += sizeof( ib );
+		memcpy( ptr, ai->ai_desc->ad_cname.bv_val, ib.ib_len );
+		ptr += ib.ib_len;
+	}
+	return 0;
+}
+
+/* Take the configured index types whose records aren't complete out
+ * of the current ones, returns how many attributes lost some. In an
+ * empty database there is nothing to be missing.
+ */
+int
+mdb_idxbuilt_restore(
+	struct mdb_info *mdb,
+	MDB_txn *txn )
+{
+	MDB_val key, data;
+	MDB_stat st;
+	mdb_idxbuild ib;
+	AttributeDescription *ad;
+	AttrInfo *ai;
+	struct berval name;
+	const char *text;
+	char *ptr, *end;
+	slap_mask_t *built;
+	int i, rc, n = 0;
+
+	if ( !mdb->mi_idxstats || !mdb->mi_nattrs )
+		return 0;
+
+	key.mv_data = idxbuilt_key.bv_val;
+	key.mv_size = idxbuilt_key.bv_len;
+	rc = mdb_get( txn, mdb->mi_idxstats, &key, &data );
+	if ( rc == MDB_NOTFOUND ) {
+		rc = mdb_stat( txn, mdb->mi_id2entry, &st );
+		if ( rc == 0 && !st.ms_entries )
+			return 0;
+		data.mv_size = 0;
+	} else if ( rc ) {
+		data.mv_size = 0;
+	}
+
+	built = ch_calloc( mdb->mi_nattrs, sizeof( slap_mask_t ));
+	ptr = data.mv_data;
+	end = ptr + data.mv_size;
+	while ( ptr + sizeof( ib ) <= end ) {
+		memcpy( &ib, ptr, sizeof( ib ));
+		ptr += sizeof( ib );
+		if ( ib.ib_len > (ber_len_t)( end - ptr ))
+			break;
+		name.bv_val = ptr;
+		name.bv_len = ib.ib_len;
+		ptr += ib.ib_len;
+
+		ad = NULL;
+		if ( slap_bv2ad( &name, &ad, &text ))
+			continue;
+		i = mdb_attr_slot( mdb, ad, NULL );
+		if ( i >= 0 )
+			built[i] = ib.ib_mask;
+	}
+
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		slap_mask_t missing;
+
+		ai = mdb->mi_attrs[i];
+		missing = ai->ai_indexmask & MDB_INDEX_NOKEYS & ~built[i];
+		if ( !missing )
+			continue;
+		if ( !ai->ai_newmask )
+			ai->ai_newmask = ai->ai_indexmask;
+		ai->ai_indexmask &= ~missing;
+		n++;
+	}
+	ch_free( built );
+	return n;
+}
+
+/* Online indexer key buffers */
+static char mdb_keybuf_oekey;
+
+#define	MDB_KEYREC_ALIGN(n)	(((n) + sizeof(ID) - 1) & ~(sizeof(ID) - 1))
+
+void
+mdb_keybuf_init( mdb_keybuf *kb )
+{
+	memset( kb, 0, sizeof( *kb ));
+	kb->kb_oe.oe_key = &mdb_keybuf_oekey;
+}
+
+void
+mdb_keybuf_free( mdb_keybuf *kb )
+{
+	ch_free( kb->kb_buf );
+	kb->kb_buf = NULL;
+	kb->kb_len = kb->kb_size = 0;
+}
+
+static mdb_keybuf *
+mdb_keybuf_find( Operation *op )
+{
+	OpExtra *oex;
+
+	LDAP_SLIST_FOREACH( oex, &op->o_extra, oe_next ) {
+		if ( oex->oe_key == &mdb_keybuf_oekey )
+			return (mdb_keybuf *)oex;
+	}
+	return NULL;
+}
+
+static mdb_keyrec *
+mdb_keybuf_alloc( mdb_keybuf *kb, size_t len )
+{
+	mdb_keyrec *kr;
+
+	len = MDB_KEYREC_ALIGN( len );
+	if ( kb->kb_len + len > kb->kb_size ) {
+		kb->kb_size = 2 * ( kb->kb_len + len );
+		kb->kb_buf = ch_realloc( kb->kb_buf, kb->kb_size );
+	}
+	kr = (mdb_keyrec *)( kb->kb_buf + kb->kb_len );
+	kb->kb_len += len;
+	kr->kr_len = len;
+	return kr;
+}
+
+/* Remember the keys instead of writing them. The stats slot
+ * passed in tells the index type.
+ */
+int
+mdb_keybuf_add(
+	BackendDB *be,
+	MDB_cursor *mc,
+	struct berval *keys,
+	ID id,
+	mdb_idxstat *st )
+{
+	mdb_keybuf *kb = (mdb_keybuf *)mc;
+	mdb_keyrec *kr;
+	size_t len = sizeof( mdb_keyrec );
+	char *ptr;
+	int k;
+
+	for ( k = 0; keys[k].bv_val; k++ )
+		len += MDB_KEYREC_ALIGN( sizeof( ber_len_t ) + keys[k].bv_len );
+
+	kr = mdb_keybuf_alloc( kb, len );
+	kr->kr_id = id;
+	kr->kr_ai = kb->kb_ai;
+	kr->kr_type = st - kb->kb_st;
+	kr->kr_nkeys = k;
+	ptr = (char *)( kr + 1 );
+	for ( k = 0; k < kr->kr_nkeys; k++ ) {
+		*(ber_len_t *)ptr = keys[k].bv_len;
+		memcpy( ptr + sizeof( ber_len_t ), keys[k].bv_val, keys[k].bv_len );
+		ptr += MDB_KEYREC_ALIGN( sizeof( ber_len_t ) + keys[k].bv_len );
+	}
+	return 0;
+}
+
+/* Note that entry id must be indexed by the writer itself */
+void
+mdb_keybuf_redo( mdb_keybuf *kb, ID id )
+{
+	mdb_keyrec *kr;
+
+	kr = mdb_keybuf_alloc( kb, sizeof( mdb_keyrec ));
+	kr->kr_id = id;
+	kr->kr_ai = NULL;
+	kr->kr_type = 0;
+	kr->kr_nkeys = 0;
+}
+
+/* Write the keys of a record with a cursor on its index */
+int
+mdb_keyrec_write(
+	Operation *op,
+	MDB_cursor *mc,
+	mdb_keyrec *kr,
+	mdb_idxstat *st )
+{
+	struct berval *keys;
+	char *ptr = (char *)( kr + 1 );
+	int k, rc;
+
+	keys = op->o_tmpalloc( ( kr->kr_nkeys + 1 ) * sizeof( struct berval ),
+		op->o_tmpmemctx );
+	for ( k = 0; k < kr->kr_nkeys; k++ ) {
+		keys[k].bv_len = *(ber_len_t *)ptr;
+		keys[k].bv_val = ptr + sizeof( ber_len_t );
+		ptr += MDB_KEYREC_ALIGN( sizeof( ber_len_t ) + keys[k].bv_len );
+	}
+	BER_BVZERO( &keys[k] );
+	rc = mdb_idl_insert_keys( op->o_bd, mc, keys, kr->kr_id,
+		&st[kr->kr_type] );
+	op->o_tmpfree( keys, op->o_tmpmemctx );
+	return rc;
+}
+
 static int indexer(
 	Operation *op,
 	MDB_txn *txn,
@@ -176,11 +671,22 @@ static int indexer(
 	struct berval *keys;
 	MDB_cursor *mc = ai->ai_cursor;
 	mdb_idl_keyfunc *keyfunc;
+	mdb_idxstat st[MDB_IDXSTAT_TYPES], *stp = st;
+	mdb_keybuf *kb = NULL;
 	char *err;
 
-	assert( mask != 0 );
+	/* cover and order are kept in DBs of their own, there are no keys */
+	mask &= ~MDB_INDEX_NOKEYS;
+	if ( !mask )
+		return LDAP_SUCCESS;
+
+	memset( st, 0, sizeof( st ));
 
-	if ( !mc ) {
+	/* online indexer generating keys, there's no txn */
+	if ( opid == SLAP_INDEX_ADD_OP && !ai->ai_sort )
+		kb = mdb_keybuf_find( op );
+
+	if ( !mc && !kb ) {
 		err = "c_open";
 		rc = mdb_cursor_open( txn, ai->ai_dbi, &mc );
 		if ( rc ) goto done;
@@ -189,12 +695,29 @@ static int indexer(
 	}
 
 	if ( opid == SLAP_INDEX_ADD_OP ) {
+		if ( ai->ai_sort ) {
+			/* Bulk load, the keys are sorted and written at the end.
+			 * The stats slot passed in tells the index type.
+			 */
+			keyfunc = mdb_tool_sort_add;
+			mc = (MDB_cursor *)ai->ai_sort;
+			stp = ai->ai_sort->ts_st;
+		} else if ( kb ) {
+			kb->kb_ai = ai;
+			keyfunc = mdb_keybuf_add;
+			mc = (MDB_cursor *)kb;
+			stp = kb->kb_st;
+		} else
 #ifdef MDB_TOOL_IDL_CACHING
 		if (( slapMode & SLAP_TOOL_QUICK ) && slap_tool_thread_max > 2 ) {
 			AttrIxInfo *ax = (AttrIxInfo *)LDAP_SLIST_FIRST(&op->o_extra);
 			ax->ai_ai = ai;
 			keyfunc = mdb_tool_idl_add;
 			mc = (MDB_cursor *)ax;
+			/* this may be an indexer thread, the stats are written
+			 * along with the cached IDLs
+			 */
+			stp = ai->ai_st;
 		} else
 #endif
 			keyfunc = mdb_idl_insert_keys;
@@ -202,7 +725,8 @@ static int indexer(
 		keyfunc = mdb_idl_delete_keys;
 
 	if( IS_SLAP_INDEX( mask, SLAP_INDEX_PRESENT ) ) {
-		rc = keyfunc( op->o_bd, mc, presence_key, id );
+		rc = keyfunc( op->o_bd, mc, presence_key, id,
+			&stp[MDB_IDXSTAT_PRESENT] );
 		if( rc ) {
 			err = "presence";
 			goto done;
@@ -218,7 +742,8 @@ static int indexer(
 			atname, vals, &keys, op->o_tmpmemctx );
 
 		if( rc == LDAP_SUCCESS && keys != NULL ) {
-			rc = keyfunc( op->o_bd, mc, keys, id );
+			rc = keyfunc( op->o_bd, mc, keys, id,
+				&stp[MDB_IDXSTAT_EQUALITY] );
 			ber_bvarray_free_x( keys, op->o_tmpmemctx );
 			if ( rc ) {
 				err = "equality";
@@ -237,7 +762,8 @@ static int indexer(
 			atname, vals, &keys, op->o_tmpmemctx );
 
 		if( rc == LDAP_SUCCESS && keys != NULL ) {
-			rc = keyfunc( op->o_bd, mc, keys, id );
+			rc = keyfunc( op->o_bd, mc, keys, id,
+				&stp[MDB_IDXSTAT_APPROX] );
 			ber_bvarray_free_x( keys, op->o_tmpmemctx );
 			if ( rc ) {
 				err = "approx";
@@ -257,7 +783,8 @@ static int indexer(
 			atname, vals, &keys, op->o_tmpmemctx );
 
 		if( rc == LDAP_SUCCESS && keys != NULL ) {
-			rc = keyfunc( op->o_bd, mc, keys, id );
+			rc = keyfunc( op->o_bd, mc, keys, id,
+				&stp[MDB_IDXSTAT_SUBSTR] );
 			ber_bvarray_free_x( keys, op->o_tmpmemctx );
 			if( rc ) {
 				err = "substr";
@@ -268,8 +795,11 @@ static int indexer(
 		rc = LDAP_SUCCESS;
 	}
 
+	err = "stats";
+	rc = mdb_idxstat_update( op->o_bd->be_private, txn, ai, st );
+
 done:
-	if ( !(slapMode & SLAP_TOOL_QUICK))
+	if ( !(slapMode & SLAP_TOOL_QUICK) && !kb )
 		mdb_cursor_close( mc );
 	switch( rc ) {
 	/* The callers all know how to deal with these results */
@@ -412,7 +942,8 @@ mdb_index_recset(
 	/* If this type has no AD, we've never used it before */
 	if( type->sat_ad ) {
 		slot = mdb_attr_slot( mdb, type->sat_ad, NULL );
-		if ( slot >= 0 ) {
+		/* attrs without an index DB have no keys */
+		if ( slot >= 0 && mdb->mi_attrs[slot]->ai_dbi ) {
 			ir[slot].ir_ai = mdb->mi_attrs[slot];
 			al = ch_malloc( sizeof( AttrList ));
 			al->attr = a;
@@ -426,7 +957,7 @@ mdb_index_recset(
 		desc = ad_find_tags( type, tags );
 		if( desc ) {
 			slot = mdb_attr_slot( mdb, desc, NULL );
-			if ( slot >= 0 ) {
+			if ( slot >= 0 && mdb->mi_attrs[slot]->ai_dbi ) {
 				ir[slot].ir_ai = mdb->mi_attrs[slot];
 				al = ch_malloc( sizeof( AttrList ));
 				al->attr = a;
@@ -32,6 +32,10 @@ static const struct berval mdmi_databases[] = {
 	BER_BVC("dn2i"),
 	BER_BVC("id2e"),
 	BER_BVC("id2v"),
+	BER_BVC("idxs"),
+	BER_BVC("cover"),
+	BER_BVC("order"),
+	BER_BVC("id2o"),
 	BER_BVNULL
 };
 
@@ -66,6 +70,12 @@ mdb_db_init( BackendDB *be, ConfigReply *cr )
 	mdb->mi_multi_hi = UINT_MAX;
 	mdb->mi_multi_lo = UINT_MAX;
 
+	ldap_pvt_thread_mutex_init( &mdb->mi_plan_mutex );
+	ldap_pvt_thread_mutex_init( &mdb->mi_index_mutex );
+	mdb_ecache_init( &mdb->mi_ecache );
+	mdb_dncache_init( &mdb->mi_dncache );
+	mdb_wgroup_init( &mdb->mi_wgroup );
+
 	be->be_private = mdb;
 	be->be_cf_ocs = be->bd_info->bi_cf_ocs+1;
 
@@ -90,6 +100,8 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 	unsigned flags;
 	char *dbhome;
 	MDB_txn *txn;
+	ID next = 0;
+	int resume = 0;
 
 	if ( be->be_suffix == NULL ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -205,6 +217,10 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 				flags |= MDB_DUPSORT;
 			if ( i == MDB_ID2VAL )
 				flags ^= MDB_INTEGERKEY|MDB_DUPSORT;
+			if ( i == MDB_IDXSTATS )
+				flags ^= MDB_INTEGERKEY;
+			if ( i == MDB_ORDER )
+				flags ^= MDB_INTEGERKEY|MDB_DUPSORT|MDB_DUPFIXED|MDB_INTEGERDUP;
 			if ( !(slapMode & SLAP_TOOL_READONLY) )
 				flags |= MDB_CREATE;
 		}
@@ -214,6 +230,13 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 			flags,
 			&mdb->mi_dbis[i] );
 
+		/* older databases have no index statistics, cover or order DBs */
+		if ( rc == MDB_NOTFOUND && ( i == MDB_IDXSTATS || i == MDB_COVER ||
+			i == MDB_ORDER || i == MDB_ID2ORDER )) {
+			mdb->mi_dbis[i] = 0;
+			continue;
+		}
+
 		if ( rc != 0 ) {
 			snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
 				"mdb_dbi_open(%s/%s) failed: %s (%d).", 
@@ -226,7 +249,7 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 			goto fail;
 		}
 
-		if ( i == MDB_ID2ENTRY )
+		if ( i == MDB_ID2ENTRY || i == MDB_COVER || i == MDB_ID2ORDER )
 			mdb_set_compare( txn, mdb->mi_dbis[i], mdb_id_compare );
 		else if ( i == MDB_ID2VAL ) {
 			mdb_set_compare( txn, mdb->mi_dbis[i], mdb_id2v_compare );
@@ -283,6 +306,26 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		}
 	}
 
+	/* pick up an online index build that didn't finish */
+	if ( slapMode & SLAP_SERVER_MODE )
+		resume = !mdb_idxbuild_restore( mdb, txn, &next );
+
+	/* don't serve covered values the records don't all have, and
+	 * forget the ones the records are no longer kept up to date for
+	 */
+	if ( !(slapMode & SLAP_TOOL_READONLY) ) {
+		if ( mdb_idxbuilt_restore( mdb, txn ) &&
+			( slapMode & SLAP_SERVER_MODE )) {
+			resume = 1;
+			next = 1;
+		}
+		rc = mdb_idxbuilt_put( mdb, txn, 0 );
+		if ( rc ) {
+			mdb_txn_abort( txn );
+			goto fail;
+		}
+	}
+
 	rc = mdb_txn_commit(txn);
 	if ( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -300,6 +343,15 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 
 	mdb->mi_flags |= MDB_IS_OPEN;
 
+	if ( resume ) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_db_open) ": database %s: "
+			"resuming online indexing at ID %lu\n",
+			be->be_suffix[0].bv_val, (unsigned long) next );
+		/* with overlays be is a copy on the stack */
+		mdb_online_index_start( be->bd_self, next );
+	}
+
 	return 0;
 
 fail:
@@ -374,6 +426,14 @@ mdb_db_destroy( BackendDB *be, ConfigReply *cr )
 
 	mdb_attr_index_destroy( mdb );
 
+	/* fold the threads' plan statistics back in */
+	ldap_pvt_thread_pool_purgekey( mdb );
+	ldap_pvt_thread_mutex_destroy( &mdb->mi_plan_mutex );
+	ldap_pvt_thread_mutex_destroy( &mdb->mi_index_mutex );
+	mdb_ecache_destroy( &mdb->mi_ecache );
+	mdb_dncache_destroy( &mdb->mi_dncache );
+	mdb_wgroup_destroy( &mdb->mi_wgroup );
+
 	ch_free( mdb );
 	be->be_private = NULL;
 
@@ -606,6 +606,7 @@ mdb_modify( Operation *op, SlapReply *rs )
 		goto return_results;
 	}
 	txn = moi->moi_txn;
+	numads = mdb->mi_numads;
 
 	/* Don't touch the opattrs, if this is a contextCSN update
 	 * initiated from updatedn */
@@ -760,13 +761,14 @@ mdb_modify( Operation *op, SlapReply *rs )
 		opinfo.moi_oe.oe_key = NULL;
 		if( op->o_noop ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_wtxn_abort( mdb, moi );
 			rs->sr_err = LDAP_X_NO_OPERATION;
 			txn = NULL;
 			goto return_results;
 		} else {
-			rs->sr_err = mdb_txn_commit( txn );
-			if ( rs->sr_err )
+			rs->sr_err = mdb_wtxn_commit( mdb, moi );
+			/* a failed group has already unwound its attributes */
+			if ( rs->sr_err && !( moi->moi_flag & MOI_GROUP ))
 				mdb->mi_numads = numads;
 			txn = NULL;
 		}
@@ -811,7 +813,7 @@ done:
 	if( moi == &opinfo ) {
 		if( txn != NULL ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_wtxn_abort( mdb, moi );
 		}
 		if ( opinfo.moi_oe.oe_key ) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
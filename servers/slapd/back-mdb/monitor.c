@@ -50,6 +50,23 @@ static AttributeDescription *ad_olmMDBReadersMax,
 
 static AttributeDescription *ad_olmMDBEntries;
 
+static AttributeDescription *ad_olmMDBFilterPlans,
+	*ad_olmMDBFilterReordered, *ad_olmMDBFilterShortcuts,
+	*ad_olmMDBFilterSkipped;
+
+static AttributeDescription *ad_olmMDBEntryCacheHits,
+	*ad_olmMDBEntryCacheMisses;
+
+static AttributeDescription *ad_olmMDBIndexStats;
+
+static AttributeDescription *ad_olmMDBDNCacheHits,
+	*ad_olmMDBDNCacheMisses;
+
+static AttributeDescription *ad_olmMDBIndexBuild;
+
+static AttributeDescription *ad_olmMDBGroupCommits,
+	*ad_olmMDBGroupedOps;
+
 /*
  * NOTE: there's some confusion in monitor OID arc;
  * by now, let's consider:
@@ -143,6 +160,102 @@ static struct {
 		"NO-USER-MODIFICATION "
 		"USAGE dSAOperation )",
 		&ad_olmMDBEntries },
+
+	{ "( olmMDBAttributes:7 "
+		"NAME ( 'olmMDBFilterPlans' ) "
+		"DESC 'Number of AND filters planned' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBFilterPlans },
+
+	{ "( olmMDBAttributes:8 "
+		"NAME ( 'olmMDBFilterReordered' ) "
+		"DESC 'Number of AND filters whose clauses were reordered' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBFilterReordered },
+
+	{ "( olmMDBAttributes:9 "
+		"NAME ( 'olmMDBFilterShortcuts' ) "
+		"DESC 'Number of AND filters evaluated only in part' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBFilterShortcuts },
+
+	{ "( olmMDBAttributes:10 "
+		"NAME ( 'olmMDBFilterSkipped' ) "
+		"DESC 'Number of AND filter clauses not looked up' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBFilterSkipped },
+
+	{ "( olmMDBAttributes:11 "
+		"NAME ( 'olmMDBEntryCacheHits' ) "
+		"DESC 'Number of entries found in the entry cache' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBEntryCacheHits },
+
+	{ "( olmMDBAttributes:12 "
+		"NAME ( 'olmMDBEntryCacheMisses' ) "
+		"DESC 'Number of entries not found in the entry cache' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBEntryCacheMisses },
+
+	{ "( olmMDBAttributes:13 "
+		"NAME ( 'olmMDBIndexStats' ) "
+		"DESC 'Number of keys, range keys and IDs of each index' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBIndexStats },
+
+	{ "( olmMDBAttributes:14 "
+		"NAME ( 'olmMDBDNCacheHits' ) "
+		"DESC 'Number of DNs found in the DN cache' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBDNCacheHits },
+
+	{ "( olmMDBAttributes:15 "
+		"NAME ( 'olmMDBDNCacheMisses' ) "
+		"DESC 'Number of DNs not found in the DN cache' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBDNCacheMisses },
+
+	{ "( olmMDBAttributes:16 "
+		"NAME ( 'olmMDBIndexBuild' ) "
+		"DESC 'Progress of the online index build' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBIndexBuild },
+
+	{ "( olmMDBAttributes:17 "
+		"NAME ( 'olmMDBGroupCommits' ) "
+		"DESC 'Number of commits shared by grouped write operations' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBGroupCommits },
+
+	{ "( olmMDBAttributes:18 "
+		"NAME ( 'olmMDBGroupedOps' ) "
+		"DESC 'Number of write operations committed in a group' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBGroupedOps },
 	{ NULL }
 };
 
@@ -162,12 +275,157 @@ static struct {
 #endif /* MDB_MONITOR_IDX */
 			"$ olmMDBPagesMax $ olmMDBPagesUsed $ olmMDBPagesFree "
 			"$ olmMDBReadersMax $ olmMDBReadersUsed $ olmMDBEntries "
+			"$ olmMDBFilterPlans $ olmMDBFilterReordered "
+			"$ olmMDBFilterShortcuts $ olmMDBFilterSkipped "
+			"$ olmMDBEntryCacheHits $ olmMDBEntryCacheMisses "
+			"$ olmMDBIndexStats "
+			"$ olmMDBDNCacheHits $ olmMDBDNCacheMisses "
+			"$ olmMDBIndexBuild "
+			"$ olmMDBGroupCommits $ olmMDBGroupedOps "
 			") )",
 		&oc_olmMDBDatabase },
 
 	{ NULL }
 };
 
+static struct {
+	slap_mask_t	type;
+	char		*name;
+} idxstat_types[] = {
+	{ SLAP_INDEX_PRESENT, "present" },
+	{ SLAP_INDEX_EQUALITY, "equality" },
+	{ SLAP_INDEX_APPROX, "approx" },
+	{ SLAP_INDEX_SUBSTR, "substr" },
+};
+
+/* Replace the values of an optional attribute, or remove it */
+static void
+mdb_monitor_attr_set(
+	Entry		*e,
+	AttributeDescription *ad,
+	BerVarray	vals )
+{
+	Attribute	*a, **ap;
+
+	for ( ap = &e->e_attrs; *ap != NULL; ap = &(*ap)->a_next ) {
+		if ( (*ap)->a_desc == ad )
+			break;
+	}
+	if ( vals == NULL ) {
+		if ( *ap != NULL ) {
+			a = *ap;
+			*ap = a->a_next;
+			a->a_next = NULL;
+			attr_free( a );
+		}
+		return;
+	}
+	if ( *ap == NULL ) {
+		*ap = attr_alloc( ad );
+	} else {
+		ber_bvarray_free( (*ap)->a_vals );
+	}
+	a = *ap;
+	a->a_vals = vals;
+	a->a_nvals = a->a_vals;
+	for ( a->a_numvals = 0; vals[a->a_numvals].bv_val; a->a_numvals++ )
+		;
+}
+
+/* One value per index: <attr>#<type>#keys=<n>#ranges=<n>#ids=<n> */
+static void
+mdb_monitor_idxstat_update(
+	struct mdb_info	*mdb,
+	MDB_txn		*txn,
+	Entry		*e )
+{
+	mdb_idxstat	stats[MDB_IDXSTAT_TYPES];
+	BerVarray	vals = NULL;
+	char		buf[ BUFSIZ ];
+	struct berval	bv;
+	int		i, j;
+
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		AttrInfo *ai = mdb->mi_attrs[i];
+
+		if ( mdb_idxstat_get( mdb, txn, ai->ai_desc, stats ))
+			continue;
+		for ( j = 0; j < MDB_IDXSTAT_TYPES; j++ ) {
+			if ( !IS_SLAP_INDEX( ai->ai_indexmask, idxstat_types[j].type ))
+				continue;
+			bv.bv_val = buf;
+			bv.bv_len = snprintf( buf, sizeof( buf ),
+				"%s#%s#keys=%lu#ranges=%lu#ids=%lu",
+				ai->ai_desc->ad_cname.bv_val, idxstat_types[j].name,
+				(unsigned long) stats[j].is_keys,
+				(unsigned long) stats[j].is_ranges,
+				(unsigned long) stats[j].is_ids );
+			value_add_one( &vals, &bv );
+		}
+	}
+
+	mdb_monitor_attr_set( e, ad_olmMDBIndexStats, vals );
+}
+
+/* While indexing online:
+ * <attr>[,<attr>...]#next=<id>#last=<id>#eta=<seconds>
+ */
+static void
+mdb_monitor_idxbuild_update(
+	struct mdb_info	*mdb,
+	MDB_txn		*txn,
+	Entry		*e )
+{
+	BerVarray	vals = NULL;
+	char		buf[ BUFSIZ ], *ptr = buf, *end = buf + sizeof( buf );
+	struct berval	bv;
+	MDB_cursor	*mc;
+	MDB_val		key, data;
+	ID		first, next, last = 0;
+	time_t		start;
+	unsigned long	eta = 0;
+	int		i;
+
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		AttrInfo *ai = mdb->mi_attrs[i];
+
+		if ( ai->ai_indexmask & MDB_INDEX_DELETING ||
+			!( ai->ai_newmask & ~ai->ai_indexmask ))
+			continue;
+		/* leave room for the rest */
+		if ( ptr + ai->ai_desc->ad_cname.bv_len + 64 > end )
+			break;
+		if ( ptr != buf )
+			*ptr++ = ',';
+		ptr = lutil_strcopy( ptr, ai->ai_desc->ad_cname.bv_val );
+	}
+
+	if ( ptr != buf ) {
+		ldap_pvt_thread_mutex_lock( &mdb->mi_index_mutex );
+		first = mdb->mi_index_first;
+		next = mdb->mi_index_next;
+		start = mdb->mi_index_start;
+		ldap_pvt_thread_mutex_unlock( &mdb->mi_index_mutex );
+		if ( mdb_cursor_open( txn, mdb->mi_id2entry, &mc ) == 0 ) {
+			if ( mdb_cursor_get( mc, &key, &data, MDB_LAST ) == 0 )
+				memcpy( &last, key.mv_data, sizeof( ID ));
+			mdb_cursor_close( mc );
+		}
+
+		/* assume the entries left go as fast as the ones done */
+		if ( next > first && last >= next )
+			eta = (double)( slap_get_time() - start ) *
+				( last - next + 1 ) / ( next - first );
+		snprintf( ptr, end - ptr, "#next=%lu#last=%lu#eta=%lu",
+			(unsigned long) next, (unsigned long) last, eta );
+		bv.bv_val = buf;
+		bv.bv_len = strlen( buf );
+		value_add_one( &vals, &bv );
+	}
+
+	mdb_monitor_attr_set( e, ad_olmMDBIndexBuild, vals );
+}
+
 static int
 mdb_monitor_update(
 	Operation	*op,
@@ -182,6 +440,9 @@ mdb_monitor_update(
 	MDB_stat mst;
 	MDB_envinfo mei;
 	MDB_txn *txn;
+	unsigned long plans, reordered, shortcuts, skipped, hits, misses;
+	unsigned long groups, grouped;
+	mdb_plan_stats *ps;
 	int rc;
 
 #ifdef MDB_MONITOR_IDX
@@ -216,6 +477,92 @@ mdb_monitor_update(
 	bv.bv_len = snprintf( buf, sizeof( buf ), "%u", mei.me_numreaders );
 	ber_bvreplace( &a->a_vals[ 0 ], &bv );
 
+	/* the threads' counts may move on while we add them up */
+	ldap_pvt_thread_mutex_lock( &mdb->mi_plan_mutex );
+	plans = mdb->mi_plan_stats.ps_ands;
+	reordered = mdb->mi_plan_stats.ps_reordered;
+	shortcuts = mdb->mi_plan_stats.ps_shortcuts;
+	skipped = mdb->mi_plan_stats.ps_skipped;
+	for ( ps = mdb->mi_plan_stats.ps_next; ps; ps = ps->ps_next ) {
+		plans += ps->ps_ands;
+		reordered += ps->ps_reordered;
+		shortcuts += ps->ps_shortcuts;
+		skipped += ps->ps_skipped;
+	}
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_plan_mutex );
+
+	a = attr_find( e->e_attrs, ad_olmMDBFilterPlans );
+	assert( a != NULL );
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", plans );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmMDBFilterReordered );
+	assert( a != NULL );
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", reordered );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmMDBFilterShortcuts );
+	assert( a != NULL );
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", shortcuts );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmMDBFilterSkipped );
+	assert( a != NULL );
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", skipped );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_ecache.ec_mutex );
+	hits = mdb->mi_ecache.ec_hits;
+	misses = mdb->mi_ecache.ec_misses;
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_ecache.ec_mutex );
+
+	a = attr_find( e->e_attrs, ad_olmMDBEntryCacheHits );
+	assert( a != NULL );
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", hits );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmMDBEntryCacheMisses );
+	assert( a != NULL );
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", misses );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	mdb_dncache_stats( &mdb->mi_dncache, &hits, &misses );
+
+	a = attr_find( e->e_attrs, ad_olmMDBDNCacheHits );
+	assert( a != NULL );
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", hits );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmMDBDNCacheMisses );
+	assert( a != NULL );
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", misses );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_wgroup.wg_mutex );
+	groups = mdb->mi_wgroup.wg_groups;
+	grouped = mdb->mi_wgroup.wg_ops;
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_wgroup.wg_mutex );
+
+	a = attr_find( e->e_attrs, ad_olmMDBGroupCommits );
+	assert( a != NULL );
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", groups );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+	a = attr_find( e->e_attrs, ad_olmMDBGroupedOps );
+	assert( a != NULL );
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", grouped );
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
 	rc = mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &txn );
 	if ( !rc ) {
 		MDB_cursor *cursor;
@@ -238,6 +585,9 @@ mdb_monitor_update(
 		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", mst.ms_entries );
 		ber_bvreplace( &a->a_vals[ 0 ], &bv );
 
+		mdb_monitor_idxstat_update( mdb, txn, e );
+		mdb_monitor_idxbuild_update( mdb, txn, e );
+
 		mdb_txn_abort( txn );
 
 		a = attr_find( e->e_attrs, ad_olmMDBPagesFree );
@@ -436,7 +786,7 @@ mdb_monitor_db_open( BackendDB *be )
 	}
 
 	/* alloc as many as required (plus 1 for objectClass) */
-	a = attrs_alloc( 1 + 7 );
+	a = attrs_alloc( 1 + 17 );
 	if ( a == NULL ) {
 		rc = 1;
 		goto cleanup;
@@ -472,6 +822,46 @@ mdb_monitor_db_open( BackendDB *be )
 		next->a_desc = ad_olmMDBEntries;
 		attr_valadd( next, &bv, NULL, 1 );
 		next = next->a_next;
+
+		next->a_desc = ad_olmMDBFilterPlans;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmMDBFilterReordered;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmMDBFilterShortcuts;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmMDBFilterSkipped;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmMDBEntryCacheHits;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmMDBEntryCacheMisses;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmMDBDNCacheHits;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmMDBDNCacheMisses;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmMDBGroupCommits;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_olmMDBGroupedOps;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
 	}
 
 	{
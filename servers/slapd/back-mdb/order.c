@@ -0,0 +1,713 @@
+/* order.c - ordering index for sorted searches */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2021 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+
+/*
+ * An ordering index keeps every entry in the order DB under the least
+ * value of the attribute, so that a search with a server side sort on
+ * it can return the entries by walking the index instead of having
+ * the sssvlv overlay collect and sort all of them.
+ *
+ * Keys are the attribute's ID from the ad2id DB, then 1 and the value
+ * in a form whose bytes sort like the attribute's values do, see below,
+ * or 2 for entries without the attribute, which RFC 2891 sorts after
+ * all the others. The IDs of the entries are the sorted duplicates of
+ * each key. The keys of each entry are also kept in the id2order DB,
+ * so that they can be found again when the entry changes.
+ *
+ * Values are only compared on their first bytes, up to the LMDB key
+ * size limit; entries whose values share such a prefix are in ID order.
+ */
+
+#define MDB_ORDER_MAXKEY	480
+
+#define MDB_ORDER_VALUE		1
+#define MDB_ORDER_MISSING	2
+
+/* Ordering rules the index can keep in byte order. Attributes
+ * without an ORDERING rule, like most names, are kept in the order
+ * their EQUALITY rule's normalized values have, which is the order
+ * a sort with any of the octet string like rules gives them.
+ */
+#define MDB_ORD_BYTES	1	/* compared as octet strings */
+#define MDB_ORD_TIME	2	/* ... without the trailing Z */
+#define MDB_ORD_INTEGER	3
+
+static struct {
+	char *oid;
+	int type;
+} mdb_order_rules[] = {
+	{ "2.5.13.3", MDB_ORD_BYTES },		/* caseIgnoreOrderingMatch */
+	{ "2.5.13.6", MDB_ORD_BYTES },		/* caseExactOrderingMatch */
+	{ "2.5.13.9", MDB_ORD_BYTES },		/* numericStringOrderingMatch */
+	{ "2.5.13.18", MDB_ORD_BYTES },		/* octetStringOrderingMatch */
+	{ "1.3.6.1.1.16.3", MDB_ORD_BYTES },	/* UUIDOrderingMatch */
+	{ "1.3.6.1.4.1.4203.666.11.2.3", MDB_ORD_BYTES },	/* CSNOrderingMatch */
+	{ "2.5.13.28", MDB_ORD_TIME },		/* generalizedTimeOrderingMatch */
+	{ "2.5.13.15", MDB_ORD_INTEGER },	/* integerOrderingMatch */
+	{ NULL, 0 }
+}, mdb_order_equality[] = {
+	{ "2.5.13.2", MDB_ORD_BYTES },		/* caseIgnoreMatch */
+	{ "2.5.13.5", MDB_ORD_BYTES },		/* caseExactMatch */
+	{ "2.5.13.8", MDB_ORD_BYTES },		/* numericStringMatch */
+	{ "2.5.13.17", MDB_ORD_BYTES },		/* octetStringMatch */
+	{ "1.3.6.1.4.1.1466.109.114.1", MDB_ORD_BYTES },	/* caseExactIA5Match */
+	{ "1.3.6.1.4.1.1466.109.114.2", MDB_ORD_BYTES },	/* caseIgnoreIA5Match */
+	{ NULL, 0 }
+};
+
+static int
+mdb_order_type( MatchingRule *mr )
+{
+	int i;
+
+	if ( !mr || !( mr->smr_usage & SLAP_MR_ORDERING ))
+		return 0;
+	for ( i = 0; mdb_order_rules[i].oid; i++ ) {
+		if ( !strcmp( mr->smr_oid, mdb_order_rules[i].oid ))
+			return mdb_order_rules[i].type;
+	}
+	return 0;
+}
+
+/* How the index of ad keeps its values */
+static int
+mdb_order_adtype( AttributeDescription *ad )
+{
+	MatchingRule *mr = ad->ad_type->sat_equality;
+	int i;
+
+	if ( ad->ad_type->sat_ordering )
+		return mdb_order_type( ad->ad_type->sat_ordering );
+	for ( i = 0; mr && mdb_order_equality[i].oid; i++ ) {
+		if ( !strcmp( mr->smr_oid, mdb_order_equality[i].oid ))
+			return mdb_order_equality[i].type;
+	}
+	return 0;
+}
+
+/* Can ad have an ordering index? */
+int
+mdb_order_supported( AttributeDescription *ad )
+{
+	return mdb_order_adtype( ad ) != 0;
+}
+
+/* Append the byte ordered form of a normalized value to key */
+static void
+mdb_order_val( int type, struct berval *val, struct berval *key )
+{
+	unsigned char *ptr = (unsigned char *)key->bv_val + key->bv_len;
+	unsigned char *end = (unsigned char *)key->bv_val + MDB_ORDER_MAXKEY;
+	ber_len_t i, len = val->bv_len;
+	unsigned char *v = (unsigned char *)val->bv_val;
+	int neg;
+
+	switch ( type ) {
+	case MDB_ORD_TIME:
+		if ( len && v[len-1] == 'Z' )
+			len--;
+		/* FALLTHRU */
+	case MDB_ORD_BYTES:
+		if ( len > (ber_len_t)( end - ptr ))
+			len = end - ptr;
+		memcpy( ptr, v, len );
+		ptr += len;
+		break;
+
+	case MDB_ORD_INTEGER:
+		/* sign, number of digits, digits; all inverted if negative */
+		neg = len && v[0] == '-';
+		if ( neg ) {
+			v++;
+			len--;
+		}
+		*ptr++ = neg ? 0 : 1;
+		i = len > 0xffff ? 0xffff : len;
+		if ( neg )
+			i = 0xffff - i;
+		*ptr++ = i >> 8;
+		*ptr++ = i & 0xff;
+		if ( len > (ber_len_t)( end - ptr ))
+			len = end - ptr;
+		for ( i = 0; i < len; i++ )
+			*ptr++ = neg ? 0xff - v[i] : v[i];
+		break;
+	}
+	key->bv_len = (char *)ptr - key->bv_val;
+}
+
+static int
+mdb_order_cmp( struct berval *a, struct berval *b )
+{
+	ber_len_t len = a->bv_len < b->bv_len ? a->bv_len : b->bv_len;
+	int rc = memcmp( a->bv_val, b->bv_val, len );
+
+	if ( rc == 0 )
+		rc = a->bv_len < b->bv_len ? -1 : a->bv_len > b->bv_len;
+	return rc;
+}
+
+static void
+mdb_order_prefix( int adx, struct berval *key )
+{
+	key->bv_val[0] = ( adx >> 8 ) & 0xff;
+	key->bv_val[1] = adx & 0xff;
+	key->bv_len = 2;
+}
+
+/* The key of an entry for the ordering index of ad, under the least
+ * of its values. key must have room for MDB_ORDER_MAXKEY bytes.
+ */
+static void
+mdb_order_key( int adx, AttributeDescription *ad, Attribute *a,
+	struct berval *key )
+{
+	char buf[MDB_ORDER_MAXKEY];
+	struct berval tmp;
+	int type;
+	unsigned i;
+
+	mdb_order_prefix( adx, key );
+	if ( !a || !a->a_numvals ) {
+		key->bv_val[key->bv_len++] = MDB_ORDER_MISSING;
+		return;
+	}
+	type = mdb_order_adtype( ad );
+	key->bv_val[key->bv_len++] = MDB_ORDER_VALUE;
+	mdb_order_val( type, &a->a_nvals[0], key );
+
+	/* the forms sort like the values, so does the least one */
+	tmp.bv_val = buf;
+	memcpy( buf, key->bv_val, 3 );
+	for ( i = 1; i < a->a_numvals; i++ ) {
+		tmp.bv_len = 3;
+		mdb_order_val( type, &a->a_nvals[i], &tmp );
+		if ( mdb_order_cmp( &tmp, key ) < 0 ) {
+			memcpy( key->bv_val + 3, buf + 3, tmp.bv_len - 3 );
+			key->bv_len = tmp.bv_len;
+		}
+	}
+}
+
+/* The id2order record of an entry is the list of its keys, each one
+ * preceded by its length in two bytes.
+ */
+static int
+mdb_order_keys_del( struct mdb_info *mdb, MDB_txn *txn, ID id,
+	char *rec, size_t len, char *keep, size_t klen )
+{
+	char *ptr = rec, *end = rec + len, *kp;
+	MDB_val key, data;
+	size_t n;
+	int rc;
+
+	data.mv_data = &id;
+	data.mv_size = sizeof(ID);
+	while ( ptr + 2 <= end ) {
+		key.mv_size = ((unsigned char)ptr[0] << 8) | (unsigned char)ptr[1];
+		key.mv_data = ptr + 2;
+		ptr += 2 + key.mv_size;
+		if ( ptr > end )
+			break;
+		/* still one of the new keys? */
+		for ( kp = keep; kp && kp + 2 <= keep + klen; kp += 2 + n ) {
+			n = ((unsigned char)kp[0] << 8) | (unsigned char)kp[1];
+			if ( n == key.mv_size && !memcmp( kp + 2, key.mv_data, n ))
+				break;
+		}
+		if ( kp && kp + 2 <= keep + klen )
+			continue;
+		rc = mdb_del( txn, mdb->mi_order, &key, &data );
+		if ( rc && rc != MDB_NOTFOUND )
+			return rc;
+	}
+	return 0;
+}
+
+/* Store an entry under its keys in the order DB, replacing the keys
+ * it was stored under before.
+ */
+int
+mdb_order_put(
+	Operation *op,
+	MDB_txn *txn,
+	Entry *e )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_val key, data;
+	struct berval k;
+	char *rec, *old = NULL, *ptr;
+	size_t len = 0, olen = 0, n;
+	int i, rc;
+
+	if ( !mdb->mi_order || !mdb->mi_id2order )
+		return 0;
+	for ( i = 0, n = 0; i < mdb->mi_nattrs; i++ ) {
+		if (( mdb->mi_attrs[i]->ai_indexmask |
+			mdb->mi_attrs[i]->ai_newmask ) & MDB_INDEX_ORDER )
+			n++;
+	}
+	/* don't leave keys of attributes that are no longer ordered */
+	if ( !n )
+		return mdb_order_del( mdb, txn, e->e_id );
+
+	rec = op->o_tmpalloc( n * ( 2 + MDB_ORDER_MAXKEY ), op->o_tmpmemctx );
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		AttrInfo *ai = mdb->mi_attrs[i];
+
+		if ( !(( ai->ai_indexmask | ai->ai_newmask ) & MDB_INDEX_ORDER ))
+			continue;
+		rc = mdb_ad_get( mdb, txn, ai->ai_desc );
+		if ( rc )
+			goto done;
+		k.bv_val = rec + len + 2;
+		mdb_order_key( mdb->mi_adxs[ai->ai_desc->ad_index], ai->ai_desc,
+			attr_find( e->e_attrs, ai->ai_desc ), &k );
+		rec[len] = k.bv_len >> 8;
+		rec[len+1] = k.bv_len & 0xff;
+		len += 2 + k.bv_len;
+	}
+
+	key.mv_data = &e->e_id;
+	key.mv_size = sizeof(ID);
+	rc = mdb_get( txn, mdb->mi_id2order, &key, &data );
+	if ( rc == 0 ) {
+		if ( data.mv_size == len && !memcmp( data.mv_data, rec, len ))
+			goto done;
+		/* our own updates may move it */
+		olen = data.mv_size;
+		old = op->o_tmpalloc( olen, op->o_tmpmemctx );
+		memcpy( old, data.mv_data, olen );
+		rc = mdb_order_keys_del( mdb, txn, e->e_id, old, olen, rec, len );
+		if ( rc )
+			goto done;
+	} else if ( rc != MDB_NOTFOUND ) {
+		goto done;
+	}
+
+	data.mv_data = &e->e_id;
+	data.mv_size = sizeof(ID);
+	for ( ptr = rec; ptr < rec + len; ptr += 2 + n ) {
+		n = ((unsigned char)ptr[0] << 8) | (unsigned char)ptr[1];
+		key.mv_data = ptr + 2;
+		key.mv_size = n;
+		rc = mdb_put( txn, mdb->mi_order, &key, &data, MDB_NODUPDATA );
+		if ( rc && rc != MDB_KEYEXIST )
+			goto done;
+	}
+
+	key.mv_data = &e->e_id;
+	key.mv_size = sizeof(ID);
+	data.mv_data = rec;
+	data.mv_size = len;
+	rc = mdb_put( txn, mdb->mi_id2order, &key, &data, 0 );
+
+done:
+	if ( rc && rc != MDB_KEYEXIST ) {
+		Debug( LDAP_DEBUG_ANY, "mdb_order_put: id %ld err %s(%d)\n",
+			(long) e->e_id, mdb_strerror(rc), rc );
+	} else {
+		rc = 0;
+	}
+	if ( old )
+		op->o_tmpfree( old, op->o_tmpmemctx );
+	op->o_tmpfree( rec, op->o_tmpmemctx );
+	return rc;
+}
+
+/* Take a deleted entry out of the order DB */
+int
+mdb_order_del(
+	struct mdb_info *mdb,
+	MDB_txn *txn,
+	ID id )
+{
+	MDB_val key, data;
+	char *old;
+	size_t olen;
+	int rc;
+
+	if ( !mdb->mi_order || !mdb->mi_id2order )
+		return 0;
+
+	key.mv_data = &id;
+	key.mv_size = sizeof(ID);
+	rc = mdb_get( txn, mdb->mi_id2order, &key, &data );
+	if ( rc )
+		return rc == MDB_NOTFOUND ? 0 : rc;
+	olen = data.mv_size;
+	old = ch_malloc( olen );
+	memcpy( old, data.mv_data, olen );
+	rc = mdb_order_keys_del( mdb, txn, id, old, olen, NULL, 0 );
+	ch_free( old );
+	if ( rc == 0 )
+		rc = mdb_del( txn, mdb->mi_id2order, &key, NULL );
+	return rc;
+}
+
+/* Sorted searches
+ *
+ * The walk returns the IDs of the order DB in the requested direction.
+ * Equal keys are returned in ID order either way, like the overlay
+ * does. The search tells the walk about every entry that matches, and
+ * the walk decides which of them are in the window to send. When the
+ * window's position depends on entries before it, either on a count
+ * of all of them or on where the VLV assertion value falls, a first
+ * pass only counts and the walk starts over.
+ */
+
+/* Position the cursor at the first record at or after (key, id) in
+ * the order of the walk.
+ */
+static void
+mdb_order_seek( mdb_orderwalk *ow, struct berval *bkey, ID id )
+{
+	MDB_cursor *mc = ow->ow_mc;
+	MDB_val key, data;
+	int rc;
+
+	key.mv_data = bkey->bv_val;
+	key.mv_size = bkey->bv_len;
+	data.mv_data = &id;
+	data.mv_size = sizeof(ID);
+	rc = mdb_cursor_get( mc, &key, &data, MDB_GET_BOTH_RANGE );
+	if ( rc == 0 )
+		goto placed;
+
+	key.mv_data = bkey->bv_val;
+	key.mv_size = bkey->bv_len;
+	rc = mdb_cursor_get( mc, &key, &data, MDB_SET_RANGE );
+	if ( !ow->ow_srq->srq_reverse ) {
+		/* all of this key's IDs are before id */
+		if ( rc == 0 && key.mv_size == bkey->bv_len &&
+			!memcmp( key.mv_data, bkey->bv_val, key.mv_size ))
+			rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_NODUP );
+	} else {
+		if ( rc == 0 ) {
+			rc = mdb_cursor_get( mc, &key, &data, MDB_PREV_NODUP );
+		} else {
+			/* MDB_LAST leaves the cursor at EOF, where MDB_NEXT_DUP
+			 * finds nothing, set it on the key again
+			 */
+			rc = mdb_cursor_get( mc, &key, &data, MDB_LAST );
+			if ( rc == 0 )
+				rc = mdb_cursor_get( mc, &key, &data, MDB_SET );
+		}
+		if ( rc == 0 )
+			rc = mdb_cursor_get( mc, &key, &data, MDB_FIRST_DUP );
+	}
+placed:
+	ow->ow_placed = rc ? -1 : 1;
+}
+
+static void
+mdb_order_rewind( mdb_orderwalk *ow )
+{
+	struct berval key;
+	char buf[3];
+
+	key.bv_val = buf;
+	memcpy( buf, ow->ow_pfx.bv_val, 2 );
+	key.bv_len = 2;
+	/* past all the keys of the attribute */
+	if ( ow->ow_srq->srq_reverse )
+		buf[key.bv_len++] = (char)0xff;
+	mdb_order_seek( ow, &key, 0 );
+	ow->ow_pos = 0;
+}
+
+/* Find the window once the target is known */
+static void
+mdb_order_window( mdb_orderwalk *ow )
+{
+	SortRequest *srq = ow->ow_srq;
+	long t;
+
+	if ( !BER_BVISNULL( &srq->srq_value )) {
+		t = ow->ow_target;
+	} else {
+		if ( srq->srq_offset == srq->srq_ocount )
+			t = ow->ow_total;
+		else if ( srq->srq_offset == 1 )
+			t = 1;
+		else if ( srq->srq_ocount && srq->srq_ocount != ow->ow_total )
+			t = srq->srq_offset > srq->srq_ocount ? ow->ow_total + 1 :
+				ow->ow_total * srq->srq_offset / srq->srq_ocount;
+		else
+			t = srq->srq_offset;
+		ow->ow_target = t;
+		/* out of range, the overlay will tell */
+		if ( t > ow->ow_total && ( ow->ow_total || ow->ow_counted )) {
+			ow->ow_phase = MDB_OW_DONE;
+			return;
+		}
+	}
+	ow->ow_lo = t - srq->srq_before;
+	/* past all of them by value, the overlay sends the last one */
+	if ( ow->ow_counted && ow->ow_lo > ow->ow_total )
+		ow->ow_lo = ow->ow_total;
+	if ( ow->ow_lo < 1 )
+		ow->ow_lo = 1;
+	ow->ow_hi = srq->srq_after < 0 ? LONG_MAX : t + srq->srq_after;
+}
+
+/* Start walking the ordering index for the sort request of a search.
+ * Returns 0 if the search should take its IDs from the walk.
+ */
+int
+mdb_order_open(
+	Operation *op,
+	MDB_txn *txn,
+	SortRequest *srq,
+	ID ncand,
+	mdb_orderwalk *ow )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	AttributeDescription *ad = srq->srq_ad;
+	AttrInfo *ai;
+	MDB_stat ms;
+	int adx, rc, type, need;
+
+	if ( !mdb->mi_order || !mdb->mi_id2order )
+		return -1;
+	ai = mdb_attr_mask( mdb, ad );
+	type = mdb_order_type( srq->srq_ordering );
+	if ( !ai || ai->ai_desc != ad ||
+		!( ai->ai_indexmask & MDB_INDEX_ORDER ) ||
+		( ai->ai_indexmask & MDB_INDEX_DELETING ) ||
+		!type || type != mdb_order_adtype( ad ))
+		return -1;
+	adx = mdb->mi_adxs[ad->ad_index];
+	if ( !adx )
+		return -1;
+
+	/* a few candidates are cheaper to sort, but a paged search
+	 * has to go on the way it started
+	 */
+	if ( BER_BVISNULL( &srq->srq_resume )) {
+		mdb_stat( txn, mdb->mi_id2entry, &ms );
+		if ( ncand * MDB_ORDER_SPARSE < ms.ms_entries )
+			return -1;
+	} else {
+		unsigned char *pfx = (unsigned char *)srq->srq_resume.bv_val + sizeof(ID);
+
+		/* must be a position in this index */
+		if ( srq->srq_resume.bv_len < sizeof(ID) + 3 ||
+			srq->srq_resume.bv_len > sizeof(ID) + MDB_ORDER_MAXKEY ||
+			pfx[0] != (( adx >> 8 ) & 0xff ) || pfx[1] != ( adx & 0xff ))
+			return -1;
+	}
+
+	memset( ow, 0, sizeof( *ow ));
+	rc = mdb_cursor_open( txn, mdb->mi_order, &ow->ow_mc );
+	if ( rc )
+		return -1;
+	ow->ow_srq = srq;
+	ow->ow_ksize = MDB_ORDER_MAXKEY;
+	ow->ow_key.bv_val = op->o_tmpalloc( 2 * MDB_ORDER_MAXKEY + 2,
+		op->o_tmpmemctx );
+	ow->ow_pfx.bv_val = ow->ow_key.bv_val + MDB_ORDER_MAXKEY;
+	mdb_order_prefix( adx, &ow->ow_pfx );
+	ow->ow_total = srq->srq_total;
+
+	if ( !BER_BVISNULL( &srq->srq_value )) {
+		ow->ow_akey.bv_val = op->o_tmpalloc( MDB_ORDER_MAXKEY, op->o_tmpmemctx );
+		mdb_order_prefix( adx, &ow->ow_akey );
+		ow->ow_akey.bv_val[ow->ow_akey.bv_len++] = MDB_ORDER_VALUE;
+		mdb_order_val( type, &srq->srq_value, &ow->ow_akey );
+		need = srq->srq_before > 0 || ( srq->srq_count && !ow->ow_total );
+	} else {
+		/* the target depends on the count, unless it's the first */
+		need = !ow->ow_total &&
+			!( srq->srq_offset == 1 && srq->srq_ocount != 1 );
+	}
+
+	if ( !BER_BVISNULL( &srq->srq_resume )) {
+		struct berval key;
+		ID id;
+
+		memcpy( &id, srq->srq_resume.bv_val, sizeof(ID) );
+		key.bv_val = srq->srq_resume.bv_val + sizeof(ID);
+		key.bv_len = srq->srq_resume.bv_len - sizeof(ID);
+		ow->ow_phase = MDB_OW_SEND;
+		mdb_order_window( ow );
+		mdb_order_seek( ow, &key, id );
+	} else {
+		if ( need ) {
+			ow->ow_phase = MDB_OW_COUNT;
+		} else {
+			ow->ow_phase = MDB_OW_SEND;
+			/* by value, the window is known when the walk gets there */
+			if ( BER_BVISNULL( &srq->srq_value ))
+				mdb_order_window( ow );
+		}
+		mdb_order_rewind( ow );
+	}
+	srq->srq_sorted = 1;
+	return 0;
+}
+
+/* The next ID of the walk, or NOID at the end */
+ID
+mdb_order_next( Operation *op, mdb_orderwalk *ow )
+{
+	SortRequest *srq = ow->ow_srq;
+	MDB_val key, data;
+	struct berval bkey;
+	ID id;
+	int rc;
+
+	for (;;) {
+		if ( ow->ow_phase == MDB_OW_DONE )
+			return NOID;
+		if ( ow->ow_placed < 0 ) {
+			rc = MDB_NOTFOUND;
+		} else if ( ow->ow_placed ) {
+			rc = mdb_cursor_get( ow->ow_mc, &key, &data, MDB_GET_CURRENT );
+		} else if ( !srq->srq_reverse ) {
+			rc = mdb_cursor_get( ow->ow_mc, &key, &data, MDB_NEXT );
+		} else {
+			rc = mdb_cursor_get( ow->ow_mc, &key, &data, MDB_NEXT_DUP );
+			if ( rc == MDB_NOTFOUND ) {
+				rc = mdb_cursor_get( ow->ow_mc, &key, &data, MDB_PREV_NODUP );
+				if ( rc == 0 )
+					rc = mdb_cursor_get( ow->ow_mc, &key, &data, MDB_FIRST_DUP );
+			}
+		}
+		ow->ow_placed = 0;
+		if ( rc == 0 && ( key.mv_size < 3 || key.mv_size > ow->ow_ksize ||
+			memcmp( key.mv_data, ow->ow_pfx.bv_val, 2 )))
+			rc = MDB_NOTFOUND;
+
+		if ( rc ) {
+			if ( rc != MDB_NOTFOUND )
+				Debug( LDAP_DEBUG_ANY, "mdb_order_next: err %s(%d)\n",
+					mdb_strerror(rc), rc );
+			if ( ow->ow_phase == MDB_OW_COUNT ) {
+				ow->ow_total = ow->ow_pos;
+				ow->ow_counted = 1;
+				if ( !ow->ow_target )
+					ow->ow_target = ow->ow_pos + 1;
+				ow->ow_phase = MDB_OW_SEND;
+				mdb_order_window( ow );
+				mdb_order_rewind( ow );
+				continue;
+			}
+			if ( ow->ow_akey.bv_val && !ow->ow_target )
+				ow->ow_target = ow->ow_pos + 1;
+			/* the whole list was seen */
+			if ( !ow->ow_counted && BER_BVISNULL( &srq->srq_resume )) {
+				ow->ow_total = ow->ow_pos;
+				ow->ow_counted = 1;
+			}
+			ow->ow_phase = MDB_OW_DONE;
+			return NOID;
+		}
+
+		memcpy( &id, data.mv_data, sizeof(ID) );
+		memcpy( ow->ow_key.bv_val, key.mv_data, key.mv_size );
+		ow->ow_key.bv_len = key.mv_size;
+		ow->ow_id = id;
+
+		/* got to the VLV assertion value */
+		if ( ow->ow_akey.bv_val && !ow->ow_target ) {
+			bkey = ow->ow_key;
+			rc = mdb_order_cmp( &bkey, &ow->ow_akey );
+			if ( srq->srq_reverse ? rc <= 0 : rc >= 0 ) {
+				ow->ow_target = ow->ow_pos + 1;
+				if ( ow->ow_phase == MDB_OW_SEND ) {
+					mdb_order_window( ow );
+				} else if ( !srq->srq_count || ow->ow_total ) {
+					/* no need to count the rest */
+					ow->ow_phase = MDB_OW_SEND;
+					mdb_order_window( ow );
+					mdb_order_rewind( ow );
+					continue;
+				}
+			}
+		}
+		return id;
+	}
+}
+
+/* The current entry matches the search. Returns 1 if it is to be sent. */
+int
+mdb_order_match( mdb_orderwalk *ow )
+{
+	SortRequest *srq = ow->ow_srq;
+
+	ow->ow_pos++;
+	if ( ow->ow_phase != MDB_OW_SEND || !ow->ow_lo || ow->ow_pos < ow->ow_lo )
+		return 0;
+	if ( ow->ow_pos <= ow->ow_hi )
+		return 1;
+
+	/* the first one past the window starts the next page */
+	if ( ow->ow_pos == ow->ow_hi + 1 && BER_BVISNULL( &srq->srq_next )) {
+		srq->srq_next.bv_len = sizeof(ID) + ow->ow_key.bv_len;
+		srq->srq_next.bv_val = ch_malloc( srq->srq_next.bv_len );
+		memcpy( srq->srq_next.bv_val, &ow->ow_id, sizeof(ID) );
+		memcpy( srq->srq_next.bv_val + sizeof(ID), ow->ow_key.bv_val,
+			ow->ow_key.bv_len );
+	}
+	/* go on counting if asked to */
+	if ( !srq->srq_count || ow->ow_counted || ow->ow_total )
+		ow->ow_phase = MDB_OW_DONE;
+	return 0;
+}
+
+/* Get the cursor back to where it was after the read txn was renewed */
+void
+mdb_order_renew( mdb_orderwalk *ow, MDB_txn *txn )
+{
+	MDB_val key, data;
+
+	mdb_cursor_renew( txn, ow->ow_mc );
+	if ( ow->ow_phase == MDB_OW_DONE || ow->ow_placed )
+		return;
+	key.mv_data = ow->ow_key.bv_val;
+	key.mv_size = ow->ow_key.bv_len;
+	data.mv_data = &ow->ow_id;
+	data.mv_size = sizeof(ID);
+	if ( mdb_cursor_get( ow->ow_mc, &key, &data, MDB_GET_BOTH ))
+		/* it was deleted meanwhile, go on from the next one */
+		mdb_order_seek( ow, &ow->ow_key, ow->ow_id );
+}
+
+/* Done walking, tell the overlay where the window was */
+void
+mdb_order_close( Operation *op, mdb_orderwalk *ow )
+{
+	SortRequest *srq = ow->ow_srq;
+
+	srq->srq_target = ow->ow_target;
+	if ( ow->ow_counted )
+		srq->srq_total = ow->ow_total;
+	else if ( BER_BVISNULL( &srq->srq_resume ) && ow->ow_pos > srq->srq_total )
+		srq->srq_total = ow->ow_pos;
+
+	mdb_cursor_close( ow->ow_mc );
+	op->o_tmpfree( ow->ow_key.bv_val, op->o_tmpmemctx );
+	if ( ow->ow_akey.bv_val )
+		op->o_tmpfree( ow->ow_akey.bv_val, op->o_tmpmemctx );
+}
@@ -32,6 +32,9 @@ void mdb_attr_flush( struct mdb_info *mdb );
 int mdb_attr_slot( struct mdb_info *mdb,
 	AttributeDescription *desc, int *insert );
 
+int mdb_attr_cover( struct mdb_info *mdb,
+	AttributeDescription *ad, int writing );
+
 int mdb_attr_dbs_open( BackendDB *be, MDB_txn *txn, struct config_reply_s *cr );
 void mdb_attr_dbs_close( struct mdb_info *mdb );
 
@@ -64,6 +67,7 @@ void mdb_ad_unwind( struct mdb_info *mdb, int prev_ads );
  */
 
 int mdb_back_init_cf( BackendInfo *bi );
+void mdb_online_index_start( BackendDB *be, ID next );
 
 /*
  * dn2entry.c
@@ -162,6 +166,32 @@ void mdb_dn2id_wrestore(
 
 MDB_cmp_func mdb_dup_compare;
 
+/*
+ * ecache.c
+ */
+
+void mdb_ecache_init( mdb_ecache *ec );
+void mdb_ecache_destroy( mdb_ecache *ec );
+int mdb_ecache_get( Operation *op, MDB_txn *txn, ID id, Entry **e );
+void mdb_ecache_put( Operation *op, MDB_txn *txn, Entry *e );
+void mdb_ecache_del( struct mdb_info *mdb, MDB_txn *txn, ID id );
+void mdb_ecache_release( Entry *e );
+void mdb_ecache_resize( struct mdb_info *mdb, unsigned max );
+
+/*
+ * dncache.c
+ */
+
+void mdb_dncache_init( mdb_dncache *dc );
+void mdb_dncache_destroy( mdb_dncache *dc );
+void mdb_dncache_stats( mdb_dncache *dc, unsigned long *hits,
+	unsigned long *misses );
+int mdb_dncache_get( Operation *op, MDB_txn *txn, struct berval *ndn,
+	ID *id, struct berval *name );
+void mdb_dncache_put( Operation *op, MDB_txn *txn, struct berval *ndn,
+	struct berval *name, ID id );
+void mdb_dncache_del( struct mdb_info *mdb, MDB_txn *txn, ID id, int subtree );
+
 /*
  * filterentry.c
  */
@@ -174,6 +204,16 @@ int mdb_filter_candidates(
 	ID *tmp,
 	ID *stack );
 
+/*
+ * group.c
+ */
+
+void mdb_wgroup_init( mdb_wgroup *wg );
+void mdb_wgroup_destroy( mdb_wgroup *wg );
+int mdb_wgroup_begin( Operation *op, struct mdb_info *mdb, mdb_op_info *moi );
+int mdb_wtxn_commit( struct mdb_info *mdb, mdb_op_info *moi );
+void mdb_wtxn_abort( struct mdb_info *mdb, mdb_op_info *moi );
+
 /*
  * id2entry.c
  */
@@ -210,15 +250,22 @@ int mdb_id2edata(
 	ID id,
 	MDB_val *data);
 
+int mdb_cover_put(
+	Operation *op,
+	MDB_txn *txn,
+	Entry *e );
+
 int mdb_entry_return( Operation *op, Entry *e );
 BI_entry_release_rw mdb_entry_release;
 BI_entry_get_rw mdb_entry_get;
 BI_op_txn mdb_txn;
 
-int mdb_entry_decode( Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e );
+int mdb_entry_decode( Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e,
+	mdb_proj *mp );
 
 void mdb_reader_flush( MDB_env *env );
 int mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **moi );
+int mdb_txn_reader( Operation *op, struct mdb_info *mdb, MDB_txn *txn );
 
 int mdb_mval_put(Operation *op, MDB_cursor *mc, ID id, Attribute *a);
 int mdb_mval_del(Operation *op, MDB_cursor *mc, ID id, Attribute *a);
@@ -238,13 +285,21 @@ int mdb_idl_fetch_key(
 	MDB_cursor	**saved_cursor,
 	int                     get_flag );
 
+int mdb_idl_count_key(
+	BackendDB	*be,
+	MDB_txn		*txn,
+	MDB_dbi		dbi,
+	MDB_val		*key,
+	ID			*count );
+
 int mdb_idl_insert( ID *ids, ID id );
 
 typedef int (mdb_idl_keyfunc)(
 	BackendDB *be,
 	MDB_cursor *mc,
 	struct berval *key,
-	ID id );
+	ID id,
+	mdb_idxstat *st );
 
 mdb_idl_keyfunc mdb_idl_insert_keys;
 mdb_idl_keyfunc mdb_idl_delete_keys;
@@ -262,6 +317,11 @@ mdb_idl_union(
 ID mdb_idl_first( ID *ids, ID *cursor );
 ID mdb_idl_next( ID *ids, ID *cursor );
 
+/* bitmap IDLs, with 64 bit IDs only */
+ID mdb_idl_bits_first( ID *ids );
+ID mdb_idl_bits_last( ID *ids );
+size_t mdb_idl_bits_pack( ID *ids, size_t n, ID *words );
+
 void mdb_idl_sort( ID *ids, ID *tmp );
 int mdb_idl_append( ID *a, ID *b );
 int mdb_idl_append_one( ID *ids, ID id );
@@ -314,6 +374,26 @@ mdb_index_recrun LDAP_P((
 
 int mdb_index_entry LDAP_P(( Operation *op, MDB_txn *t, int r, Entry *e ));
 
+int mdb_idxstat_get( struct mdb_info *mdb, MDB_txn *txn,
+	AttributeDescription *ad, mdb_idxstat *stats );
+int mdb_idxstat_update( struct mdb_info *mdb, MDB_txn *txn,
+	AttrInfo *ai, mdb_idxstat *delta );
+int mdb_idxstat_clear( struct mdb_info *mdb, MDB_txn *txn,
+	AttributeDescription *ad );
+
+int mdb_idxbuild_put( struct mdb_info *mdb, MDB_txn *txn, ID next );
+int mdb_idxbuild_del( struct mdb_info *mdb, MDB_txn *txn );
+int mdb_idxbuild_restore( struct mdb_info *mdb, MDB_txn *txn, ID *next );
+int mdb_idxbuilt_put( struct mdb_info *mdb, MDB_txn *txn, slap_mask_t built );
+int mdb_idxbuilt_restore( struct mdb_info *mdb, MDB_txn *txn );
+
+void mdb_keybuf_init( mdb_keybuf *kb );
+void mdb_keybuf_free( mdb_keybuf *kb );
+void mdb_keybuf_redo( mdb_keybuf *kb, ID id );
+mdb_idl_keyfunc mdb_keybuf_add;
+int mdb_keyrec_write( Operation *op, MDB_cursor *mc, mdb_keyrec *kr,
+	mdb_idxstat *st );
+
 #define mdb_index_entry_add(op,t,e) \
 	mdb_index_entry((op),(t),SLAP_INDEX_ADD_OP,(e))
 #define mdb_index_entry_del(op,t,e) \
@@ -333,12 +413,34 @@ mdb_key_read(
     MDB_cursor **saved_cursor,
         int get_flags );
 
+extern int
+mdb_key_count(
+	Backend	*be,
+	MDB_txn *txn,
+	MDB_dbi dbi,
+	struct berval *k,
+	ID *count );
+
 /*
  * nextid.c
  */
 
 int mdb_next_id( BackendDB *be, MDB_cursor *mc, ID *id );
 
+/*
+ * order.c
+ */
+
+int mdb_order_supported( AttributeDescription *ad );
+int mdb_order_put( Operation *op, MDB_txn *txn, Entry *e );
+int mdb_order_del( struct mdb_info *mdb, MDB_txn *txn, ID id );
+int mdb_order_open( Operation *op, MDB_txn *txn, SortRequest *srq,
+	ID ncand, mdb_orderwalk *ow );
+ID mdb_order_next( Operation *op, mdb_orderwalk *ow );
+int mdb_order_match( mdb_orderwalk *ow );
+void mdb_order_renew( mdb_orderwalk *ow, MDB_txn *txn );
+void mdb_order_close( Operation *op, mdb_orderwalk *ow );
+
 /*
  * modify.c
  */
@@ -405,6 +507,7 @@ extern BI_tool_entry_modify		mdb_tool_entry_modify;
 extern BI_tool_entry_delete		mdb_tool_entry_delete;
 
 extern mdb_idl_keyfunc mdb_tool_idl_add;
+extern mdb_idl_keyfunc mdb_tool_sort_add;
 
 LDAP_END_DECL
 
@@ -325,6 +325,9 @@ static void scope_chunk_ret( Operation *op, ID2 *scopes )
 
 static void *search_stack( Operation *op );
 
+struct mdb_psearch;
+static void mdb_psearch_reset( Operation *op, struct mdb_psearch *ps );
+
 typedef struct ww_ctx {
 	MDB_txn *txn;
 	MDB_cursor *mcd;	/* if set, save cursor context */
@@ -332,6 +335,7 @@ typedef struct ww_ctx {
 	MDB_val data;
 	int flag;
 	unsigned nentries;
+	struct mdb_psearch *ps;	/* entries read ahead from txn */
 } ww_ctx;
 
 /* ITS#7904 if we get blocked while writing results to client,
@@ -356,6 +360,8 @@ mdb_rtxn_snap( Operation *op, ww_ctx *ww )
 		ww->data.mv_data = op->o_tmpalloc( data.mv_size, op->o_tmpmemctx );
 		memcpy(ww->data.mv_data, data.mv_data, data.mv_size);
 	}
+	if ( ww->ps )
+		mdb_psearch_reset( op, ww->ps );
 	mdb_txn_reset( ww->txn );
 	ww->flag = 1;
 }
@@ -370,7 +376,8 @@ mdb_writewait( Operation *op, slap_callback *sc )
 }
 
 static int
-mdb_waitfixup( Operation *op, ww_ctx *ww, MDB_cursor *mci, MDB_cursor *mcd, IdScopes *isc )
+mdb_waitfixup( Operation *op, ww_ctx *ww, MDB_cursor *mci, MDB_cursor *mcd,
+	MDB_cursor *mcc, IdScopes *isc )
 {
 	MDB_val key;
 	int rc = 0;
@@ -378,6 +385,8 @@ mdb_waitfixup( Operation *op, ww_ctx *ww, MDB_cursor *mci, MDB_cursor *mcd, IdSc
 	mdb_txn_renew( ww->txn );
 	mdb_cursor_renew( ww->txn, mci );
 	mdb_cursor_renew( ww->txn, mcd );
+	if ( mcc )
+		mdb_cursor_renew( ww->txn, mcc );
 
 	key.mv_size = sizeof(ID);
 	if ( ww->mcd ) {	/* scope-based search using dn2id_walk */
@@ -416,11 +425,826 @@ mdb_waitfixup( Operation *op, ww_ctx *ww, MDB_cursor *mci, MDB_cursor *mcd, IdSc
 	return rc;
 }
 
+static void
+mdb_proj_add( Operation *op, mdb_proj *mp, AttributeDescription *ad )
+{
+	if ( mp->mp_nads == mp->mp_maxads ) {
+		mp->mp_maxads = mp->mp_maxads ? mp->mp_maxads * 2 : 8;
+		mp->mp_ads = op->o_tmprealloc( mp->mp_ads,
+			mp->mp_maxads * sizeof(AttributeDescription *), op->o_tmpmemctx );
+	}
+	mp->mp_ads[mp->mp_nads++] = ad;
+}
+
+/* Add the attributes tested by a filter. Returns 1 if the filter
+ * may look at any attribute.
+ */
+static int
+mdb_proj_filter( Operation *op, mdb_proj *mp, Filter *f )
+{
+	for ( ; f; f = f->f_next ) {
+		switch ( f->f_choice ) {
+		case LDAP_FILTER_AND:
+		case LDAP_FILTER_OR:
+			if ( mdb_proj_filter( op, mp, f->f_list ))
+				return 1;
+			break;
+		case LDAP_FILTER_NOT:
+			if ( mdb_proj_filter( op, mp, f->f_not ))
+				return 1;
+			break;
+		case LDAP_FILTER_EQUALITY:
+		case LDAP_FILTER_GE:
+		case LDAP_FILTER_LE:
+		case LDAP_FILTER_APPROX:
+			mdb_proj_add( op, mp, f->f_av_desc );
+			break;
+		case LDAP_FILTER_SUBSTRINGS:
+			mdb_proj_add( op, mp, f->f_sub_desc );
+			break;
+		case LDAP_FILTER_PRESENT:
+			mdb_proj_add( op, mp, f->f_desc );
+			break;
+		case LDAP_FILTER_EXT:
+			if ( !f->f_mr_desc )
+				return 1;
+			mdb_proj_add( op, mp, f->f_mr_desc );
+			break;
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+/* Is every attribute the projection looks at kept in the cover DB?
+ * Attributes with subtypes would need the subtypes to be covered as
+ * well, and dynamic ones aren't stored at all.
+ */
+static int
+mdb_search_cover_ad( struct mdb_info *mdb, AttributeDescription *ad )
+{
+	return !ad->ad_type->sat_subtypes &&
+		!( ad->ad_type->sat_flags & SLAP_AT_DYNAMIC ) &&
+		mdb_attr_cover( mdb, ad, 0 );
+}
+
+static int
+mdb_search_cover( Operation *op, mdb_proj *mp )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	AttributeName *an;
+	int i;
+
+	if ( !mdb->mi_cover || mp->mp_user || mp->mp_oper )
+		return 0;
+	/* names without a description, such as 1.1, match nothing */
+	for ( an = mp->mp_attrs; an && an->an_name.bv_val; an++ ) {
+		if ( an->an_desc && !mdb_search_cover_ad( mdb, an->an_desc ))
+			return 0;
+	}
+	for ( i = 0; i < mp->mp_nads; i++ ) {
+		if ( !mdb_search_cover_ad( mdb, mp->mp_ads[i] ))
+			return 0;
+	}
+	return 1;
+}
+
+/* Work out which attributes of each candidate the search will look
+ * at: those requested, those in the filter, those the ACLs test, and
+ * the few the search itself relies on. Returns NULL if the entries
+ * must be decoded in full.
+ */
+static mdb_proj *
+mdb_search_proj( Operation *op, mdb_proj *mp )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	slap_mask_t flags = slap_attr_flags( op->ors_attrs );
+	AttributeName *an;
+	AccessControl *acl;
+	Access *b;
+
+	/* overlays and callbacks may look at anything */
+	if ( op->o_callback || SLAP_ISOVERLAY( op->o_bd ) ||
+		SLAP_ISGLOBALOVERLAY( frontendDB ))
+		return NULL;
+#ifdef LDAP_SLAPI
+	if ( slapi_plugins_used )
+		return NULL;
+#endif
+
+	memset( mp, 0, sizeof( *mp ));
+	mp->mp_user = SLAP_USERATTRS( flags );
+	mp->mp_oper = SLAP_OPATTRS( flags );
+	if ( mp->mp_user && mp->mp_oper )
+		return NULL;
+	for ( an = op->ors_attrs; an && an->an_name.bv_val; an++ ) {
+		if ( an->an_oc )
+			return NULL;
+	}
+	mp->mp_attrs = op->ors_attrs;
+
+	mdb_proj_add( op, mp, slap_schema.si_ad_objectClass );
+	mdb_proj_add( op, mp, slap_schema.si_ad_structuralObjectClass );
+	mdb_proj_add( op, mp, slap_schema.si_ad_ref );
+	mdb_proj_add( op, mp, slap_schema.si_ad_aliasedObjectName );
+
+	if ( mdb_proj_filter( op, mp, op->ors_filter ))
+		goto full;
+
+	if ( !be_isroot( op )) {
+		acl = op->o_bd->be_acl ? op->o_bd->be_acl : frontendDB->be_acl;
+		for ( ; acl; acl = acl->acl_next ) {
+			if ( mdb_proj_filter( op, mp, acl->acl_filter ))
+				goto full;
+			for ( b = acl->acl_access; b; b = b->a_next ) {
+				/* sets and dynamic ACLs can reach anything */
+				if ( !BER_BVISEMPTY( &b->a_set_pat ))
+					goto full;
+#ifdef SLAP_DYNACL
+				if ( b->a_dynacl )
+					goto full;
+#endif
+				if ( b->a_dn_at )
+					mdb_proj_add( op, mp, b->a_dn_at );
+				if ( b->a_realdn_at )
+					mdb_proj_add( op, mp, b->a_realdn_at );
+			}
+		}
+	}
+
+	mp->mp_nwant = mdb->mi_numads + 1;
+	mp->mp_want = op->o_tmpcalloc( mp->mp_nwant, 1, op->o_tmpmemctx );
+	mp->mp_cover = mdb_search_cover( op, mp );
+	return mp;
+
+full:
+	op->o_tmpfree( mp->mp_ads, op->o_tmpmemctx );
+	return NULL;
+}
+
+/* Fetch the stored data of candidate id, from the cover DB if the
+ * search is covered (mcc is set) and the entry has a cover record.
+ */
+static int
+mdb_search_edata( Operation *op, MDB_cursor *mci, MDB_cursor *mcc,
+	ID id, MDB_val *data )
+{
+	if ( mcc && mdb_id2edata( op, mcc, id, data ) == 0 )
+		return 0;
+	return mdb_id2edata( op, mci, id, data );
+}
+
+/* Read-ahead of candidates (searchprefetch)
+ *
+ * On a cold page cache each candidate costs a blocking page fault on
+ * the id2entry or cover leaf that holds it. Keep the leaves of the next
+ * searchprefetch candidates requested from the OS, so their reads
+ * overlap with testing the current ones. List and range cursors both
+ * advance by one per candidate, so the window is a cursor distance.
+ */
+static void
+mdb_search_prefetch( struct mdb_info *mdb, MDB_txn *txn, MDB_dbi dbi,
+	ID *ids, ID cursor, ID *pfcursor )
+{
+	MDB_val key;
+	ID id;
+
+	if ( *pfcursor == NOID )
+		return;
+	if ( *pfcursor < cursor )
+		*pfcursor = cursor;
+
+	key.mv_data = &id;
+	key.mv_size = sizeof(ID);
+	while ( *pfcursor - cursor < mdb->mi_search_prefetch ) {
+		id = mdb_idl_next( ids, pfcursor );
+		if ( id == NOID ) {
+			*pfcursor = NOID;
+			break;
+		}
+		mdb_prefetch( txn, dbi, &key );
+	}
+}
+
+/* Whether candidate id is within the search scope, when the candidates
+ * aren't walked by scope. isc is left with the RDNs of the entry below
+ * the scope it was found in. Returns 1 or 0, or an MDB error.
+ */
+static int
+mdb_search_inscope( Operation *op, IdScopes *isc, ID baseid, ID id )
+{
+	int rc;
+
+	isc->numrdns = 0;
+	switch( op->ors_scope ) {
+	case LDAP_SCOPE_BASE:
+		/* This is always true, yes? */
+		return id == baseid;
+
+#ifdef LDAP_SCOPE_CHILDREN
+	case LDAP_SCOPE_CHILDREN:
+		if ( id == baseid ) return 0;
+		/* Fall-thru */
+#endif
+	case LDAP_SCOPE_SUBTREE:
+		if ( id == baseid ) return 1;
+		/* Fall-thru */
+	case LDAP_SCOPE_ONELEVEL:
+		if ( id == baseid ) return 0;
+		isc->id = id;
+		isc->nscope = 0;
+		rc = mdb_idscopes( op, isc );
+		if ( rc )
+			return rc;
+		return isc->nscope != 0;
+	}
+	return 0;
+}
+
+/* Set the DN of e, a candidate below base, from the RDNs left in isc
+ * by mdb_idscopes(), or by mdb_dn2id_walk() if walk is set. The DN is
+ * allocated in op's memory context.
+ */
+static void
+mdb_search_name( Operation *op, MDB_txn *txn, IdScopes *isc, Entry *base,
+	int walk, Entry *e )
+{
+	struct berval pdn, pndn;
+	char *d, *n;
+	int i;
+
+	/* child of base, just append RDNs to base->e_name */
+	if ( walk || isc->scopes[isc->nscope].mid == base->e_id ) {
+		pdn = base->e_name;
+		pndn = base->e_nname;
+	} else {
+		mdb_id2name( op, txn, &isc->mc, isc->scopes[isc->nscope].mid, &pdn, &pndn );
+	}
+	e->e_name.bv_len = pdn.bv_len;
+	e->e_nname.bv_len = pndn.bv_len;
+	for (i=0; i<isc->numrdns; i++) {
+		e->e_name.bv_len += isc->rdns[i].bv_len + 1;
+		e->e_nname.bv_len += isc->nrdns[i].bv_len + 1;
+	}
+	e->e_name.bv_val = op->o_tmpalloc(e->e_name.bv_len + 1, op->o_tmpmemctx);
+	e->e_nname.bv_val = op->o_tmpalloc(e->e_nname.bv_len + 1, op->o_tmpmemctx);
+	d = e->e_name.bv_val;
+	n = e->e_nname.bv_val;
+	if (walk) {
+		/* RDNs are in top-down order */
+		for (i=isc->numrdns-1; i>=0; i--) {
+			memcpy(d, isc->rdns[i].bv_val, isc->rdns[i].bv_len);
+			d += isc->rdns[i].bv_len;
+			*d++ = ',';
+			memcpy(n, isc->nrdns[i].bv_val, isc->nrdns[i].bv_len);
+			n += isc->nrdns[i].bv_len;
+			*n++ = ',';
+		}
+	} else {
+		/* RDNs are in bottom-up order */
+		for (i=0; i<isc->numrdns; i++) {
+			memcpy(d, isc->rdns[i].bv_val, isc->rdns[i].bv_len);
+			d += isc->rdns[i].bv_len;
+			*d++ = ',';
+			memcpy(n, isc->nrdns[i].bv_val, isc->nrdns[i].bv_len);
+			n += isc->nrdns[i].bv_len;
+			*n++ = ',';
+		}
+	}
+
+	if (pdn.bv_len) {
+		memcpy(d, pdn.bv_val, pdn.bv_len+1);
+		memcpy(n, pndn.bv_val, pndn.bv_len+1);
+	} else {
+		*--d = '\0';
+		*--n = '\0';
+		e->e_name.bv_len--;
+		e->e_nname.bv_len--;
+	}
+	if (pndn.bv_val != base->e_nname.bv_val) {
+		op->o_tmpfree(pndn.bv_val, op->o_tmpmemctx);
+		op->o_tmpfree(pdn.bv_val, op->o_tmpmemctx);
+	}
+}
+
+/* Whether the search may return e at all, whatever the filter says */
+static int
+mdb_search_visible( Operation *op, Entry *e, int isbase )
+{
+	if ( is_entry_subentry( e ) ) {
+		if( op->oq_search.rs_scope != LDAP_SCOPE_BASE ) {
+			if(!get_subentries_visibility( op )) {
+				/* only subentries are visible */
+				return 0;
+			}
+
+		} else if ( get_subentries( op ) &&
+			!get_subentries_visibility( op ))
+		{
+			/* only subentries are visible */
+			return 0;
+		}
+
+	} else if ( get_subentries_visibility( op )) {
+		/* only subentries are visible */
+		return 0;
+	}
+
+	/* aliases were already dereferenced in candidate list */
+	if ( op->ors_deref & LDAP_DEREF_SEARCHING ) {
+		/* but if the search base is an alias, and we didn't
+		 * deref it when finding, return it.
+		 */
+		if ( is_entry_alias(e) &&
+			((op->ors_deref & LDAP_DEREF_FINDING) || !isbase ))
+		{
+			return 0;
+		}
+	}
+
+	if ( !get_manageDSAit( op ) && is_entry_glue( e )) {
+		return 0;
+	}
+	return 1;
+}
+
+/* Parallel processing of candidates (searchthreads)
+ *
+ * When walking a long candidate list, the search thread looks ahead
+ * one window of candidates at a time. It checks their scope, builds
+ * their DNs and fetches their raw data from its own read txn. Then it
+ * and up to searchthreads-1 pool threads take them in batches: each
+ * candidate is decoded once and tested against the filter as the user
+ * of the search. When the entry would go through send_search_entry()
+ * unchanged, its access control checks and encoding are done there too.
+ * The search thread doesn't go on until the whole window is done, so
+ * the helpers never touch the data after the txn moves on. It then
+ * takes the results in candidate order: candidates that can't be
+ * returned are skipped, the others are handed over decoded, with their
+ * pdu if there is one, so that scope, filter and decoding aren't done
+ * again and only the write is left. Whatever a helper couldn't work
+ * out goes through the normal loop.
+ *
+ * The decoded entries point into the txn's snapshot. They are dropped
+ * with the window whenever the search thread releases its txn.
+ */
+#define MDB_PS_BATCH	64
+
+/* What became of a candidate */
+#define MDB_PS_UNKNOWN	0	/* left to the search loop */
+#define MDB_PS_DROP	1	/* not returned */
+#define MDB_PS_ENTRY	2	/* decoded and matched */
+
+typedef struct mdb_psearch {
+	ldap_pvt_thread_mutex_t	ps_mutex;
+	ldap_pvt_thread_cond_t	ps_cond;
+	int		ps_refcnt;		/* search thread + pending helpers */
+	int		ps_done;		/* search is over */
+	int		ps_nbatch;		/* batches in the window */
+	int		ps_next;		/* next batch to claim */
+	int		ps_busy;		/* batches being worked on */
+	int		ps_count;		/* candidates in the window */
+	int		ps_pos;
+	int		ps_max;
+	int		ps_encode;		/* helpers may encode the entries */
+	unsigned	ps_threads;
+	size_t	ps_txnid;		/* snapshot the window was read from */
+	Operation	*ps_op;
+	mdb_proj	*ps_mp;
+	ID		*ps_ids;
+	MDB_val	*ps_data;
+	Entry	*ps_names;		/* DNs of the candidates in scope */
+	Entry	**ps_ents;		/* entries for the search thread */
+	BerElement	**ps_bers;		/* ...and their pdus */
+	char	*ps_state;
+} mdb_psearch;
+
+/* Entries whose filter result depends on more than the stored
+ * attributes and the DN must be tested by the search thread.
+ */
+static int
+mdb_psearch_filter_ok( Filter *f )
+{
+	AttributeDescription *ad;
+
+	for ( ; f; f = f->f_next ) {
+		switch ( f->f_choice ) {
+		case LDAP_FILTER_AND:
+		case LDAP_FILTER_OR:
+			if ( !mdb_psearch_filter_ok( f->f_list ))
+				return 0;
+			continue;
+		case LDAP_FILTER_NOT:
+			if ( !mdb_psearch_filter_ok( f->f_not ))
+				return 0;
+			continue;
+		case LDAP_FILTER_EQUALITY:
+		case LDAP_FILTER_GE:
+		case LDAP_FILTER_LE:
+		case LDAP_FILTER_APPROX:
+			ad = f->f_av_desc;
+			break;
+		case LDAP_FILTER_SUBSTRINGS:
+			ad = f->f_sub_desc;
+			break;
+		case LDAP_FILTER_PRESENT:
+			ad = f->f_desc;
+			break;
+		case LDAP_FILTER_EXT:
+			ad = f->f_mr_desc;
+			if ( !ad )
+				continue;
+			break;
+		default:
+			continue;
+		}
+		if ( !ad || ad == slap_schema.si_ad_hasSubordinates ||
+			ad == slap_schema.si_ad_subschemaSubentry )
+			return 0;
+	}
+	return 1;
+}
+
+/* Whether send_search_entry() would send the entries of op as
+ * slap_encode_search_entry() encodes them: nothing must see them
+ * on the way, and no operational attribute is asked for, since
+ * backends and overlays may compute them.
+ */
+static int
+mdb_psearch_encode_ok( Operation *op )
+{
+	slap_callback *sc;
+	AttributeName *an;
+
+	if ( !op->o_conn || op->o_res_ber ||
+		op->o_conn->c_send_search_entry != slap_send_search_entry ||
+#ifdef LDAP_CONNECTIONLESS
+		op->o_conn->c_is_udp ||
+#endif
+		overlay_is_over( op->o_bd ) || overlay_is_over( frontendDB ) ||
+		SLAP_OPATTRS( slap_attr_flags( op->ors_attrs )))
+		return 0;
+
+	for ( sc = op->o_callback; sc; sc = sc->sc_next ) {
+		if ( sc->sc_response )
+			return 0;
+	}
+	for ( an = op->ors_attrs; an && !BER_BVISNULL( &an->an_name ); an++ ) {
+		if ( an->an_desc && is_at_operational( an->an_desc->ad_type ))
+			return 0;
+	}
+	return 1;
+}
+
+static mdb_psearch *
+mdb_psearch_init( Operation *op, mdb_proj *mp )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_psearch *ps;
+	int max;
+
+	if ( mdb->mi_search_threads < 2 || !( slapMode & SLAP_SERVER_MODE ) ||
+		!mdb_psearch_filter_ok( op->ors_filter ))
+		return NULL;
+
+	max = MDB_PS_BATCH * mdb->mi_search_threads;
+	ps = ch_calloc( 1, sizeof(mdb_psearch) + max * ( sizeof(MDB_val) +
+		sizeof(Entry) + sizeof(Entry *) + sizeof(BerElement *) +
+		sizeof(ID) + 1 ));
+	ldap_pvt_thread_mutex_init( &ps->ps_mutex );
+	ldap_pvt_thread_cond_init( &ps->ps_cond );
+	ps->ps_refcnt = 1;
+	ps->ps_max = max;
+	ps->ps_encode = mdb_psearch_encode_ok( op );
+	ps->ps_threads = mdb->mi_search_threads;
+	ps->ps_op = op;
+	ps->ps_mp = mp;
+	ps->ps_data = (MDB_val *)(ps+1);
+	ps->ps_names = (Entry *)(ps->ps_data + max);
+	ps->ps_ents = (Entry **)(ps->ps_names + max);
+	ps->ps_bers = (BerElement **)(ps->ps_ents + max);
+	ps->ps_ids = (ID *)(ps->ps_bers + max);
+	ps->ps_state = (char *)(ps->ps_ids + max);
+	return ps;
+}
+
+/* Free what is left in slot i of the window. Everything in it
+ * was allocated without a memory context.
+ */
+static void
+mdb_psearch_clear( Operation *op, mdb_psearch *ps, int i )
+{
+	if ( ps->ps_ents[i] ) {
+		mdb_entry_return( op, ps->ps_ents[i] );
+		ps->ps_ents[i] = NULL;
+	}
+	if ( ps->ps_bers[i] ) {
+		ber_free_buf( ps->ps_bers[i] );
+		ch_free( ps->ps_bers[i] );
+		ps->ps_bers[i] = NULL;
+	}
+	if ( ps->ps_names[i].e_name.bv_val ) {
+		ch_free( ps->ps_names[i].e_name.bv_val );
+		ch_free( ps->ps_names[i].e_nname.bv_val );
+		BER_BVZERO( &ps->ps_names[i].e_name );
+		BER_BVZERO( &ps->ps_names[i].e_nname );
+	}
+}
+
+/* Drop the rest of the window, before the search thread releases the
+ * txn its entries point into.
+ */
+static void
+mdb_psearch_reset( Operation *op, mdb_psearch *ps )
+{
+	for ( ; ps->ps_pos < ps->ps_count; ps->ps_pos++ )
+		mdb_psearch_clear( op, ps, ps->ps_pos );
+	ps->ps_count = 0;
+	ps->ps_pos = 0;
+}
+
+/* Drop a reference, the last one frees it */
+static void
+mdb_psearch_release( mdb_psearch *ps, int done )
+{
+	int last;
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	if ( done )
+		ps->ps_done = 1;
+	last = !--ps->ps_refcnt;
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+	if ( last ) {
+		ldap_pvt_thread_cond_destroy( &ps->ps_cond );
+		ldap_pvt_thread_mutex_destroy( &ps->ps_mutex );
+		ch_free( ps );
+	}
+}
+
+/* Set up a private copy of the search op for the helpers.
+ * The caller provides the Opheader.
+ */
+static mdb_proj *
+mdb_psearch_op( mdb_psearch *ps, Operation *op, mdb_proj *mp )
+{
+	Operation *sop = ps->ps_op;
+	Opheader *ohdr = op->o_hdr;
+
+	*op = *sop;
+	op->o_hdr = ohdr;
+	op->o_callback = NULL;
+	op->o_groups = NULL;
+	LDAP_SLIST_INIT( &op->o_extra );
+	if ( !ps->ps_mp )
+		return NULL;
+
+	*mp = *ps->ps_mp;
+	mp->mp_want = op->o_tmpcalloc( mp->mp_nwant, 1, op->o_tmpmemctx );
+	return mp;
+}
+
+/* Undo mdb_psearch_op() */
+static void
+mdb_psearch_op_done( Operation *op, mdb_proj *mp )
+{
+	slap_op_groups_free( op );
+	if ( mp )
+		op->o_tmpfree( mp->mp_want, op->o_tmpmemctx );
+}
+
+static void
+mdb_psearch_batch( Operation *op, mdb_proj *mp, mdb_psearch *ps, int b )
+{
+	void *memctx = op->o_tmpmemctx;
+	int i, end, rc;
+	Entry *e;
+	SlapReply rs = { REP_SEARCH };
+
+	end = ( b + 1 ) * MDB_PS_BATCH;
+	if ( end > ps->ps_count )
+		end = ps->ps_count;
+
+	for ( i = b * MDB_PS_BATCH; i < end; i++ ) {
+		if ( ps->ps_state[i] != MDB_PS_UNKNOWN || !ps->ps_data[i].mv_data )
+			continue;
+		/* what the search thread gets must be on the heap */
+		op->o_tmpmemctx = NULL;
+		rc = mdb_entry_decode( op, NULL, &ps->ps_data[i], ps->ps_ids[i], &e, mp );
+		op->o_tmpmemctx = memctx;
+		if ( rc )
+			continue;
+		e->e_id = ps->ps_ids[i];
+		e->e_name = ps->ps_names[i].e_name;
+		e->e_nname = ps->ps_names[i].e_nname;
+
+		if ( !mdb_search_visible( op, e, 0 )) {
+			ps->ps_state[i] = MDB_PS_DROP;
+		} else if ( !get_manageDSAit( op ) && is_entry_referral( e )) {
+			/* referrals are returned whatever the filter says */
+			ps->ps_state[i] = MDB_PS_ENTRY;
+		} else if ( test_filter( op, e, op->ors_filter ) != LDAP_COMPARE_TRUE ) {
+			ps->ps_state[i] = MDB_PS_DROP;
+		} else {
+			ps->ps_state[i] = MDB_PS_ENTRY;
+			if ( ps->ps_encode ) {
+				rs.sr_attrs = op->ors_attrs;
+				rs.sr_operational_attrs = NULL;
+				rs.sr_ctrls = NULL;
+				rs.sr_entry = e;
+				rs.sr_flags = 0;
+				rs.sr_err = LDAP_SUCCESS;
+				op->o_tmpmemctx = NULL;
+				rc = slap_encode_search_entry( op, &rs, &ps->ps_bers[i] );
+				op->o_tmpmemctx = memctx;
+				rs.sr_entry = NULL;
+				if ( rc == LDAP_INSUFFICIENT_ACCESS )
+					ps->ps_state[i] = MDB_PS_DROP;
+			}
+		}
+
+		if ( ps->ps_state[i] == MDB_PS_ENTRY ) {
+			ps->ps_ents[i] = e;
+			BER_BVZERO( &ps->ps_names[i].e_name );
+			BER_BVZERO( &ps->ps_names[i].e_nname );
+		} else {
+			/* the DN stays with the window */
+			BER_BVZERO( &e->e_name );
+			BER_BVZERO( &e->e_nname );
+			mdb_entry_return( op, e );
+		}
+	}
+}
+
+/* Claim and process batches until the window is used up */
+static void
+mdb_psearch_work( Operation *op, mdb_proj *mp, mdb_psearch *ps )
+{
+	int b;
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	while ( !ps->ps_done && ps->ps_next < ps->ps_nbatch ) {
+		b = ps->ps_next++;
+		ps->ps_busy++;
+		ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+		mdb_psearch_batch( op, mp, ps, b );
+		ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+		if ( !--ps->ps_busy && ps->ps_next == ps->ps_nbatch )
+			ldap_pvt_thread_cond_signal( &ps->ps_cond );
+	}
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+}
+
+static void *
+mdb_psearch_task( void *ctx, void *arg )
+{
+	mdb_psearch *ps = arg;
+	Operation op;
+	Opheader ohdr;
+	mdb_proj proj, *mp = NULL;
+	int b, started = 0;
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	while ( !ps->ps_done && ps->ps_next < ps->ps_nbatch ) {
+		b = ps->ps_next++;
+		ps->ps_busy++;
+		ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+		/* the search op can only be looked at while
+		 * we hold a batch of the current window
+		 */
+		if ( !started ) {
+			ohdr = *ps->ps_op->o_hdr;
+			ohdr.oh_tmpmemctx = slap_sl_mem_create( SLAP_SLAB_SIZE,
+				SLAP_SLAB_STACK, ctx, 1 );
+			ohdr.oh_threadctx = ctx;
+			op.o_hdr = &ohdr;
+			mp = mdb_psearch_op( ps, &op, &proj );
+			started = 1;
+		}
+		mdb_psearch_batch( &op, mp, ps, b );
+		ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+		if ( !--ps->ps_busy && ps->ps_next == ps->ps_nbatch )
+			ldap_pvt_thread_cond_signal( &ps->ps_cond );
+	}
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+
+	if ( started )
+		mdb_psearch_op_done( &op, mp );
+	mdb_psearch_release( ps, 0 );
+	return NULL;
+}
+
+/* Read the window of candidates starting at id and process it */
+static void
+mdb_psearch_fill( Operation *op, mdb_psearch *ps, MDB_txn *txn,
+	MDB_cursor *mci, MDB_cursor *mcc, IdScopes *isc, Entry *base,
+	ID *candidates, ID id, ID cursor )
+{
+	Operation wop;
+	Opheader whdr;
+	mdb_proj proj, *mp;
+	int i, n, nhelp;
+
+	/* the entries found so far would wait for the whole window */
+	slap_write_batch_check( op, 1 );
+
+	mdb_psearch_reset( op, ps );
+
+	/* the DNs go on the heap, for the helpers to hand them back */
+	whdr = *op->o_hdr;
+	whdr.oh_tmpmemctx = NULL;
+	wop = *op;
+	wop.o_hdr = &whdr;
+
+	for ( n = 0; n < ps->ps_max && id != NOID; n++ ) {
+		ps->ps_ids[n] = id;
+		ps->ps_state[n] = MDB_PS_UNKNOWN;
+		ps->ps_data[n].mv_data = NULL;
+		/* the base and missing ones are left to the search loop */
+		if ( id != base->e_id ) {
+			i = mdb_search_inscope( op, isc, base->e_id, id );
+			if ( i == 0 ) {
+				ps->ps_state[n] = MDB_PS_DROP;
+			} else if ( i == 1 &&
+				!mdb_search_edata( op, mci, mcc, id, &ps->ps_data[n] )) {
+				mdb_search_name( &wop, txn, isc, base, 0, &ps->ps_names[n] );
+			} else {
+				ps->ps_data[n].mv_data = NULL;
+			}
+		}
+		id = mdb_idl_next( candidates, &cursor );
+	}
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	ps->ps_count = n;
+	ps->ps_pos = 0;
+	ps->ps_txnid = mdb_txn_id( txn );
+	ps->ps_nbatch = ( n + MDB_PS_BATCH - 1 ) / MDB_PS_BATCH;
+	ps->ps_next = 0;
+	nhelp = ( ps->ps_nbatch < ps->ps_threads ? ps->ps_nbatch :
+		ps->ps_threads ) - ps->ps_refcnt;
+	ps->ps_refcnt += nhelp > 0 ? nhelp : 0;
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+
+	for ( i = 0; i < nhelp; i++ ) {
+		if ( ldap_pvt_thread_pool_submit( &connection_pool,
+			mdb_psearch_task, ps ))
+			mdb_psearch_release( ps, 0 );
+	}
+
+	/* our share, with our own slab but a header of our own */
+	whdr.oh_tmpmemctx = op->o_tmpmemctx;
+	mp = mdb_psearch_op( ps, &wop, &proj );
+	/* entries fetched for group ACLs come from our txn */
+	wop.o_extra = op->o_extra;
+	mdb_psearch_work( &wop, mp, ps );
+	mdb_psearch_op_done( &wop, mp );
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	while ( ps->ps_busy )
+		ldap_pvt_thread_cond_wait( &ps->ps_cond, &ps->ps_mutex );
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+}
+
+/* Take what became of candidate id. With MDB_PS_ENTRY, the entry
+ * and its pdu, if it was encoded, are returned in *ep and *berp.
+ */
+static int
+mdb_psearch_take( Operation *op, mdb_psearch *ps, MDB_txn *txn,
+	MDB_cursor *mci, MDB_cursor *mcc, IdScopes *isc, Entry *base,
+	ID *candidates, ID id, ID cursor, Entry **ep, BerElement **berp )
+{
+	int i, state;
+
+	if ( ps->ps_pos >= ps->ps_count || ps->ps_txnid != mdb_txn_id( txn ) ||
+		id < ps->ps_ids[ps->ps_pos] || id > ps->ps_ids[ps->ps_count-1] )
+		mdb_psearch_fill( op, ps, txn, mci, mcc, isc, base,
+			candidates, id, cursor );
+
+	while ( ps->ps_ids[ps->ps_pos] < id )
+		mdb_psearch_clear( op, ps, ps->ps_pos++ );
+	i = ps->ps_pos;
+	if ( ps->ps_ids[i] != id )
+		return MDB_PS_UNKNOWN;
+
+	state = ps->ps_state[i];
+	if ( state == MDB_PS_ENTRY ) {
+		*ep = ps->ps_ents[i];
+		*berp = ps->ps_bers[i];
+		ps->ps_ents[i] = NULL;
+		ps->ps_bers[i] = NULL;
+	}
+	mdb_psearch_clear( op, ps, i );
+	ps->ps_pos++;
+	return state;
+}
+
 int
 mdb_search( Operation *op, SlapReply *rs )
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	ID		id, cursor, nsubs, ncand, cscope;
+	ID		pfcursor = 0;
 	ID		lastid = NOID;
 	ID		*candidates, *iscopes, *c0;
 	ID2		*scopes;
@@ -433,9 +1257,15 @@ mdb_search( Operation *op, SlapReply *rs )
 	int		manageDSAit;
 	int		tentries = 0;
 	IdScopes	isc;
-	MDB_cursor	*mci, *mcd;
+	MDB_cursor	*mci, *mcd, *mcc = NULL;
 	ww_ctx wwctx;
 	slap_callback cb = { 0 };
+	mdb_proj	proj, *mp = NULL;
+	mdb_psearch	*ps = NULL;
+	BerElement	*ber = NULL;
+	int		psstate;
+	SortRequest	*srq;
+	mdb_orderwalk	ow, *owp = NULL;
 
 	mdb_op_info	opinfo = {{{0}}}, *moi = &opinfo;
 	MDB_txn			*ltid = NULL;
@@ -488,8 +1318,13 @@ mdb_search( Operation *op, SlapReply *rs )
 		MDB_IDL_ZERO(candidates);
 	}
 dn2entry_retry:
-	/* get entry with reader lock */
-	rs->sr_err = mdb_dn2entry( op, ltid, mcd, &op->o_req_ndn, &e, &nsubs, 1 );
+	/* get entry with reader lock. A base scoped search needs neither
+	 * the subtree count nor the dn2id cursor, so the DN cache can be used.
+	 */
+	if ( op->ors_scope == LDAP_SCOPE_BASE )
+		rs->sr_err = mdb_dn2entry( op, ltid, NULL, &op->o_req_ndn, &e, NULL, 1 );
+	else
+		rs->sr_err = mdb_dn2entry( op, ltid, mcd, &op->o_req_ndn, &e, &nsubs, 1 );
 
 	switch(rs->sr_err) {
 	case MDB_NOTFOUND:
@@ -653,6 +1488,7 @@ dn2entry_retry:
 		rs->sr_err = base_candidate( op->o_bd, base, candidates );
 		scopes[0].mid = 0;
 		ncand = 1;
+		nsubs = ncand;	/* no scope'd search */
 	} else {
 		if ( op->ors_scope == LDAP_SCOPE_ONELEVEL ) {
 			size_t nkids;
@@ -722,8 +1558,29 @@ adminlimit:
 		tentries = ncand;
 	}
 
+	mp = mdb_search_proj( op, &proj );
+	/* read the candidates from the cover DB if it has all we need */
+	if ( mp && mp->mp_cover &&
+		mdb_cursor_open( ltid, mdb->mi_cover, &mcc ))
+		mcc = NULL;
+	/* return the entries in the order of a sort request by walking
+	 * its ordering index, the candidates only tell which to look at
+	 */
+	if ( op->ors_scope != LDAP_SCOPE_BASE &&
+		get_pagedresults( op ) <= SLAP_CONTROL_IGNORED &&
+		( srq = slap_sort_request( op )) &&
+		mdb_order_open( op, ltid, srq, ncand, &ow ) == 0 )
+	{
+		owp = &ow;
+		nsubs = ncand;	/* the scope is checked for each entry */
+	}
+	if ( !owp && ncand >= 2 * MDB_PS_BATCH && ( nsubs >= ncand ||
+		get_pagedresults( op ) > SLAP_CONTROL_IGNORED ))
+		ps = mdb_psearch_init( op, mp );
+
 	wwctx.flag = 0;
 	wwctx.nentries = 0;
+	wwctx.ps = ps;
 	/* If we're running in our own read txn */
 	if (  moi == &opinfo ) {
 		cb.sc_writewait = mdb_writewait;
@@ -733,6 +1590,7 @@ adminlimit:
 		cb.sc_next = op->o_callback;
 		op->o_callback = &cb;
 	}
+	slap_write_batch_start( op );
 
 	if ( get_pagedresults( op ) > SLAP_CONTROL_IGNORED ) {
 		PagedResultsState *ps = op->o_pagedresults_state;
@@ -765,7 +1623,9 @@ adminlimit:
 		nsubs = ncand;	/* always bypass scope'd search */
 		goto loop_begin;
 	}
-	if ( nsubs < ncand ) {
+	if ( owp ) {
+		id = mdb_order_next( op, owp );
+	} else if ( nsubs < ncand ) {
 		int rc;
 		/* Do scope-based search */
 
@@ -803,6 +1663,9 @@ adminlimit:
 
 loop_begin:
 
+		/* don't hold entries back behind candidates that don't match */
+		slap_write_batch_check( op, 0 );
+
 		/* check for abandon */
 		if ( op->o_abandon ) {
 			rs->sr_err = SLAPD_ABANDON;
@@ -830,8 +1693,23 @@ loop_begin:
 			goto done;
 		}
 
+		if ( mdb->mi_search_prefetch && nsubs >= ncand && !owp )
+			mdb_search_prefetch( mdb, ltid,
+				mcc ? mdb->mi_cover : mdb->mi_id2entry,
+				candidates, cursor, &pfcursor );
+
+		/* take what the search threads made of it */
+		psstate = MDB_PS_UNKNOWN;
+		if ( ps && nsubs >= ncand && id != base->e_id ) {
+			psstate = mdb_psearch_take( op, ps, ltid, mci, mcc, &isc, base,
+				candidates, id, cursor, &e, &ber );
+			if ( psstate == MDB_PS_DROP )
+				goto loop_continue;
+			if ( psstate == MDB_PS_ENTRY )
+				goto found;
+		}
 
-		if ( nsubs < ncand ) {
+		if ( nsubs < ncand || owp ) {
 			unsigned i;
 			/* Is this entry in the candidate list? */
 			scopeok = 0;
@@ -839,54 +1717,30 @@ loop_begin:
 				if ( id >= MDB_IDL_RANGE_FIRST( candidates ) &&
 					id <= MDB_IDL_RANGE_LAST( candidates ))
 					scopeok = 1;
+			} else if (MDB_IDL_IS_BITS( candidates )) {
+				ID c = id;
+				if ( mdb_idl_first( candidates, &c ) == id )
+					scopeok = 1;
 			} else {
 				i = mdb_idl_search( candidates, id );
 				if (i <= candidates[0] && candidates[i] == id )
 					scopeok = 1;
 			}
-			if ( scopeok )
+			if ( !scopeok )
+				goto loop_continue;
+			/* entries of the ordering index may be anywhere */
+			if ( !owp )
 				goto scopeok;
-			goto loop_continue;
 		}
 
 		/* Does this candidate actually satisfy the search scope?
 		 */
-		scopeok = 0;
-		isc.numrdns = 0;
-		switch( op->ors_scope ) {
-		case LDAP_SCOPE_BASE:
-			/* This is always true, yes? */
-			if ( id == base->e_id ) scopeok = 1;
-			break;
-
-#ifdef LDAP_SCOPE_CHILDREN
-		case LDAP_SCOPE_CHILDREN:
-			if ( id == base->e_id ) break;
-			/* Fall-thru */
-#endif
-		case LDAP_SCOPE_SUBTREE:
-			if ( id == base->e_id ) {
-				scopeok = 1;
-				break;
-			}
-			/* Fall-thru */
-		case LDAP_SCOPE_ONELEVEL:
-			if ( id == base->e_id ) break;
-			isc.id = id;
-			isc.nscope = 0;
-			rs->sr_err = mdb_idscopes( op, &isc );
-			if ( rs->sr_err == MDB_SUCCESS ) {
-				if ( isc.nscope )
-					scopeok = 1;
-			} else {
-				if ( rs->sr_err == MDB_NOTFOUND )
-					goto notfound;
-			}
-			break;
-		}
+		scopeok = mdb_search_inscope( op, &isc, base->e_id, id );
+		if ( scopeok == MDB_NOTFOUND )
+			goto notfound;
 
 		/* Not in scope, ignore it */
-		if ( !scopeok )
+		if ( scopeok != 1 )
 		{
 			Debug( LDAP_DEBUG_TRACE,
 				LDAP_XSTRING(mdb_search)
@@ -898,13 +1752,13 @@ loop_begin:
 scopeok:
 		if ( id == base->e_id ) {
 			e = base;
-		} else {
+		} else if ( mdb_ecache_get( op, ltid, id, &e ) != 0 ) {
 
 			/* get the entry */
-			rs->sr_err = mdb_id2edata( op, mci, id, &edata );
+			rs->sr_err = mdb_search_edata( op, mci, mcc, id, &edata );
 			if ( rs->sr_err == MDB_NOTFOUND ) {
 notfound:
-				if( nsubs < ncand )
+				if( nsubs < ncand || owp )
 					goto loop_continue;
 
 				if( !MDB_IDL_IS_RANGE(candidates) ) {
@@ -936,7 +1790,7 @@ notfound:
 				goto done;
 			}
 
-			rs->sr_err = mdb_entry_decode( op, ltid, &edata, id, &e );
+			rs->sr_err = mdb_entry_decode( op, ltid, &edata, id, &e, mp );
 			if ( rs->sr_err ) {
 				rs->sr_err = LDAP_OTHER;
 				rs->sr_text = "internal error in mdb_entry_decode";
@@ -946,102 +1800,17 @@ notfound:
 			e->e_id = id;
 			e->e_name.bv_val = NULL;
 			e->e_nname.bv_val = NULL;
+			if ( !mp )
+				mdb_ecache_put( op, ltid, e );
 		}
 
-		if ( is_entry_subentry( e ) ) {
-			if( op->oq_search.rs_scope != LDAP_SCOPE_BASE ) {
-				if(!get_subentries_visibility( op )) {
-					/* only subentries are visible */
-					goto loop_continue;
-				}
-
-			} else if ( get_subentries( op ) &&
-				!get_subentries_visibility( op ))
-			{
-				/* only subentries are visible */
-				goto loop_continue;
-			}
-
-		} else if ( get_subentries_visibility( op )) {
-			/* only subentries are visible */
-			goto loop_continue;
-		}
-
-		/* aliases were already dereferenced in candidate list */
-		if ( op->ors_deref & LDAP_DEREF_SEARCHING ) {
-			/* but if the search base is an alias, and we didn't
-			 * deref it when finding, return it.
-			 */
-			if ( is_entry_alias(e) &&
-				((op->ors_deref & LDAP_DEREF_FINDING) || e != base ))
-			{
-				goto loop_continue;
-			}
-		}
-
-		if ( !manageDSAit && is_entry_glue( e )) {
+		if ( !mdb_search_visible( op, e, e == base ))
 			goto loop_continue;
-		}
-
-		if (e != base) {
-			struct berval pdn, pndn;
-			char *d, *n;
-			int i;
 
-			/* child of base, just append RDNs to base->e_name */
-			if ( nsubs < ncand || isc.scopes[isc.nscope].mid == base->e_id ) {
-				pdn = base->e_name;
-				pndn = base->e_nname;
-			} else {
-				mdb_id2name( op, ltid, &isc.mc, scopes[isc.nscope].mid, &pdn, &pndn );
-			}
-			e->e_name.bv_len = pdn.bv_len;
-			e->e_nname.bv_len = pndn.bv_len;
-			for (i=0; i<isc.numrdns; i++) {
-				e->e_name.bv_len += isc.rdns[i].bv_len + 1;
-				e->e_nname.bv_len += isc.nrdns[i].bv_len + 1;
-			}
-			e->e_name.bv_val = op->o_tmpalloc(e->e_name.bv_len + 1, op->o_tmpmemctx);
-			e->e_nname.bv_val = op->o_tmpalloc(e->e_nname.bv_len + 1, op->o_tmpmemctx);
-			d = e->e_name.bv_val;
-			n = e->e_nname.bv_val;
-			if (nsubs < ncand) {
-				/* RDNs are in top-down order */
-				for (i=isc.numrdns-1; i>=0; i--) {
-					memcpy(d, isc.rdns[i].bv_val, isc.rdns[i].bv_len);
-					d += isc.rdns[i].bv_len;
-					*d++ = ',';
-					memcpy(n, isc.nrdns[i].bv_val, isc.nrdns[i].bv_len);
-					n += isc.nrdns[i].bv_len;
-					*n++ = ',';
-				}
-			} else {
-				/* RDNs are in bottom-up order */
-				for (i=0; i<isc.numrdns; i++) {
-					memcpy(d, isc.rdns[i].bv_val, isc.rdns[i].bv_len);
-					d += isc.rdns[i].bv_len;
-					*d++ = ',';
-					memcpy(n, isc.nrdns[i].bv_val, isc.nrdns[i].bv_len);
-					n += isc.nrdns[i].bv_len;
-					*n++ = ',';
-				}
-			}
-
-			if (pdn.bv_len) {
-				memcpy(d, pdn.bv_val, pdn.bv_len+1);
-				memcpy(n, pndn.bv_val, pndn.bv_len+1);
-			} else {
-				*--d = '\0';
-				*--n = '\0';
-				e->e_name.bv_len--;
-				e->e_nname.bv_len--;
-			}
-			if (pndn.bv_val != base->e_nname.bv_val) {
-				op->o_tmpfree(pndn.bv_val, op->o_tmpmemctx);
-				op->o_tmpfree(pdn.bv_val, op->o_tmpmemctx);
-			}
-		}
+		if (e != base)
+			mdb_search_name( op, ltid, &isc, base, nsubs < ncand, e );
 
+found:
 		/*
 		 * if it's a referral, add it to the list of referrals. only do
 		 * this for non-base searches, and don't check the filter
@@ -1050,6 +1819,10 @@ notfound:
 		if ( !manageDSAit && op->oq_search.rs_scope != LDAP_SCOPE_BASE
 			&& is_entry_referral( e ) )
 		{
+			/* a walk sends them once, when it sends the entries */
+			if ( owp && owp->ow_phase != MDB_OW_SEND )
+				goto loop_continue;
+
 			BerVarray erefs = get_entry_referrals( op, e );
 			rs->sr_ref = referral_rewrite( erefs, &e->e_name, NULL,
 				op->oq_search.rs_scope == LDAP_SCOPE_ONELEVEL
@@ -1073,9 +1846,16 @@ notfound:
 		}
 
 		/* if it matches the filter and scope, send it */
-		rs->sr_err = test_filter( op, e, op->oq_search.rs_filter );
+		if ( psstate == MDB_PS_ENTRY )
+			rs->sr_err = LDAP_COMPARE_TRUE;
+		else
+			rs->sr_err = test_filter( op, e, op->oq_search.rs_filter );
 
 		if ( rs->sr_err == LDAP_COMPARE_TRUE ) {
+			/* not in the window of the sort request */
+			if ( owp && !mdb_order_match( owp ))
+				goto loop_continue;
+
 			/* check size limit */
 			if ( get_pagedresults(op) > SLAP_CONTROL_IGNORED ) {
 				if ( rs->sr_nentries >= ((PagedResultsState *)op->o_pagedresults_state)->ps_size ) {
@@ -1097,7 +1877,12 @@ notfound:
 				RS_ASSERT( e->e_private != NULL );
 				rs->sr_flags = 0;
 				rs->sr_err = LDAP_SUCCESS;
-				rs->sr_err = send_search_entry( op, rs );
+				if ( ber ) {
+					rs->sr_err = slap_send_search_encoded( op, rs, ber );
+					ber = NULL;
+				} else {
+					rs->sr_err = send_search_entry( op, rs );
+				}
 				rs->sr_attrs = NULL;
 				rs->sr_entry = NULL;
 				if (e != base)
@@ -1134,6 +1919,11 @@ notfound:
 		}
 
 loop_continue:
+		if ( ber ) {
+			ber_free_buf( ber );
+			ch_free( ber );
+			ber = NULL;
+		}
 		if ( moi == &opinfo && !wwctx.flag && mdb->mi_rtxn_size ) {
 			wwctx.nentries++;
 			if ( wwctx.nentries >= mdb->mi_rtxn_size ) {
@@ -1145,11 +1935,13 @@ loop_continue:
 			}
 		}
 		if ( wwctx.flag ) {
-			rs->sr_err = mdb_waitfixup( op, &wwctx, mci, mcd, &isc );
+			rs->sr_err = mdb_waitfixup( op, &wwctx, mci, mcd, mcc, &isc );
 			if ( rs->sr_err ) {
 				send_ldap_result( op, rs );
 				goto done;
 			}
+			if ( owp )
+				mdb_order_renew( owp, ltid );
 		}
 
 		if( e != NULL ) {
@@ -1160,7 +1952,9 @@ loop_continue:
 			rs->sr_entry = NULL;
 		}
 
-		if ( nsubs < ncand ) {
+		if ( owp ) {
+			id = mdb_order_next( op, owp );
+		} else if ( nsubs < ncand ) {
 			int rc = mdb_dn2id_walk( op, &isc );
 			if (rc) {
 				id = NOID;
@@ -1193,6 +1987,10 @@ loop_continue:
 	}
 
 nochange:
+	if ( owp ) {
+		mdb_order_close( op, owp );
+		owp = NULL;
+	}
 	rs->sr_ctrls = NULL;
 	rs->sr_ref = rs->sr_v2ref;
 	rs->sr_err = (rs->sr_v2ref == NULL) ? LDAP_SUCCESS : LDAP_REFERRAL;
@@ -1206,6 +2004,7 @@ nochange:
 	rs->sr_err = LDAP_SUCCESS;
 
 done:
+	slap_write_batch_flush( op );
 	if ( cb.sc_private ) {
 		/* remove our writewait callback */
 		slap_callback **scp = &op->o_callback;
@@ -1217,6 +2016,22 @@ done:
 			}
 		}
 	}
+	if ( ber ) {
+		ber_free_buf( ber );
+		ch_free( ber );
+	}
+	if ( ps ) {
+		mdb_psearch_reset( op, ps );
+		mdb_psearch_release( ps, 1 );
+	}
+	if ( owp )
+		mdb_order_close( op, owp );
+	if ( mp ) {
+		op->o_tmpfree( mp->mp_want, op->o_tmpmemctx );
+		op->o_tmpfree( mp->mp_ads, op->o_tmpmemctx );
+	}
+	if ( mcc )
+		mdb_cursor_close( mcc );
 	mdb_cursor_close( mcd );
 	mdb_cursor_close( mci );
 	if ( moi == &opinfo ) {
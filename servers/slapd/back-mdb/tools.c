@@ -19,10 +19,12 @@
 #include <stdio.h>
 #include <ac/string.h>
 #include <ac/errno.h>
+#include <ac/unistd.h>
 
 #define AVL_INTERNAL
 #include "back-mdb.h"
 #include "idl.h"
+#include "lutil.h"
 
 #ifdef MDB_TOOL_IDL_CACHING
 static int mdb_tool_idl_flush( BackendDB *be, MDB_txn *txn );
@@ -87,6 +89,52 @@ static void * mdb_tool_index_task( void *ctx, void *ptr );
 
 static int	mdb_writes, mdb_writes_per_commit;
 
+/* A slapindex rewrites the cover (order) records of every entry when
+ * it reindexes everything or a covered (ordered) attribute. An
+ * attribute list narrows mi_attrs to its attributes, the records are
+ * written with all of them.
+ */
+static slap_mask_t mdb_tool_rebuild;
+static AttrInfo **mdb_tool_attrs;
+static int mdb_tool_nattrs;
+
+/* switch between all the attributes and those being reindexed */
+static void
+mdb_tool_attrs_swap( struct mdb_info *mi )
+{
+	AttrInfo **attrs = mi->mi_attrs;
+	int nattrs = mi->mi_nattrs;
+
+	if ( !mdb_tool_attrs )
+		return;
+	mi->mi_attrs = mdb_tool_attrs;
+	mi->mi_nattrs = mdb_tool_nattrs;
+	mdb_tool_attrs = attrs;
+	mdb_tool_nattrs = nattrs;
+}
+
+/* Bulk indexing in Quick mode: the keys of index DBs that start
+ * out empty are collected in memory, sorted and spilled to temp
+ * files in runs of up to this many bytes, and merged at the end.
+ */
+#ifndef MDB_TOOL_SORT_SIZE
+#define MDB_TOOL_SORT_SIZE	(256*1048576)
+#endif
+
+static int mdb_tool_sorting;	/* -1 if not needed, 1 if active */
+static const char *mdb_tool_sort_dir;
+static mdb_tool_sort **mdb_tool_sort_jobs;
+static int mdb_tool_sort_njobs, mdb_tool_sort_next, mdb_tool_sort_busy;
+static int mdb_tool_sort_final;
+static unsigned mdb_tool_sort_maxkey;
+static ldap_pvt_thread_mutex_t mdb_tool_sort_mutex;
+static ldap_pvt_thread_cond_t mdb_tool_sort_cond;
+
+static void mdb_tool_sort_open( BackendDB *be, MDB_txn *txn );
+static int mdb_tool_sort_spill( BackendDB *be, int final );
+static size_t mdb_tool_sort_total( BackendDB *be );
+static int mdb_tool_sort_flush( BackendDB *be );
+
 /* Number of ops per commit in Quick mode.
  * Batching speeds writes overall, but too large a
  * batch will fail with MDB_TXN_FULL.
@@ -229,6 +277,42 @@ int mdb_tool_entry_close(
 		txi = NULL;
 	}
 
+	if ( mdb_tool_sorting ) {
+		int rc = mdb_tool_sort_flush( be );
+		mdb_tool_sorting = 0;
+		if ( rc )
+			return -1;
+	}
+
+	if ( mdb_tool_attrs ) {
+		struct mdb_info *mdb = be->be_private;
+		memcpy( mdb->mi_attrs, mdb_tool_attrs,
+			mdb_tool_nattrs * sizeof( AttrInfo * ));
+		mdb->mi_nattrs = mdb_tool_nattrs;
+		ch_free( mdb_tool_attrs );
+		mdb_tool_attrs = NULL;
+	}
+	if ( mdb_tool_rebuild ) {
+		struct mdb_info *mdb = be->be_private;
+		MDB_txn *txn;
+		int rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+		if ( rc == 0 ) {
+			rc = mdb_idxbuilt_put( mdb, txn, mdb_tool_rebuild );
+			if ( rc == 0 )
+				rc = mdb_txn_commit( txn );
+			else
+				mdb_txn_abort( txn );
+		}
+		mdb_tool_rebuild = 0;
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_tool_entry_close) ": database %s: "
+				"recording the rebuilt records failed: %s (%d)\n",
+				be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+			return -1;
+		}
+	}
+
 	if( nholes ) {
 		unsigned i;
 		fprintf( stderr, "Error, entries missing!\n");
@@ -413,7 +497,7 @@ mdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep )
 			}
 		}
 	}
-	rc = mdb_entry_decode( &op, mdb_tool_txn, &data, id, &e );
+	rc = mdb_entry_decode( &op, mdb_tool_txn, &data, id, &e, NULL );
 	e->e_id = id;
 	if ( !BER_BVISNULL( &dn )) {
 		e->e_name = dn;
@@ -593,7 +677,7 @@ mdb_tool_index_add(
 		}
 		for (i=0; i<mdb->mi_nattrs; i++) {
 			if ( !ir[i].ir_ai )
-				break;
+				continue;
 			rc = mdb_cursor_open( txn, ir[i].ir_ai->ai_dbi,
 				 &ir[i].ir_ai->ai_cursor );
 			if ( rc )
@@ -716,6 +800,8 @@ ID mdb_tool_entry_put(
 	op.o_tmpmemctx = NULL;
 	op.o_tmpmfuncs = &ch_mfuncs;
 
+	mdb_tool_sort_open( be, mdb_tool_txn );
+
 	/* add dn2id indices */
 	rc = mdb_tool_next_id( &op, mdb_tool_txn, e, text, 0 );
 	if( rc != 0 ) {
@@ -750,6 +836,18 @@ ID mdb_tool_entry_put(
 	if( mdb->mi_nattrs && mdb_tool_threads > 1 )
 		rc = mdb_tool_index_finish();
 
+	if( rc == 0 && mdb_tool_sort_total( be ) >= MDB_TOOL_SORT_SIZE ) {
+		rc = mdb_tool_sort_spill( be, 0 );
+		if( rc != 0 ) {
+			snprintf( text->bv_val, text->bv_len,
+				"index sort failed: %s (%d)",
+				mdb_strerror(rc), rc );
+			Debug( LDAP_DEBUG_ANY,
+				"=> " LDAP_XSTRING(mdb_tool_entry_put) ": %s\n",
+				text->bv_val );
+		}
+	}
+
 done:
 	if( rc == 0 ) {
 		mdb_writes++;
@@ -807,6 +905,7 @@ int mdb_tool_entry_reindex(
 	Entry *e;
 	Operation op = {0};
 	Opheader ohdr = {0};
+	slap_mask_t rebuild = MDB_INDEX_NOKEYS;
 
 	Debug( LDAP_DEBUG_ARGS,
 		"=> " LDAP_XSTRING(mdb_tool_entry_reindex) "( %ld )\n",
@@ -832,6 +931,13 @@ int mdb_tool_entry_reindex(
 	if ( adv ) {
 		int i, j, n;
 
+		if ( !mdb_tool_attrs ) {
+			mdb_tool_nattrs = mi->mi_nattrs;
+			mdb_tool_attrs = ch_malloc( mdb_tool_nattrs * sizeof( AttrInfo * ));
+			memcpy( mdb_tool_attrs, mi->mi_attrs,
+				mdb_tool_nattrs * sizeof( AttrInfo * ));
+		}
+
 		if ( mi->mi_attrs[0]->ai_desc != adv[0] ) {
 			/* count */
 			for ( n = 0; adv[n]; n++ ) ;
@@ -867,6 +973,12 @@ int mdb_tool_entry_reindex(
 			}
 		}
 		mi->mi_nattrs = i;
+
+		rebuild = 0;
+		for ( i = 0; i < mi->mi_nattrs; i++ ) {
+			rebuild |= ( mi->mi_attrs[i]->ai_indexmask |
+				mi->mi_attrs[i]->ai_newmask ) & MDB_INDEX_NOKEYS;
+		}
 	}
 
 	e = mdb_tool_entry_get( be, id );
@@ -893,7 +1005,11 @@ int mdb_tool_entry_reindex(
 	if ( slapMode & SLAP_TRUNCATE_MODE ) {
 		int i;
 		for ( i=0; i < mi->mi_nattrs; i++ ) {
+			if ( !mi->mi_attrs[i]->ai_dbi )	/* cover only */
+				continue;
 			rc = mdb_drop( txi, mi->mi_attrs[i]->ai_dbi, 0 );
+			if ( rc == 0 )
+				rc = mdb_idxstat_clear( mi, txi, mi->mi_attrs[i]->ai_desc );
 			if ( rc ) {
 				Debug( LDAP_DEBUG_ANY,
 					LDAP_XSTRING(mdb_tool_entry_reindex)
@@ -903,8 +1019,57 @@ int mdb_tool_entry_reindex(
 				return -1;
 			}
 		}
+		if (( rebuild & MDB_INDEX_COVER ) && mi->mi_cover ) {
+			rc = mdb_drop( txi, mi->mi_cover, 0 );
+			if ( rc ) {
+				Debug( LDAP_DEBUG_ANY,
+					LDAP_XSTRING(mdb_tool_entry_reindex)
+					": (Truncate) mdb_drop(cover) failed: %s (%d)\n",
+					mdb_strerror(rc), rc );
+				return -1;
+			}
+		}
+		if (( rebuild & MDB_INDEX_ORDER ) && mi->mi_order ) {
+			rc = mdb_drop( txi, mi->mi_order, 0 );
+			if ( rc == 0 )
+				rc = mdb_drop( txi, mi->mi_id2order, 0 );
+			if ( rc ) {
+				Debug( LDAP_DEBUG_ANY,
+					LDAP_XSTRING(mdb_tool_entry_reindex)
+					": (Truncate) mdb_drop(order) failed: %s (%d)\n",
+					mdb_strerror(rc), rc );
+				return -1;
+			}
+		}
 		slapMode ^= SLAP_TRUNCATE_MODE;
 	}
+	mdb_tool_sort_open( be, txi );
+
+	if ( rebuild & ~mdb_tool_rebuild ) {
+		/* the records can't be used until they have all been
+		 * rewritten, see mdb_tool_entry_close
+		 */
+		int i;
+		mdb_tool_attrs_swap( mi );
+		for ( i = 0; i < mi->mi_nattrs; i++ ) {
+			AttrInfo *ai = mi->mi_attrs[i];
+			if ( !( ai->ai_indexmask & rebuild ))
+				continue;
+			if ( !ai->ai_newmask )
+				ai->ai_newmask = ai->ai_indexmask;
+			ai->ai_indexmask &= ~rebuild;
+		}
+		rc = mdb_idxbuilt_put( mi, txi, 0 );
+		mdb_tool_attrs_swap( mi );
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_tool_entry_reindex)
+				": recording the rebuilt records failed: %s (%d)\n",
+				mdb_strerror(rc), rc );
+			return -1;
+		}
+		mdb_tool_rebuild |= rebuild;
+	}
 
 	/*
 	 * just (re)add them for now
@@ -921,6 +1086,22 @@ int mdb_tool_entry_reindex(
 	op.o_tmpmfuncs = &ch_mfuncs;
 
 	rc = mdb_tool_index_add( &op, txi, e );
+	if( rc == 0 && mi->mi_nattrs && mdb_tool_threads > 1 )
+		rc = mdb_tool_index_finish();
+	/* the cover records hold all the covered attrs */
+	if( rc == 0 && ( mdb_tool_rebuild & MDB_INDEX_COVER )) {
+		mdb_tool_attrs_swap( mi );
+		rc = mdb_cover_put( &op, txi, e );
+		mdb_tool_attrs_swap( mi );
+	}
+	/* and the order DB all the ordered ones */
+	if( rc == 0 && ( mdb_tool_rebuild & MDB_INDEX_ORDER )) {
+		mdb_tool_attrs_swap( mi );
+		rc = mdb_order_put( &op, txi, e );
+		mdb_tool_attrs_swap( mi );
+	}
+	if( rc == 0 && mdb_tool_sort_total( be ) >= MDB_TOOL_SORT_SIZE )
+		rc = mdb_tool_sort_spill( be, 0 );
 
 done:
 	if( rc == 0 ) {
@@ -1091,6 +1272,30 @@ int mdb_tool_entry_delete(
 		mdb_cursor_close( cursor );
 		cursor = NULL;
 	}
+	/* the keys held back by the bulk indexer must be in place */
+	if( mdb_tool_sorting > 0 ) {
+		rc = 0;
+		if( mdb_tool_txn ) {
+			unsigned i;
+			rc = mdb_txn_commit( mdb_tool_txn );
+			mdb_tool_txn = NULL;
+			idcursor = NULL;
+			for ( i=0; i<mdb->mi_nattrs; i++ )
+				mdb->mi_attrs[i]->ai_cursor = NULL;
+			mdb_writes = 0;
+		}
+		if( rc == 0 )
+			rc = mdb_tool_sort_flush( be );
+		if( rc != 0 ) {
+			snprintf( text->bv_val, text->bv_len,
+				"index flush failed: %s (%d)",
+				mdb_strerror(rc), rc );
+			Debug( LDAP_DEBUG_ANY,
+				"=> " LDAP_XSTRING(mdb_tool_entry_delete) ": %s\n",
+				 text->bv_val );
+			return LDAP_OTHER;
+		}
+	}
 	if( !mdb_tool_txn ) {
 		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &mdb_tool_txn );
 		if( rc != 0 ) {
@@ -1259,6 +1464,555 @@ mdb_tool_index_task( void *ctx, void *ptr )
 	return NULL;
 }
 
+/* Records of the bulk indexer. Keys are compared the same way
+ * as by LMDB's default key compare, then by ID. Records are padded
+ * to keep the IDs aligned, in memory and in the temp files alike.
+ */
+typedef struct mdb_tool_srec {
+	ID sr_id;
+	unsigned short sr_len;
+	unsigned char sr_type;
+	unsigned char sr_key[1];
+} mdb_tool_srec;
+
+#define SREC_HDR	offsetof(mdb_tool_srec, sr_key)
+#define SREC_SIZE(len)	((SREC_HDR + (len) + sizeof(ID)-1) & ~(sizeof(ID)-1))
+
+#define MDB_TOOL_RUNBUF	(256*1024)	/* read buffer of each run */
+#define MDB_TOOL_MERGE_IDS	(1<<20)	/* IDs written per merge txn */
+
+/* A sorted run being merged, either in a temp file or in memory */
+typedef struct mdb_tool_run {
+	off_t tr_off;
+	off_t tr_end;
+	char *tr_buf, *tr_ptr, *tr_lim;
+	void **tr_recs;
+	size_t tr_nrecs;
+	mdb_tool_srec *tr_cur;
+} mdb_tool_run;
+
+static int
+mdb_tool_srec_keycmp( const mdb_tool_srec *sr, const void *key, unsigned len )
+{
+	int rc = memcmp( sr->sr_key, key, sr->sr_len < len ? sr->sr_len : len );
+	if ( rc == 0 )
+		rc = (int)sr->sr_len - (int)len;
+	return rc;
+}
+
+static int
+mdb_tool_srec_cmp( const void *v1, const void *v2 )
+{
+	const mdb_tool_srec *s1 = *(void **)v1, *s2 = *(void **)v2;
+	int rc = mdb_tool_srec_keycmp( s1, s2->sr_key, s2->sr_len );
+
+	if ( rc == 0 )
+		rc = ( s1->sr_id > s2->sr_id ) - ( s1->sr_id < s2->sr_id );
+	return rc;
+}
+
+static void
+mdb_tool_sort_open( BackendDB *be, MDB_txn *txn )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	MDB_stat st;
+	int i;
+
+	if ( mdb_tool_sorting )
+		return;
+	mdb_tool_sorting = -1;
+	if (( slapMode & (SLAP_TOOL_QUICK|SLAP_TOOL_READONLY)) != SLAP_TOOL_QUICK )
+		return;
+
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		AttrInfo *ai = mdb->mi_attrs[i];
+
+		if ( !ai->ai_dbi || !( ai->ai_indexmask || ai->ai_newmask ))
+			continue;
+		if ( mdb_stat( txn, ai->ai_dbi, &st ) || st.ms_entries )
+			continue;
+		ai->ai_sort = ch_calloc( 1, sizeof( mdb_tool_sort ));
+		ai->ai_sort->ts_ai = ai;
+		ai->ai_sort->ts_fd = -1;
+		mdb_tool_sorting = 1;
+	}
+	if ( mdb_tool_sorting > 0 ) {
+		mdb_tool_sort_dir = mdb->mi_dbenv_home;
+		mdb_tool_sort_maxkey = mdb_env_get_maxkeysize( mdb->mi_dbenv );
+		mdb_tool_sort_jobs = ch_calloc( mdb->mi_nattrs, sizeof( mdb_tool_sort * ));
+		ldap_pvt_thread_mutex_init( &mdb_tool_sort_mutex );
+		ldap_pvt_thread_cond_init( &mdb_tool_sort_cond );
+	}
+}
+
+/* Collect the keys of one index type, see indexer() */
+int
+mdb_tool_sort_add(
+	BackendDB *be,
+	MDB_cursor *mc,
+	struct berval *keys,
+	ID id,
+	mdb_idxstat *st )
+{
+	mdb_tool_sort *ts = (mdb_tool_sort *)mc;
+	mdb_tool_srec *sr;
+	size_t len;
+	int k;
+
+	for ( k = 0; keys[k].bv_val; k++ ) {
+		if ( keys[k].bv_len > mdb_tool_sort_maxkey )
+			return MDB_BAD_VALSIZE;
+		len = SREC_SIZE( keys[k].bv_len );
+		if ( ts->ts_len + len > ts->ts_size ) {
+			size_t size = ts->ts_size ? ts->ts_size * 2 : 1048576;
+			while ( ts->ts_len + len > size )
+				size *= 2;
+			ts->ts_buf = ch_realloc( ts->ts_buf, size );
+			ts->ts_size = size;
+		}
+		sr = (mdb_tool_srec *)( ts->ts_buf + ts->ts_len );
+		sr->sr_id = id;
+		sr->sr_len = keys[k].bv_len;
+		sr->sr_type = st - ts->ts_st;
+		memcpy( sr->sr_key, keys[k].bv_val, keys[k].bv_len );
+		ts->ts_len += len;
+		ts->ts_nrecs++;
+	}
+	return 0;
+}
+
+static int
+mdb_tool_sort_write( int fd, char *buf, size_t len )
+{
+	ssize_t rc;
+
+	while ( len ) {
+		rc = write( fd, buf, len );
+		if ( rc < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			return errno;
+		}
+		buf += rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+/* Sort the collected records. Unless this is the final run, which
+ * is merged straight from memory, write them out to the temp file.
+ */
+static int
+mdb_tool_sort_run( mdb_tool_sort *ts, int final )
+{
+	mdb_tool_srec *sr, *prev = NULL;
+	char *ptr, *out = NULL;
+	size_t i, olen = 0;
+	int rc = 0;
+
+	ts->ts_recs = ch_realloc( ts->ts_recs, ts->ts_nrecs * sizeof( void * ));
+	for ( i = 0, ptr = ts->ts_buf; i < ts->ts_nrecs; i++ ) {
+		ts->ts_recs[i] = ptr;
+		ptr += SREC_SIZE( ((mdb_tool_srec *)ptr)->sr_len );
+	}
+	qsort( ts->ts_recs, ts->ts_nrecs, sizeof( void * ), mdb_tool_srec_cmp );
+	if ( final )
+		return 0;
+
+	if ( ts->ts_fd < 0 ) {
+		char *path = ch_malloc( strlen( mdb_tool_sort_dir ) + sizeof( "/idxsort.XXXXXX" ));
+		sprintf( path, "%s/idxsort.XXXXXX", mdb_tool_sort_dir );
+		ts->ts_fd = mkstemp( path );
+		if ( ts->ts_fd < 0 ) {
+			rc = errno;
+			Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_tool_sort_run)
+				": cannot create %s: %s (%d)\n",
+				path, mdb_strerror(rc), rc );
+			ch_free( path );
+			return rc;
+		}
+		/* nobody else needs to see it */
+		unlink( path );
+		ch_free( path );
+	}
+	ts->ts_runs = ch_realloc( ts->ts_runs, ( ts->ts_nruns + 1 ) * sizeof( off_t ));
+	ts->ts_runs[ts->ts_nruns++] = ts->ts_fend;
+
+	out = ch_malloc( MDB_TOOL_RUNBUF );
+	for ( i = 0; i < ts->ts_nrecs; i++ ) {
+		size_t len;
+		sr = ts->ts_recs[i];
+		if ( prev && sr->sr_id == prev->sr_id &&
+			!mdb_tool_srec_keycmp( sr, prev->sr_key, prev->sr_len ))
+			continue;
+		prev = sr;
+		len = SREC_SIZE( sr->sr_len );
+		if ( olen + len > MDB_TOOL_RUNBUF ) {
+			rc = mdb_tool_sort_write( ts->ts_fd, out, olen );
+			if ( rc )
+				break;
+			ts->ts_fend += olen;
+			olen = 0;
+		}
+		memcpy( out + olen, sr, len );
+		olen += len;
+	}
+	if ( !rc && olen ) {
+		rc = mdb_tool_sort_write( ts->ts_fd, out, olen );
+		ts->ts_fend += olen;
+	}
+	ch_free( out );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_tool_sort_run)
+			": write to temp file failed: %s (%d)\n",
+			mdb_strerror(rc), rc );
+	}
+	ts->ts_len = 0;
+	ts->ts_nrecs = 0;
+	return rc;
+}
+
+static void
+mdb_tool_sort_work( void )
+{
+	mdb_tool_sort *ts;
+
+	for (;;) {
+		ldap_pvt_thread_mutex_lock( &mdb_tool_sort_mutex );
+		if ( mdb_tool_sort_next == mdb_tool_sort_njobs ) {
+			if ( !--mdb_tool_sort_busy )
+				ldap_pvt_thread_cond_signal( &mdb_tool_sort_cond );
+			ldap_pvt_thread_mutex_unlock( &mdb_tool_sort_mutex );
+			break;
+		}
+		ts = mdb_tool_sort_jobs[mdb_tool_sort_next++];
+		ldap_pvt_thread_mutex_unlock( &mdb_tool_sort_mutex );
+		ts->ts_rc = mdb_tool_sort_run( ts, mdb_tool_sort_final );
+	}
+}
+
+static void *
+mdb_tool_sort_task( void *ctx, void *ptr )
+{
+	mdb_tool_sort_work();
+	return NULL;
+}
+
+/* Sort the collected records of all attributes, using as many
+ * tool threads as there are attributes with records.
+ */
+static int
+mdb_tool_sort_spill( BackendDB *be, int final )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	int i, rc = 0;
+
+	mdb_tool_sort_njobs = 0;
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		if ( mdb->mi_attrs[i]->ai_sort && mdb->mi_attrs[i]->ai_sort->ts_nrecs )
+			mdb_tool_sort_jobs[mdb_tool_sort_njobs++] = mdb->mi_attrs[i]->ai_sort;
+	}
+	mdb_tool_sort_next = 0;
+	mdb_tool_sort_final = final;
+	mdb_tool_sort_busy = 1;
+	for ( i = 1; i < slap_tool_thread_max && i < mdb_tool_sort_njobs; i++ ) {
+		ldap_pvt_thread_mutex_lock( &mdb_tool_sort_mutex );
+		mdb_tool_sort_busy++;
+		ldap_pvt_thread_mutex_unlock( &mdb_tool_sort_mutex );
+		if ( ldap_pvt_thread_pool_submit( &connection_pool,
+			mdb_tool_sort_task, NULL )) {
+			ldap_pvt_thread_mutex_lock( &mdb_tool_sort_mutex );
+			mdb_tool_sort_busy--;
+			ldap_pvt_thread_mutex_unlock( &mdb_tool_sort_mutex );
+			break;
+		}
+	}
+	mdb_tool_sort_work();
+	ldap_pvt_thread_mutex_lock( &mdb_tool_sort_mutex );
+	while ( mdb_tool_sort_busy )
+		ldap_pvt_thread_cond_wait( &mdb_tool_sort_cond, &mdb_tool_sort_mutex );
+	ldap_pvt_thread_mutex_unlock( &mdb_tool_sort_mutex );
+
+	for ( i = 0; i < mdb_tool_sort_njobs; i++ ) {
+		if ( mdb_tool_sort_jobs[i]->ts_rc )
+			rc = mdb_tool_sort_jobs[i]->ts_rc;
+	}
+	return rc;
+}
+
+/* Memory held by the collected records, including the pointers
+ * needed to sort them. Each sorter is only filled by the indexer of
+ * its own attribute, so this must be called once they are all done.
+ */
+static size_t
+mdb_tool_sort_total( BackendDB *be )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	mdb_tool_sort *ts;
+	size_t total = 0;
+	int i;
+
+	if ( mdb_tool_sorting <= 0 )
+		return 0;
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		ts = mdb->mi_attrs[i]->ai_sort;
+		if ( ts )
+			total += ts->ts_len + ts->ts_nrecs * sizeof( void * );
+	}
+	return total;
+}
+
+/* Step a run to its next record. Returns 0 at the end of the run. */
+static int
+mdb_tool_run_next( mdb_tool_sort *ts, mdb_tool_run *tr, int *rc )
+{
+	size_t avail;
+	ssize_t len;
+
+	if ( !tr->tr_buf ) {
+		if ( tr->tr_nrecs == 0 )
+			return 0;
+		tr->tr_cur = *tr->tr_recs++;
+		tr->tr_nrecs--;
+		return 1;
+	}
+
+	if ( tr->tr_cur )
+		tr->tr_ptr += SREC_SIZE( tr->tr_cur->sr_len );
+	avail = tr->tr_lim - tr->tr_ptr;
+	if ( avail < SREC_HDR ||
+		avail < SREC_SIZE( ((mdb_tool_srec *)tr->tr_ptr)->sr_len )) {
+		if ( tr->tr_off == tr->tr_end )
+			return 0;
+		memmove( tr->tr_buf, tr->tr_ptr, avail );
+		len = MDB_TOOL_RUNBUF - avail;
+		if ( len > tr->tr_end - tr->tr_off )
+			len = tr->tr_end - tr->tr_off;
+		if ( lseek( ts->ts_fd, tr->tr_off, SEEK_SET ) < 0 ) {
+			*rc = errno;
+			return 0;
+		}
+		while (( len = read( ts->ts_fd, tr->tr_buf + avail, len )) < 0 ) {
+			if ( errno != EINTR ) {
+				*rc = errno;
+				return 0;
+			}
+		}
+		if ( len == 0 ) {
+			*rc = EIO;
+			return 0;
+		}
+		tr->tr_off += len;
+		tr->tr_ptr = tr->tr_buf;
+		tr->tr_lim = tr->tr_buf + avail + len;
+		if ( avail + len < SREC_HDR ||
+			avail + len < SREC_SIZE( ((mdb_tool_srec *)tr->tr_ptr)->sr_len )) {
+			/* short read, try again */
+			tr->tr_cur = NULL;
+			return mdb_tool_run_next( ts, tr, rc );
+		}
+	}
+	tr->tr_cur = (mdb_tool_srec *)tr->tr_ptr;
+	return 1;
+}
+
+static void
+mdb_tool_run_down( mdb_tool_run **heap, int n, int i )
+{
+	mdb_tool_run *tr = heap[i];
+	int c;
+
+	while (( c = 2*i + 1 ) < n ) {
+		if ( c+1 < n && mdb_tool_srec_cmp( &heap[c+1]->tr_cur, &heap[c]->tr_cur ) < 0 )
+			c++;
+		if ( mdb_tool_srec_cmp( &tr->tr_cur, &heap[c]->tr_cur ) <= 0 )
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = tr;
+}
+
+/* Merge the runs of one attribute and append the keys to its
+ * index DB, which is still empty.
+ */
+static int
+mdb_tool_sort_merge( BackendDB *be, mdb_tool_sort *ts )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	AttrInfo *ai = ts->ts_ai;
+	mdb_tool_run *runs, **heap;
+	mdb_tool_srec *sr;
+	MDB_txn *txn = NULL;
+	MDB_cursor *mc = NULL;
+	MDB_val key, data[2];
+	unsigned char *kbuf;
+	ID *ids = NULL, *bits = NULL, tids[MDB_IDXSTAT_TYPES], range[3];
+	size_t nids, maxids = 0, maxbits = 0, written = 0;
+	int i, n, nruns, type, rc = 0;
+
+	kbuf = ch_malloc( mdb_tool_sort_maxkey );
+	nruns = ts->ts_nruns + 1;
+	runs = ch_calloc( nruns, sizeof( mdb_tool_run ) + sizeof( mdb_tool_run * ));
+	heap = (mdb_tool_run **)( runs + nruns );
+	for ( i = 0; i < ts->ts_nruns; i++ ) {
+		runs[i].tr_off = ts->ts_runs[i];
+		runs[i].tr_end = i+1 < ts->ts_nruns ? ts->ts_runs[i+1] : ts->ts_fend;
+		runs[i].tr_buf = ch_malloc( MDB_TOOL_RUNBUF );
+		runs[i].tr_ptr = runs[i].tr_lim = runs[i].tr_buf;
+	}
+	runs[i].tr_recs = ts->ts_recs;
+	runs[i].tr_nrecs = ts->ts_nrecs;
+
+	for ( i = 0, n = 0; i < nruns; i++ ) {
+		if ( mdb_tool_run_next( ts, &runs[i], &rc ))
+			heap[n++] = &runs[i];
+		if ( rc )
+			goto done;
+	}
+	for ( i = n/2 - 1; i >= 0; i-- )
+		mdb_tool_run_down( heap, n, i );
+
+	while ( n ) {
+		sr = heap[0]->tr_cur;
+		key.mv_size = sr->sr_len;
+		key.mv_data = kbuf;
+		memcpy( kbuf, sr->sr_key, sr->sr_len );
+		type = sr->sr_type;
+		memset( tids, 0, sizeof( tids ));
+		nids = 0;
+
+		/* gather the IDs of this key from all runs */
+		do {
+			sr = heap[0]->tr_cur;
+			if ( mdb_tool_srec_keycmp( sr, kbuf, key.mv_size ))
+				break;
+			if ( !nids || ids[nids-1] != sr->sr_id ) {
+				if ( nids == maxids ) {
+					maxids = maxids ? maxids * 2 : 1024;
+					ids = ch_realloc( ids, maxids * sizeof( ID ));
+				}
+				ids[nids++] = sr->sr_id;
+				tids[sr->sr_type]++;
+			}
+			if ( mdb_tool_run_next( ts, heap[0], &rc )) {
+				mdb_tool_run_down( heap, n, 0 );
+			} else {
+				if ( rc )
+					goto done;
+				heap[0] = heap[--n];
+				mdb_tool_run_down( heap, n, 0 );
+			}
+		} while ( n );
+
+		if ( !txn ) {
+			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+			if ( rc == 0 )
+				rc = mdb_cursor_open( txn, ai->ai_dbi, &mc );
+			if ( rc )
+				goto done;
+		}
+		ts->ts_st[type].is_keys++;
+		data[0].mv_size = sizeof( ID );
+#ifdef MDB_IDL_BITS
+		if ( nids > MDB_idl_db_max && ids[nids-1] < MDB_BITS_MAXID ) {
+			if ( nids >= maxbits ) {
+				maxbits = nids + 1;
+				bits = ch_realloc( bits, maxbits * sizeof( ID ));
+			}
+			data[0].mv_data = bits;
+			data[1].mv_size = mdb_idl_bits_pack( ids, nids, bits );
+			for ( i = 0; i < MDB_IDXSTAT_TYPES; i++ )
+				ts->ts_st[i].is_ids += tids[i];
+		} else
+#endif
+		if ( nids > MDB_idl_db_max ) {
+			range[0] = 0;
+			range[1] = ids[0];
+			range[2] = ids[nids-1];
+			data[0].mv_data = range;
+			data[1].mv_size = 3;
+			ts->ts_st[type].is_ranges++;
+		} else {
+			data[0].mv_data = ids;
+			data[1].mv_size = nids;
+			for ( i = 0; i < MDB_IDXSTAT_TYPES; i++ )
+				ts->ts_st[i].is_ids += tids[i];
+		}
+		written += data[1].mv_size;
+		rc = mdb_cursor_put( mc, &key, data,
+			MDB_APPEND|MDB_APPENDDUP|MDB_MULTIPLE );
+		if ( rc )
+			goto done;
+		if ( written >= MDB_TOOL_MERGE_IDS ) {
+			rc = mdb_txn_commit( txn );
+			txn = NULL;
+			written = 0;
+			if ( rc )
+				goto done;
+		}
+	}
+
+	if ( !txn )
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+	if ( rc == 0 )
+		rc = mdb_idxstat_update( mdb, txn, ai, ts->ts_st );
+	if ( rc == 0 )
+		rc = mdb_txn_commit( txn );
+	txn = NULL;
+
+done:
+	if ( txn )
+		mdb_txn_abort( txn );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_tool_sort_merge)
+			": index %s failed: %s (%d)\n",
+			ai->ai_desc->ad_cname.bv_val, mdb_strerror(rc), rc );
+	}
+	for ( i = 0; i < ts->ts_nruns; i++ )
+		ch_free( runs[i].tr_buf );
+	ch_free( runs );
+	ch_free( ids );
+	ch_free( bits );
+	ch_free( kbuf );
+	return rc;
+}
+
+/* Write out everything collected so far and stop bulk indexing.
+ * There must be no write txn open.
+ */
+static int
+mdb_tool_sort_flush( BackendDB *be )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	int i, rc;
+
+	if ( mdb_tool_sorting <= 0 )
+		return 0;
+	mdb_tool_sorting = -1;
+
+	rc = mdb_tool_sort_spill( be, 1 );
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		mdb_tool_sort *ts = mdb->mi_attrs[i]->ai_sort;
+		if ( !ts )
+			continue;
+		if ( rc == 0 && ( ts->ts_nruns || ts->ts_nrecs ))
+			rc = mdb_tool_sort_merge( be, ts );
+		if ( ts->ts_fd >= 0 )
+			close( ts->ts_fd );
+		ch_free( ts->ts_runs );
+		ch_free( ts->ts_recs );
+		ch_free( ts->ts_buf );
+		ch_free( ts );
+		mdb->mi_attrs[i]->ai_sort = NULL;
+	}
+	ch_free( mdb_tool_sort_jobs );
+	mdb_tool_sort_jobs = NULL;
+	ldap_pvt_thread_cond_destroy( &mdb_tool_sort_cond );
+	ldap_pvt_thread_mutex_destroy( &mdb_tool_sort_mutex );
+	return rc;
+}
+
 #ifdef MDB_TOOL_IDL_CACHING
 static int
 mdb_tool_idl_cmp( const void *v1, const void *v2 )
@@ -1393,6 +2147,10 @@ mdb_tool_idl_flush( BackendDB *be, MDB_txn *txn )
 		rc = mdb_tool_idl_flush_db( txn, mdb->mi_attrs[i], mdb_tool_axinfo[i % mdb_tool_threads] );
 		tavl_free(mdb->mi_attrs[i]->ai_root, NULL);
 		mdb->mi_attrs[i]->ai_root = NULL;
+		if ( !rc )
+			rc = mdb_idxstat_update( mdb, txn, mdb->mi_attrs[i],
+				mdb->mi_attrs[i]->ai_st );
+		memset( mdb->mi_attrs[i]->ai_st, 0, sizeof( mdb->mi_attrs[i]->ai_st ));
 		if ( rc )
 			break;
 	}
@@ -1403,7 +2161,8 @@ int mdb_tool_idl_add(
 	BackendDB *be,
 	MDB_cursor *mc,
 	struct berval *keys,
-	ID id )
+	ID id,
+	mdb_idxstat *st )
 {
 	MDB_dbi dbi;
 	mdb_tool_idl_cache *ic, itmp;
@@ -1440,6 +2199,7 @@ int mdb_tool_idl_add(
 		ic->flags = 0;
 		tavl_insert( &ai->ai_root, ic, mdb_tool_idl_cmp,
 			avl_dup_error );
+		st->is_keys++;
 
 		/* load existing key count here */
 		key.mv_size = keys[i].bv_len;
@@ -1447,6 +2207,7 @@ int mdb_tool_idl_add(
 		rc = mdb_cursor_get( mc, &key, &data, MDB_SET );
 		if ( rc == 0 ) {
 			ic->flags |= WAS_FOUND;
+			st->is_keys--;
 			nid = *(ID *)data.mv_data;
 			if ( nid == 0 ) {
 				ic->count = MDB_idl_db_size+1;
@@ -1467,6 +2228,8 @@ int mdb_tool_idl_add(
 		continue;
 	/* Are we at the limit, and converting to a range? */
 	} else if ( ic->count == MDB_idl_db_size ) {
+		st->is_ranges++;
+		st->is_ids -= ic->count;
 		if ( ic->head ) {
 			ic->tail->next = ax->ai_flist;
 			ax->ai_flist = ic->head;
@@ -1501,6 +2264,7 @@ int mdb_tool_idl_add(
 	if (!lcount || ice->ids[lcount-1] != id) {
 		ice->ids[lcount] = id;
 		ic->count++;
+		st->is_ids++;
 	}
 	}
 
@@ -33,6 +33,8 @@ typedef enum {
 	MT_UNKNOWN,
 	MT_RUNQUEUE,
 	MT_TASKLIST,
+	MT_QUEUES,
+	MT_FREELISTS,
 
 	MT_LAST
 } monitor_thread_t;
@@ -86,6 +88,12 @@ static struct {
 	{ BER_BVC( "cn=Tasklist" ),
 		BER_BVC("List of running plus standby threads - besides those handling operations"),
 		BER_BVNULL,	LDAP_PVT_THREAD_POOL_PARAM_UNKNOWN,	MT_TASKLIST },
+	{ BER_BVC( "cn=Queues" ),
+		BER_BVC("Per-queue statistics of the thread pool"),
+		BER_BVNULL,	LDAP_PVT_THREAD_POOL_PARAM_UNKNOWN,	MT_QUEUES },
+	{ BER_BVC( "cn=Free Lists" ),
+		BER_BVC("Per-thread free lists of operations and BER elements"),
+		BER_BVNULL,	LDAP_PVT_THREAD_POOL_PARAM_UNKNOWN,	MT_FREELISTS },
 
 	{ BER_BVNULL }
 };
@@ -312,6 +320,79 @@ monitor_subsys_thread_update(
 			}
 			break;
 
+		case MT_QUEUES: {
+			ldap_pvt_thread_pool_qstats_t st;
+
+			if ( a != NULL ) {
+				if ( a->a_nvals != a->a_vals ) {
+					ber_bvarray_free( a->a_nvals );
+				}
+				ber_bvarray_free( a->a_vals );
+				a->a_vals = NULL;
+				a->a_nvals = NULL;
+				a->a_numvals = 0;
+			}
+
+			bv.bv_val = buf;
+			for ( i = 0; ldap_pvt_thread_pool_queuestats( &connection_pool,
+				i, &st ) == 0; i++ )
+			{
+				bv.bv_len = snprintf( buf, sizeof( buf ),
+					"{%d}pending=%d active=%d open=%d tasks=%lu stolen=%lu "
+					"waitavg=%luus waitmax=%luus",
+					i, st.ltq_pending, st.ltq_active, st.ltq_open,
+					st.ltq_tasks, st.ltq_stolen,
+					st.ltq_wait_avg, st.ltq_wait_max );
+				if ( bv.bv_len < sizeof( buf ) ) {
+					value_add_one( &vals, &bv );
+				}
+			}
+
+			if ( vals ) {
+				attr_merge_normalize( e, mi->mi_ad_monitoredInfo, vals, NULL );
+				ber_bvarray_free( vals );
+
+			} else {
+				attr_delete( &e->e_attrs, mi->mi_ad_monitoredInfo );
+			}
+			} break;
+
+		case MT_FREELISTS: {
+			static const char *fname[ SLAP_FREELIST_NUM ] = {
+				"operation", "berelement" };
+			slap_freelist_stats_t st[ SLAP_FREELIST_NUM ];
+
+			if ( a != NULL ) {
+				if ( a->a_nvals != a->a_vals ) {
+					ber_bvarray_free( a->a_nvals );
+				}
+				ber_bvarray_free( a->a_vals );
+				a->a_vals = NULL;
+				a->a_nvals = NULL;
+				a->a_numvals = 0;
+			}
+
+			slap_op_freelist_stats( st );
+			bv.bv_val = buf;
+			for ( i = 0; i < SLAP_FREELIST_NUM; i++ ) {
+				bv.bv_len = snprintf( buf, sizeof( buf ),
+					"{%d}%s hits=%lu misses=%lu trimmed=%lu cached=%lu",
+					i, fname[ i ], st[ i ].fs_hits, st[ i ].fs_misses,
+					st[ i ].fs_trimmed, st[ i ].fs_cached );
+				if ( bv.bv_len < sizeof( buf ) ) {
+					value_add_one( &vals, &bv );
+				}
+			}
+
+			if ( vals ) {
+				attr_merge_normalize( e, mi->mi_ad_monitoredInfo, vals, NULL );
+				ber_bvarray_free( vals );
+
+			} else {
+				attr_delete( &e->e_attrs, mi->mi_ad_monitoredInfo );
+			}
+			} break;
+
 		default:
 			assert( 0 );
 		}
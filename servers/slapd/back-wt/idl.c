@@ -323,6 +323,15 @@ wt_idl_intersection(
 		goto done;
 	}
 
+	/* Both are lists, hand them to the sorted list kernels */
+	if ( !WT_IDL_IS_RANGE( b )) {
+		cursora = wt_idl_search( a, idmin );
+		cursorb = wt_idl_search( b, idmin );
+		a[0] = slap_idl_intersect( a + cursora, a[0] - cursora + 1,
+			b + cursorb, b[0] - cursorb + 1, a + 1, 0 );
+		goto done;
+	}
+
 	/* Fine, do the intersection one element at a time.
 	 * First advance to idmin in both IDLs.
 	 */
@@ -380,6 +389,14 @@ over:		ida = IDL_MIN( WT_IDL_FIRST(a), WT_IDL_FIRST(b) );
 		return 0;
 	}
 
+	/* The distinct elements of a are cat'd to b, then merged back */
+	if ( a[0] + b[0] <= WT_IDL_UM_MAX ) {
+		cursorc = slap_idl_intersect( a + 1, a[0], b + 1, b[0],
+			b + b[0] + 1, 1 );
+		a[0] = slap_idl_merge( b + 1, b[0], b + b[0] + 1, cursorc, a + 1 );
+		return 0;
+	}
+
 	ida = wt_idl_first( a, &cursora );
 	idb = wt_idl_first( b, &cursorb );
 
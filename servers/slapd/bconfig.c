@@ -26,6 +26,9 @@
 #include <ac/errno.h>
 #include <sys/stat.h>
 #include <ac/unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "slap.h"
 
@@ -201,6 +204,10 @@ enum {
 	CFG_TLS_CACERT,
 	CFG_TLS_CERT,
 	CFG_TLS_KEY,
+	CFG_NUMA,
+	CFG_WBATCH,
+	CFG_TWEIGHTS,
+	CFG_SEARCHMAX,
 
 	CFG_LAST
 };
@@ -504,6 +511,10 @@ static ConfigTable config_back_cf_table[] = {
 		"( OLcfgDbAt:0.18 NAME 'olcMonitoring' "
 			"EQUALITY booleanMatch "
 			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
+	{ "numapolicy", "policy> <[node]", 2, 3, 0, ARG_MAGIC|CFG_NUMA,
+		&config_generic, "( OLcfgGlAt:101 NAME 'olcNumaPolicy' "
+			"EQUALITY caseIgnoreMatch "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "objectclass", "objectclass", 2, 0, 0, ARG_PAREN|ARG_MAGIC|CFG_OC,
 		&config_generic, "( OLcfgGlAt:32 NAME 'olcObjectClasses' "
 		"DESC 'OpenLDAP object classes' "
@@ -674,6 +685,11 @@ static ConfigTable config_back_cf_table[] = {
 		&config_schema_dn, "( OLcfgGlAt:58 NAME 'olcSchemaDN' "
 			"EQUALITY distinguishedNameMatch "
 			"SYNTAX OMsDN SINGLE-VALUE )", NULL, NULL },
+	{ "searchpoolmax", "count", 2, 2, 0,
+		ARG_INT|ARG_MAGIC|CFG_SEARCHMAX, &config_generic,
+		"( OLcfgGlAt:104 NAME 'olcSearchPoolMax' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "security", "factors", 2, 0, 0, ARG_MAY_DB|ARG_MAGIC,
 		&config_security, "( OLcfgGlAt:59 NAME 'olcSecurity' "
 			"EQUALITY caseIgnoreMatch "
@@ -738,6 +754,11 @@ static ConfigTable config_back_cf_table[] = {
 		"( OLcfgGlAt:95 NAME 'olcThreadQueues' "
 			"EQUALITY integerMatch "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "threadweights", "default> <quick> <search", 4, 4, 0,
+		ARG_MAGIC|CFG_TWEIGHTS, &config_generic,
+		"( OLcfgGlAt:103 NAME 'olcThreadWeights' "
+			"EQUALITY caseIgnoreMatch "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "timelimit", "limit", 2, 0, 0, ARG_MAY_DB|ARG_MAGIC,
 		&config_timelimit, "( OLcfgGlAt:67 NAME 'olcTimeLimit' "
 			"EQUALITY caseExactMatch "
@@ -894,6 +915,10 @@ static ConfigTable config_back_cf_table[] = {
 		&config_updateref, "( OLcfgDbAt:0.13 NAME 'olcUpdateRef' "
 			"EQUALITY caseIgnoreMatch "
 			"SUP labeledURI )", NULL, NULL },
+	{ "writebatch", "bytes> <[msec]", 2, 3, 0, ARG_MAGIC|CFG_WBATCH,
+		&config_generic, "( OLcfgGlAt:102 NAME 'olcWriteBatch' "
+			"EQUALITY caseIgnoreMatch "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "writetimeout", "timeout", 2, 2, 0, ARG_INT,
 		&global_writetimeout, "( OLcfgGlAt:88 NAME 'olcWriteTimeout' "
 			"EQUALITY integerMatch "
@@ -949,22 +974,23 @@ static ConfigOCs cf_ocs[] = {
 		 "olcIndexSubstrAnyLen $ olcIndexSubstrAnyStep $ olcIndexHash64 $ "
 		 "olcIndexIntLen $ "
 		 "olcListenerThreads $ olcLocalSSF $ olcLogFile $ olcLogLevel $ "
+		 "olcNumaPolicy $ "
 		 "olcPasswordCryptSaltFormat $ olcPasswordHash $ olcPidFile $ "
 		 "olcPluginLogFile $ olcReadOnly $ olcReferral $ "
 		 "olcReplogFile $ olcRequires $ olcRestrict $ olcReverseLookup $ "
 		 "olcRootDSE $ "
 		 "olcSaslAuxprops $ olcSaslAuxpropsDontUseCopy $ olcSaslAuxpropsDontUseCopyIgnore $ "
 		 "olcSaslCBinding $ olcSaslHost $ olcSaslRealm $ olcSaslSecProps $ "
-		 "olcSecurity $ olcServerID $ olcSizeLimit $ "
+		 "olcSearchPoolMax $ olcSecurity $ olcServerID $ olcSizeLimit $ "
 		 "olcSockbufMaxIncoming $ olcSockbufMaxIncomingAuth $ "
 		 "olcTCPBuffer $ "
-		 "olcThreads $ olcThreadQueues $ "
+		 "olcThreads $ olcThreadQueues $ olcThreadWeights $ "
 		 "olcTimeLimit $ olcTLSCACertificateFile $ "
 		 "olcTLSCACertificatePath $ olcTLSCertificateFile $ "
 		 "olcTLSCertificateKeyFile $ olcTLSCipherSuite $ olcTLSCRLCheck $ "
 		 "olcTLSCACertificate $ olcTLSCertificate $ olcTLSCertificateKey $ "
 		 "olcTLSRandFile $ olcTLSVerifyClient $ olcTLSDHParamFile $ olcTLSECName $ "
-		 "olcTLSCRLFile $ olcTLSProtocolMin $ olcToolThreads $ olcWriteTimeout $ "
+		 "olcTLSCRLFile $ olcTLSProtocolMin $ olcToolThreads $ olcWriteBatch $ olcWriteTimeout $ "
 		 "olcObjectIdentifier $ olcAttributeTypes $ olcObjectClasses $ "
 		 "olcDitContentRules $ olcLdapSyntaxes ) )", Cft_Global },
 	{ "( OLcfgGlOc:2 "
@@ -1051,6 +1077,44 @@ static ADlist *sortVals;
 
 static int new_daemon_threads;
 
+/* NUMA memory policy, from <linux/mempolicy.h> */
+#define SLAP_NUMA_DEFAULT	0
+#define SLAP_NUMA_PREFERRED	1
+#define SLAP_NUMA_INTERLEAVE	3
+
+static slap_verbmasks numa_policies[] = {
+	{ BER_BVC("default"),		SLAP_NUMA_DEFAULT },
+	{ BER_BVC("preferred"),		SLAP_NUMA_PREFERRED },
+	{ BER_BVC("interleave"),	SLAP_NUMA_INTERLEAVE },
+	{ BER_BVNULL, 0 }
+};
+
+static int numa_policy, numa_node;
+
+/* Set the memory policy of the calling thread, which the threads
+ * it starts later inherit. Pages of the page cache, and so of the
+ * LMDB maps, are placed by the policy of the thread that faults
+ * them in, so this must be done before any worker threads run.
+ */
+static int
+config_numa_policy( int policy, int node )
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+	unsigned long mask;
+
+	if ( policy == SLAP_NUMA_DEFAULT )
+		return syscall( SYS_set_mempolicy, policy, NULL, 0UL );
+	mask = policy == SLAP_NUMA_PREFERRED ? 1UL << node : ~0UL;
+	return syscall( SYS_set_mempolicy, policy, &mask,
+		(unsigned long)( sizeof( mask ) * 8 ));
+#else
+	if ( policy == SLAP_NUMA_DEFAULT )
+		return 0;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 static int
 config_resize_lthreads(ConfigArgs *c)
 {
@@ -1079,6 +1143,56 @@ config_generic(ConfigArgs *c) {
 		case CFG_LTHREADS:
 			c->value_uint = slapd_daemon_threads;
 			break;
+		case CFG_NUMA:
+			if ( numa_policy == SLAP_NUMA_DEFAULT ) {
+				rc = 1;
+			} else {
+				char buf[ sizeof("preferred ") + LDAP_PVT_INTTYPE_CHARS(int) ];
+				struct berval bv;
+
+				enum_to_verb( numa_policies, numa_policy, &bv );
+				if ( numa_policy == SLAP_NUMA_PREFERRED ) {
+					bv.bv_len = snprintf( buf, sizeof( buf ), "%s %d",
+						bv.bv_val, numa_node );
+					bv.bv_val = buf;
+				}
+				value_add_one( &c->rvalue_vals, &bv );
+			}
+			break;
+		case CFG_TWEIGHTS:
+			if ( connection_pool_weight[SLAP_TCLASS_DEFAULT] == 1 &&
+				connection_pool_weight[SLAP_TCLASS_QUICK] == 1 &&
+				connection_pool_weight[SLAP_TCLASS_SEARCH] == 1 ) {
+				rc = 1;
+			} else {
+				char buf[ SLAP_TCLASS_NUM * LDAP_PVT_INTTYPE_CHARS(int) ];
+				struct berval bv;
+
+				bv.bv_len = snprintf( buf, sizeof( buf ), "%d %d %d",
+					connection_pool_weight[SLAP_TCLASS_DEFAULT],
+					connection_pool_weight[SLAP_TCLASS_QUICK],
+					connection_pool_weight[SLAP_TCLASS_SEARCH] );
+				bv.bv_val = buf;
+				value_add_one( &c->rvalue_vals, &bv );
+			}
+			break;
+		case CFG_SEARCHMAX:
+			c->value_int = connection_pool_search_max;
+			break;
+		case CFG_WBATCH:
+			if ( slap_write_batch == SLAP_WRITE_BATCH_DEFAULT &&
+				slap_write_batch_msec == SLAP_WRITE_BATCH_MSEC ) {
+				rc = 1;
+			} else {
+				char buf[ 2 * LDAP_PVT_INTTYPE_CHARS(unsigned long) ];
+				struct berval bv;
+
+				bv.bv_len = snprintf( buf, sizeof( buf ), "%lu %d",
+					(unsigned long)slap_write_batch, slap_write_batch_msec );
+				bv.bv_val = buf;
+				value_add_one( &c->rvalue_vals, &bv );
+			}
+			break;
 		case CFG_SALT:
 			if ( passwd_salt )
 				c->value_string = ch_strdup( passwd_salt );
@@ -1446,7 +1560,28 @@ config_generic(ConfigArgs *c) {
 
 		/* no-op, requires slapd restart */
 		case CFG_MODLOAD:
+		case CFG_NUMA:
 			snprintf(c->log, sizeof( c->log ), "change requires slapd restart");
+			numa_policy = SLAP_NUMA_DEFAULT;
+			break;
+
+		case CFG_WBATCH:
+			slap_write_batch = SLAP_WRITE_BATCH_DEFAULT;
+			slap_write_batch_msec = SLAP_WRITE_BATCH_MSEC;
+			break;
+
+		case CFG_TWEIGHTS:
+			for ( i = 0; i < SLAP_TCLASS_NUM; i++ ) {
+				connection_pool_weight[i] = 1;
+				ldap_pvt_thread_pool_class( &connection_pool, i, 1,
+					i == SLAP_TCLASS_SEARCH ? connection_pool_search_max : 0 );
+			}
+			break;
+
+		case CFG_SEARCHMAX:
+			connection_pool_search_max = 0;
+			ldap_pvt_thread_pool_class( &connection_pool, SLAP_TCLASS_SEARCH,
+				connection_pool_weight[SLAP_TCLASS_SEARCH], 0 );
 			break;
 
 		case CFG_MULTIPROVIDER:
@@ -1834,6 +1969,95 @@ config_generic(ConfigArgs *c) {
 			connection_pool_queues = c->value_int;	/* save for reference */
 			break;
 
+		case CFG_NUMA:
+			i = verb_to_mask( c->argv[1], numa_policies );
+			if ( BER_BVISNULL( &numa_policies[i].word ) ||
+				( numa_policies[i].mask == SLAP_NUMA_PREFERRED ) != ( c->argc == 3 )) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ), "<%s> unable to parse value", c->argv[0] );
+				Debug(LDAP_DEBUG_ANY, "%s: %s \"%s\"\n",
+					c->log, c->cr_msg, c->argv[1] );
+				return 1;
+			}
+			numa_node = 0;
+			if ( c->argc == 3 && ( lutil_atoi( &numa_node, c->argv[2] ) ||
+				numa_node < 0 || numa_node >= (int)( sizeof(long) * 8 - 1 ))) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ), "<%s> invalid node", c->argv[0] );
+				Debug(LDAP_DEBUG_ANY, "%s: %s \"%s\"\n",
+					c->log, c->cr_msg, c->argv[2] );
+				return 1;
+			}
+			/* a worker thread can't change the others' policy */
+			if ( CONFIG_ONLINE_ADD( c )) {
+				snprintf( c->log, sizeof( c->log ), "change requires slapd restart" );
+			} else if ( config_numa_policy( numa_policies[i].mask, numa_node )) {
+				char ebuf[128];
+				snprintf( c->cr_msg, sizeof( c->cr_msg ), "<%s> failed: %s",
+					c->argv[0], AC_STRERROR_R( errno, ebuf, sizeof( ebuf )));
+				Debug(LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg );
+				return 1;
+			}
+			numa_policy = numa_policies[i].mask;
+			break;
+
+		case CFG_WBATCH: {
+			unsigned long bytes;
+			int msec = SLAP_WRITE_BATCH_MSEC;
+
+			if ( lutil_atoul( &bytes, c->argv[1] ) ||
+				( c->argc == 3 && ( lutil_atoi( &msec, c->argv[2] ) || msec < 0 ))) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ), "<%s> unable to parse value", c->argv[0] );
+				Debug(LDAP_DEBUG_ANY, "%s: %s \"%s\"\n",
+					c->log, c->cr_msg, c->argv[1] );
+				return 1;
+			}
+			slap_write_batch = bytes;
+			slap_write_batch_msec = msec;
+			}
+			break;
+
+		case CFG_TWEIGHTS: {
+			int weight[SLAP_TCLASS_NUM];
+
+			for ( i = 0; i < SLAP_TCLASS_NUM; i++ ) {
+				if ( lutil_atoi( &weight[i], c->argv[i+1] ) || weight[i] < 1 ) {
+					snprintf( c->cr_msg, sizeof( c->cr_msg ),
+						"<%s> weights must be positive integers", c->argv[0] );
+					Debug(LDAP_DEBUG_ANY, "%s: %s \"%s\"\n",
+						c->log, c->cr_msg, c->argv[i+1] );
+					return 1;
+				}
+			}
+			for ( i = 0; i < SLAP_TCLASS_NUM; i++ ) {
+				connection_pool_weight[i] = weight[i];
+				if ( slapMode & SLAP_SERVER_MODE )
+					ldap_pvt_thread_pool_class( &connection_pool, i, weight[i],
+						i == SLAP_TCLASS_SEARCH ? connection_pool_search_max : 0 );
+			}
+			}
+			break;
+
+		case CFG_SEARCHMAX:
+			if ( c->value_int < 0 ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"searchpoolmax=%d smaller than minimum value 0",
+					c->value_int );
+				Debug(LDAP_DEBUG_ANY, "%s: %s.\n",
+					c->log, c->cr_msg );
+				return 1;
+			}
+			if ( c->value_int >= connection_pool_max ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"warning, searchpoolmax=%d not smaller than threads=%d, no effect",
+					c->value_int, connection_pool_max );
+				Debug(LDAP_DEBUG_ANY, "%s: %s.\n",
+					c->log, c->cr_msg );
+			}
+			if ( slapMode & SLAP_SERVER_MODE )
+				ldap_pvt_thread_pool_class( &connection_pool, SLAP_TCLASS_SEARCH,
+					connection_pool_weight[SLAP_TCLASS_SEARCH], c->value_int );
+			connection_pool_search_max = c->value_int;	/* save for reference */
+			break;
+
 		case CFG_TTHREADS:
 			if ( slapMode & SLAP_TOOL_MODE )
 				ldap_pvt_thread_pool_maxthreads(&connection_pool, c->value_int);
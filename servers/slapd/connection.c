@@ -85,6 +85,7 @@ static int connection_input( Connection *c, conn_readinfo *cri );
 static void connection_close( Connection *c );
 
 static int connection_op_activate( Operation *op );
+static int connection_op_class( Operation *op );
 static void connection_op_queue( Operation *op );
 static int connection_resched( Connection *conn );
 static void connection_abandon( Connection *conn );
@@ -424,6 +425,7 @@ Connection * connection_init(
 	assert( c->c_sasl_bindop == NULL );
 	assert( c->c_sasl_cbind == NULL );
 	assert( c->c_currentber == NULL );
+	assert( c->c_wbatch == NULL );
 	assert( c->c_writewaiter == 0);
 	assert( c->c_writers == 0);
 
@@ -664,6 +666,12 @@ connection_destroy( Connection *c )
 		c->c_currentber = NULL;
 	}
 
+	if ( c->c_wbatch != NULL ) {
+		ber_free( c->c_wbatch, 1 );
+		c->c_wbatch = NULL;
+	}
+	c->c_wbatchop = NULL;
+
 
 #ifdef LDAP_SLAPI
 	/* call destructors, then constructors; avoids unnecessary allocation */
@@ -1337,8 +1345,8 @@ int connection_read_activate( ber_socket_t s )
 	if ( rc )
 		return rc;
 
-	rc = ldap_pvt_thread_pool_submit( &connection_pool,
-		connection_read_thread, (void *)(long)s );
+	rc = ldap_pvt_thread_pool_submit3( &connection_pool,
+		connection_read_thread, (void *)(long)s, NULL, SLAP_TCLASS_QUICK );
 
 	if( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -1352,7 +1360,7 @@ int connection_read_activate( ber_socket_t s )
 static int
 connection_read( ber_socket_t s, conn_readinfo *cri )
 {
-	int rc = 0;
+	int rc = 0, npdus = 0;
 	Connection *c;
 
 	assert( connections != NULL );
@@ -1487,6 +1495,7 @@ connection_read( ber_socket_t s, conn_readinfo *cri )
 	do {
 		/* How do we do this without getting into a busy loop ? */
 		rc = connection_input( c, cri );
+		if ( !rc ) npdus++;
 	}
 #ifdef DATA_READY_LOOP
 	while( !rc && ber_sockbuf_ctrl( c->c_sb, LBER_SB_OPT_DATA_READY, NULL ));
@@ -1508,6 +1517,19 @@ connection_read( ber_socket_t s, conn_readinfo *cri )
 		return 0;
 	}
 
+	/* The client pipelines its requests. Read ahead from now on,
+	 * so that one read(2) fetches all the PDUs waiting in the socket
+	 * instead of two reads per PDU. Writers walk the same I/O stack.
+	 */
+	if ( npdus > 1 && !ber_sockbuf_ctrl( c->c_sb, LBER_SB_OPT_HAS_IO,
+		&ber_sockbuf_io_readahead ))
+	{
+		ldap_pvt_thread_mutex_lock( &c->c_write1_mutex );
+		ber_sockbuf_add_io( c->c_sb, &ber_sockbuf_io_readahead,
+			LBER_SBIOD_LEVEL_PROVIDER, NULL );
+		ldap_pvt_thread_mutex_unlock( &c->c_write1_mutex );
+	}
+
 	if ( ber_sockbuf_ctrl( c->c_sb, LBER_SB_OPT_NEEDS_WRITE, NULL ) ) {
 		slapd_set_write( s, 0 );
 	}
@@ -1535,7 +1557,7 @@ connection_input( Connection *conn , conn_readinfo *cri )
 	void *ctx;
 
 	if ( conn->c_currentber == NULL &&
-		( conn->c_currentber = ber_alloc()) == NULL )
+		( conn->c_currentber = slap_ber_alloc( cri->ctx )) == NULL )
 	{
 		Debug( LDAP_DEBUG_ANY, "ber_alloc failed\n" );
 		return -1;
@@ -1751,17 +1773,21 @@ connection_input( Connection *conn , conn_readinfo *cri )
 		 * The first op will be processed in the same thread context,
 		 * as long as there is only one op total.
 		 * Subsequent ops will be submitted to the pool by
-		 * calling connection_op_activate()
+		 * calling connection_op_activate(). So are searches
+		 * when their number of threads is limited.
 		 */
-		if ( cri->op == NULL ) {
+		if ( cri->op == NULL && !( connection_pool_search_max &&
+			connection_op_class( op ) == SLAP_TCLASS_SEARCH ))
+		{
 			/* the first incoming request */
 			connection_op_queue( op );
 			cri->op = op;
 		} else {
-			if ( !cri->nullop ) {
+			if ( cri->op && !cri->nullop ) {
 				cri->nullop = 1;
-				rc = ldap_pvt_thread_pool_submit( &connection_pool,
-					connection_operation, (void *) cri->op );
+				rc = ldap_pvt_thread_pool_submit3( &connection_pool,
+					connection_operation, (void *) cri->op, NULL,
+					connection_op_class( cri->op ));
 			}
 			connection_op_activate( op );
 		}
@@ -1938,14 +1964,42 @@ static void connection_op_queue( Operation *op )
 	LDAP_STAILQ_INSERT_TAIL( &op->o_conn->c_ops, op, o_next );
 }
 
+/* Thread pool class of a not yet decoded operation */
+static int connection_op_class( Operation *op )
+{
+	BerElementBuffer berbuf;
+	BerElement *ber = (BerElement *)&berbuf;
+	struct berval bv, base;
+	ber_int_t scope;
+
+	switch ( op->o_tag ) {
+	case LDAP_REQ_BIND:
+	case LDAP_REQ_COMPARE:
+	case LDAP_REQ_ABANDON:
+	case LDAP_REQ_UNBIND:
+		return SLAP_TCLASS_QUICK;
+
+	case LDAP_REQ_SEARCH:
+		/* peek at the scope, do_search() decodes the request later */
+		if ( ber_peek_element( op->o_ber, &bv ) == LDAP_REQ_SEARCH ) {
+			ber_init2( ber, &bv, 0 );
+			if ( ber_scanf( ber, "me", &base, &scope ) != LBER_ERROR &&
+				scope == LDAP_SCOPE_BASE )
+				return SLAP_TCLASS_QUICK;
+		}
+		return SLAP_TCLASS_SEARCH;
+	}
+	return SLAP_TCLASS_DEFAULT;
+}
+
 static int connection_op_activate( Operation *op )
 {
 	int rc;
 
 	connection_op_queue( op );
 
-	rc = ldap_pvt_thread_pool_submit( &connection_pool,
-		connection_operation, (void *) op );
+	rc = ldap_pvt_thread_pool_submit3( &connection_pool,
+		connection_operation, (void *) op, NULL, connection_op_class( op ));
 
 	if ( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -670,6 +670,23 @@ int slap_add_ctrls(
 	return i;
 }
 
+/* The sort the sssvlv overlay offers to the backend of a search */
+SortRequest *
+slap_sort_request( Operation *op )
+{
+	OpExtra *oex;
+
+	LDAP_SLIST_FOREACH( oex, &op->o_extra, oe_next ) {
+		if ( oex->oe_key == (void *)slap_sort_request ) {
+			SortRequest *srq = (SortRequest *)oex;
+
+			/* internal searches made with a copy of op see it too */
+			return srq->srq_op == op ? srq : NULL;
+		}
+	}
+	return NULL;
+}
+
 int slap_parse_ctrl(
 	Operation *op,
 	SlapReply *rs,
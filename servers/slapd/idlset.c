@@ -0,0 +1,398 @@
+/* idlset.c - set operations on sorted ID lists */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 1998-2021 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* These are the inner loops of the backends' IDL intersection, union
+ * and difference, working on plain ascending arrays of IDs without
+ * the count word or range encoding of an IDL. They must not call back
+ * into the rest of slapd so that tests/progs/idl-bench can link them
+ * on their own.
+ *
+ * When one list is much shorter than the other, the short one is
+ * walked and the long one is searched with a galloping (exponential
+ * then binary) search. Otherwise both lists are compared in blocks of
+ * four IDs, all against all, using SSE4.2 or AVX2 if the CPU has them;
+ * the kernel is picked once by slap_idl_init() at startup.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "slap.h"
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__amd64__) ) && \
+	ULONG_MAX == 0xffffffffffffffffUL && !defined(SLAP_IDL_NO_SIMD)
+#define IDL_SIMD_X86	1
+#include <immintrin.h>
+#endif
+
+#ifdef __GNUC__
+#define IDL_INLINE	static inline __attribute__((always_inline))
+#else
+#define IDL_INLINE	static
+#endif
+
+/* Gallop instead of merging when one list is this many times
+ * longer than the other.
+ */
+#define IDL_GALLOP_RATIO	32
+
+/* Members of the current block of a already known to be in b,
+ * one bit per member.
+ */
+typedef unsigned (idl_match_func)( const ID *a, const ID *b );
+
+typedef ID (idl_isect_func)( const ID *a, ID na, const ID *b, ID nb,
+	ID *out, int notin );
+
+/* First index >= i in p[0..n) whose ID is >= id, p[i] < id known */
+static ID
+idl_gallop( const ID *p, ID i, ID n, ID id )
+{
+	ID lo = i, hi, step = 1;
+
+	while ( i + step < n && p[i + step] < id ) {
+		lo = i + step;
+		step <<= 1;
+	}
+	hi = i + step < n ? i + step : n;
+
+	/* p[lo] < id, and p[hi] >= id or hi == n */
+	while ( hi - lo > 1 ) {
+		ID mid = lo + ( hi - lo ) / 2;
+		if ( p[mid] < id )
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return hi;
+}
+
+/* End of the run of IDs < id starting at p[i]. Runs are usually
+ * short, so look at a few neighbours before galloping.
+ */
+static ID
+idl_run( const ID *p, ID i, ID n, ID id )
+{
+	ID end = i + 4 < n ? i + 4 : n;
+
+	for ( ; i < end; i++ ) {
+		if ( p[i] >= id )
+			return i;
+	}
+	if ( i == n || p[i] >= id )
+		return i;
+	return idl_gallop( p, i, n, id );
+}
+
+/* Finish an intersection or difference one ID at a time. The low
+ * bits of m flag members of a[i..] already found in b.
+ */
+IDL_INLINE ID
+idl_isect_tail( const ID *a, ID i, ID na, const ID *b, ID j, ID nb,
+	ID *out, ID n, unsigned m, int notin )
+{
+	for ( ; i < na; i++, m >>= 1 ) {
+		ID x = a[i];
+		int hit;
+
+		if ( m & 1 ) {
+			hit = 1;
+		} else {
+			while ( j < nb && b[j] < x )
+				j++;
+			if ( j == nb && !m && !notin )
+				break;
+			hit = j < nb && b[j] == x;
+		}
+		if ( hit != notin )
+			out[n++] = x;
+	}
+	return n;
+}
+
+/* One ID at a time, without branching on the comparisons. out may
+ * be a, and must have room for na IDs.
+ */
+static ID
+idl_isect_scalar( const ID *a, ID na, const ID *b, ID nb,
+	ID *out, int notin )
+{
+	ID i = 0, j = 0, n = 0;
+
+	while ( i < na && j < nb ) {
+		ID x = a[i], y = b[j];
+		out[n] = x;
+		n += notin ? x < y : x == y;
+		i += x <= y;
+		j += y <= x;
+	}
+	return idl_isect_tail( a, i, na, b, j, nb, out, n, 0, notin );
+}
+
+/* Compare four IDs of a against four of b at a time. Whichever block
+ * ends lower is done with and the next one is loaded; a block of a is
+ * only written out once no more of b can match it.
+ */
+IDL_INLINE ID
+idl_isect_block( const ID *a, ID na, const ID *b, ID nb,
+	ID *out, int notin, idl_match_func *match )
+{
+	ID i = 0, j = 0, n = 0;
+	unsigned m = 0;
+
+	while ( i + 4 <= na && j + 4 <= nb ) {
+		ID la = a[i + 3], lb = b[j + 3];
+
+		m |= match( a + i, b + j );
+		if ( la <= lb ) {
+			unsigned keep = notin ? ~m : m;
+			int k;
+
+			for ( k = 0; k < 4; k++ ) {
+				if ( keep & ( 1U << k ))
+					out[n++] = a[i + k];
+			}
+			i += 4;
+			m = 0;
+		}
+		if ( lb <= la )
+			j += 4;
+	}
+	return idl_isect_tail( a, i, na, b, j, nb, out, n, m, notin );
+}
+
+#ifdef IDL_SIMD_X86
+__attribute__((target("sse4.2")))
+static unsigned
+idl_match_sse42( const ID *a, const ID *b )
+{
+	__m128i a0 = _mm_loadu_si128( (const __m128i *)a );
+	__m128i a1 = _mm_loadu_si128( (const __m128i *)( a + 2 ));
+	__m128i b0 = _mm_loadu_si128( (const __m128i *)b );
+	__m128i b1 = _mm_loadu_si128( (const __m128i *)( b + 2 ));
+	__m128i b0s = _mm_shuffle_epi32( b0, 0x4e );
+	__m128i b1s = _mm_shuffle_epi32( b1, 0x4e );
+	__m128i m0, m1;
+
+	m0 = _mm_or_si128(
+		_mm_or_si128( _mm_cmpeq_epi64( a0, b0 ), _mm_cmpeq_epi64( a0, b0s )),
+		_mm_or_si128( _mm_cmpeq_epi64( a0, b1 ), _mm_cmpeq_epi64( a0, b1s )));
+	m1 = _mm_or_si128(
+		_mm_or_si128( _mm_cmpeq_epi64( a1, b0 ), _mm_cmpeq_epi64( a1, b0s )),
+		_mm_or_si128( _mm_cmpeq_epi64( a1, b1 ), _mm_cmpeq_epi64( a1, b1s )));
+
+	return _mm_movemask_pd( _mm_castsi128_pd( m0 )) |
+		( _mm_movemask_pd( _mm_castsi128_pd( m1 )) << 2 );
+}
+
+__attribute__((target("sse4.2")))
+static ID
+idl_isect_sse42( const ID *a, ID na, const ID *b, ID nb,
+	ID *out, int notin )
+{
+	return idl_isect_block( a, na, b, nb, out, notin, idl_match_sse42 );
+}
+
+__attribute__((target("avx2")))
+static unsigned
+idl_match_avx2( const ID *a, const ID *b )
+{
+	__m256i va = _mm256_loadu_si256( (const __m256i *)a );
+	__m256i vb = _mm256_loadu_si256( (const __m256i *)b );
+	__m256i m;
+
+	/* compare against each rotation of b */
+	m = _mm256_cmpeq_epi64( va, vb );
+	vb = _mm256_permute4x64_epi64( vb, 0x39 );
+	m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+	vb = _mm256_permute4x64_epi64( vb, 0x39 );
+	m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+	vb = _mm256_permute4x64_epi64( vb, 0x39 );
+	m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+
+	return _mm256_movemask_pd( _mm256_castsi256_pd( m ));
+}
+
+__attribute__((target("avx2")))
+static ID
+idl_isect_avx2( const ID *a, ID na, const ID *b, ID nb,
+	ID *out, int notin )
+{
+	return idl_isect_block( a, na, b, nb, out, notin, idl_match_avx2 );
+}
+#endif /* IDL_SIMD_X86 */
+
+static struct {
+	const char *name;
+	idl_isect_func *func;
+} idl_kernels[] = {
+#ifdef IDL_SIMD_X86
+	{ "avx2", idl_isect_avx2 },
+	{ "sse4.2", idl_isect_sse42 },
+#endif
+	{ "scalar", idl_isect_scalar },
+	{ NULL, NULL }
+};
+
+static idl_isect_func *idl_isect = idl_isect_scalar;
+static const char *idl_kernel = "scalar";
+
+static int
+idl_kernel_supported( const char *name )
+{
+#ifdef IDL_SIMD_X86
+	__builtin_cpu_init();
+	if ( !strcmp( name, "avx2" ))
+		return __builtin_cpu_supports( "avx2" );
+	if ( !strcmp( name, "sse4.2" ))
+		return __builtin_cpu_supports( "sse4.2" );
+#endif
+	return !strcmp( name, "scalar" );
+}
+
+/* Select the kernel to use, the best one the CPU supports if
+ * name is NULL. Returns -1 if the named kernel is unavailable.
+ */
+int
+slap_idl_init( const char *name )
+{
+	int i;
+
+	for ( i = 0; idl_kernels[i].name; i++ ) {
+		if ( name && strcasecmp( name, idl_kernels[i].name ))
+			continue;
+		if ( idl_kernel_supported( idl_kernels[i].name )) {
+			idl_isect = idl_kernels[i].func;
+			idl_kernel = idl_kernels[i].name;
+			return 0;
+		}
+		if ( name )
+			break;
+	}
+	return -1;
+}
+
+const char *
+slap_idl_kernel( void )
+{
+	return idl_kernel;
+}
+
+/* out = a & b (notin == 0) or out = a & ~b (notin != 0).
+ * Returns the number of IDs written to out, which may be a and
+ * must have room for na IDs.
+ */
+ID
+slap_idl_intersect( ID *a, ID na, ID *b, ID nb, ID *out, int notin )
+{
+	ID i, j, n = 0;
+
+	if ( na == 0 || ( nb == 0 && !notin ))
+		return 0;
+
+	if ( na * IDL_GALLOP_RATIO <= nb ) {
+		/* look up each member of a in b */
+		for ( i = 0, j = 0; i < na; i++ ) {
+			if ( b[j] < a[i] )
+				j = idl_gallop( b, j, nb, a[i] );
+			if ( j == nb ) {
+				if ( notin ) {
+					AC_MEMCPY( out + n, a + i, ( na - i ) * sizeof(ID) );
+					n += na - i;
+				}
+				break;
+			}
+			if ( ( b[j] == a[i] ) != notin )
+				out[n++] = a[i];
+		}
+		return n;
+	}
+
+	if ( nb * IDL_GALLOP_RATIO <= na ) {
+		/* look up each member of b in a */
+		for ( i = 0, j = 0; j < nb && i < na; j++ ) {
+			ID k = i;
+			if ( a[k] < b[j] )
+				k = idl_gallop( a, k, na, b[j] );
+			if ( notin ) {
+				AC_MEMCPY( out + n, a + i, ( k - i ) * sizeof(ID) );
+				n += k - i;
+			}
+			i = k;
+			if ( i < na && a[i] == b[j] ) {
+				if ( !notin )
+					out[n++] = a[i];
+				i++;
+			}
+		}
+		if ( notin && i < na ) {
+			AC_MEMCPY( out + n, a + i, ( na - i ) * sizeof(ID) );
+			n += na - i;
+		}
+		return n;
+	}
+
+	return idl_isect( a, na, b, nb, out, notin );
+}
+
+/* out = a | b. Returns the number of IDs written to out, which must
+ * not overlap a or b and must have room for na + nb IDs.
+ */
+ID
+slap_idl_merge( ID *a, ID na, ID *b, ID nb, ID *out )
+{
+	ID i = 0, j = 0, k, n = 0;
+
+	if ( na * IDL_GALLOP_RATIO <= nb || nb * IDL_GALLOP_RATIO <= na ) {
+		/* copy the runs of either list that fall between
+		 * members of the other
+		 */
+		while ( i < na && j < nb ) {
+			if ( a[i] < b[j] ) {
+				k = idl_run( a, i, na, b[j] );
+				AC_MEMCPY( out + n, a + i, ( k - i ) * sizeof(ID) );
+				n += k - i;
+				i = k;
+			} else if ( b[j] < a[i] ) {
+				k = idl_run( b, j, nb, a[i] );
+				AC_MEMCPY( out + n, b + j, ( k - j ) * sizeof(ID) );
+				n += k - j;
+				j = k;
+			} else {
+				out[n++] = a[i++];
+				j++;
+			}
+		}
+	} else {
+		while ( i < na && j < nb ) {
+			ID x = a[i], y = b[j];
+			out[n++] = x <= y ? x : y;
+			i += x <= y;
+			j += y <= x;
+		}
+	}
+	if ( i < na ) {
+		AC_MEMCPY( out + n, a + i, ( na - i ) * sizeof(ID) );
+		n += na - i;
+	}
+	if ( j < nb ) {
+		AC_MEMCPY( out + n, b + j, ( nb - j ) * sizeof(ID) );
+		n += nb - j;
+	}
+	return n;
+}
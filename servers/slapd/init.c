@@ -61,6 +61,8 @@ BerVarray default_referral = NULL;
 ldap_pvt_thread_pool_t	connection_pool;
 int		connection_pool_max = SLAP_MAX_WORKER_THREADS;
 int		connection_pool_queues = 1;
+int		connection_pool_weight[SLAP_TCLASS_NUM] = { 1, 1, 1 };
+int		connection_pool_search_max = 0;
 int		slap_tool_thread_max = 1;
 
 slap_counters_t			slap_counters, *slap_counters_list;
@@ -123,6 +125,10 @@ slap_init( int mode, const char *name )
 		return 1;
 	}
 
+	slap_idl_init( NULL );
+	Debug( LDAP_DEBUG_TRACE,
+		"%s init: using %s ID list kernel\n", name, slap_idl_kernel() );
+
 	switch ( slapMode & SLAP_MODE ) {
 	case SLAP_SERVER_MODE:
 		root_dse_init();
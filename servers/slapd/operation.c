@@ -41,6 +41,30 @@ static ldap_pvt_thread_mutex_t	slap_op_mutex;
 static time_t last_time;
 static int last_incr;
 
+/* Per-thread free lists of Operations and of the BerElements requests
+ * are read into. They're usually released by the thread that executed
+ * the request, which need not be the one that read it, so anything
+ * beyond these bounds is simply freed.
+ */
+#define SLAP_FREELIST_OPS	10
+#define SLAP_FREELIST_BERS	16
+
+typedef struct slap_freelist {
+	struct slap_freelist	*fl_next;
+	Operation	*fl_ops;
+	int		fl_nops;
+	int		fl_nbers;
+	BerElement	*fl_bers[SLAP_FREELIST_BERS];
+	/* only written by the owning thread */
+	slap_freelist_stats_t	fl_stats[SLAP_FREELIST_NUM];
+} slap_freelist;
+
+/* All live free lists, and the totals of those already destroyed.
+ * Protected by slap_op_mutex.
+ */
+static slap_freelist	*slap_freelists;
+static slap_freelist_stats_t	slap_freelist_gone[SLAP_FREELIST_NUM];
+
 void slap_op_init(void)
 {
 	ldap_pvt_thread_mutex_init( &slap_op_mutex );
@@ -52,13 +76,124 @@ void slap_op_destroy(void)
 }
 
 static void
-slap_op_q_destroy( void *key, void *data )
+slap_freelist_destroy( void *key, void *data )
 {
+	slap_freelist *fl = data, **prev;
 	Operation *op, *op2;
-	for ( op = data; op; op = op2 ) {
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &slap_op_mutex );
+	for ( prev = &slap_freelists; *prev; prev = &(*prev)->fl_next ) {
+		if ( *prev == fl ) {
+			*prev = fl->fl_next;
+			break;
+		}
+	}
+	for ( i = 0; i < SLAP_FREELIST_NUM; i++ ) {
+		slap_freelist_gone[i].fs_hits += fl->fl_stats[i].fs_hits;
+		slap_freelist_gone[i].fs_misses += fl->fl_stats[i].fs_misses;
+		slap_freelist_gone[i].fs_trimmed += fl->fl_stats[i].fs_trimmed;
+	}
+	ldap_pvt_thread_mutex_unlock( &slap_op_mutex );
+
+	for ( op = fl->fl_ops; op; op = op2 ) {
 		op2 = LDAP_STAILQ_NEXT( op, o_next );
 		ber_memfree_x( op, NULL );
 	}
+	/* buffers were released when they were put on the list */
+	for ( i = 0; i < fl->fl_nbers; i++ ) {
+		ber_free( fl->fl_bers[i], 0 );
+	}
+	ch_free( fl );
+}
+
+static slap_freelist *
+slap_freelist_get( void *ctx )
+{
+	void *data = NULL;
+	slap_freelist *fl;
+
+	if ( !ctx )
+		return NULL;
+
+	ldap_pvt_thread_pool_getkey( ctx, (void *)slap_freelist_get, &data, NULL );
+	if ( data )
+		return data;
+
+	fl = ch_calloc( 1, sizeof( slap_freelist ));
+	if ( ldap_pvt_thread_pool_setkey( ctx, (void *)slap_freelist_get,
+			fl, slap_freelist_destroy, NULL, NULL )) {
+		ch_free( fl );
+		return NULL;
+	}
+	ldap_pvt_thread_mutex_lock( &slap_op_mutex );
+	fl->fl_next = slap_freelists;
+	slap_freelists = fl;
+	ldap_pvt_thread_mutex_unlock( &slap_op_mutex );
+	return fl;
+}
+
+/* Returns a BerElement set up like ber_alloc() does, for reading a
+ * request into.
+ */
+BerElement *
+slap_ber_alloc( void *ctx )
+{
+	slap_freelist *fl = slap_freelist_get( ctx );
+	BerElement *ber;
+
+	if ( fl ) {
+		if ( fl->fl_nbers ) {
+			ber = fl->fl_bers[--fl->fl_nbers];
+			ber_init2( ber, NULL, 0 );
+			fl->fl_stats[SLAP_FREELIST_BER].fs_hits++;
+			return ber;
+		}
+		fl->fl_stats[SLAP_FREELIST_BER].fs_misses++;
+	}
+	return ber_alloc();
+}
+
+void
+slap_ber_free( BerElement *ber, void *ctx )
+{
+	slap_freelist *fl = slap_freelist_get( ctx );
+
+	if ( fl ) {
+		if ( fl->fl_nbers < SLAP_FREELIST_BERS ) {
+			ber_free_buf( ber );
+			fl->fl_bers[fl->fl_nbers++] = ber;
+			return;
+		}
+		fl->fl_stats[SLAP_FREELIST_BER].fs_trimmed++;
+	}
+	ber_free( ber, 1 );
+}
+
+/* The counters of other threads are read without their owners
+ * stopping, the result is only approximate.
+ */
+void
+slap_op_freelist_stats( slap_freelist_stats_t st[SLAP_FREELIST_NUM] )
+{
+	slap_freelist *fl;
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &slap_op_mutex );
+	for ( i = 0; i < SLAP_FREELIST_NUM; i++ ) {
+		st[i] = slap_freelist_gone[i];
+		st[i].fs_cached = 0;
+	}
+	for ( fl = slap_freelists; fl; fl = fl->fl_next ) {
+		for ( i = 0; i < SLAP_FREELIST_NUM; i++ ) {
+			st[i].fs_hits += fl->fl_stats[i].fs_hits;
+			st[i].fs_misses += fl->fl_stats[i].fs_misses;
+			st[i].fs_trimmed += fl->fl_stats[i].fs_trimmed;
+		}
+		st[SLAP_FREELIST_OP].fs_cached += fl->fl_nops;
+		st[SLAP_FREELIST_BER].fs_cached += fl->fl_nbers;
+	}
+	ldap_pvt_thread_mutex_unlock( &slap_op_mutex );
 }
 
 void
@@ -76,6 +211,7 @@ void
 slap_op_free( Operation *op, void *ctx )
 {
 	OperationBuffer *opbuf;
+	slap_freelist *fl;
 
 	assert( LDAP_STAILQ_NEXT(op, o_next) == NULL );
 
@@ -83,7 +219,7 @@ slap_op_free( Operation *op, void *ctx )
 	op->o_abandon = 1;
 
 	if ( op->o_ber != NULL ) {
-		ber_free( op->o_ber, 1 );
+		slap_ber_free( op->o_ber, ctx );
 	}
 	if ( !BER_BVISNULL( &op->o_dn ) ) {
 		ch_free( op->o_dn.bv_val );
@@ -135,25 +271,17 @@ slap_op_free( Operation *op, void *ctx )
 	memset( opbuf->ob_controls, 0, sizeof( opbuf->ob_controls ));
 	op->o_controls = opbuf->ob_controls;
 
-	if ( ctx ) {
-		Operation *op2 = NULL;
-		ldap_pvt_thread_pool_setkey( ctx, (void *)slap_op_free,
-			op, slap_op_q_destroy, (void **)&op2, NULL );
-		LDAP_STAILQ_NEXT( op, o_next ) = op2;
-		if ( op2 ) {
-			op->o_tincr = op2->o_tincr + 1;
-			/* No more than 10 ops on per-thread free list */
-			if ( op->o_tincr > 10 ) {
-				ldap_pvt_thread_pool_setkey( ctx, (void *)slap_op_free,
-					op2, slap_op_q_destroy, NULL, NULL );
-				ber_memfree_x( op, NULL );
-			}
-		} else {
-			op->o_tincr = 1;
+	fl = slap_freelist_get( ctx );
+	if ( fl ) {
+		if ( fl->fl_nops < SLAP_FREELIST_OPS ) {
+			LDAP_STAILQ_NEXT( op, o_next ) = fl->fl_ops;
+			fl->fl_ops = op;
+			fl->fl_nops++;
+			return;
 		}
-	} else {
-		ber_memfree_x( op, NULL );
+		fl->fl_stats[SLAP_FREELIST_OP].fs_trimmed++;
 	}
+	ber_memfree_x( op, NULL );
 }
 
 void
@@ -183,17 +311,19 @@ slap_op_alloc(
 	void *ctx )
 {
 	Operation	*op = NULL;
+	slap_freelist	*fl = slap_freelist_get( ctx );
 
-	if ( ctx ) {
-		void *otmp = NULL;
-		ldap_pvt_thread_pool_getkey( ctx, (void *)slap_op_free, &otmp, NULL );
-		if ( otmp ) {
-			op = otmp;
-			otmp = LDAP_STAILQ_NEXT( op, o_next );
-			ldap_pvt_thread_pool_setkey( ctx, (void *)slap_op_free,
-				otmp, slap_op_q_destroy, NULL, NULL );
+	if ( fl ) {
+		if ( fl->fl_ops ) {
+			op = fl->fl_ops;
+			fl->fl_ops = LDAP_STAILQ_NEXT( op, o_next );
+			fl->fl_nops--;
+			LDAP_STAILQ_NEXT( op, o_next ) = NULL;
 			op->o_abandon = 0;
 			op->o_cancel = 0;
+			fl->fl_stats[SLAP_FREELIST_OP].fs_hits++;
+		} else {
+			fl->fl_stats[SLAP_FREELIST_OP].fs_misses++;
 		}
 	}
 	if (!op) {
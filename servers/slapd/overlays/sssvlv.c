@@ -117,8 +117,15 @@ typedef struct sort_op
 	int so_session;
 	unsigned long so_vcontext;
 	int so_running;
+	int so_native;	/* the backend sorts the entries */
+	struct berval so_resume;	/* the backend's start of the next page */
+	SortRequest *so_srq;	/* offered to the backend by the running op */
 } sort_op;
 
+/* The paged results cookie of a session */
+#define so_cookie(so)	((PagedResultsCookie)( (so)->so_native ? \
+	(void *)(so)->so_resume.bv_val : (void *)(so)->so_tree ))
+
 /* There is only one conn table for all overlay instances */
 /* Each conn can handle one session by context */
 static sort_op ***sort_conns;
@@ -215,7 +222,8 @@ static int pack_vlv_response_control(
 	rc = ber_printf( ber, "{iie", so->so_vlv_target, so->so_nentries,
 		so->so_vlv_rc );
 
-	if ( rc != -1 && so->so_vcontext ) {
+	/* nothing is kept to continue from if the backend sorted them */
+	if ( rc != -1 && so->so_vcontext && !so->so_native ) {
 		cookie.bv_val = (char *)&so->so_vcontext;
 		cookie.bv_len = sizeof(so->so_vcontext);
 		rc = ber_printf( ber, "tO", LDAP_VLVCONTEXT_IDENTIFIER, &cookie );
@@ -264,8 +272,9 @@ static int pack_pagedresult_response_control(
 	ber_init2( ber, NULL, LBER_USE_DER );
 	ber_set_option( ber, LBER_OPT_BER_MEMCTX, &op->o_tmpmemctx );
 
-	if ( so->so_nentries > 0 ) {
-		resp_cookie		= ( PagedResultsCookie )so->so_tree;
+	if ( so->so_native ? !BER_BVISNULL( &so->so_resume ) :
+		so->so_nentries > 0 ) {
+		resp_cookie		= so_cookie( so );
 		cookie.bv_len	= sizeof( PagedResultsCookie );
 		cookie.bv_val	= (char *)&resp_cookie;
 	} else {
@@ -278,7 +287,9 @@ static int pack_pagedresult_response_control(
 		= ((PagedResultsState *)op->o_pagedresults_state)->ps_count
 		  + rs->sr_nentries;
 
-	rc = ber_printf( ber, "{iO}", so->so_nentries, &cookie );
+	/* the backend doesn't tell how many are left */
+	rc = ber_printf( ber, "{iO}", so->so_native ? 0 : so->so_nentries,
+		&cookie );
 	if ( rc != -1 ) {
 		rc = ber_flatten2( ber, &bv, 0 );
 	}
@@ -369,7 +380,7 @@ static int find_session_by_context(
 	for(sess_id = 0; sess_id < svi_max_percon; sess_id++) {
 		if( sort_conns[conn_id] && sort_conns[conn_id][sess_id] &&
 		    ( sort_conns[conn_id][sess_id]->so_vcontext == vc_context || 
-                      (PagedResultsCookie) sort_conns[conn_id][sess_id]->so_tree == ps_cookie ) )
+                      so_cookie( sort_conns[conn_id][sess_id] ) == ps_cookie ) )
 			return sess_id;
 	}
 	return -1;
@@ -422,6 +433,8 @@ static void free_sort_op( Connection *conn, sort_op *so )
 		    }
 		    so->so_tree = NULL;
 	    }
+	    if ( so->so_resume.bv_val )
+		    ch_free( so->so_resume.bv_val );
 
 	    ch_free( so );
 	}
@@ -704,14 +717,116 @@ static void send_result(
 
 	if ( ctrls[0] != NULL )
 		slap_add_ctrls( op, rs, ctrls );
-	send_ldap_result( op, rs );
 
-	if ( so->so_tree == NULL ) {
+	/* Let go of the session before the client can ask for more */
+	if ( so->so_tree == NULL && BER_BVISNULL( &so->so_resume )) {
 		/* Search finished, so clean up */
 		free_sort_op( op->o_conn, so );
 	} else {
 	    so->so_running = 0;
 	}
+	send_ldap_result( op, rs );
+}
+
+/* A backend that has an ordering index for the sort key can return
+ * the entries in order by itself, and only those that are to be sent.
+ * That is offered for single key sorts, but the backend may still
+ * return them in any order, and then they are sorted as usual.
+ */
+static int sssvlv_native_ok(
+	Operation		*op,
+	sort_ctrl		*sc,
+	PagedResultsState	*ps )
+{
+	return sc->sc_nkeys == 1 && op->ors_scope != LDAP_SCOPE_BASE &&
+		!SLAP_GLUE_INSTANCE( op->o_bd ) && ( !ps || ps->ps_size > 0 );
+}
+
+static void sssvlv_native_offer(
+	Operation		*op,
+	sort_op			*so,
+	PagedResultsState	*ps,
+	vlv_ctrl		*vc )
+{
+	sort_key *sk = &so->so_ctrl->sc_keys[0];
+	SortRequest *srq;
+	struct berval bv;
+
+	if ( vc && !BER_BVISNULL( &vc->vc_value )) {
+		MatchingRule *mr = sk->sk_ordering;
+
+		if ( mr->smr_normalize ) {
+			/* send_list will complain */
+			if ( mr->smr_normalize( SLAP_MR_VALUE_OF_SYNTAX,
+				mr->smr_syntax, mr, &vc->vc_value, &bv, op->o_tmpmemctx ))
+				return;
+		} else {
+			ber_dupbv_x( &bv, &vc->vc_value, op->o_tmpmemctx );
+		}
+	}
+
+	srq = op->o_tmpcalloc( 1, sizeof(SortRequest), op->o_tmpmemctx );
+	srq->srq_oe.oe_key = (void *)slap_sort_request;
+	srq->srq_op = op;
+	srq->srq_ad = sk->sk_ad;
+	srq->srq_ordering = sk->sk_ordering;
+	srq->srq_reverse = sk->sk_direction < 0;
+	srq->srq_offset = 1;
+	srq->srq_after = -1;
+	if ( ps ) {
+		srq->srq_after = ps->ps_size - 1;
+		srq->srq_resume = so->so_resume;
+	} else if ( vc ) {
+		srq->srq_before = vc->vc_before;
+		srq->srq_after = vc->vc_after;
+		/* contentCount is always returned */
+		srq->srq_count = 1;
+		if ( !BER_BVISNULL( &vc->vc_value )) {
+			srq->srq_value = bv;
+		} else {
+			srq->srq_offset = vc->vc_offset;
+			srq->srq_ocount = vc->vc_count;
+		}
+	}
+	so->so_srq = srq;
+	LDAP_SLIST_INSERT_HEAD( &op->o_extra, &srq->srq_oe, oe_next );
+}
+
+/* The backend sent the entries in order, return its results */
+static void send_native_result(
+	Operation		*op,
+	SlapReply		*rs,
+	sort_op			*so,
+	SortRequest		*srq )
+{
+	so->so_native = 1;
+	if ( so->so_paged > SLAP_CONTROL_IGNORED ) {
+		if ( so->so_resume.bv_val )
+			ch_free( so->so_resume.bv_val );
+		so->so_resume = srq->srq_next;
+		so->so_nentries += rs->sr_nentries;
+	} else {
+		if ( srq->srq_next.bv_val )
+			ch_free( srq->srq_next.bv_val );
+		if ( so->so_vlv > SLAP_CONTROL_IGNORED ) {
+			so->so_nentries = srq->srq_total;
+			if ( BER_BVISNULL( &srq->srq_value ) && srq->srq_total &&
+				srq->srq_target > srq->srq_total ) {
+				LDAPControl *ctrls[2];
+
+				/* like send_list does */
+				so->so_vlv_rc = LDAP_VLV_RANGE_ERROR;
+				pack_vlv_response_control( op, rs, so, ctrls );
+				ctrls[1] = NULL;
+				slap_add_ctrls( op, rs, ctrls );
+				rs->sr_err = LDAP_VLV_ERROR;
+			} else {
+				so->so_vlv_target = srq->srq_target;
+				so->so_vlv_rc = LDAP_SUCCESS;
+			}
+		}
+	}
+	send_result( op, rs, so );
 }
 
 static int sssvlv_op_response(
@@ -720,8 +835,16 @@ static int sssvlv_op_response(
 {
 	sort_ctrl *sc = op->o_controls[sss_cid];
 	sort_op *so = op->o_callback->sc_private;
+	SortRequest *srq = so->so_srq;
+
+	if ( rs->sr_type == REP_SEARCH && srq && srq->srq_sorted ) {
+		return SLAP_CB_CONTINUE;
+
+	} else if ( rs->sr_type == REP_SEARCH && so->so_native ) {
+		/* the page can't be sorted like the previous ones */
+		rs->sr_err = LDAP_SUCCESS;
 
-	if ( rs->sr_type == REP_SEARCH ) {
+	} else if ( rs->sr_type == REP_SEARCH ) {
 		int i;
 		size_t len;
 		sort_node *sn, *sn2;
@@ -795,8 +918,27 @@ static int sssvlv_op_response(
 			op->o_callback = op->o_callback->sc_next;
 		}
 
-		send_entry( op, rs, so );
-		send_result( op, rs, so );
+		if ( srq ) {
+			LDAP_SLIST_REMOVE( &op->o_extra, &srq->srq_oe, OpExtra, oe_next );
+			so->so_srq = NULL;
+		}
+		if ( srq && srq->srq_sorted ) {
+			send_native_result( op, rs, so, srq );
+		} else {
+			if ( so->so_native ) {
+				rs->sr_err = LDAP_OTHER;
+				rs->sr_text = "paged sort can not be continued";
+				ch_free( so->so_resume.bv_val );
+				BER_BVZERO( &so->so_resume );
+			}
+			send_entry( op, rs, so );
+			send_result( op, rs, so );
+		}
+		if ( srq ) {
+			if ( srq->srq_value.bv_val )
+				op->o_tmpfree( srq->srq_value.bv_val, op->o_tmpmemctx );
+			op->o_tmpfree( srq, op->o_tmpmemctx );
+		}
 	}
 
 	return rs->sr_err;
@@ -924,11 +1066,28 @@ static int sssvlv_op_search(
 			send_result( op, rs, so );
 			rc = LDAP_SUCCESS;
 		/* are we continuing a paged search? */
-		} else if ( so && ps && ps->ps_cookie ) {
+		} else if ( so && ps && ps->ps_cookie && !so->so_native ) {
 			so->so_ctrl = sc;
 			send_page( op, rs, so );
 			send_result( op, rs, so );
 			rc = LDAP_SUCCESS;
+		} else if ( so && ps && so->so_native ) {
+			/* the backend sorts the next page too */
+			slap_callback *cb = op->o_tmpalloc( sizeof(slap_callback),
+				op->o_tmpmemctx );
+
+			so->so_ctrl = sc;
+			so->so_page_size = ps->ps_size;
+			op->o_pagedresults = SLAP_CONTROL_IGNORED;
+
+			cb->sc_cleanup		= NULL;
+			cb->sc_response		= sssvlv_op_response;
+			cb->sc_next			= op->o_callback;
+			cb->sc_private		= so;
+			cb->sc_writewait	= NULL;
+
+			sssvlv_native_offer( op, so, ps, NULL );
+			op->o_callback		= cb;
 		} else {
 			slap_callback *cb = op->o_tmpalloc( sizeof(slap_callback),
 				op->o_tmpmemctx );
@@ -970,6 +1129,8 @@ static int sssvlv_op_search(
 			so->so_nentries = 0;
 			so->so_running = 1;
 
+			if ( sssvlv_native_ok( op, sc, ps ))
+				sssvlv_native_offer( op, so, ps, vc );
 			op->o_callback		= cb;
 		}
 	} else {
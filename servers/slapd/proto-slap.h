@@ -652,6 +652,8 @@ LDAP_SLAPD_F (int) slap_add_ctrls LDAP_P((
 	Operation *op,
 	SlapReply *rs,
 	LDAPControl **ctrls ));
+LDAP_SLAPD_F (SortRequest *) slap_sort_request LDAP_P((
+	Operation *op ));
 LDAP_SLAPD_F (int) slap_parse_ctrl LDAP_P((
 	Operation *op,
 	SlapReply *rs,
@@ -1169,6 +1171,16 @@ LDAP_SLAPD_V( struct slap_sync_cookie_s ) slap_sync_cookie;
 LDAP_SLAPD_V( void * ) slap_tls_ctx;
 LDAP_SLAPD_V( LDAP * ) slap_tls_ld;
 
+/*
+ * idlset.c
+ */
+LDAP_SLAPD_F (int) slap_idl_init LDAP_P(( const char *name ));
+LDAP_SLAPD_F (const char *) slap_idl_kernel LDAP_P(( void ));
+LDAP_SLAPD_F (ID) slap_idl_intersect LDAP_P(( ID *a, ID na, ID *b, ID nb,
+	ID *out, int notin ));
+LDAP_SLAPD_F (ID) slap_idl_merge LDAP_P(( ID *a, ID na, ID *b, ID nb,
+	ID *out ));
+
 /*
  * index.c
  */
@@ -1500,6 +1512,10 @@ LDAP_SLAPD_F (void) slap_op_time LDAP_P(( time_t *t, int *n ));
 LDAP_SLAPD_F (Operation *) slap_op_alloc LDAP_P((
 	BerElement *ber, ber_int_t msgid,
 	ber_tag_t tag, ber_int_t id, void *ctx ));
+LDAP_SLAPD_F (BerElement *) slap_ber_alloc LDAP_P(( void *ctx ));
+LDAP_SLAPD_F (void) slap_ber_free LDAP_P(( BerElement *ber, void *ctx ));
+LDAP_SLAPD_F (void) slap_op_freelist_stats LDAP_P((
+	slap_freelist_stats_t st[SLAP_FREELIST_NUM] ));
 
 LDAP_SLAPD_F (slap_op_t) slap_req2op LDAP_P(( ber_tag_t tag ));
 
@@ -1628,6 +1644,15 @@ LDAP_SLAPD_F (void) slap_send_ldap_intermediate LDAP_P(( Operation *op, SlapRepl
 LDAP_SLAPD_F (void) slap_send_search_result LDAP_P(( Operation *op, SlapReply *rs ));
 LDAP_SLAPD_F (int) slap_send_search_reference LDAP_P(( Operation *op, SlapReply *rs ));
 LDAP_SLAPD_F (int) slap_send_search_entry LDAP_P(( Operation *op, SlapReply *rs ));
+LDAP_SLAPD_F (int) slap_encode_search_entry LDAP_P(( Operation *op,
+	SlapReply *rs, BerElement **berp ));
+LDAP_SLAPD_F (int) slap_send_search_encoded LDAP_P(( Operation *op,
+	SlapReply *rs, BerElement *ber ));
+LDAP_SLAPD_F (void) slap_write_batch_start LDAP_P(( Operation *op ));
+LDAP_SLAPD_F (void) slap_write_batch_check LDAP_P(( Operation *op, int now ));
+LDAP_SLAPD_F (void) slap_write_batch_flush LDAP_P(( Operation *op ));
+LDAP_SLAPD_V (ber_len_t) slap_write_batch;
+LDAP_SLAPD_V (int) slap_write_batch_msec;
 LDAP_SLAPD_F (int) slap_null_cb LDAP_P(( Operation *op, SlapReply *rs ));
 LDAP_SLAPD_F (int) slap_freeself_cb LDAP_P(( Operation *op, SlapReply *rs ));
 
@@ -2099,6 +2124,8 @@ LDAP_SLAPD_V (time_t)		starttime;
 LDAP_SLAPD_V (ldap_pvt_thread_pool_t)	connection_pool;
 LDAP_SLAPD_V (int)			connection_pool_max;
 LDAP_SLAPD_V (int)			connection_pool_queues;
+LDAP_SLAPD_V (int)			connection_pool_weight[SLAP_TCLASS_NUM];
+LDAP_SLAPD_V (int)			connection_pool_search_max;
 LDAP_SLAPD_V (int)			slap_tool_thread_max;
 
 LDAP_SLAPD_V (ldap_pvt_thread_mutex_t)	entry2str_mutex;
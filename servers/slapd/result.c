@@ -331,17 +331,79 @@ slap_writewait_play(
 	}
 }
 
+ber_len_t slap_write_batch = SLAP_WRITE_BATCH_DEFAULT;
+int slap_write_batch_msec = SLAP_WRITE_BATCH_MSEC;
+
+/* Add a pdu to the connection's write batch, which must be ours.
+ * Returns the batch, or NULL if it could not grow.
+ */
+static BerElement *
+slap_write_batch_add(
+	Connection *conn,
+	BerElement *ber )
+{
+	struct berval bv;
+
+	if ( conn->c_wbatch == NULL ) {
+		conn->c_wbatch = ber_alloc_t( LBER_USE_DER );
+		if ( conn->c_wbatch == NULL )
+			return NULL;
+		(void) gettimeofday( &conn->c_wbatchtime, NULL );
+	}
+	if ( ber ) {
+		ber_flatten2( ber, &bv, 0 );
+		if ( ber_write( conn->c_wbatch, bv.bv_val, bv.bv_len, 0 ) < 0 )
+			return NULL;
+	}
+	return conn->c_wbatch;
+}
+
+/* Whether the connection's write batch is past its latency bound */
+static int
+slap_write_batch_late(
+	Connection *conn )
+{
+	struct timeval now;
+	long msec;
+
+	(void) gettimeofday( &now, NULL );
+	msec = ( now.tv_sec - conn->c_wbatchtime.tv_sec ) * 1000 +
+		( now.tv_usec - conn->c_wbatchtime.tv_usec ) / 1000;
+	return msec >= slap_write_batch_msec;
+}
+
+/* Whether the connection's write batch should be written now */
+static int
+slap_write_batch_full(
+	Connection *conn )
+{
+	ber_len_t len;
+
+	ber_get_option( conn->c_wbatch, LBER_OPT_BER_BYTES_TO_WRITE, &len );
+	if ( len >= slap_write_batch )
+		return 1;
+	return slap_write_batch_late( conn );
+}
+
+/* Send the pdu in ber, or if it is NULL whatever is left in the
+ * connection's write batch. With batch set, entries and references
+ * of the search that owns the batch are only added to it, until it
+ * is full; any other pdu takes the batch along with it.
+ */
 static long send_ldap_ber(
 	Operation *op,
-	BerElement *ber )
+	BerElement *ber,
+	int batch )
 {
 	Connection *conn = op->o_conn;
-	ber_len_t bytes;
+	BerElement *wber = ber;
+	ber_len_t bytes = 0;
 	long ret = 0;
 	char *close_reason;
 	int do_resume = 0;
 
-	ber_get_option( ber, LBER_OPT_BER_BYTES_TO_WRITE, &bytes );
+	if ( ber )
+		ber_get_option( ber, LBER_OPT_BER_BYTES_TO_WRITE, &bytes );
 
 	/* write only one pdu at a time - wait til it's our turn */
 	ldap_pvt_thread_mutex_lock( &conn->c_write1_mutex );
@@ -372,12 +434,30 @@ static long send_ldap_ber(
 	/* Our turn */
 	conn->c_writing = 1;
 
+	batch = batch && conn->c_wbatchop == op;
+	if ( batch || conn->c_wbatch ) {
+		wber = slap_write_batch_add( conn, ber );
+		if ( wber == NULL ) {
+			close_reason = "out of memory";
+			goto fail;
+		}
+		if ( batch && !slap_write_batch_full( conn ) ) {
+			/* leave it for a later pdu */
+			wber = NULL;
+			ret = bytes;
+		}
+	}
+
 	/* write the pdu */
-	while( 1 ) {
+	while( wber ) {
 		int err;
 		char ebuf[128];
 
-		if ( ber_flush2( conn->c_sb, ber, LBER_FLUSH_FREE_NEVER ) == 0 ) {
+		if ( ber_flush2( conn->c_sb, wber, LBER_FLUSH_FREE_NEVER ) == 0 ) {
+			if ( wber == conn->c_wbatch ) {
+				ber_free( wber, 1 );
+				conn->c_wbatch = NULL;
+			}
 			ret = bytes;
 			break;
 		}
@@ -455,6 +535,65 @@ fail:
 	return ret;
 }
 
+/* Batch the entries and references op sends from now on. The caller
+ * must call slap_write_batch_check() while it looks for more entries,
+ * and slap_write_batch_flush() before it returns.
+ */
+void
+slap_write_batch_start( Operation *op )
+{
+	Connection *conn = op->o_conn;
+
+	if ( !slap_write_batch || !conn
+#ifdef LDAP_CONNECTIONLESS
+		|| conn->c_is_udp
+#endif
+		)
+		return;
+
+	ldap_pvt_thread_mutex_lock( &conn->c_write1_mutex );
+	conn->c_wbatchop = op;
+	ldap_pvt_thread_mutex_unlock( &conn->c_write1_mutex );
+}
+
+/* Write op's batch if it is past its latency bound, or right away
+ * if now is set, e.g. before op may block for a while.
+ */
+void
+slap_write_batch_check( Operation *op, int now )
+{
+	Connection *conn = op->o_conn;
+
+	/* Unlocked peek: only op starts a batch while it owns it, and
+	 * only it sets c_wbatchtime. If another pdu wrote the batch in
+	 * the meantime, send_ldap_ber() finds nothing to do.
+	 */
+	if ( !conn || conn->c_wbatchop != op || conn->c_wbatch == NULL )
+		return;
+	if ( now || slap_write_batch_late( conn ))
+		(void) send_ldap_ber( op, NULL, 0 );
+}
+
+/* Stop batching for op, and write whatever is still batched */
+void
+slap_write_batch_flush( Operation *op )
+{
+	Connection *conn = op->o_conn;
+	int pending;
+
+	if ( !conn )
+		return;
+
+	ldap_pvt_thread_mutex_lock( &conn->c_write1_mutex );
+	if ( conn->c_wbatchop == op )
+		conn->c_wbatchop = NULL;
+	pending = conn->c_wbatch != NULL;
+	ldap_pvt_thread_mutex_unlock( &conn->c_write1_mutex );
+
+	if ( pending )
+		(void) send_ldap_ber( op, NULL, 0 );
+}
+
 static int
 send_ldap_control( BerElement *ber, LDAPControl *c )
 {
@@ -760,7 +899,7 @@ send_ldap_response(
 	}
 
 	/* send BER */
-	bytes = send_ldap_ber( op, ber );
+	bytes = send_ldap_ber( op, ber, 0 );
 #ifdef LDAP_CONNECTIONLESS
 	if (!op->o_conn || op->o_conn->c_is_udp == 0)
 #endif
@@ -1009,23 +1148,59 @@ slap_send_ldap_intermediate( Operation *op, SlapReply *rs )
 #define set_ldap_error( rs, err, text ) do { \
 		(rs)->sr_err = err; (rs)->sr_text = text; } while(0)
 
-/*
- * returns:
- *
- * LDAP_SUCCESS			entry sent
- * LDAP_OTHER			entry not sent (other)
- * LDAP_INSUFFICIENT_ACCESS	entry not sent (ACL)
- * LDAP_UNAVAILABLE		entry not sent (connection closed)
- * LDAP_SIZELIMIT_EXCEEDED	entry not sent (caller must send sizelimitExceeded)
- */
+/* The limits checked before each entry is sent */
+static int
+slap_search_entry_limits( Operation *op, SlapReply *rs )
+{
+	if ( op->ors_slimit >= 0 && rs->sr_nentries >= op->ors_slimit )
+		return LDAP_SIZELIMIT_EXCEEDED;
 
-int
-slap_send_search_entry( Operation *op, SlapReply *rs )
+	/* Every 64 entries, check for thread pool pause */
+	if ( ( ( rs->sr_nentries & 0x3f ) == 0x3f ) &&
+		ldap_pvt_thread_pool_pausing( &connection_pool ) > 0 )
+		return LDAP_BUSY;
+
+	return LDAP_SUCCESS;
+}
+
+/* Write an encoded entry and count it */
+static int
+slap_search_entry_write( Operation *op, SlapReply *rs, BerElement *ber )
+{
+	int bytes;
+
+	bytes = send_ldap_ber( op, ber, 1 );
+	ber_free_buf( ber );
+
+	if ( bytes < 0 ) {
+		Debug( LDAP_DEBUG_ANY,
+			"send_search_entry: conn %lu  ber write failed.\n", 
+			op->o_connid );
+
+		return LDAP_UNAVAILABLE;
+	}
+	rs->sr_nentries++;
+
+	ldap_pvt_thread_mutex_lock( &op->o_counters->sc_mutex );
+	ldap_pvt_mp_add_ulong( op->o_counters->sc_bytes, (unsigned long)bytes );
+	ldap_pvt_mp_add_ulong( op->o_counters->sc_entries, 1 );
+	ldap_pvt_mp_add_ulong( op->o_counters->sc_pdu, 1 );
+	ldap_pvt_thread_mutex_unlock( &op->o_counters->sc_mutex );
+
+	return LDAP_SUCCESS;
+}
+
+/* With encp set, stop short of sending the entry: the limits are not
+ * checked, and the pdu is returned in *encp, allocated in op's memory
+ * context (see slap_encode_search_entry()).
+ */
+static int
+slap_search_entry( Operation *op, SlapReply *rs, BerElement **encp )
 {
 	BerElementBuffer berbuf;
 	BerElement	*ber = (BerElement *) &berbuf;
 	Attribute	*a;
-	int		i, j, rc = LDAP_UNAVAILABLE, bytes;
+	int		i, j, rc = LDAP_UNAVAILABLE;
 	int		userattrs;
 	AccessControlState acl_state = ACL_STATE_INIT;
 	int			 attrsonly;
@@ -1039,17 +1214,13 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 
 	rs->sr_type = REP_SEARCH;
 
-	if ( op->ors_slimit >= 0 && rs->sr_nentries >= op->ors_slimit ) {
-		rc = LDAP_SIZELIMIT_EXCEEDED;
-		goto error_return;
-	}
-
-	/* Every 64 entries, check for thread pool pause */
-	if ( ( ( rs->sr_nentries & 0x3f ) == 0x3f ) &&
-		ldap_pvt_thread_pool_pausing( &connection_pool ) > 0 )
-	{
-		rc = LDAP_BUSY;
-		goto error_return;
+	if ( encp ) {
+		*encp = NULL;
+		ber = op->o_tmpalloc( sizeof( BerElementBuffer ), op->o_tmpmemctx );
+	} else {
+		rc = slap_search_entry_limits( op, rs );
+		if ( rc != LDAP_SUCCESS )
+			goto error_return;
 	}
 
 	/* eventually will loop through generated operational attribute types
@@ -1481,30 +1652,21 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 		goto error_return;
 	}
 
+	if ( encp ) {
+		*encp = ber;
+		rc = LDAP_SUCCESS;
+		goto error_return;
+	}
+
 	Debug( LDAP_DEBUG_STATS2, "%s ENTRY dn=\"%s\"\n",
 	    op->o_log_prefix, rs->sr_entry->e_nname.bv_val );
 
 	rs_flush_entry( op, rs, NULL );
 
 	if ( op->o_res_ber == NULL ) {
-		bytes = send_ldap_ber( op, ber );
-		ber_free_buf( ber );
-
-		if ( bytes < 0 ) {
-			Debug( LDAP_DEBUG_ANY,
-				"send_search_entry: conn %lu  ber write failed.\n", 
-				op->o_connid );
-
-			rc = LDAP_UNAVAILABLE;
+		rc = slap_search_entry_write( op, rs, ber );
+		if ( rc != LDAP_SUCCESS )
 			goto error_return;
-		}
-		rs->sr_nentries++;
-
-		ldap_pvt_thread_mutex_lock( &op->o_counters->sc_mutex );
-		ldap_pvt_mp_add_ulong( op->o_counters->sc_bytes, (unsigned long)bytes );
-		ldap_pvt_mp_add_ulong( op->o_counters->sc_entries, 1 );
-		ldap_pvt_mp_add_ulong( op->o_counters->sc_pdu, 1 );
-		ldap_pvt_thread_mutex_unlock( &op->o_counters->sc_mutex );
 	}
 
 	Debug( LDAP_DEBUG_TRACE,
@@ -1513,6 +1675,9 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 	rc = LDAP_SUCCESS;
 
 error_return:;
+	if ( encp && *encp == NULL )
+		op->o_tmpfree( ber, op->o_tmpmemctx );
+
 	if ( op->o_callback ) {
 		(void)slap_cleanup_play( op, rs );
 	}
@@ -1545,6 +1710,63 @@ error_return:;
 	return( rc );
 }
 
+/*
+ * returns:
+ *
+ * LDAP_SUCCESS			entry sent
+ * LDAP_OTHER			entry not sent (other)
+ * LDAP_INSUFFICIENT_ACCESS	entry not sent (ACL)
+ * LDAP_UNAVAILABLE		entry not sent (connection closed)
+ * LDAP_SIZELIMIT_EXCEEDED	entry not sent (caller must send sizelimitExceeded)
+ */
+
+int
+slap_send_search_entry( Operation *op, SlapReply *rs )
+{
+	return slap_search_entry( op, rs, NULL );
+}
+
+/* Check access to the entry of rs and encode it into *berp, so that a
+ * backend can prepare entries on other threads and send them later with
+ * slap_send_search_encoded(). Nothing is sent or counted, and the limits
+ * are left to slap_send_search_encoded(). op's callbacks must not have
+ * any sc_response, and op must not use o_res_ber. Returns what
+ * send_search_entry() would. On success *berp is allocated in op's
+ * memory context, which must be NULL if the pdu is sent by another
+ * thread.
+ */
+int
+slap_encode_search_entry( Operation *op, SlapReply *rs, BerElement **berp )
+{
+	assert( op->o_res_ber == NULL );
+
+	return slap_search_entry( op, rs, berp );
+}
+
+/* Send the entry of rs that slap_encode_search_entry() encoded into ber,
+ * and free ber. Returns what send_search_entry() would.
+ */
+int
+slap_send_search_encoded( Operation *op, SlapReply *rs, BerElement *ber )
+{
+	int rc;
+
+	rs->sr_type = REP_SEARCH;
+	rc = slap_search_entry_limits( op, rs );
+	if ( rc == LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_STATS2, "%s ENTRY dn=\"%s\"\n",
+			op->o_log_prefix, rs->sr_entry->e_nname.bv_val );
+		rc = slap_search_entry_write( op, rs, ber );
+	} else {
+		ber_free_buf( ber );
+	}
+	op->o_tmpfree( ber, op->o_tmpmemctx );
+
+	if ( op->o_tag == LDAP_REQ_SEARCH )
+		rs_flush_entry( op, rs, NULL );
+	return rc;
+}
+
 int
 slap_send_search_reference( Operation *op, SlapReply *rs )
 {
@@ -1653,7 +1875,7 @@ slap_send_search_reference( Operation *op, SlapReply *rs )
 #ifdef LDAP_CONNECTIONLESS
 	if (!op->o_conn || op->o_conn->c_is_udp == 0) {
 #endif
-	bytes = send_ldap_ber( op, ber );
+	bytes = send_ldap_ber( op, ber, 1 );
 	ber_free_buf( ber );
 
 	if ( bytes < 0 ) {
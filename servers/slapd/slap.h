@@ -136,12 +136,21 @@ LDAP_BEGIN_DECL
 
 #define SLAP_MAX_WORKER_THREADS		(16)
 
+/* Thread pool task classes of operations */
+#define SLAP_TCLASS_DEFAULT	0	/* updates, extended ops, ... */
+#define SLAP_TCLASS_QUICK	1	/* reads, binds, compares, base searches */
+#define SLAP_TCLASS_SEARCH	2	/* onelevel and subtree searches */
+#define SLAP_TCLASS_NUM		3
+
 #define SLAP_SB_MAX_INCOMING_DEFAULT ((1<<18) - 1)
 #define SLAP_SB_MAX_INCOMING_AUTH ((1<<24) - 1)
 
 #define SLAP_CONN_MAX_PENDING_DEFAULT	100
 #define SLAP_CONN_MAX_PENDING_AUTH	1000
 
+#define SLAP_WRITE_BATCH_DEFAULT	(1<<16)
+#define SLAP_WRITE_BATCH_MSEC	10
+
 #define SLAP_TEXT_BUFLEN (256)
 
 /* pseudo error code indicating abandoned operation */
@@ -2557,6 +2566,18 @@ typedef struct slap_counters_t {
 	ldap_pvt_mp_t		sc_ops_initiated_[SLAP_OP_LAST];
 } slap_counters_t;
 
+/* Per-thread free lists of Operations and BerElements */
+#define SLAP_FREELIST_OP	0
+#define SLAP_FREELIST_BER	1
+#define SLAP_FREELIST_NUM	2
+
+typedef struct slap_freelist_stats_t {
+	unsigned long	fs_hits;	/* allocations taken from a free list */
+	unsigned long	fs_misses;	/* allocations that had to malloc */
+	unsigned long	fs_trimmed;	/* releases freed, the list was full */
+	unsigned long	fs_cached;	/* currently on free lists */
+} slap_freelist_stats_t;
+
 /*
  * represents an operation pending from an ldap client
  */
@@ -2610,6 +2631,32 @@ typedef struct OpExtraDB {
 	BackendDB *oe_db;
 } OpExtraDB;
 
+/* A server side sort on a single key, offered to the backend by the
+ * sssvlv overlay, see slap_sort_request(). A backend that can return
+ * the matching entries in this order by itself sets srq_sorted and
+ * sends only the window of the sorted list around the target entry,
+ * using 1-based positions. Otherwise the overlay sorts them.
+ */
+typedef struct SortRequest {
+	OpExtra		srq_oe;
+	Operation	*srq_op;		/* not for copies of it */
+	AttributeDescription	*srq_ad;
+	MatchingRule	*srq_ordering;
+	int			srq_reverse;
+	struct berval	srq_value;	/* target: first entry not before this */
+	int			srq_offset;		/* or the entry at this position */
+	int			srq_ocount;		/* scaled by this count if not 0 */
+	int			srq_before;
+	int			srq_after;		/* < 0 for all the rest */
+	int			srq_count;		/* count all the matching entries */
+	struct berval	srq_resume;	/* paged results: start of this page */
+
+	int			srq_sorted;
+	int			srq_target;
+	int			srq_total;		/* in: an estimate, out: the count if known */
+	struct berval	srq_next;	/* start of the next page, ch_malloc'd */
+} SortRequest;
+
 struct Operation {
 	Opheader *o_hdr;
 
@@ -2934,6 +2981,9 @@ struct Connection {
 	ldap_pvt_thread_cond_t	c_write1_cv;	/* only one pdu written at a time */
 
 	BerElement	*c_currentber;	/* ber we're attempting to read */
+	BerElement	*c_wbatch;		/* pdus waiting to be written together */
+	Operation	*c_wbatchop;	/* search whose pdus are batched */
+	struct timeval	c_wbatchtime;	/* when c_wbatch was started */
 	int			c_writers;		/* number of writers waiting */
 	char		c_writing;		/* someone is writing */
 
@@ -19,6 +19,7 @@
 #include "portable.h"
 
 #include <stdio.h>
+#include <limits.h>
 
 #include <ac/string.h>
 #include <ac/socket.h>
@@ -146,6 +147,14 @@ typedef struct syncinfo_s {
 	int			si_strict_refresh;	/* stop listening during fallback refresh */
 	int			si_too_old;
 	int			si_is_configdb;
+	int			si_txnmax;	/* changes per batched txn */
+	int			si_txnkbytes;
+	int			si_txnmsec;
+	OpExtra			*si_txn;	/* batched txn in progress */
+	int			si_txncount;
+	ber_len_t		si_txnsize;
+	struct timeval		si_txnstart;
+	struct sync_cookie	si_txncookie;	/* cookieState when it began */
 	ber_int_t	si_msgid;
 	Avlnode			*si_presentlist;
 	LDAP			*si_ld;
@@ -178,7 +187,7 @@ static int presentlist_insert( syncinfo_t* si, struct berval *syncUUID );
 static void presentlist_delete( Avlnode **av, struct berval *syncUUID );
 static char *presentlist_find( Avlnode *av, struct berval *syncUUID );
 static int presentlist_free( Avlnode *av );
-static void syncrepl_del_nonpresent( Operation *, syncinfo_t *, BerVarray, struct sync_cookie *, int );
+static int syncrepl_del_nonpresent( Operation *, syncinfo_t *, BerVarray, struct sync_cookie *, int );
 static int syncrepl_message_to_op(
 					syncinfo_t *, Operation *, LDAPMessage *, int );
 static int syncrepl_message_to_entry(
@@ -1210,6 +1219,225 @@ get_pmutex(
 	return 0;
 }
 
+/* Group commit of replicated changes (txnbatch)
+ *
+ * The changes read in one pass of do_syncrep2 go into a single backend
+ * txn, which is committed once it holds si_txnmax entries or
+ * si_txnkbytes of them, once it is si_txnmsec old, and whenever no
+ * more messages are waiting. Entries deleted because the provider no
+ * longer has them count as well, however many one message causes.
+ * The backend undoes the writes of any op in the txn that fails, so
+ * ops that are expected to fail (an add of an entry we already have)
+ * don't spoil it, and a change that can't be applied at all aborts
+ * the batch. The contextCSN update that goes with each
+ * change is made in the same txn, so the stored cookie never gets
+ * ahead of the stored data. Only the in-memory cookieState does, and
+ * it is put back if the txn is aborted, so that the next session asks
+ * for the lost changes again.
+ *
+ * Anything else looking at the cookieState, or overlays like syncprov,
+ * would see changes that may still be rolled back, or may wait on
+ * locks while we hold the backend's write txn, so batching is only
+ * done without them.
+ */
+static int
+syncrepl_txn_ok(
+	Operation *op,
+	syncinfo_t *si )
+{
+	if ( !si->si_txnmax || si->si_is_configdb ||
+		si->si_syncdata == SYNCDATA_CHANGELOG )
+		return 0;
+#ifdef LDAP_CONTROL_X_DIRSYNC
+	if ( si->si_ctype == MSAD_DIRSYNC )
+		return 0;
+#endif
+	return op->o_bd == si->si_wbe && !overlay_is_over( op->o_bd ) &&
+		op->o_bd->bd_info->bi_op_txn &&
+		si->si_cookieState->cs_ref == 1;
+}
+
+static void
+syncrepl_txn_begin(
+	Operation *op,
+	syncinfo_t *si )
+{
+	cookie_state *cs = si->si_cookieState;
+	int i, rc;
+
+	if ( si->si_txn || !syncrepl_txn_ok( op, si ))
+		return;
+
+	if (( rc = op->o_bd->bd_info->bi_op_txn( op, SLAP_TXN_BEGIN, &si->si_txn ))) {
+		/* unwilling means the database can't do it as configured */
+		Debug( rc == LDAP_UNWILLING_TO_PERFORM ? LDAP_DEBUG_SYNC : LDAP_DEBUG_ANY,
+			"syncrepl_txn_begin: %s "
+			"couldn't start DB transaction\n", si->si_ridtxt );
+		if ( si->si_txn ) {
+			LDAP_SLIST_REMOVE( &op->o_extra, si->si_txn, OpExtra, oe_next );
+			op->o_bd->bd_info->bi_op_txn( op, SLAP_TXN_ABORT, &si->si_txn );
+			si->si_txn = NULL;
+		}
+		return;
+	}
+
+	ldap_pvt_thread_mutex_lock( &cs->cs_mutex );
+	si->si_txncookie.numcsns = cs->cs_num;
+	if ( cs->cs_num ) {
+		ber_bvarray_dup_x( &si->si_txncookie.ctxcsn, cs->cs_vals, NULL );
+		si->si_txncookie.sids = ch_malloc( cs->cs_num * sizeof(int) );
+		for ( i=0; i<cs->cs_num; i++ )
+			si->si_txncookie.sids[i] = cs->cs_sids[i];
+	}
+	ldap_pvt_thread_mutex_unlock( &cs->cs_mutex );
+
+	si->si_txncount = 0;
+	si->si_txnsize = 0;
+	gettimeofday( &si->si_txnstart, NULL );
+}
+
+static int
+syncrepl_txn_limit(
+	syncinfo_t *si )
+{
+	struct timeval now;
+
+	if ( si->si_txncount >= si->si_txnmax ||
+		( si->si_txnkbytes && si->si_txnsize >= (ber_len_t)si->si_txnkbytes * 1024 ))
+		return 1;
+	if ( si->si_txnmsec ) {
+		gettimeofday( &now, NULL );
+		return ( now.tv_sec - si->si_txnstart.tv_sec ) * 1000 +
+			( now.tv_usec - si->si_txnstart.tv_usec ) / 1000 >= si->si_txnmsec;
+	}
+	return 0;
+}
+
+/* Account for a message applied in the batched txn, return nonzero
+ * if the txn should be committed now.
+ */
+static int
+syncrepl_txn_full(
+	syncinfo_t *si,
+	LDAPMessage *msg )
+{
+	if ( ldap_msgtype( msg ) == LDAP_RES_SEARCH_ENTRY ) {
+		BerElement *ber;
+		struct berval dn;
+		ber_len_t len = 0;
+
+		si->si_txncount++;
+		if ( si->si_txnkbytes &&
+			ldap_get_dn_ber( si->si_ld, msg, &ber, &dn ) == LDAP_SUCCESS ) {
+			ber_get_option( ber, LBER_OPT_REMAINING_BYTES, &len );
+			si->si_txnsize += dn.bv_len + len;
+			ber_free( ber, 0 );
+		}
+	}
+	return syncrepl_txn_limit( si );
+}
+
+static int
+syncrepl_txn_end(
+	Operation *op,
+	syncinfo_t *si,
+	int commit )
+{
+	cookie_state *cs = si->si_cookieState;
+	BackendDB *be = op->o_bd;
+	int i, rc = LDAP_OTHER;
+
+	if ( !si->si_txn )
+		return LDAP_SUCCESS;
+
+	op->o_bd = si->si_wbe;
+	LDAP_SLIST_REMOVE( &op->o_extra, si->si_txn, OpExtra, oe_next );
+	if ( commit ) {
+		rc = op->o_bd->bd_info->bi_op_txn( op, SLAP_TXN_COMMIT, &si->si_txn );
+	} else {
+		op->o_bd->bd_info->bi_op_txn( op, SLAP_TXN_ABORT, &si->si_txn );
+	}
+	si->si_txn = NULL;
+	op->o_bd = be;
+
+	if ( rc == LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_SYNC, "syncrepl_txn_end: %s "
+			"committed %d entries\n", si->si_ridtxt, si->si_txncount );
+		slap_sync_cookie_free( &si->si_txncookie, 0 );
+		return rc;
+	}
+
+	Debug( LDAP_DEBUG_ANY, "syncrepl_txn_end: %s "
+		"%s, dropping %d entries\n", si->si_ridtxt,
+		commit ? "commit failed" : "aborted", si->si_txncount );
+
+	/* go back to what the database has */
+	ldap_pvt_thread_mutex_lock( &cs->cs_mutex );
+	ber_bvarray_free( cs->cs_vals );
+	ch_free( cs->cs_sids );
+	cs->cs_vals = si->si_txncookie.ctxcsn;
+	cs->cs_sids = si->si_txncookie.sids;
+	cs->cs_num = si->si_txncookie.numcsns;
+	si->si_txncookie.ctxcsn = NULL;
+	si->si_txncookie.sids = NULL;
+	si->si_txncookie.numcsns = 0;
+
+	slap_sync_cookie_free( &si->si_syncCookie, 0 );
+	si->si_syncCookie.numcsns = cs->cs_num;
+	if ( cs->cs_num ) {
+		ber_bvarray_dup_x( &si->si_syncCookie.ctxcsn, cs->cs_vals, NULL );
+		si->si_syncCookie.sids = ch_malloc( cs->cs_num * sizeof(int) );
+		for ( i=0; i<cs->cs_num; i++ )
+			si->si_syncCookie.sids[i] = cs->cs_sids[i];
+	}
+	cs->cs_age++;
+	si->si_cookieAge = cs->cs_age;
+	ldap_pvt_thread_mutex_unlock( &cs->cs_mutex );
+
+	/* the pending CSNs of the dropped changes would make us ignore them */
+	ldap_pvt_thread_mutex_lock( &cs->cs_pmutex );
+	ber_bvarray_free( cs->cs_pvals );
+	ch_free( cs->cs_psids );
+	cs->cs_pvals = NULL;
+	cs->cs_psids = NULL;
+	cs->cs_pnum = cs->cs_num;
+	if ( cs->cs_num ) {
+		ber_bvarray_dup_x( &cs->cs_pvals, cs->cs_vals, NULL );
+		cs->cs_psids = ch_malloc( cs->cs_num * sizeof(int) );
+		for ( i=0; i<cs->cs_num; i++ )
+			cs->cs_psids[i] = cs->cs_sids[i];
+	}
+	ldap_pvt_thread_mutex_unlock( &cs->cs_pmutex );
+
+	return rc;
+}
+
+/* Account for an entry deleted in the batched txn because the provider
+ * no longer has it. These all come from one message, so the batch is
+ * committed here when it is full, and a new one begun.
+ */
+static int
+syncrepl_txn_del(
+	Operation *op,
+	syncinfo_t *si,
+	struct berval *dn )
+{
+	int rc;
+
+	if ( !si->si_txn )
+		return LDAP_SUCCESS;
+
+	si->si_txncount++;
+	si->si_txnsize += dn->bv_len;
+	if ( !syncrepl_txn_limit( si ))
+		return LDAP_SUCCESS;
+
+	rc = syncrepl_txn_end( op, si, 1 );
+	if ( rc == LDAP_SUCCESS )
+		syncrepl_txn_begin( op, si );
+	return rc;
+}
+
 static int
 do_syncrep2(
 	Operation *op,
@@ -1265,6 +1493,7 @@ do_syncrep2(
 			goto done;
 		}
 		si->si_lastcontact = slap_get_time();
+		syncrepl_txn_begin( op, si );
 		switch( ldap_msgtype( msg ) ) {
 		case LDAP_RES_SEARCH_ENTRY:
 #ifdef LDAP_CONTROL_X_DIRSYNC
@@ -1638,8 +1867,10 @@ logerr:
 				 */
 				if ( refreshDeletes == 0 && match < 0 && err == LDAP_SUCCESS )
 				{
-					syncrepl_del_nonpresent( op, si, NULL,
-						&syncCookie, m );
+					/* the cookie must not cover deletes that were lost */
+					if (( rc = syncrepl_del_nonpresent( op, si, NULL,
+						&syncCookie, m )))
+						goto done;
 				} else if ( si->si_presentlist ) {
 					presentlist_free( si->si_presentlist );
 					si->si_presentlist = NULL;
@@ -1788,21 +2019,21 @@ logerr:
 					syncUUIDs = NULL;
 					rc = ber_scanf( ber, "[W]", &syncUUIDs );
 					ber_scanf( ber, /*"{"*/ "}" );
-					if ( rc != LBER_ERROR ) {
-						if ( refreshDeletes ) {
-							syncrepl_del_nonpresent( op, si, syncUUIDs,
-								&syncCookie, m );
-							ber_bvarray_free_x( syncUUIDs, op->o_tmpmemctx );
-						} else {
-							int i;
-							for ( i = 0; !BER_BVISNULL( &syncUUIDs[i] ); i++ ) {
-								(void)presentlist_insert( si, &syncUUIDs[i] );
-								slap_sl_free( syncUUIDs[i].bv_val, op->o_tmpmemctx );
-							}
-							slap_sl_free( syncUUIDs, op->o_tmpmemctx );
+					if ( rc == LBER_ERROR ) {
+						rc = 0;
+					} else if ( refreshDeletes ) {
+						rc = syncrepl_del_nonpresent( op, si, syncUUIDs,
+							&syncCookie, m );
+						ber_bvarray_free_x( syncUUIDs, op->o_tmpmemctx );
+					} else {
+						int i;
+						for ( i = 0; !BER_BVISNULL( &syncUUIDs[i] ); i++ ) {
+							(void)presentlist_insert( si, &syncUUIDs[i] );
+							slap_sl_free( syncUUIDs[i].bv_val, op->o_tmpmemctx );
 						}
+						slap_sl_free( syncUUIDs, op->o_tmpmemctx );
+						rc = 0;
 					}
-					rc = 0;
 					slap_sync_cookie_free( &syncCookie, 0 );
 					break;
 				default:
@@ -1830,11 +2061,11 @@ logerr:
 				if ( match < 0 ) {
 					if ( si->si_refreshPresent == 1 &&
 						si_tag != LDAP_TAG_SYNC_NEW_COOKIE ) {
-						syncrepl_del_nonpresent( op, si, NULL,
+						rc = syncrepl_del_nonpresent( op, si, NULL,
 							&syncCookie, m );
 					}
 
-					if ( syncCookie.ctxcsn )
+					if ( !rc && syncCookie.ctxcsn )
 					{
 						rc = syncrepl_updateCookie( si, op, &syncCookie, 1 );
 					}
@@ -1872,15 +2103,27 @@ logerr:
 			syncCookie_req = syncCookie;
 			memset( &syncCookie, 0, sizeof( syncCookie ));
 		}
+		if ( si->si_txn && syncrepl_txn_full( si, msg ) &&
+			( rc = syncrepl_txn_end( op, si, 1 )))
+			goto done;
 		ldap_msgfree( msg );
 		msg = NULL;
 		if ( ldap_pvt_thread_pool_pausing( &connection_pool )) {
+			if (( rc = syncrepl_txn_end( op, si, 1 )))
+				goto done;
 			slap_sync_cookie_free( &syncCookie, 0 );
 			slap_sync_cookie_free( &syncCookie_req, 0 );
 			return SYNC_PAUSED;
 		}
 	}
 
+	/* nothing more to read for now */
+	if ( si->si_txn ) {
+		int rc2 = syncrepl_txn_end( op, si, 1 );
+		if ( rc2 && !rc )
+			rc = rc2;
+	}
+
 	if ( rc == SYNC_ERROR ) {
 		rc = LDAP_OTHER;
 		ldap_get_option( si->si_ld, LDAP_OPT_ERROR_NUMBER, &rc );
@@ -1888,6 +2131,13 @@ logerr:
 	}
 
 done:
+	if ( si->si_txn ) {
+		/* keep what was applied, unless applying a change failed */
+		int commit = !rc || rc == SYNC_SHUTDOWN || rc == SYNC_REPOLL ||
+			rc == LDAP_SYNC_REFRESH_REQUIRED || err != LDAP_SUCCESS;
+		if ( syncrepl_txn_end( op, si, commit ) && !rc )
+			rc = LDAP_OTHER;
+	}
 	if ( err != LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_ANY,
 			"do_syncrep2: %s (%d) %s\n",
@@ -4479,7 +4729,7 @@ static struct berval gcbva[] = {
 
 #define NP_DELETE_ONE	2
 
-static void
+static int
 syncrepl_del_nonpresent(
 	Operation *op,
 	syncinfo_t *si,
@@ -4490,7 +4740,7 @@ syncrepl_del_nonpresent(
 	Backend* be = op->o_bd;
 	slap_callback	cb = { NULL };
 	struct nonpresent_entry *np_list, *np_prev;
-	int rc;
+	int rc, txnrc = LDAP_SUCCESS;
 	AttributeName	an[3]; /* entryUUID, entryCSN, NULL */
 
 	struct berval pdn = BER_BVNULL;
@@ -4690,15 +4940,27 @@ syncrepl_del_nonpresent(
 
 			op->o_delete_glue_parent = 0;
 
+			txnrc = syncrepl_txn_del( op, si, np_prev->npe_nname );
+
 			ber_bvfree( np_prev->npe_name );
 			ber_bvfree( np_prev->npe_nname );
 			ch_free( np_prev );
 
-			if ( slapd_shutdown ) {
+			if ( slapd_shutdown || txnrc ) {
 				break;
 			}
 		}
 
+		/* the rest are found again on the next attempt */
+		while ( txnrc && np_list != NULL ) {
+			LDAP_LIST_REMOVE( np_list, npe_link );
+			np_prev = np_list;
+			np_list = LDAP_LIST_NEXT( np_list, npe_link );
+			ber_bvfree( np_prev->npe_name );
+			ber_bvfree( np_prev->npe_nname );
+			ch_free( np_prev );
+		}
+
 		slap_graduate_commit_csn( op );
 		op->o_bd = be;
 
@@ -4706,7 +4968,7 @@ syncrepl_del_nonpresent(
 		BER_BVZERO( &op->o_csn );
 	}
 
-	return;
+	return txnrc;
 }
 
 static int
@@ -5978,6 +6240,7 @@ config_suffixm( ConfigArgs *c, syncinfo_t *si )
 #define SUFFIXMSTR		"suffixmassage"
 #define	STRICT_REFRESH	"strictrefresh"
 #define LAZY_COMMIT		"lazycommit"
+#define TXNBATCHSTR		"txnbatch"
 
 /* FIXME: undocumented */
 #define EXATTRSSTR		"exattrs"
@@ -6505,6 +6768,38 @@ parse_syncrepl_line(
 					STRLENOF( LAZY_COMMIT ) ) )
 		{
 			si->si_lazyCommit = 1;
+		} else if ( !strncasecmp( c->argv[ i ], TXNBATCHSTR "=",
+					STRLENOF( TXNBATCHSTR "=" ) ) )
+		{
+			int *vals[3], j;
+			char *next;
+			long l;
+
+			vals[0] = &si->si_txnmax;
+			vals[1] = &si->si_txnkbytes;
+			vals[2] = &si->si_txnmsec;
+			si->si_txnkbytes = 0;
+			si->si_txnmsec = 0;
+			val = c->argv[ i ] + STRLENOF( TXNBATCHSTR "=" );
+			for ( j = 0; j < 3; j++ ) {
+				l = strtol( val, &next, 10 );
+				if ( next == val || l < 0 || l > INT_MAX ||
+					( *next && ( *next != ',' || j == 2 )))
+					break;
+				*vals[j] = l;
+				if ( !*next ) {
+					j = 3;
+					break;
+				}
+				val = next + 1;
+			}
+			if ( j < 3 ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"invalid txnbatch value \"%s\".\n",
+					c->argv[ i ] + STRLENOF( TXNBATCHSTR "=" ));
+				Debug( LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg );
+				return 1;
+			}
 		} else if ( !bindconf_parse( c->argv[i], &si->si_bindconf ) ) {
 			si->si_got |= GOT_BINDCONF;
 		} else {
@@ -7320,6 +7615,13 @@ syncrepl_unparse( syncinfo_t *si, struct berval *bv )
 		ptr = lutil_strcopy( ptr, " " LAZY_COMMIT );
 	}
 
+	if ( si->si_txnmax ) {
+		len = snprintf( ptr, WHATSLEFT, " " TXNBATCHSTR "=%d,%d,%d",
+			si->si_txnmax, si->si_txnkbytes, si->si_txnmsec );
+		if ( WHATSLEFT <= len ) return;
+		ptr += len;
+	}
+
 	bc.bv_len = ptr - buf;
 	bc.bv_val = buf;
 	ber_dupbv( bv, &bc );
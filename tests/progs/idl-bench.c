@@ -0,0 +1,236 @@
+/* idl-bench -- check and time the slapd ID list set kernels */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2021 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/time.h>
+#include <ac/unistd.h>
+
+#include "slap.h"
+
+/* not linked with the rest of slapd */
+#undef malloc
+#undef free
+
+static const char *progname = "idl-bench";
+
+static const char *kernels[] = { "scalar", "sse4.2", "avx2", NULL };
+
+/* One test case: lists of count/adiv and count/bdiv IDs
+ * picked from 1..count*span
+ */
+static struct {
+	const char *name;
+	ID adiv, bdiv, span;
+} cases[] = {
+	{ "equal", 1, 1, 16 },
+	{ "sparse", 1, 1, 256 },
+	{ "skewed", 1, 64, 256 },
+	{ NULL }
+};
+
+static void
+usage( void )
+{
+	fprintf( stderr, "\
+Usage: %s [-k kernel] [-l loops] [-n count]\n\
+Check the ID list kernels against a plain merge, then time them\n\
+on lists of <count> IDs (default 65536), <loops> times each\n\
+(default 100). Only <kernel> is run if given.\n", progname );
+	exit( EXIT_FAILURE );
+}
+
+static ID *
+mklist( ID n, ID span )
+{
+	ID *ids = malloc( n * sizeof(ID) ), i, id = 0;
+
+	/* about n IDs spread evenly at random over 1..span */
+	for ( i = 0; i < n; i++ ) {
+		id += 1 + rand() % ( 2 * span / n );
+		ids[i] = id;
+	}
+	return ids;
+}
+
+static ID
+ref_intersect( ID *a, ID na, ID *b, ID nb, ID *out, int notin )
+{
+	ID i = 0, j = 0, n = 0;
+
+	while ( i < na ) {
+		if ( j == nb || a[i] < b[j] ) {
+			if ( notin )
+				out[n++] = a[i];
+			i++;
+		} else if ( a[i] > b[j] ) {
+			j++;
+		} else {
+			if ( !notin )
+				out[n++] = a[i];
+			i++;
+			j++;
+		}
+	}
+	return n;
+}
+
+static ID
+ref_merge( ID *a, ID na, ID *b, ID nb, ID *out )
+{
+	ID i = 0, j = 0, n = 0;
+
+	while ( i < na || j < nb ) {
+		if ( j == nb || ( i < na && a[i] < b[j] ))
+			out[n++] = a[i++];
+		else if ( i == na || b[j] < a[i] )
+			out[n++] = b[j++];
+		else {
+			out[n++] = a[i++];
+			j++;
+		}
+	}
+	return n;
+}
+
+static double
+now( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int
+main( int argc, char **argv )
+{
+	const char *only = NULL;
+	int loops = 100, i, k, c, l, rc = EXIT_SUCCESS;
+	ID count = 65536;
+
+	while ( (i = getopt( argc, argv, "k:l:n:" )) != EOF ) {
+		switch ( i ) {
+		case 'k':
+			only = optarg;
+			break;
+		case 'l':
+			loops = atoi( optarg );
+			break;
+		case 'n':
+			count = strtoul( optarg, NULL, 10 );
+			break;
+		default:
+			usage();
+		}
+	}
+	if ( optind != argc || loops < 1 || count < 64 )
+		usage();
+
+	for ( c = 0; cases[c].name; c++ ) {
+		ID na = count / cases[c].adiv, nb = count / cases[c].bdiv;
+		ID span = count * cases[c].span;
+		ID *a = mklist( na, span ), *b = mklist( nb, span );
+		ID *tmp = malloc( ( 2 * na + nb ) * sizeof(ID) );
+		ID *ref = malloc( ( na + nb ) * sizeof(ID) );
+		ID *out = malloc( ( na + nb ) * sizeof(ID) );
+		ID nand, nnot, nor, n;
+
+		nand = ref_intersect( a, na, b, nb, ref, 0 );
+		nnot = ref_intersect( a, na, b, nb, tmp, 1 );
+		nor = ref_merge( a, na, b, nb, tmp + nnot );
+		printf( "%s: %lu & %lu IDs in 1..%lu, %lu in common\n",
+			cases[c].name, na, nb, span, nand );
+
+		for ( k = 0; kernels[k]; k++ ) {
+			double t0, tand, tnot, tor;
+
+			if ( only && strcasecmp( only, kernels[k] ))
+				continue;
+			if ( slap_idl_init( kernels[k] )) {
+				printf( "  %-8s not supported\n", kernels[k] );
+				continue;
+			}
+
+			/* check */
+			n = slap_idl_intersect( a, na, b, nb, out, 0 );
+			if ( n != nand || memcmp( out, ref, n * sizeof(ID) )) {
+				printf( "  %-8s intersection FAILED\n", kernels[k] );
+				rc = EXIT_FAILURE;
+				continue;
+			}
+			n = slap_idl_intersect( a, na, b, nb, out, 1 );
+			if ( n != nnot || memcmp( out, tmp, n * sizeof(ID) )) {
+				printf( "  %-8s difference FAILED\n", kernels[k] );
+				rc = EXIT_FAILURE;
+				continue;
+			}
+			n = slap_idl_merge( a, na, b, nb, out );
+			if ( n != nor || memcmp( out, tmp + nnot, n * sizeof(ID) )) {
+				printf( "  %-8s union FAILED\n", kernels[k] );
+				rc = EXIT_FAILURE;
+				continue;
+			}
+
+			/* time */
+			t0 = now();
+			for ( l = 0; l < loops; l++ )
+				slap_idl_intersect( a, na, b, nb, out, 0 );
+			tand = now() - t0;
+			t0 = now();
+			for ( l = 0; l < loops; l++ )
+				slap_idl_intersect( a, na, b, nb, out, 1 );
+			tnot = now() - t0;
+			t0 = now();
+			for ( l = 0; l < loops; l++ )
+				slap_idl_merge( a, na, b, nb, out );
+			tor = now() - t0;
+			printf( "  %-8s and %.3fs  not %.3fs  or %.3fs\n",
+				kernels[k], tand, tnot, tor );
+		}
+
+		/* the plain merge, for comparison */
+		if ( !only ) {
+			double t0, tand, tnot, tor;
+
+			t0 = now();
+			for ( l = 0; l < loops; l++ )
+				ref_intersect( a, na, b, nb, out, 0 );
+			tand = now() - t0;
+			t0 = now();
+			for ( l = 0; l < loops; l++ )
+				ref_intersect( a, na, b, nb, out, 1 );
+			tnot = now() - t0;
+			t0 = now();
+			for ( l = 0; l < loops; l++ )
+				ref_merge( a, na, b, nb, out );
+			tor = now() - t0;
+			printf( "  %-8s and %.3fs  not %.3fs  or %.3fs\n",
+				"merge", tand, tnot, tor );
+		}
+
+		free( a );
+		free( b );
+		free( tmp );
+		free( ref );
+		free( out );
+	}
+
+	return rc;
+}
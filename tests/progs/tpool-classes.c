@@ -0,0 +1,183 @@
+/* tpool-classes -- check the task class limits of the thread pool */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2021 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/*
+ * A pool of 4 threads in 2 queues, where class 1 may only run one
+ * task at a time, like slapd's searches with searchpoolmax 1.
+ * Tasks of class 0 keep all the threads of the first queue busy, then
+ * a task of class 1 that lands on the idle second queue must still
+ * run, and a second one must wait for it wherever it lands.
+ */
+
+#include "portable.h"
+
+/* Requires libldap with threads */
+#ifndef NO_THREADS
+
+#include <stdio.h>
+#include "ldap_pvt_thread.h"
+
+#include "ac/stdlib.h"
+#include "ac/string.h"
+#include "ac/time.h"
+#include "ac/unistd.h"
+
+#include "ldap.h"
+
+static const char *progname = "tpool-classes";
+
+static ldap_pvt_thread_pool_t pool;
+static ldap_pvt_thread_mutex_t mutex;
+static ldap_pvt_thread_cond_t cond;
+
+/* A task that runs until it is released */
+typedef struct task {
+	const char *name;
+	int started;
+	int released;
+	int done;
+} task;
+
+static void *
+task_run( void *ctx, void *arg )
+{
+	task *t = arg;
+
+	ldap_pvt_thread_mutex_lock( &mutex );
+	t->started = 1;
+	ldap_pvt_thread_cond_broadcast( &cond );
+	while ( !t->released )
+		ldap_pvt_thread_cond_wait( &cond, &mutex );
+	t->done = 1;
+	ldap_pvt_thread_cond_broadcast( &cond );
+	ldap_pvt_thread_mutex_unlock( &mutex );
+	return NULL;
+}
+
+static void
+submit( task *t, const char *name, int tclass )
+{
+	memset( t, 0, sizeof( *t ));
+	t->name = name;
+	if ( ldap_pvt_thread_pool_submit3( &pool, task_run, t, NULL, tclass )) {
+		fprintf( stderr, "%s: could not submit %s\n", progname, name );
+		exit( EXIT_FAILURE );
+	}
+}
+
+/* Wait up to secs seconds for *flag, returns it */
+static int
+wait_for( int *flag, int secs )
+{
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &mutex );
+	for ( i = 0; !*flag && i < secs * 10; i++ ) {
+		ldap_pvt_thread_mutex_unlock( &mutex );
+		usleep( 100000 );
+		ldap_pvt_thread_mutex_lock( &mutex );
+	}
+	i = *flag;
+	ldap_pvt_thread_mutex_unlock( &mutex );
+	return i;
+}
+
+static void
+release( task *t )
+{
+	ldap_pvt_thread_mutex_lock( &mutex );
+	t->released = 1;
+	ldap_pvt_thread_cond_broadcast( &cond );
+	ldap_pvt_thread_mutex_unlock( &mutex );
+}
+
+static void
+expect( task *t, int started )
+{
+	if ( wait_for( &t->started, started ? 5 : 1 ) != started ) {
+		fprintf( stderr, "%s: %s %s\n", progname, t->name,
+			started ? "did not start" : "started over the limit" );
+		exit( EXIT_FAILURE );
+	}
+	printf( "%s %s\n", t->name, started ? "started" : "waits" );
+}
+
+int
+main( int argc, char **argv )
+{
+	task a, b, c, s1, s2, s3;
+
+	ldap_pvt_thread_initialize();
+	ldap_pvt_thread_mutex_init( &mutex );
+	ldap_pvt_thread_cond_init( &cond );
+
+	if ( ldap_pvt_thread_pool_init_q( &pool, 4, 0, 2 ) ||
+		ldap_pvt_thread_pool_class( &pool, 1, 1, 1 ))
+	{
+		fprintf( stderr, "%s: could not set up the pool\n", progname );
+		exit( EXIT_FAILURE );
+	}
+
+	/* the first queue takes a and c, b goes to the second one
+	 * and leaves it idle when it is done
+	 */
+	submit( &a, "class 0 task a", 0 );
+	expect( &a, 1 );
+	submit( &b, "class 0 task b", 0 );
+	expect( &b, 1 );
+	submit( &c, "class 0 task c", 0 );
+	expect( &c, 1 );
+	release( &b );
+	wait_for( &b.done, 5 );
+	usleep( 100000 );
+
+	/* the limit holds for the whole pool, not per queue */
+	submit( &s1, "class 1 task 1", 1 );
+	expect( &s1, 1 );
+	submit( &s2, "class 1 task 2", 1 );
+	expect( &s2, 0 );
+
+	/* a slot freed in one queue runs the task waiting in any */
+	release( &s1 );
+	expect( &s2, 1 );
+	submit( &s3, "class 1 task 3", 1 );
+	expect( &s3, 0 );
+	release( &a );
+	release( &c );
+	expect( &s3, 0 );
+	release( &s2 );
+	expect( &s3, 1 );
+	release( &s3 );
+
+	ldap_pvt_thread_pool_close( &pool, 1 );
+	ldap_pvt_thread_pool_free( &pool );
+	ldap_pvt_thread_destroy();
+	return EXIT_SUCCESS;
+}
+
+#else /* NO_THREADS */
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+
+int
+main( int argc, char **argv )
+{
+	fprintf( stderr, "tpool-classes: libldap without threads\n" );
+	return EXIT_FAILURE;
+}
+
+#endif /* NO_THREADS */